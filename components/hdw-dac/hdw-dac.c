@@ -31,6 +31,12 @@ static fnDacCallback_t dacCb = NULL;
 /** A temporary buffer for the application to fill with audio samples before */
 static uint8_t tmpDacBuf[DAC_BUF_SIZE] = {0};
 
+/** The number of buffers which were refilled at least one buffer period late */
+static uint32_t dacLateRefills = 0;
+
+/** The number of buffers which were dropped from the queue before being refilled, written from the interrupt */
+static volatile uint32_t dacDroppedBuffers = 0;
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -53,6 +59,7 @@ static bool IRAM_ATTR dac_on_convert_done_callback(dac_continuous_handle_t handl
     {
         dac_event_data_t dummy;
         xQueueReceiveFromISR(queue, &dummy, &need_awoke);
+        dacDroppedBuffers++;
     }
     /* Send the event from callback */
     xQueueSendFromISR(queue, event, &need_awoke);
@@ -138,6 +145,13 @@ void dacPoll(void)
 {
     if (NULL != dacIsrQueue)
     {
+        /* More than one event waiting means the main loop missed at least one buffer period */
+        UBaseType_t waiting = uxQueueMessagesWaiting(dacIsrQueue);
+        if (waiting > 1)
+        {
+            dacLateRefills += (waiting - 1);
+        }
+
         /* If there is an event to receive, receive it */
         dac_event_data_t evt_data;
         while (xQueueReceive(dacIsrQueue, &evt_data, 0))
@@ -153,3 +167,23 @@ void dacPoll(void)
         }
     }
 }
+
+/**
+ * @brief Get the number of DAC buffers which were not refilled on time since initDac() was called
+ *
+ * @param lateRefills [out] Written with the number of buffers which were refilled at least one buffer period late. May
+ * be NULL
+ * @param droppedBuffers [out] Written with the number of buffers which were never refilled, so the DAC played stale
+ * samples. May be NULL
+ */
+void dacGetUnderruns(uint32_t* lateRefills, uint32_t* droppedBuffers)
+{
+    if (NULL != lateRefills)
+    {
+        *lateRefills = dacLateRefills;
+    }
+    if (NULL != droppedBuffers)
+    {
+        *droppedBuffers = dacDroppedBuffers;
+    }
+}
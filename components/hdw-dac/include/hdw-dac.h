@@ -28,6 +28,9 @@
  * sngPlayerFillBuffer(). Swadge modes may override this by providing a non-NULL function pointer for
  * ::swadgeMode_t.fnDacCb.
  *
+ * If dacPoll() isn't called often enough, buffers will be refilled late or not at all. dacGetUnderruns() returns how
+ * many times that has happened, which is useful along with dacProfiler.h when tuning a mode's audio.
+ *
  * \section dac_example Example
  *
  * \code{.c}
@@ -99,3 +102,4 @@ void deinitDac(void);
 void dacPoll(void);
 void dacStart(void);
 void dacStop(void);
+void dacGetUnderruns(uint32_t* lateRefills, uint32_t* droppedBuffers);
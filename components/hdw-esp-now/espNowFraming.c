@@ -0,0 +1,224 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <string.h>
+
+#include "espNowFraming.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// The length of the MAC address at the start of every frame
+#define FRAME_MAC_LEN 6
+/// The length of the CRC at the end of every frame
+#define FRAME_CRC_LEN 2
+
+//==============================================================================
+// Prototypes
+//==============================================================================
+
+static void espNowFrameEnd(espNowFrameDecoder_t* dec, espNowFrameCb_t cb);
+static void espNowFrameRestart(espNowFrameDecoder_t* dec);
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Encode a packet into a frame which can be written to a UART
+ *
+ * @param mac The sender's six byte MAC address
+ * @param data The payload
+ * @param len The length of the payload, at most ::ESP_NOW_FRAME_MAX_PAYLOAD
+ * @param out Written with the encoded frame, including the zero byte at the end. Must be at least
+ * ::ESP_NOW_FRAME_MAX_ENCODED bytes
+ * @return The number of bytes written to out
+ */
+uint16_t espNowFrameEncode(const uint8_t* mac, const uint8_t* data, uint8_t len, uint8_t* out)
+{
+    if (len > ESP_NOW_FRAME_MAX_PAYLOAD)
+    {
+        len = ESP_NOW_FRAME_MAX_PAYLOAD;
+    }
+
+    // Gather the MAC, payload, and CRC
+    uint8_t raw[ESP_NOW_FRAME_MAX_DECODED];
+    uint16_t rawLen = 0;
+    memcpy(&raw[rawLen], mac, FRAME_MAC_LEN);
+    rawLen += FRAME_MAC_LEN;
+    memcpy(&raw[rawLen], data, len);
+    rawLen += len;
+    uint16_t crc  = espNowFrameCrc16(raw, rawLen);
+    raw[rawLen++] = crc >> 8;
+    raw[rawLen++] = crc & 0xFF;
+
+    // COBS encode. Each block starts with a code byte, which is one more than the number of non-zero bytes which follow
+    // it. A code less than 0xFF means there was a zero after the block
+    uint16_t outLen  = 1;
+    uint16_t codeIdx = 0;
+    uint8_t code     = 1;
+    for (uint16_t i = 0; i < rawLen; i++)
+    {
+        if (0 == raw[i])
+        {
+            out[codeIdx] = code;
+            codeIdx      = outLen++;
+            code         = 1;
+        }
+        else
+        {
+            out[outLen++] = raw[i];
+            if (0xFF == ++code)
+            {
+                out[codeIdx] = code;
+                codeIdx      = outLen++;
+                code         = 1;
+            }
+        }
+    }
+    out[codeIdx] = code;
+
+    // The zero byte which ends the frame
+    out[outLen++] = 0;
+    return outLen;
+}
+
+/**
+ * @brief Ready a decoder to decode a new stream of bytes
+ *
+ * @param dec The decoder to reset
+ */
+void espNowFrameDecoderReset(espNowFrameDecoder_t* dec)
+{
+    // If the first bytes are the end of a frame which was sent before this was listening, the CRC won't match
+    memset(dec, 0, sizeof(espNowFrameDecoder_t));
+}
+
+/**
+ * @brief Decode bytes received from a UART. Bytes may be given in chunks of any size. The callback is called for each
+ * frame which ends in these bytes and has a valid CRC
+ *
+ * @param dec The decoder, which keeps its state between calls
+ * @param bytes The received bytes
+ * @param numBytes The number of received bytes
+ * @param cb The callback to call with each valid frame
+ */
+void espNowFrameDecode(espNowFrameDecoder_t* dec, const uint8_t* bytes, uint32_t numBytes, espNowFrameCb_t cb)
+{
+    for (uint32_t i = 0; i < numBytes; i++)
+    {
+        uint8_t byte = bytes[i];
+
+        if (0 == byte)
+        {
+            espNowFrameEnd(dec, cb);
+        }
+        else if (dec->discard)
+        {
+            // Wait for the next frame
+        }
+        else if (0 == dec->blockLeft)
+        {
+            // This is a code byte. The previous block, if there was one, was followed by a zero unless it was full
+            if (dec->started && !dec->blockFull)
+            {
+                if (dec->len >= ESP_NOW_FRAME_MAX_DECODED)
+                {
+                    dec->framingErrors++;
+                    dec->discard = true;
+                    continue;
+                }
+                dec->buf[dec->len++] = 0;
+            }
+            dec->started   = true;
+            dec->blockFull = (0xFF == byte);
+            dec->blockLeft = byte - 1;
+        }
+        else
+        {
+            // This is a data byte
+            if (dec->len >= ESP_NOW_FRAME_MAX_DECODED)
+            {
+                dec->framingErrors++;
+                dec->discard = true;
+                continue;
+            }
+            dec->buf[dec->len++] = byte;
+            dec->blockLeft--;
+        }
+    }
+}
+
+/**
+ * @brief Calculate a CRC-16/CCITT-FALSE, which has the polynomial 0x1021 and starts at 0xFFFF
+ *
+ * @param data The data to calculate a CRC of
+ * @param len The length of the data
+ * @return The CRC
+ */
+uint16_t espNowFrameCrc16(const uint8_t* data, uint32_t len)
+{
+    static const uint16_t nibbleTable[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+
+    uint16_t crc = 0xFFFF;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc = (crc << 4) ^ nibbleTable[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ nibbleTable[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+/**
+ * @brief Finish the current frame when a zero byte is received, and call the callback if it is valid
+ *
+ * @param dec The decoder
+ * @param cb The callback to call with a valid frame
+ */
+static void espNowFrameEnd(espNowFrameDecoder_t* dec, espNowFrameCb_t cb)
+{
+    if (dec->discard || !dec->started)
+    {
+        // A bad frame, or an extra zero byte between frames
+    }
+    else if (0 != dec->blockLeft || dec->len < FRAME_MAC_LEN + FRAME_CRC_LEN)
+    {
+        // The frame ended in the middle of a block, or is too short to have a MAC and CRC
+        dec->framingErrors++;
+    }
+    else
+    {
+        uint16_t dataLen = dec->len - FRAME_CRC_LEN;
+        uint16_t crc     = (dec->buf[dataLen] << 8) | dec->buf[dataLen + 1];
+        if (espNowFrameCrc16(dec->buf, dataLen) != crc)
+        {
+            dec->crcErrors++;
+        }
+        else
+        {
+            dec->frames++;
+            cb(dec->buf, &dec->buf[FRAME_MAC_LEN], dataLen - FRAME_MAC_LEN);
+        }
+    }
+
+    espNowFrameRestart(dec);
+}
+
+/**
+ * @brief Get ready to decode the next frame
+ *
+ * @param dec The decoder
+ */
+static void espNowFrameRestart(espNowFrameDecoder_t* dec)
+{
+    dec->len       = 0;
+    dec->blockLeft = 0;
+    dec->blockFull = false;
+    dec->started   = false;
+    dec->discard   = false;
+}
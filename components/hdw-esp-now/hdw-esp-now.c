@@ -3,14 +3,16 @@
 //==============================================================================
 
 #include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 
 #include <esp_wifi.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_private/wifi.h>
-#include <freertos/queue.h>
 
 #include "hdw-esp-now.h"
+#include "espNowFraming.h"
 
 //==============================================================================
 // Defines
@@ -23,46 +25,42 @@
 /// The WiFi rate to run at, MCS6 with short GI, 65 Mbps for 20MHz, 135 Mbps for 40MHz
 #define WIFI_RATE WIFI_PHY_RATE_MCS6_SGI
 
-/// The first random byte used as a 'start' byte for packets transmitted over UART
-#define FRAMING_START_1 251
-/// The second random byte used as a 'start' byte for packets transmitted over UART
-#define FRAMING_START_2 63
-/// The third random byte used as a 'start' byte for packets transmitted over UART
-#define FRAMING_START_3 114
+/// The size of the UART receive buffer in bytes. This holds about 20ms of data at the default baud rate
+#define ESP_NOW_SERIAL_RX_BUF_SIZE 2048
+/// The size of the UART transmit buffer in bytes, so espNowSend() doesn't wait for bytes to go out
+#define ESP_NOW_SERIAL_TX_BUF_SIZE 2048
+/// The number of bytes read from the UART at a time
+#define ESP_NOW_SERIAL_READ_SIZE 256
 
-/// The size of the UART receive buffer in bytes
-#define ESP_NOW_SERIAL_RX_BUF_SIZE 256
-/// The size of the ringbuffer used to decode packets in bytes
-#define ESP_NOW_SERIAL_RINGBUF_SIZE 512
+/// The size of the ring which moves received packets to the main loop in bytes. Must be a power of two
+#define ESP_NOW_RX_RING_SIZE 4096
+/// Every slot in the receive ring starts at a multiple of this, which is the size of a slot header
+#define ESP_NOW_RX_SLOT_ALIGN 8
+/// A slot length which means the rest of the ring is unused, and the next slot is at the start of the ring
+#define ESP_NOW_RX_SLOT_WRAP 0xFF
 
-//==============================================================================
-// Enums
-//==============================================================================
-
-typedef enum
-{
-    EU_PARSING_FR_START_1, ///< Parsing state for the first framing byte
-    EU_PARSING_FR_START_2, ///< Parsing state for the second framing byte
-    EU_PARSING_FR_START_3, ///< Parsing state for the third framing byte
-    EU_PARSING_MAC,        ///< Parsing state for the six MAC bytes
-    EU_PARSING_LEN,        ///< Parsing state for the one length byte
-    EU_PARSING_PAYLOAD,    ///< Parsing state for the payload bytes
-} decodeState_t;
+/// The number of bytes a packet of the given length takes in the receive ring
+#define ESP_NOW_RX_SLOT_SIZE(len) \
+    ((sizeof(espNowRxSlot_t) + (len) + ESP_NOW_RX_SLOT_ALIGN - 1) & ~(ESP_NOW_RX_SLOT_ALIGN - 1))
 
 //==============================================================================
-// Enums
+// Structs
 //==============================================================================
 
 /**
- * @brief A packet received over ESP-NOW
+ * @brief A packet received over ESP-NOW, as it is stored in the receive ring. The received bytes follow the header
+ * directly, and the next slot starts at the following multiple of ::ESP_NOW_RX_SLOT_ALIGN
  */
 typedef struct
 {
-    int8_t rssi;       ///< The received signal strength indicator for the packet
-    uint8_t mac[6];    ///< The MAC address of the sender
-    uint8_t len;       ///< The length of the received bytes
-    uint8_t data[255]; ///< The received bytes
-} espNowPacket_t;
+    uint8_t mac[6]; ///< The MAC address of the sender
+    uint8_t len;    ///< The length of the received bytes, or ::ESP_NOW_RX_SLOT_WRAP
+    int8_t rssi;    ///< The received signal strength indicator for the packet
+    uint8_t data[]; ///< The received bytes
+} espNowRxSlot_t;
+
+_Static_assert(sizeof(espNowRxSlot_t) == ESP_NOW_RX_SLOT_ALIGN, "Receive ring slot headers must fill one alignment");
+_Static_assert(ESP_NOW_MAX_DATA_LEN < ESP_NOW_RX_SLOT_WRAP, "Packet lengths can't be the wrap marker");
 
 //==============================================================================
 // Variables
@@ -76,7 +74,22 @@ static uint8_t myMac[6];
 static hostEspNowRecvCb_t hostEspNowRecvCb;
 static hostEspNowSendCb_t hostEspNowSendCb;
 
-static QueueHandle_t esp_now_queue;
+/**
+ * @brief The ring which moves received packets from the WiFi task to the main loop without locks. The WiFi task is the
+ * only writer of ::rxRingHead and the main loop is the only writer of ::rxRingTail, so each only has to publish its
+ * own index after touching the slots.
+ */
+static uint8_t rxRing[ESP_NOW_RX_RING_SIZE] __attribute__((aligned(ESP_NOW_RX_SLOT_ALIGN)));
+/// The number of bytes ever written to ::rxRing, including wrapped space. Only written by the WiFi task
+static atomic_uint rxRingHead;
+/// The number of bytes ever released from ::rxRing, including wrapped space. Only written by the main loop
+static atomic_uint rxRingTail;
+/// Receive statistics. Only the WiFi task writes packets and highWater, and only the main loop writes maxBatch
+static espNowRxStats_t rxStats;
+/// The number of packets dropped because ::rxRing was full. Only written by the WiFi task, and checked every frame
+static atomic_uint rxDropped;
+/// The number of dropped packets which were last logged
+static uint32_t rxDroppedLogged;
 
 static bool isSerial;
 static gpio_num_t rxGpio;
@@ -84,12 +97,10 @@ static gpio_num_t txGpio;
 static uint32_t uartNum;
 static wifiMode_t mode;
 
-/// A ringbuffer for esp-now serial communication
-static uint8_t ringBuf[ESP_NOW_SERIAL_RINGBUF_SIZE];
-/// The index for the esp-now serial communication ringbuffer's head
-static int16_t rBufHead;
-/// The index for the esp-now serial communication ringbuffer's tail
-static int16_t rBufTail;
+/// The baud rate for serial communication
+static uint32_t serialBaud = ESP_NOW_SERIAL_DEFAULT_BAUD;
+/// Decodes frames received over serial. It keeps its state between calls to checkEspNowRxQueue()
+static espNowFrameDecoder_t serialDecoder;
 
 //==============================================================================
 // Prototypes
@@ -97,6 +108,7 @@ static int16_t rBufTail;
 
 static void espNowRecvCb(const esp_now_recv_info_t* esp_now_info, const uint8_t* data, int data_len);
 static void espNowSendCb(const uint8_t* mac_addr, esp_now_send_status_t status);
+static void espNowSerialFrameCb(const uint8_t* mac, const uint8_t* data, uint8_t len);
 
 //==============================================================================
 // Functions
@@ -129,11 +141,13 @@ esp_err_t initEspNow(hostEspNowRecvCb_t recvCb, hostEspNowSendCb_t sendCb, gpio_
     uartNum = uart;
     mode    = wifiMode;
 
-    if (ESP_NOW_IMMEDIATE != mode)
-    {
-        // Create a queue to move packets from the receive callback to the main task
-        esp_now_queue = xQueueCreate(10, sizeof(espNowPacket_t));
-    }
+    // Empty the ring which moves packets from the receive callback to the main task
+    atomic_store(&rxRingHead, 0);
+    atomic_store(&rxRingTail, 0);
+    atomic_store(&rxDropped, 0);
+    memset(&rxStats, 0, sizeof(rxStats));
+    rxStats.ringSize = ESP_NOW_RX_RING_SIZE;
+    rxDroppedLogged  = 0;
 
     esp_err_t err = ESP_OK;
 
@@ -331,7 +345,7 @@ esp_err_t espNowUseWireless(void)
 }
 
 /**
- * Start the UART and use it for communication
+ * Start the UART and use it for communication. Packets are framed with COBS and a CRC-16, see espNowFraming.h
  *
  * @param crossoverPins true to crossover the rx and tx pins, false to use them
  *                      as normal.
@@ -349,15 +363,18 @@ void espNowUseSerial(bool crossoverPins)
 
         // Initialize UART
         uart_config_t uart_config = {
-            .baud_rate  = 8 * 115200,
+            .baud_rate  = serialBaud,
             .data_bits  = UART_DATA_8_BITS,
             .parity     = UART_PARITY_DISABLE,
             .stop_bits  = UART_STOP_BITS_1,
             .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
             .source_clk = UART_SCLK_APB,
         };
-        ESP_ERROR_CHECK(uart_driver_install(uartNum, ESP_NOW_SERIAL_RX_BUF_SIZE, 0, 0, NULL, 0));
+        ESP_ERROR_CHECK(
+            uart_driver_install(uartNum, ESP_NOW_SERIAL_RX_BUF_SIZE, ESP_NOW_SERIAL_TX_BUF_SIZE, 0, NULL, 0));
         ESP_ERROR_CHECK(uart_param_config(uartNum, &uart_config));
+
+        espNowFrameDecoderReset(&serialDecoder);
     }
 
     if (crossoverPins)
@@ -368,6 +385,25 @@ void espNowUseSerial(bool crossoverPins)
     {
         ESP_ERROR_CHECK(uart_set_pin(uartNum, rxGpio, txGpio, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
     }
+
+    // End any partial frame the other Swadge received while the pins were changing, so the next frame isn't lost
+    const char frameEnd = 0;
+    uart_write_bytes(uartNum, &frameEnd, sizeof(frameEnd));
+}
+
+/**
+ * Set the baud rate for serial communication. Both Swadges must use the same baud rate. This may be called before or
+ * after espNowUseSerial()
+ *
+ * @param baud The baud rate, ::ESP_NOW_SERIAL_DEFAULT_BAUD by default
+ */
+void espNowSetSerialBaud(uint32_t baud)
+{
+    serialBaud = baud;
+    if (isSerial)
+    {
+        ESP_ERROR_CHECK(uart_set_baudrate(uartNum, baud));
+    }
 }
 
 /**
@@ -386,169 +422,154 @@ static void espNowRecvCb(const esp_now_recv_info_t* esp_now_info, const uint8_t*
     else
     {
         /* The receiving callback function also runs from the Wi-Fi task. So, do not
-         * do lengthy operations in the callback function. Instead, post the
-         * necessary data to a queue and handle it from a lower priority task.
+         * do lengthy operations in the callback function. Instead, copy the packet
+         * into the receive ring and handle it from the main loop.
          */
-        espNowPacket_t packet;
+        if (data_len > ESP_NOW_MAX_DATA_LEN)
+        {
+            data_len = ESP_NOW_MAX_DATA_LEN;
+        }
+
+        uint32_t head = atomic_load_explicit(&rxRingHead, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&rxRingTail, memory_order_acquire);
+
+        // A slot never wraps around the end of the ring. If it wouldn't fit before the end, skip the rest of the ring
+        uint32_t offset   = head & (ESP_NOW_RX_RING_SIZE - 1);
+        uint32_t slotSize = ESP_NOW_RX_SLOT_SIZE(data_len);
+        uint32_t skip     = (offset + slotSize > ESP_NOW_RX_RING_SIZE) ? (ESP_NOW_RX_RING_SIZE - offset) : 0;
 
-        // Copy the MAC
-        memcpy(&packet.mac, esp_now_info->src_addr, sizeof(uint8_t) * 6);
+        uint32_t used = head + skip + slotSize - tail;
+        if (used > ESP_NOW_RX_RING_SIZE)
+        {
+            // The main loop hasn't kept up, drop this packet
+            atomic_fetch_add_explicit(&rxDropped, 1, memory_order_relaxed);
+            return;
+        }
 
-        // Make sure the data fits, then copy it
-        if (data_len > sizeof(packet.data))
+        if (skip)
         {
-            data_len = sizeof(packet.data);
+            // Mark the rest of the ring as unused
+            ((espNowRxSlot_t*)&rxRing[offset])->len = ESP_NOW_RX_SLOT_WRAP;
+            offset                                  = 0;
         }
-        packet.len = data_len;
-        memcpy(&packet.data, data, data_len);
 
-        // Copy the RSSI
-        packet.rssi = esp_now_info->rx_ctrl->rssi;
+        espNowRxSlot_t* slot = (espNowRxSlot_t*)&rxRing[offset];
+        memcpy(slot->mac, esp_now_info->src_addr, sizeof(slot->mac));
+        slot->len  = data_len;
+        slot->rssi = esp_now_info->rx_ctrl->rssi;
+        memcpy(slot->data, data, data_len);
 
-        // Queue this packet
-        xQueueSendFromISR(esp_now_queue, &packet, NULL);
+        // Publish the slot to the main loop
+        atomic_store_explicit(&rxRingHead, head + skip + slotSize, memory_order_release);
+
+        rxStats.packets++;
+        if (used > rxStats.highWater)
+        {
+            rxStats.highWater = used;
+        }
     }
 }
 
 /**
- * Check the ESP NOW receive queue. If there are any received packets, send
- * them to hostEspNowRecvCb()
+ * Check the ESP NOW receive queue. Every packet received before this is called is sent to hostEspNowRecvCb(), in the
+ * order they were received. The data given to hostEspNowRecvCb() points into the receive ring and is only valid
+ * until it returns.
  */
 void checkEspNowRxQueue(void)
 {
     if (isSerial)
     {
-        // Read bytes from the UART
-        char bytesRead[256];
-        int numBytesRead = uart_read_bytes(uartNum, &bytesRead, sizeof(bytesRead), 0);
-
-        // Insert them into the ringBuffer
-        for (uint16_t i = 0; i < numBytesRead; i++)
+        // Decode everything the UART has received. The decoder picks up where it left off last time
+        uint8_t bytesRead[ESP_NOW_SERIAL_READ_SIZE];
+        int numBytesRead;
+        while (0 < (numBytesRead = uart_read_bytes(uartNum, bytesRead, sizeof(bytesRead), 0)))
         {
-            ringBuf[rBufTail] = bytesRead[i];
-            rBufTail          = (rBufTail + 1) % sizeof(ringBuf);
+            espNowFrameDecode(&serialDecoder, bytesRead, numBytesRead, espNowSerialFrameCb);
         }
+    }
+    else if (mode != ESP_NOW_IMMEDIATE)
+    {
+        // Only dispatch packets which were received before now, so a flood of packets can't stall the main loop
+        uint32_t head  = atomic_load_explicit(&rxRingHead, memory_order_acquire);
+        uint32_t tail  = atomic_load_explicit(&rxRingTail, memory_order_relaxed);
+        uint32_t batch = 0;
 
-        decodeState_t decodeState = EU_PARSING_FR_START_1;
-        uint8_t rxMac[6];
-        uint8_t rxMacIdx   = 0;
-        uint8_t payloadLen = 0;
-        uint8_t payload[256];
-        uint8_t payloadIdx = 0;
-
-        // Check the ringBuffer for framed packets
-        int16_t rBufTmpHead = rBufHead;
-        while (rBufTmpHead != rBufTail)
+        while (tail != head)
         {
-            switch (decodeState)
+            uint32_t offset      = tail & (ESP_NOW_RX_RING_SIZE - 1);
+            espNowRxSlot_t* slot = (espNowRxSlot_t*)&rxRing[offset];
+
+            if (ESP_NOW_RX_SLOT_WRAP == slot->len)
+            {
+                // The rest of the ring is unused, the next slot is at the start
+                tail += ESP_NOW_RX_RING_SIZE - offset;
+            }
+            else
             {
-                case EU_PARSING_FR_START_1:
-                {
-                    // Check for first framing byte
-                    if (FRAMING_START_1 == ringBuf[rBufTmpHead])
-                    {
-                        decodeState = EU_PARSING_FR_START_2;
-                    }
-                    break;
-                }
-                case EU_PARSING_FR_START_2:
-                {
-                    // Check for second framing byte
-                    if (FRAMING_START_2 == ringBuf[rBufTmpHead])
-                    {
-                        decodeState = EU_PARSING_FR_START_3;
-                    }
-                    break;
-                }
-                case EU_PARSING_FR_START_3:
-                {
-                    // Check for third framing byte
-                    if (FRAMING_START_3 == ringBuf[rBufTmpHead])
-                    {
-                        decodeState = EU_PARSING_MAC;
-                    }
-                    break;
-                }
-                case EU_PARSING_MAC:
-                {
-                    // Save the MAC byte
-                    rxMac[rxMacIdx++] = ringBuf[rBufTmpHead];
-                    // If all MAC bytes have been read
-                    if (6 == rxMacIdx)
-                    {
-                        decodeState = EU_PARSING_LEN;
-                    }
-                    break;
-                }
-                case EU_PARSING_LEN:
-                {
-                    // Save the length byte
-                    payloadLen = ringBuf[rBufTmpHead];
-                    // Immediately move to EU_PARSING_PAYLOAD
-                    decodeState = EU_PARSING_PAYLOAD;
-                    break;
-                }
-                case EU_PARSING_PAYLOAD:
-                {
-                    // Save the payload byte
-                    payload[payloadIdx++] = ringBuf[rBufTmpHead];
-                    // If all payload bytes have been read
-                    if (payloadIdx == payloadLen)
-                    {
-                        esp_now_recv_info_t recvInfo = {
-                            .des_addr = myMac,
-                            .src_addr = rxMac,
-                            .rx_ctrl  = NULL,
-                        };
-                        hostEspNowRecvCb(&recvInfo, payload, payloadLen, 0);
-
-                        // Move the ringBuf head, reset variables
-                        rBufHead    = rBufTmpHead;
-                        rxMacIdx    = 0;
-                        payloadLen  = 0;
-                        payloadIdx  = 0;
-                        decodeState = EU_PARSING_FR_START_1;
-                    }
-                    break;
-                }
+                // Hand the packet to the mode straight from the ring
+                esp_now_recv_info_t recvInfo = {
+                    .des_addr = myMac,
+                    .src_addr = slot->mac,
+                    .rx_ctrl  = NULL,
+                };
+                hostEspNowRecvCb(&recvInfo, slot->data, slot->len, slot->rssi);
+
+                tail += ESP_NOW_RX_SLOT_SIZE(slot->len);
+                batch++;
             }
-            rBufTmpHead = (rBufTmpHead + 1) % sizeof(ringBuf);
+
+            // Release the slot back to the WiFi task
+            atomic_store_explicit(&rxRingTail, tail, memory_order_release);
         }
-    }
-    else if (mode != ESP_NOW_IMMEDIATE)
-    {
-        espNowPacket_t packet;
-        if (xQueueReceive(esp_now_queue, &packet, 0))
+
+        if (batch > rxStats.maxBatch)
         {
-            // Debug print the received payload
-            // char dbg[256] = {0};
-            // char tmp[8] = {0};
-            // int i;
-            // for (i = 0; i < packet.len; i++)
-            // {
-            //     sprintf(tmp, "%02X ", packet.data[i]);
-            //     strcat(dbg, tmp);
-            // }
-            // ESP_LOGD("ESPNOW", "%s, MAC [%02X:%02X:%02X:%02X:%02X:%02X], Bytes [%s]",
-            //        __func__,
-            //        packet.mac[0],
-            //        packet.mac[1],
-            //        packet.mac[2],
-            //        packet.mac[3],
-            //        packet.mac[4],
-            //        packet.mac[5],
-            //        dbg);
-
-            esp_now_recv_info_t recvInfo = {
-                .des_addr = myMac,
-                .src_addr = packet.mac,
-                .rx_ctrl  = NULL,
-            };
-            hostEspNowRecvCb(&recvInfo, packet.data, packet.len, packet.rssi);
+            rxStats.maxBatch = batch;
+        }
+
+        uint32_t dropped = atomic_load_explicit(&rxDropped, memory_order_relaxed);
+        if (dropped != rxDroppedLogged)
+        {
+            ESP_LOGD("ESPNOW", "Receive ring full, %" PRIu32 " packets dropped", dropped - rxDroppedLogged);
+            rxDroppedLogged = dropped;
         }
     }
 }
 
+/**
+ * @brief Get statistics about packets moved from the WiFi task to the main loop. Useful to check if the receive ring
+ * is big enough when many Swadges are broadcasting
+ *
+ * @param stats Written with the statistics since initEspNow()
+ */
+void espNowGetRxStats(espNowRxStats_t* stats)
+{
+    *stats           = rxStats;
+    stats->dropped   = atomic_load(&rxDropped);
+    stats->badFrames = serialDecoder.crcErrors + serialDecoder.framingErrors;
+}
+
+/**
+ * @brief Called by the serial frame decoder for each valid frame. This sends the frame to hostEspNowRecvCb()
+ *
+ * @param mac The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ */
+static void espNowSerialFrameCb(const uint8_t* mac, const uint8_t* data, uint8_t len)
+{
+    uint8_t rxMac[6];
+    memcpy(rxMac, mac, sizeof(rxMac));
+
+    esp_now_recv_info_t recvInfo = {
+        .des_addr = myMac,
+        .src_addr = rxMac,
+        .rx_ctrl  = NULL,
+    };
+    hostEspNowRecvCb(&recvInfo, data, len, 0);
+    rxStats.packets++;
+}
+
 /**
  * This is a wrapper for esp_now_send(). It also sets the wifi power with
  * wifi_set_user_fixed_rate()
@@ -560,24 +581,12 @@ void espNowSend(const char* data, uint8_t len)
 {
     if (isSerial)
     {
-        // Frame the packet and add our MAC address
-        uint16_t framedPacketLen = len + 4 + sizeof(myMac);
-        char framedPacket[framedPacketLen];
-        uint16_t framedPacketIdx        = 0;
-        framedPacket[framedPacketIdx++] = FRAMING_START_1;
-        framedPacket[framedPacketIdx++] = FRAMING_START_2;
-        framedPacket[framedPacketIdx++] = FRAMING_START_3;
-
-        memcpy(&framedPacket[framedPacketIdx], myMac, sizeof(myMac));
-        framedPacketIdx += sizeof(myMac);
-
-        framedPacket[framedPacketIdx++] = len;
-
-        memcpy(&framedPacket[framedPacketIdx], data, len);
-        framedPacketIdx += len;
+        // Frame the packet with our MAC address
+        uint8_t framedPacket[ESP_NOW_FRAME_MAX_ENCODED];
+        uint16_t framedPacketLen = espNowFrameEncode(myMac, (const uint8_t*)data, len, framedPacket);
 
         // Send the bytes over serial
-        if (framedPacketLen == uart_write_bytes(uartNum, framedPacket, framedPacketLen))
+        if (framedPacketLen == uart_write_bytes(uartNum, (const char*)framedPacket, framedPacketLen))
         {
             // Manually call the callback
             espNowSendCb(espNowBroadcastMac, ESP_NOW_SEND_SUCCESS);
@@ -0,0 +1,129 @@
+/*! \file espNowFraming.h
+ *
+ * \section espNowFraming_design Design Philosophy
+ *
+ * When ESP-NOW packets are sent over a wired UART instead of the air (see espNowUseSerial()), they need framing so the
+ * receiver can find where each packet starts and ends, and a checksum so corrupted packets are dropped instead of
+ * being delivered.
+ *
+ * Each packet is framed as:
+ * - The sender's six byte MAC address
+ * - The payload, up to ::ESP_NOW_FRAME_MAX_PAYLOAD bytes
+ * - A CRC-16/CCITT-FALSE of the MAC and payload, most significant byte first
+ *
+ * These bytes are then encoded with <a href="https://en.wikipedia.org/wiki/Consistent_Overhead_Byte_Stuffing">
+ * Consistent Overhead Byte Stuffing (COBS)</a>, which removes every zero byte at the cost of one extra byte, and a
+ * zero byte is sent after the frame. A zero byte therefore always means a frame just ended, so a receiver which starts
+ * listening in the middle of a frame, or loses bytes, recovers at the next zero byte. The length isn't sent, since it
+ * is the distance between zero bytes.
+ *
+ * The decoder is incremental. It keeps its state in an ::espNowFrameDecoder_t between calls, so bytes may be given to
+ * it in chunks of any size as they arrive, and each byte is only looked at once. Decoded frames are handed to a
+ * callback straight from the decoder's buffer.
+ *
+ * This code is shared by the firmware and the emulator, so wired links can be tested on a computer.
+ *
+ * \section espNowFraming_usage Usage
+ *
+ * espNowFrameEncode() encodes a packet into a buffer of at least ::ESP_NOW_FRAME_MAX_ENCODED bytes, which can be
+ * written to the UART as-is.
+ *
+ * espNowFrameDecoderReset() readies an ::espNowFrameDecoder_t. Then call espNowFrameDecode() with every chunk of bytes
+ * read from the UART. The callback is called for each valid frame.
+ *
+ * You don't need to call these functions to use wired connections. hdw-esp-now.c does.
+ *
+ * \section espNowFraming_example Example
+ *
+ * \code{.c}
+ * static espNowFrameDecoder_t decoder;
+ *
+ * static void frameCb(const uint8_t* mac, const uint8_t* data, uint8_t len)
+ * {
+ *     printf("Received %d bytes\n", len);
+ * }
+ *
+ * ...
+ *
+ * // Send a packet
+ * uint8_t frame[ESP_NOW_FRAME_MAX_ENCODED];
+ * uint16_t frameLen = espNowFrameEncode(myMac, payload, payloadLen, frame);
+ * uart_write_bytes(uartNum, frame, frameLen);
+ *
+ * ...
+ *
+ * // Receive packets
+ * espNowFrameDecoderReset(&decoder);
+ * while (true)
+ * {
+ *     uint8_t bytes[128];
+ *     int numBytes = uart_read_bytes(uartNum, bytes, sizeof(bytes), 0);
+ *     if (numBytes > 0)
+ *     {
+ *         espNowFrameDecode(&decoder, bytes, numBytes, frameCb);
+ *     }
+ * }
+ * \endcode
+ */
+
+#ifndef _ESP_NOW_FRAMING_H_
+#define _ESP_NOW_FRAMING_H_
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// The longest payload in a frame, which is the longest ESP-NOW packet
+#define ESP_NOW_FRAME_MAX_PAYLOAD 250
+
+/// The length of a frame's MAC address, payload, and CRC before it is encoded
+#define ESP_NOW_FRAME_MAX_DECODED (6 + ESP_NOW_FRAME_MAX_PAYLOAD + 2)
+
+/// The longest encoded frame, including COBS overhead and the zero byte after it
+#define ESP_NOW_FRAME_MAX_ENCODED (ESP_NOW_FRAME_MAX_DECODED + (ESP_NOW_FRAME_MAX_DECODED / 254) + 1 + 1)
+
+//==============================================================================
+// Types
+//==============================================================================
+
+/**
+ * @brief A function typedef for a callback called when a valid frame is decoded
+ * @param mac The sender's MAC address
+ * @param data The payload. This is only valid until the callback returns
+ * @param len The length of the payload
+ */
+typedef void (*espNowFrameCb_t)(const uint8_t* mac, const uint8_t* data, uint8_t len);
+
+/**
+ * @brief The state of a frame decoder, which is kept between calls to espNowFrameDecode()
+ */
+typedef struct
+{
+    uint8_t buf[ESP_NOW_FRAME_MAX_DECODED]; ///< The decoded bytes of the current frame
+    uint16_t len;                           ///< The number of decoded bytes in buf
+    uint8_t blockLeft;                      ///< The number of bytes left in the current COBS block
+    bool blockFull;                         ///< Whether the current COBS block has no zero after it
+    bool started;                           ///< Whether a COBS block has started in this frame
+    bool discard;                           ///< Whether the current frame is bad and is ignored until the next zero
+    uint32_t frames;                        ///< The number of valid frames decoded
+    uint32_t crcErrors;                     ///< The number of frames dropped because their CRC didn't match
+    uint32_t framingErrors;                 ///< The number of frames dropped because they were malformed or too long
+} espNowFrameDecoder_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+uint16_t espNowFrameEncode(const uint8_t* mac, const uint8_t* data, uint8_t len, uint8_t* out);
+void espNowFrameDecoderReset(espNowFrameDecoder_t* dec);
+void espNowFrameDecode(espNowFrameDecoder_t* dec, const uint8_t* bytes, uint32_t numBytes, espNowFrameCb_t cb);
+uint16_t espNowFrameCrc16(const uint8_t* data, uint32_t len);
+
+#endif
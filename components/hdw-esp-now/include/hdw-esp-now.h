@@ -33,6 +33,9 @@
  *
  * espNowUseWireless() and espNowUseSerial() may be used to switch between wireless connections and wired connections,
  * respectively. espNowUseSerial() is also used to configure the RX and TX pins for UART communication.
+ * espNowSetSerialBaud() changes the baud rate from ::ESP_NOW_SERIAL_DEFAULT_BAUD. Over a wire, each packet is framed
+ * with COBS and checked with a CRC-16, so corrupted packets are dropped and the receiver recovers at the next packet.
+ * See espNowFraming.h.
  *
  * To send a packet, call espNowSend().
  * When the packet transmission finishes, the ::hostEspNowSendCb_t callback passed to initEspNow() is called with a
@@ -41,6 +44,12 @@
  * When a packet is received, the ::hostEspNowRecvCb_t callback passed to initEspNow() is called with the received
  * packet.
  *
+ * In ::ESP_NOW mode, received packets are copied once into a lock-free ring, and checkEspNowRxQueue() hands every
+ * waiting packet to the callback in one batch, straight from the ring. The data is only valid until the callback
+ * returns, so copy anything which is needed later. If the main loop falls behind, like when hundreds of Swadges are
+ * broadcasting nearby, new packets are dropped until there is room in the ring. espNowGetRxStats() reports how many
+ * were dropped and how full the ring has been.
+ *
  * \section esp-now_example Example
  *
  * \code{.c}
@@ -88,6 +97,13 @@
 #include <hal/gpio_types.h>
 #include <driver/uart.h>
 
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// The default baud rate for wired connections, see espNowSetSerialBaud()
+#define ESP_NOW_SERIAL_DEFAULT_BAUD (8 * 115200)
+
 //==============================================================================
 // Types
 //==============================================================================
@@ -102,6 +118,19 @@ typedef enum __attribute__((packed))
     ESP_NOW_IMMEDIATE, ///< ESP-NOW packets are delivered to Swadge modes from the interrupt
 } wifiMode_t;
 
+/**
+ * @brief Statistics about packets moved from the WiFi task to the main loop, from espNowGetRxStats()
+ */
+typedef struct
+{
+    uint32_t packets;   ///< The number of packets received
+    uint32_t dropped;   ///< The number of packets dropped because the receive ring was full
+    uint32_t highWater; ///< The most bytes ever used in the receive ring
+    uint32_t ringSize;  ///< The size of the receive ring in bytes
+    uint32_t maxBatch;  ///< The most packets handed to the mode by one call to checkEspNowRxQueue()
+    uint32_t badFrames; ///< The number of packets received over serial which were dropped for a bad CRC or framing
+} espNowRxStats_t;
+
 //==============================================================================
 // Prototypes
 //==============================================================================
@@ -128,8 +157,10 @@ void deinitEspNow(void);
 
 esp_err_t espNowUseWireless(void);
 void espNowUseSerial(bool crossoverPins);
+void espNowSetSerialBaud(uint32_t baud);
 
 void espNowSend(const char* data, uint8_t len);
 void checkEspNowRxQueue(void);
+void espNowGetRxStats(espNowRxStats_t* stats);
 
 #endif /* USER_ESP_NOW_UTILS_H_ */
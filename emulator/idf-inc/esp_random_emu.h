@@ -1,4 +1,9 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+
 void emulatorSetEspRandomSeed(unsigned int seed);
 unsigned int emulatorGetEspRandomSeed(void);
+bool emulatorGetEspRandomState(unsigned int* outSeed, uint64_t* outDraws);
+void emulatorSetEspRandomState(unsigned int seed, uint64_t drawCount);
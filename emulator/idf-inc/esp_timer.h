@@ -57,7 +57,7 @@ extern "C"
 
     struct esp_timer
     {
-        uint64_t alarm;
+        uint64_t alarm; //!< The emulator time this timer expires at, in microseconds
         uint64_t period : 56;
         flags_t flags   : 8;
         union
@@ -66,6 +66,8 @@ extern "C"
             uint32_t event_id;
         };
         void* arg;
+        uint64_t seq;        //!< When the timer was started, to call timers with the same alarm in a fixed order
+        uint32_t heap_index; //!< The 1-based position of this timer in the emulator's timer heap, or 0 if stopped
         // #if WITH_PROFILING
         //     const char* name;
         //     size_t times_triggered;
@@ -331,7 +333,7 @@ extern "C"
      */
     bool esp_timer_is_active(esp_timer_handle_t timer);
 
-    void check_esp_timer(uint64_t elapsed_us);
+    void check_esp_timer(void);
 
 #ifdef __cplusplus
 }
@@ -5,3 +5,4 @@ void emuSetEspTimerTime(int64_t timeUs);
 void emuTimerPause(void);
 void emuTimerUnpause(void);
 bool emuTimerIsPaused(void);
+bool emuTimerNextDeadline(int64_t* deadlineUs);
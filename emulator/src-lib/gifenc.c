@@ -89,7 +89,8 @@ ge_new_gif(
 {
     int i, r, g, b, v;
     int store_gct, custom_gct;
-    int nbuffers = bgindex < 0 ? 2 : 1;
+    /* The back buffer is also needed if delta is set later */
+    int nbuffers = 2;
     ge_GIF *gif = calloc(1, sizeof(*gif) + nbuffers*width*height);
     if (!gif)
         goto no_gif;
@@ -224,6 +225,8 @@ put_image(ge_GIF *gif, uint16_t w, uint16_t h, uint16_t x, uint16_t y)
     for (i = y; i < y+h; i++) {
         for (j = x; j < x+w; j++) {
             uint8_t pixel = gif->frame[i*gif->w+j] & (degree - 1);
+            if (gif->delta && gif->nframes && gif->frame[i*gif->w+j] == gif->back[i*gif->w+j])
+                pixel = (uint8_t) gif->bgindex & (degree - 1);
             child = node->children[pixel];
             if (child) {
                 node = child;
@@ -260,7 +263,7 @@ get_bbox(ge_GIF *gif, uint16_t *w, uint16_t *h, uint16_t *x, uint16_t *y)
     k = 0;
     for (i = 0; i < gif->h; i++) {
         for (j = 0; j < gif->w; j++, k++) {
-            back = gif->bgindex >= 0 ? gif->bgindex : gif->back[k];
+            back = (gif->bgindex >= 0 && !gif->delta) ? gif->bgindex : gif->back[k];
             if (gif->frame[k] != back) {
                 if (j < left)   left    = j;
                 if (j > right)  right   = j;
@@ -282,7 +285,8 @@ get_bbox(ge_GIF *gif, uint16_t *w, uint16_t *h, uint16_t *x, uint16_t *y)
 static void
 add_graphics_control_extension(ge_GIF *gif, uint16_t d)
 {
-    uint8_t flags = ((gif->bgindex >= 0 ? 2 : 1) << 2) + 1;
+    /* Delta frames are drawn over the previous frame, so it must not be disposed */
+    uint8_t flags = ((gif->bgindex >= 0 && !gif->delta ? 2 : 1) << 2) + 1;
     write(gif->fd, (uint8_t []) {'!', 0xF9, 0x04, flags}, 4);
     write_num(gif->fd, d);
     write(gif->fd, (uint8_t []) {(uint8_t) gif->bgindex, 0x00}, 2);
@@ -307,7 +311,7 @@ ge_add_frame(ge_GIF *gif, uint16_t delay)
     }
     put_image(gif, w, h, x, y);
     gif->nframes++;
-    if (gif->bgindex < 0) {
+    if (gif->bgindex < 0 || gif->delta) {
         tmp = gif->back;
         gif->back = gif->frame;
         gif->frame = tmp;
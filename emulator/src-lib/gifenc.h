@@ -14,6 +14,10 @@ typedef struct ge_GIF {
     int fd;
     int offset;
     int nframes;
+    /* If set, frames after the first only encode the rectangle which changed
+     * since the previous frame, and unchanged pixels in that rectangle are
+     * written as bgindex, which must be transparent. */
+    int delta;
     uint8_t *frame, *back;
     uint32_t partial;
     uint8_t buffer[0xFF];
@@ -3,20 +3,70 @@
 //==============================================================================
 
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "hdw-dac.h"
 #include "hdw-dac_emu.h"
+#include "macros.h"
 
 //==============================================================================
 // Defines
 //==============================================================================
 
+/// @brief The size of a canonical PCM WAV header
+#define WAV_HEADER_SIZE 44
+
+/// @brief The number of samples the ring between the main loop and the audio thread can hold. This must be a power of
+/// two
+#define DAC_RING_SIZE 4096
+
+/// @brief How full dacPoll() keeps the ring, in samples. This is the audio latency the main loop can stall for without
+/// an underrun, about 62ms
+#define DAC_RING_TARGET (4 * DAC_BUF_SIZE)
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void putLe16(uint8_t* out, uint16_t val);
+static void putLe32(uint8_t* out, uint32_t val);
+static void writeWavHeader(FILE* file, uint32_t numSamples);
+
 //==============================================================================
 // Variables
 //==============================================================================
 
 fnDacCallback_t dacCb = NULL;
 
+/// @brief The WAV file headless audio is written to, or NULL
+static FILE* sinkFile = NULL;
+
+/// @brief The number of samples written to \c sinkFile
+static uint32_t sinkSamples = 0;
+
+/// @brief Samples generated on the main loop by dacPoll(), waiting to be played by the audio thread
+static uint8_t ring[DAC_RING_SIZE];
+
+/// @brief The number of samples ever written to the ring. Only written by the main loop
+static atomic_uint ringHead;
+
+/// @brief The number of samples ever read from the ring. Only written by the audio thread
+static atomic_uint ringTail;
+
+/// @brief Set by the audio thread the first time it asks for samples. Until then, there is nothing to fill the ring
+/// for, like when running headless
+static atomic_bool ringActive;
+
+/// @brief Audio thread requests which got some samples from the ring, but not enough
+static atomic_uint ringShortReads;
+
+/// @brief Audio thread requests which found the ring empty
+static atomic_uint ringEmptyReads;
+
+/// @brief The number of samples of silence the audio thread played because the ring ran out
+static atomic_uint ringUnderrunSamples;
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -60,15 +110,39 @@ void dacStop(void)
 
 /**
  * @brief Poll the queue to see if it needs to be filled with audio samples
+ *
+ * Like the firmware, samples are generated here, on the main loop, so the DAC callback never runs at the same time as
+ * the Swadge mode. The audio thread only copies samples out of the ring in dacHandleSoundOutput().
  */
 void dacPoll(void)
 {
-    // In actual firmware, this function will fill sample buffers received in interrupts.
-    // In the emulator, that's handled in dacHandleSoundOutput() instead
+    if (NULL == dacCb || !atomic_load_explicit(&ringActive, memory_order_relaxed))
+    {
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ringTail, memory_order_acquire);
+    uint32_t fill = head - tail;
+
+    // Top the ring up in buffer-sized pieces, like the DMA buffers on the Swadge
+    while (fill < DAC_RING_TARGET)
+    {
+        uint32_t offset = head & (DAC_RING_SIZE - 1);
+        uint32_t len    = MIN(MIN(DAC_RING_TARGET - fill, DAC_BUF_SIZE), DAC_RING_SIZE - offset);
+
+        // Samples are written straight into the ring
+        dacCb(&ring[offset], len);
+
+        head += len;
+        fill += len;
+        atomic_store_explicit(&ringHead, head, memory_order_release);
+    }
 }
 
 /**
- * @brief Fill a buffer with sample output
+ * @brief Fill a buffer with sample output. This is called on the audio thread, so it only copies samples which
+ * dacPoll() already generated. If the main loop fell behind, the rest of the buffer is silent.
  *
  * @param out     A pointer to fill with samples
  * @param framesp The number of samples to fill, per-channel
@@ -77,30 +151,206 @@ void dacPoll(void)
 void dacHandleSoundOutput(short* out, int framesp, short numChannels)
 {
     // Make sure there is a buffer to fill
-    if (NULL != out)
+    if (NULL == out)
+    {
+        return;
+    }
+
+    if (!atomic_load_explicit(&ringActive, memory_order_relaxed))
     {
-        // Make sure there is a callback function to call
+        // This is the first request, so the ring hasn't been filled yet. Start filling it and play silence for now
+        atomic_store_explicit(&ringActive, true, memory_order_relaxed);
+        memset(out, 0, sizeof(short) * numChannels * framesp);
+        return;
+    }
+
+    uint32_t tail  = atomic_load_explicit(&ringTail, memory_order_relaxed);
+    uint32_t head  = atomic_load_explicit(&ringHead, memory_order_acquire);
+    uint32_t avail = MIN(head - tail, (uint32_t)framesp);
+
+    // Write the samples to the emulator output, in signed short format
+    for (uint32_t i = 0; i < avail; i++)
+    {
+        short samp = (ring[(tail + i) & (DAC_RING_SIZE - 1)] - 127) * 256;
+        // Copy the same sample to each channel
+        for (int j = 0; j < numChannels; j++)
+        {
+            out[i * numChannels + j] = samp;
+        }
+    }
+    atomic_store_explicit(&ringTail, tail + avail, memory_order_release);
+
+    if (avail < (uint32_t)framesp)
+    {
+        // The main loop didn't keep up. Silence is quieter than repeating old samples
+        memset(&out[avail * numChannels], 0, sizeof(short) * numChannels * (framesp - avail));
+
+        // Without a callback there's nothing to play, so that isn't an underrun
         if (NULL != dacCb)
         {
-            // Get samples from the Swadge mode
-            uint8_t tempSamps[framesp];
-            dacCb(tempSamps, framesp);
-
-            // Write the samples to the emulator output, in signed short format
-            for (int i = 0; i < framesp; i++)
-            {
-                short samp = (tempSamps[i] - 127) * 256;
-                // Copy the same sample to each channel
-                for (int j = 0; j < numChannels; j++)
-                {
-                    out[i * numChannels + j] = samp;
-                }
-            }
+            atomic_fetch_add_explicit(avail ? &ringShortReads : &ringEmptyReads, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&ringUnderrunSamples, framesp - avail, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Get the state of the ring between the main loop and the audio thread
+ *
+ * @param fill [out] Written with the number of samples waiting to be played. May be NULL
+ * @param capacity [out] Written with the number of samples dacPoll() keeps in the ring. May be NULL
+ * @param underrunSamples [out] Written with the number of samples of silence played because the ring ran out. May be
+ * NULL
+ */
+void dacGetRingStats(uint32_t* fill, uint32_t* capacity, uint32_t* underrunSamples)
+{
+    if (NULL != fill)
+    {
+        *fill = atomic_load_explicit(&ringHead, memory_order_relaxed)
+                - atomic_load_explicit(&ringTail, memory_order_relaxed);
+    }
+    if (NULL != capacity)
+    {
+        *capacity = DAC_RING_TARGET;
+    }
+    if (NULL != underrunSamples)
+    {
+        *underrunSamples = atomic_load_explicit(&ringUnderrunSamples, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Pull samples from the DAC callback when there is no audio device, as if they were played. If a sink file is
+ * open, the samples are written to it, otherwise they are discarded.
+ *
+ * @param framesp The number of samples to pull
+ */
+void dacHandleHeadlessOutput(int framesp)
+{
+    uint8_t tempSamps[DAC_BUF_SIZE];
+    while (framesp > 0)
+    {
+        int len = MIN(framesp, DAC_BUF_SIZE);
+        if (NULL != dacCb)
+        {
+            dacCb(tempSamps, len);
         }
         else
         {
-            // No callback function, write zeros
-            memset(out, 0, sizeof(short) * 2 * framesp);
+            // No callback function, write silence
+            memset(tempSamps, 128, len);
+        }
+
+        if (NULL != sinkFile)
+        {
+            sinkSamples += fwrite(tempSamps, 1, len, sinkFile);
         }
+        framesp -= len;
+    }
+}
+
+/**
+ * @brief Write a 16-bit value in little-endian order
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe16(uint8_t* out, uint16_t val)
+{
+    out[0] = val & 0xFF;
+    out[1] = (val >> 8) & 0xFF;
+}
+
+/**
+ * @brief Write a 32-bit value in little-endian order
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe32(uint8_t* out, uint32_t val)
+{
+    putLe16(out, val & 0xFFFF);
+    putLe16(out + 2, val >> 16);
+}
+
+/**
+ * @brief Write a header for an 8-bit mono WAV file at ::DAC_SAMPLE_RATE_HZ at the current position in a file
+ *
+ * @param file The file to write to
+ * @param numSamples The number of samples which follow the header
+ */
+static void writeWavHeader(FILE* file, uint32_t numSamples)
+{
+    uint8_t hdr[WAV_HEADER_SIZE];
+    memcpy(&hdr[0], "RIFF", 4);
+    putLe32(&hdr[4], WAV_HEADER_SIZE - 8 + numSamples);
+    memcpy(&hdr[8], "WAVEfmt ", 8);
+    putLe32(&hdr[16], 16);                 // fmt chunk size
+    putLe16(&hdr[20], 1);                  // PCM
+    putLe16(&hdr[22], 1);                  // Mono
+    putLe32(&hdr[24], DAC_SAMPLE_RATE_HZ); // Sample rate
+    putLe32(&hdr[28], DAC_SAMPLE_RATE_HZ); // Byte rate
+    putLe16(&hdr[32], 1);                  // Bytes per frame
+    putLe16(&hdr[34], 8);                  // Bits per sample
+    memcpy(&hdr[36], "data", 4);
+    putLe32(&hdr[40], numSamples);
+
+    fwrite(hdr, 1, sizeof(hdr), file);
+}
+
+/**
+ * @brief Open a WAV file to write headless audio to
+ *
+ * @param fname The name of the file to write
+ * @return true if the file was opened, false if it could not be
+ */
+bool dacOpenSinkFile(const char* fname)
+{
+    dacCloseSinkFile();
+
+    sinkFile = fopen(fname, "wb");
+    if (NULL == sinkFile)
+    {
+        return false;
+    }
+
+    // The sizes are filled in when the file is closed
+    sinkSamples = 0;
+    writeWavHeader(sinkFile, 0);
+    return true;
+}
+
+/**
+ * @brief Finish and close the headless audio sink file, if one is open
+ */
+void dacCloseSinkFile(void)
+{
+    if (NULL != sinkFile)
+    {
+        fseek(sinkFile, 0, SEEK_SET);
+        writeWavHeader(sinkFile, sinkSamples);
+        fclose(sinkFile);
+        sinkFile = NULL;
+    }
+}
+
+/**
+ * @brief Get the number of DAC buffers which were not refilled on time.
+ *
+ * In the emulator, these count the audio thread's requests which the ring couldn't fully satisfy because dacPoll()
+ * wasn't called often enough. When running headless, samples are pulled synchronously, so there are never any.
+ *
+ * @param lateRefills [out] Written with the number of requests which got some samples, but not enough. May be NULL
+ * @param droppedBuffers [out] Written with the number of requests which got no samples at all. May be NULL
+ */
+void dacGetUnderruns(uint32_t* lateRefills, uint32_t* droppedBuffers)
+{
+    if (NULL != lateRefills)
+    {
+        *lateRefills = atomic_load_explicit(&ringShortReads, memory_order_relaxed);
+    }
+    if (NULL != droppedBuffers)
+    {
+        *droppedBuffers = atomic_load_explicit(&ringEmptyReads, memory_order_relaxed);
     }
 }
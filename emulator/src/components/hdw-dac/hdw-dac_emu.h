@@ -1,3 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void dacHandleSoundOutput(short* out, int framesp, short numChannels);
+void dacHandleHeadlessOutput(int framesp);
+void dacGetRingStats(uint32_t* fill, uint32_t* capacity, uint32_t* underrunSamples);
+bool dacOpenSinkFile(const char* fname);
+void dacCloseSinkFile(void);
@@ -25,16 +25,26 @@
     #include <sys/socket.h> // for socket(), connect(), sendto(), and recvfrom()
     #include <arpa/inet.h>  // for sockaddr_in and inet_addr()
     #include <fcntl.h>
+    #include <stdlib.h>  // for posix_openpt()
+    #include <termios.h> // for raw serial devices
 #endif
 
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "hdw-esp-now.h"
+#include "hdw-esp-now_emu.h"
+#include "espNowFraming.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "emu_main.h"
+#include "emu_args.h"
+#include "macros.h"
 
 //==============================================================================
 // Defines
@@ -43,6 +53,59 @@
 #define ESP_NOW_PORT  32888
 #define MAXRECVSTRING 1024 // Longest string to receive
 
+/// The first byte of every emulated ESP-NOW packet
+#define EMU_ESP_NOW_MAGIC_0 'E'
+/// The second byte of every emulated ESP-NOW packet
+#define EMU_ESP_NOW_MAGIC_1 'N'
+/// The most bytes in one ESP-NOW packet
+#define EMU_ESP_NOW_MAX_LEN 250
+
+/// The most received packets which may wait to be delivered at once
+#define EMU_ESP_NOW_MAX_PENDING 256
+/// With --espnow-rate, packets which would wait longer than this to be received are dropped
+#define EMU_ESP_NOW_MAX_BACKLOG_US 1000000
+
+/// The pcap link type for IEEE 802.11 frames without a radio header
+#define PCAP_LINKTYPE_IEEE802_11 105
+/// The size of the 802.11 header and ESP-NOW vendor specific action before the payload, in a capture
+#define PCAP_ESP_NOW_HDR_LEN 39
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief The header of an emulated ESP-NOW packet sent over UDP. The payload follows it
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t magic[2]; ///< ::EMU_ESP_NOW_MAGIC_0 and ::EMU_ESP_NOW_MAGIC_1
+    uint8_t mac[6];   ///< The sender's MAC address
+} emuEspNowHdr_t;
+
+/**
+ * @brief A received packet waiting to be delivered after its simulated delay
+ */
+typedef struct
+{
+    int64_t deliverUs;                 ///< The time to deliver this packet to the mode
+    uint32_t seq;                      ///< The order packets were queued in, to deliver equal times in order
+    uint8_t mac[6];                    ///< The sender's MAC address
+    uint8_t len;                       ///< The length of the payload
+    uint8_t data[EMU_ESP_NOW_MAX_LEN]; ///< The payload
+} emuEspNowPending_t;
+
+/**
+ * @brief What the simulated link did to received packets
+ */
+typedef struct
+{
+    uint32_t received;   ///< Packets received from other emulators
+    uint32_t lost;       ///< Packets lost with --espnow-loss
+    uint32_t duplicated; ///< Packets delivered twice with --espnow-dup
+    uint32_t overflowed; ///< Packets dropped because too many were waiting to be delivered
+} emuEspNowLinkStats_t;
+
 //==============================================================================
 // Variables
 //==============================================================================
@@ -52,6 +115,71 @@ hostEspNowSendCb_t hostEspNowSendCb = NULL;
 
 int socketFd;
 
+/// This emulator's MAC address, to ignore its own packets
+static uint8_t ourMac[6];
+
+/// Receive statistics. The pending packets take the place of the firmware's receive ring
+static espNowRxStats_t rxStats;
+
+/// Whether any link option is set, so received packets go through the simulated link
+static bool linkImpaired;
+/// Whether the link is in a burst of losses
+static bool linkInBurst;
+/// The state of the link's random number generator, which is separate so esp_random() isn't disturbed
+static uint32_t linkRandState;
+/// With --espnow-rate, when the link finishes carrying the packets before it
+static int64_t linkBusyUntilUs;
+/// What the link did to received packets
+static emuEspNowLinkStats_t linkStats;
+
+/// Received packets waiting to be delivered
+static emuEspNowPending_t pendingPool[EMU_ESP_NOW_MAX_PENDING];
+/// A min-heap of indices into ::pendingPool, ordered by delivery time
+static uint16_t pendingHeap[EMU_ESP_NOW_MAX_PENDING];
+/// The number of packets in ::pendingHeap
+static uint16_t pendingHeapLen;
+/// Indices into ::pendingPool which aren't in use
+static uint16_t pendingFree[EMU_ESP_NOW_MAX_PENDING];
+/// The number of indices in ::pendingFree
+static uint16_t pendingFreeLen;
+/// The number of packets ever queued, to break ties
+static uint32_t pendingSeq;
+
+/// Whether packets are sent over the serial device instead of the network
+static bool isSerial;
+/// The serial device given with --espnow-serial, or -1
+static int serialFd = -1;
+/// The baud rate set with espNowSetSerialBaud(). Pseudo-terminals ignore it
+static uint32_t serialBaud = ESP_NOW_SERIAL_DEFAULT_BAUD;
+/// Decodes frames received over the serial device. It keeps its state between calls to checkEspNowRxQueue()
+static espNowFrameDecoder_t serialDecoder;
+
+/// The file packets are captured to, or NULL
+static FILE* pcapFile;
+/// The wall clock time when esp_timer_get_time() was zero, for capture timestamps
+static int64_t pcapEpochUs;
+/// The 802.11 sequence number of the next captured packet
+static uint16_t pcapSeq;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void espNowDeliver(uint8_t* mac, const uint8_t* data, uint8_t len);
+static void espNowSerialFrameCb(const uint8_t* mac, const uint8_t* data, uint8_t len);
+static void linkReceive(const uint8_t* mac, const uint8_t* data, uint8_t len, int64_t nowUs);
+static bool linkLost(void);
+static uint32_t linkRand(void);
+static float linkRandPercent(void);
+static bool pendingPush(const uint8_t* mac, const uint8_t* data, uint8_t len, int64_t deliverUs);
+static emuEspNowPending_t* pendingPeek(void);
+static void pendingPop(void);
+static bool pendingBefore(uint16_t a, uint16_t b);
+static void pendingSiftDown(uint16_t idx);
+static void pcapWrite(const uint8_t* src, const uint8_t* data, uint8_t len);
+static void putLe16(uint8_t* out, uint16_t val);
+static void putLe32(uint8_t* out, uint32_t val);
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -76,6 +204,35 @@ esp_err_t initEspNow(hostEspNowRecvCb_t recvCb, hostEspNowSendCb_t sendCb, gpio_
     hostEspNowRecvCb = recvCb;
     hostEspNowSendCb = sendCb;
 
+    esp_wifi_get_mac(WIFI_IF_STA, ourMac);
+
+    // Set up the simulated link
+    memset(&rxStats, 0, sizeof(rxStats));
+    memset(&linkStats, 0, sizeof(linkStats));
+    rxStats.ringSize = sizeof(pendingPool);
+    linkInBurst      = false;
+    linkBusyUntilUs  = 0;
+    pendingHeapLen   = 0;
+    pendingFreeLen   = 0;
+    for (uint16_t i = EMU_ESP_NOW_MAX_PENDING; i > 0; i--)
+    {
+        pendingFree[pendingFreeLen++] = i - 1;
+    }
+
+    linkImpaired = emulatorArgs.espNowLoss > 0 || emulatorArgs.espNowDup > 0 || emulatorArgs.espNowLatency > 0
+                   || emulatorArgs.espNowJitter > 0 || emulatorArgs.espNowRate > 0;
+
+    // Seed the link differently for each emulator, but repeatably with --seed
+    linkRandState = (UINT32_MAX != emulatorArgs.seed) ? emulatorArgs.seed : (uint32_t)time(NULL);
+    for (int i = 0; i < 6; i++)
+    {
+        linkRandState = linkRandState * 31 + ourMac[i];
+    }
+    if (0 == linkRandState)
+    {
+        linkRandState = 1;
+    }
+
 #if defined(USING_WINDOWS)
     // Initialize Winsock
     WSADATA wsaData;
@@ -123,8 +280,13 @@ esp_err_t initEspNow(hostEspNowRecvCb_t recvCb, hostEspNowSendCb_t sendCb, gpio_
         return ESP_ERR_WIFI_IF;
     }
 #else
-    int optval_enable = 1;
-    setsockopt(socketFd, SOL_SOCKET, O_NONBLOCK, (char*)&optval_enable, sizeof(optval_enable));
+    // O_NONBLOCK is a file status flag, not a socket option. Without it, recvfrom() waits for the receive timeout
+    // below, which the kernel rounds up to a scheduler tick, and a steady stream of packets never lets the main loop go
+    if (fcntl(socketFd, F_SETFL, fcntl(socketFd, F_GETFL, 0) | O_NONBLOCK) < 0)
+    {
+        ESP_LOGE("WIFI", "fcntl() failed");
+        return ESP_ERR_WIFI_IF;
+    }
 #endif
 
     // Set nonblocking timeout
@@ -146,6 +308,12 @@ esp_err_t initEspNow(hostEspNowRecvCb_t recvCb, hostEspNowSendCb_t sendCb, gpio_
         ESP_LOGE("WIFI", "bind() failed");
         return ESP_ERR_WIFI_IF;
     }
+
+    // With --espnow-serial, act like a mode which called espNowUseSerial(), so any mode can be tested over a wire
+    if (NULL != emulatorArgs.espNowSerial)
+    {
+        espNowUseSerial(false);
+    }
     return ESP_OK;
 }
 
@@ -154,58 +322,213 @@ esp_err_t initEspNow(hostEspNowRecvCb_t recvCb, hostEspNowSendCb_t sendCb, gpio_
  */
 esp_err_t espNowUseWireless(void)
 {
-    // Do nothing
+    // Stop using the serial device, if there is one
+    if (-1 != serialFd)
+    {
+        close(serialFd);
+        serialFd = -1;
+    }
+    isSerial = false;
     return ESP_OK;
 }
 
 /**
- * Start the UART and use it for communication
+ * Start the UART and use it for communication. The emulator uses the serial device given with --espnow-serial, and
+ * packets are framed just like the firmware frames them, see espNowFraming.h. Without --espnow-serial, the network is
+ * still used
  *
  * @param crossoverPins true to crossover the rx and tx pins, false to use them
- *                      as normal.
+ *                      as normal. Ignored, since a serial device is always crossed over
  */
 void espNowUseSerial(bool crossoverPins)
 {
-    // Do nothing
+    if (isSerial)
+    {
+        return;
+    }
+    else if (NULL == emulatorArgs.espNowSerial)
+    {
+        ESP_LOGW("WIFI", "Use --espnow-serial to connect wired Swadges, using the network instead");
+        return;
+    }
+
+#if defined(USING_WINDOWS)
+    ESP_LOGE("WIFI", "--espnow-serial is not supported on Windows, using the network instead");
+#else
+    if (0 == strcmp("pty", emulatorArgs.espNowSerial))
+    {
+        // Create a pseudo-terminal for another emulator to open
+        serialFd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (-1 == serialFd || 0 != grantpt(serialFd) || 0 != unlockpt(serialFd))
+        {
+            ESP_LOGE("WIFI", "Couldn't create a pseudo-terminal: %s", strerror(errno));
+            espNowUseWireless();
+            return;
+        }
+        ESP_LOGI("WIFI", "Wired ESP-NOW on %s, start another emulator with --espnow-serial=%s", ptsname(serialFd),
+                 ptsname(serialFd));
+    }
+    else if (-1 == (serialFd = open(emulatorArgs.espNowSerial, O_RDWR | O_NOCTTY)))
+    {
+        ESP_LOGE("WIFI", "Couldn't open %s: %s", emulatorArgs.espNowSerial, strerror(errno));
+        return;
+    }
+
+    // Pass bytes through untouched, and never wait for them
+    struct termios tio;
+    if (0 == tcgetattr(serialFd, &tio))
+    {
+        cfmakeraw(&tio);
+        tcsetattr(serialFd, TCSANOW, &tio);
+    }
+    fcntl(serialFd, F_SETFL, fcntl(serialFd, F_GETFL, 0) | O_NONBLOCK);
+
+    espNowFrameDecoderReset(&serialDecoder);
+    isSerial = true;
+
+    // End any partial frame the other side received before this was connected
+    const uint8_t frameEnd = 0;
+    if (write(serialFd, &frameEnd, sizeof(frameEnd)) < 0)
+    {
+        ESP_LOGD("WIFI", "Nobody is listening on the serial device yet");
+    }
+#endif
+}
+
+/**
+ * Set the baud rate for serial communication. The emulator only records it, since pseudo-terminals have no baud rate.
+ * Set the speed of a real serial device with stty before starting the emulator
+ *
+ * @param baud The baud rate, ::ESP_NOW_SERIAL_DEFAULT_BAUD by default
+ */
+void espNowSetSerialBaud(uint32_t baud)
+{
+    serialBaud = baud;
 }
 
 /**
  * Check the ESP NOW receive queue. If there are any received packets, send
  * them to hostEspNowRecvCb()
+ *
+ * If any link option is set, received packets go through the simulated link first, and are sent to hostEspNowRecvCb()
+ * by a later call once their delay has passed
  */
 void checkEspNowRxQueue(void)
 {
-    char recvString[MAXRECVSTRING + 1]; // Buffer for received string
-    int recvStringLen;                  // Length of received string
+    uint8_t recvBuf[MAXRECVSTRING]; // Buffer for received packets
+    int recvLen;                    // Length of received packet
+    uint32_t batch = 0;             // Number of packets handed to the mode
 
-    // While we've received a packet
-    while ((recvStringLen = recvfrom(socketFd, recvString, MAXRECVSTRING, 0, NULL, 0)) > 0)
+    if (isSerial)
     {
-        // If the packet matches the ESP_NOW format
-        uint8_t recvMac[6] = {0};
-        if (6
-            == sscanf(recvString, "ESP_NOW-%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX-", &recvMac[0], &recvMac[1],
-                      &recvMac[2], &recvMac[3], &recvMac[4], &recvMac[5]))
+        // Decode everything the serial device has received. The decoder picks up where it left off last time
+        uint32_t before = rxStats.packets;
+        while ((recvLen = read(serialFd, recvBuf, sizeof(recvBuf))) > 0)
         {
-            // Make sure the MAC differs from our own
-            uint8_t ourMac[6] = {0};
-            esp_wifi_get_mac(WIFI_IF_STA, ourMac);
-            if (0 != memcmp(recvMac, ourMac, sizeof(ourMac)))
-            {
-                // Set up the receive info
-                esp_now_recv_info_t espNowInfo = {0};
-                espNowInfo.src_addr            = recvMac;
-                espNowInfo.des_addr            = ourMac;
+            espNowFrameDecode(&serialDecoder, recvBuf, recvLen, espNowSerialFrameCb);
+        }
 
-                wifi_pkt_rx_ctrl_t packetRxCtrl = {0};
-                packetRxCtrl.rssi               = 0x7F;
-                espNowInfo.rx_ctrl              = &packetRxCtrl;
+        // Drain the network too, so packets from other emulators don't pile up, but don't deliver them
+        while (recvfrom(socketFd, (char*)recvBuf, sizeof(recvBuf), 0, NULL, 0) > 0)
+        {
+        }
 
-                // If it does, send it to the application through the callback
-                hostEspNowRecvCb(&espNowInfo, (uint8_t*)&recvString[21], recvStringLen - 21, packetRxCtrl.rssi);
-            }
+        batch = rxStats.packets - before;
+        if (batch > rxStats.maxBatch)
+        {
+            rxStats.maxBatch = batch;
+        }
+        return;
+    }
+
+    // While we've received a packet
+    while ((recvLen = recvfrom(socketFd, (char*)recvBuf, sizeof(recvBuf), 0, NULL, 0)) > 0)
+    {
+        // Make sure the packet is an ESP-NOW packet from another emulator
+        emuEspNowHdr_t* hdr = (emuEspNowHdr_t*)recvBuf;
+        int len             = recvLen - (int)sizeof(emuEspNowHdr_t);
+        if (len < 0 || len > EMU_ESP_NOW_MAX_LEN || EMU_ESP_NOW_MAGIC_0 != hdr->magic[0]
+            || EMU_ESP_NOW_MAGIC_1 != hdr->magic[1] || 0 == memcmp(hdr->mac, ourMac, sizeof(ourMac)))
+        {
+            continue;
+        }
+
+        if (linkImpaired)
+        {
+            linkReceive(hdr->mac, &recvBuf[sizeof(emuEspNowHdr_t)], len, esp_timer_get_time());
+        }
+        else
+        {
+            espNowDeliver(hdr->mac, &recvBuf[sizeof(emuEspNowHdr_t)], len);
+            batch++;
         }
     }
+
+    // Deliver delayed packets whose time has come, in order
+    int64_t nowUs = esp_timer_get_time();
+    emuEspNowPending_t* pending;
+    while (NULL != (pending = pendingPeek()) && pending->deliverUs <= nowUs)
+    {
+        espNowDeliver(pending->mac, pending->data, pending->len);
+        pendingPop();
+        batch++;
+    }
+
+    if (batch > rxStats.maxBatch)
+    {
+        rxStats.maxBatch = batch;
+    }
+}
+
+/**
+ * @brief Called by the serial frame decoder for each valid frame. Wired links aren't impaired, so this delivers the
+ * frame immediately
+ *
+ * @param mac The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ */
+static void espNowSerialFrameCb(const uint8_t* mac, const uint8_t* data, uint8_t len)
+{
+    uint8_t rxMac[6];
+    memcpy(rxMac, mac, sizeof(rxMac));
+    espNowDeliver(rxMac, data, len);
+}
+
+/**
+ * @brief Capture a received packet and send it to hostEspNowRecvCb()
+ *
+ * @param mac The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ */
+static void espNowDeliver(uint8_t* mac, const uint8_t* data, uint8_t len)
+{
+    pcapWrite(mac, data, len);
+
+    // Set up the receive info
+    esp_now_recv_info_t espNowInfo = {0};
+    espNowInfo.src_addr            = mac;
+    espNowInfo.des_addr            = ourMac;
+
+    wifi_pkt_rx_ctrl_t packetRxCtrl = {0};
+    packetRxCtrl.rssi               = 0x7F;
+    espNowInfo.rx_ctrl              = &packetRxCtrl;
+
+    // Send it to the application through the callback
+    hostEspNowRecvCb(&espNowInfo, data, len, packetRxCtrl.rssi);
+    rxStats.packets++;
+}
+
+/**
+ * @brief Get statistics about received packets. The emulator has no receive ring, so nothing is ever dropped
+ *
+ * @param stats Written with the statistics since initEspNow()
+ */
+void espNowGetRxStats(espNowRxStats_t* stats)
+{
+    *stats           = rxStats;
+    stats->badFrames = serialDecoder.crcErrors + serialDecoder.framingErrors;
 }
 
 /**
@@ -225,21 +548,40 @@ void espNowSend(const char* data, uint8_t dataLen)
     broadcastAddr.sin_addr.s_addr = htonl(0x7FFFFFFF);   // Local broadcast IP address, 127.255.255.255
     broadcastAddr.sin_port        = htons(ESP_NOW_PORT); // Broadcast port
 
-    // Tack on ESP-NOW header and randomized MAC address
-    char espNowPacket[dataLen + 24];
-    uint8_t mac[6] = {0};
-    esp_wifi_get_mac(WIFI_IF_STA, mac);
-    sprintf(espNowPacket, "ESP_NOW-%02X%02X%02X%02X%02X%02X-", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    int hdrLen = strlen(espNowPacket);
+    // Tack on the header with our randomized MAC address
+    uint8_t espNowPacket[sizeof(emuEspNowHdr_t) + dataLen];
+    emuEspNowHdr_t* hdr = (emuEspNowHdr_t*)espNowPacket;
+    hdr->magic[0]       = EMU_ESP_NOW_MAGIC_0;
+    hdr->magic[1]       = EMU_ESP_NOW_MAGIC_1;
+    memcpy(hdr->mac, ourMac, sizeof(ourMac));
+    int hdrLen = sizeof(emuEspNowHdr_t);
     memcpy(&espNowPacket[hdrLen], data, dataLen);
 
     // For the callback
     uint8_t bcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+    pcapWrite(ourMac, (const uint8_t*)data, dataLen);
+
+    if (isSerial)
+    {
+        // Frame the packet just like the firmware does, and write it to the serial device
+        uint8_t frame[ESP_NOW_FRAME_MAX_ENCODED];
+        uint16_t frameLen = espNowFrameEncode(ourMac, (const uint8_t*)data, dataLen, frame);
+        if (frameLen == write(serialFd, frame, frameLen))
+        {
+            hostEspNowSendCb(bcastMac, ESP_NOW_SEND_SUCCESS);
+        }
+        else
+        {
+            hostEspNowSendCb(bcastMac, ESP_NOW_SEND_FAIL);
+        }
+        return;
+    }
+
     errno = 0;
     // Send the packet
-    int sentLen
-        = sendto(socketFd, espNowPacket, hdrLen + dataLen, 0, (struct sockaddr*)&broadcastAddr, sizeof(broadcastAddr));
+    int sentLen = sendto(socketFd, (const char*)espNowPacket, hdrLen + dataLen, 0, (struct sockaddr*)&broadcastAddr,
+                         sizeof(broadcastAddr));
     if (sentLen != (hdrLen + dataLen))
     {
         ESP_LOGE("WIFI", "sendto() sent a different number of bytes than expected: %d, not %d", sentLen,
@@ -262,8 +604,373 @@ void espNowSend(const char* data, uint8_t dataLen)
  */
 void deinitEspNow(void)
 {
+    if (linkImpaired)
+    {
+        ESP_LOGI("WIFI",
+                 "ESP-NOW link: %" PRIu32 " received, %" PRIu32 " lost, %" PRIu32 " duplicated, %" PRIu32
+                 " over capacity, %" PRIu16 " never delivered",
+                 linkStats.received, linkStats.lost, linkStats.duplicated, linkStats.overflowed, pendingHeapLen);
+    }
+
+    // Forget packets which were never delivered
+    pendingHeapLen = 0;
+
+    espNowUseWireless();
+
     close(socketFd);
 #if defined(USING_WINDOWS)
     WSACleanup();
 #endif
 }
+
+/**
+ * @brief Start capturing every ESP-NOW packet sent and received to a pcap file. Packets are written as the 802.11
+ * vendor specific action frames ESP-NOW sends, so Wireshark can dissect them. Received packets are captured when they
+ * are delivered to the mode, so packets lost by the simulated link aren't captured
+ *
+ * @param fname The name of the file to write
+ * @return true if the file was opened, false if it wasn't
+ */
+bool espNowOpenCapture(const char* fname)
+{
+    espNowCloseCapture();
+
+    pcapFile = fopen(fname, "wb");
+    if (NULL == pcapFile)
+    {
+        return false;
+    }
+
+    uint8_t hdr[24];
+    putLe32(&hdr[0], 0xA1B2C3D4);                // Magic, microsecond timestamps
+    putLe16(&hdr[4], 2);                         // Major version
+    putLe16(&hdr[6], 4);                         // Minor version
+    putLe32(&hdr[8], 0);                         // Time zone
+    putLe32(&hdr[12], 0);                        // Timestamp accuracy
+    putLe32(&hdr[16], 65535);                    // Snapshot length
+    putLe32(&hdr[20], PCAP_LINKTYPE_IEEE802_11); // Link type
+    fwrite(hdr, 1, sizeof(hdr), pcapFile);
+
+    pcapEpochUs = (int64_t)time(NULL) * 1000000 - esp_timer_get_time();
+    pcapSeq     = 0;
+    return true;
+}
+
+/**
+ * @brief Stop capturing ESP-NOW packets and close the capture file, if there is one
+ */
+void espNowCloseCapture(void)
+{
+    if (NULL != pcapFile)
+    {
+        fclose(pcapFile);
+        pcapFile = NULL;
+    }
+}
+
+/**
+ * @brief Simulate the link for a received packet. It may be lost, duplicated, delayed, or held back by the link's
+ * rate, and is then queued to be delivered
+ *
+ * @param mac The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ * @param nowUs The time the packet was received
+ */
+static void linkReceive(const uint8_t* mac, const uint8_t* data, uint8_t len, int64_t nowUs)
+{
+    linkStats.received++;
+
+    if (linkLost())
+    {
+        linkStats.lost++;
+        return;
+    }
+
+    int copies = 1;
+    if (emulatorArgs.espNowDup > 0 && linkRandPercent() < emulatorArgs.espNowDup)
+    {
+        linkStats.duplicated++;
+        copies = 2;
+    }
+
+    for (int i = 0; i < copies; i++)
+    {
+        int64_t deliverUs = nowUs;
+
+        if (emulatorArgs.espNowRate > 0)
+        {
+            // The link carries one packet at a time, so each packet waits for the ones before it
+            int64_t startUs = MAX(nowUs, linkBusyUntilUs);
+            if (startUs - nowUs > EMU_ESP_NOW_MAX_BACKLOG_US)
+            {
+                linkStats.overflowed++;
+                continue;
+            }
+            // Kilobits per second is bits per millisecond
+            linkBusyUntilUs = startUs + (int64_t)(len * 8 * 1000 / emulatorArgs.espNowRate);
+            deliverUs       = linkBusyUntilUs;
+        }
+
+        deliverUs += (int64_t)(emulatorArgs.espNowLatency * 1000);
+        if (emulatorArgs.espNowJitter > 0)
+        {
+            deliverUs += linkRand() % ((uint32_t)(emulatorArgs.espNowJitter * 1000) + 1);
+        }
+
+        if (!pendingPush(mac, data, len, deliverUs))
+        {
+            linkStats.overflowed++;
+        }
+    }
+}
+
+/**
+ * @brief Decide if the next received packet is lost.
+ *
+ * Losses are independent unless --espnow-burst is more than one. Then a two state model is used, where the link is
+ * either good or in a burst which loses every packet. Bursts last --espnow-burst packets on average, and start often
+ * enough that --espnow-loss percent of all packets are lost
+ *
+ * @return true if the packet is lost, false if it isn't
+ */
+static bool linkLost(void)
+{
+    float loss = emulatorArgs.espNowLoss / 100.0f;
+    if (loss <= 0)
+    {
+        return false;
+    }
+    else if (loss >= 1)
+    {
+        return true;
+    }
+    else if (emulatorArgs.espNowBurst <= 1)
+    {
+        return linkRandPercent() < emulatorArgs.espNowLoss;
+    }
+
+    float chance = linkRandPercent() / 100.0f;
+    if (linkInBurst)
+    {
+        linkInBurst = chance >= 1 / emulatorArgs.espNowBurst;
+    }
+    else
+    {
+        linkInBurst = chance < loss / (emulatorArgs.espNowBurst * (1 - loss));
+    }
+    return linkInBurst;
+}
+
+/**
+ * @brief Get a random number from the link's xorshift generator
+ *
+ * @return A random number
+ */
+static uint32_t linkRand(void)
+{
+    linkRandState ^= linkRandState << 13;
+    linkRandState ^= linkRandState >> 17;
+    linkRandState ^= linkRandState << 5;
+    return linkRandState;
+}
+
+/**
+ * @brief Get a random percentage from the link's generator
+ *
+ * @return A random number from 0 up to, but not including, 100
+ */
+static float linkRandPercent(void)
+{
+    return (linkRand() >> 8) * (100.0f / (1 << 24));
+}
+
+/**
+ * @brief Queue a received packet to be delivered later
+ *
+ * @param mac The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ * @param deliverUs When to deliver the packet
+ * @return true if the packet was queued, false if too many packets are waiting
+ */
+static bool pendingPush(const uint8_t* mac, const uint8_t* data, uint8_t len, int64_t deliverUs)
+{
+    if (0 == pendingFreeLen)
+    {
+        return false;
+    }
+
+    uint16_t pIdx           = pendingFree[--pendingFreeLen];
+    emuEspNowPending_t* pkt = &pendingPool[pIdx];
+    pkt->deliverUs          = deliverUs;
+    pkt->seq                = pendingSeq++;
+    pkt->len                = len;
+    memcpy(pkt->mac, mac, sizeof(pkt->mac));
+    memcpy(pkt->data, data, len);
+
+    // Sift the new packet up from the bottom of the heap
+    uint16_t idx = pendingHeapLen++;
+    while (idx > 0)
+    {
+        uint16_t parent = (idx - 1) / 2;
+        if (!pendingBefore(pIdx, pendingHeap[parent]))
+        {
+            break;
+        }
+        pendingHeap[idx] = pendingHeap[parent];
+        idx              = parent;
+    }
+    pendingHeap[idx] = pIdx;
+
+    uint32_t pendingBytes = pendingHeapLen * sizeof(emuEspNowPending_t);
+    if (pendingBytes > rxStats.highWater)
+    {
+        rxStats.highWater = pendingBytes;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the packet which should be delivered next
+ *
+ * @return The next packet, or NULL if none are waiting
+ */
+static emuEspNowPending_t* pendingPeek(void)
+{
+    return pendingHeapLen ? &pendingPool[pendingHeap[0]] : NULL;
+}
+
+/**
+ * @brief Remove the packet which should be delivered next from the queue
+ */
+static void pendingPop(void)
+{
+    pendingFree[pendingFreeLen++] = pendingHeap[0];
+    pendingHeap[0]                = pendingHeap[--pendingHeapLen];
+    pendingSiftDown(0);
+}
+
+/**
+ * @brief Check if one pending packet should be delivered before another. Packets with the same delivery time are
+ * delivered in the order they were queued
+ *
+ * @param a The index of a packet in ::pendingPool
+ * @param b The index of another packet in ::pendingPool
+ * @return true if a should be delivered first
+ */
+static bool pendingBefore(uint16_t a, uint16_t b)
+{
+    if (pendingPool[a].deliverUs != pendingPool[b].deliverUs)
+    {
+        return pendingPool[a].deliverUs < pendingPool[b].deliverUs;
+    }
+    return (int32_t)(pendingPool[a].seq - pendingPool[b].seq) < 0;
+}
+
+/**
+ * @brief Move a packet toward the bottom of the heap until its children are delivered after it
+ *
+ * @param idx The position in ::pendingHeap of the packet to move
+ */
+static void pendingSiftDown(uint16_t idx)
+{
+    while (true)
+    {
+        uint16_t first = idx;
+        uint16_t left  = 2 * idx + 1;
+        uint16_t right = left + 1;
+        if (left < pendingHeapLen && pendingBefore(pendingHeap[left], pendingHeap[first]))
+        {
+            first = left;
+        }
+        if (right < pendingHeapLen && pendingBefore(pendingHeap[right], pendingHeap[first]))
+        {
+            first = right;
+        }
+        if (first == idx)
+        {
+            return;
+        }
+
+        uint16_t tmp       = pendingHeap[idx];
+        pendingHeap[idx]   = pendingHeap[first];
+        pendingHeap[first] = tmp;
+        idx                = first;
+    }
+}
+
+/**
+ * @brief Write a packet to the capture file, if there is one, as an ESP-NOW vendor specific action frame
+ *
+ * @param src The sender's MAC address
+ * @param data The payload
+ * @param len The length of the payload
+ */
+static void pcapWrite(const uint8_t* src, const uint8_t* data, uint8_t len)
+{
+    if (NULL == pcapFile)
+    {
+        return;
+    }
+
+    static const uint8_t espressifOui[] = {0x18, 0xFE, 0x34};
+    static const uint8_t bcastMac[]     = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+    int64_t tUs       = pcapEpochUs + esp_timer_get_time();
+    uint32_t frameLen = PCAP_ESP_NOW_HDR_LEN + len;
+    uint8_t hdr[16 + PCAP_ESP_NOW_HDR_LEN];
+    uint8_t* frame = &hdr[16];
+
+    // Record header
+    putLe32(&hdr[0], tUs / 1000000);
+    putLe32(&hdr[4], tUs % 1000000);
+    putLe32(&hdr[8], frameLen);
+    putLe32(&hdr[12], frameLen);
+
+    // 802.11 management frame header
+    frame[0] = 0xD0; // Action frame
+    frame[1] = 0x00; // Flags
+    putLe16(&frame[2], 0);
+    memcpy(&frame[4], bcastMac, 6);
+    memcpy(&frame[10], src, 6);
+    memcpy(&frame[16], bcastMac, 6);
+    putLe16(&frame[22], (pcapSeq++ & 0x0FFF) << 4);
+
+    // Vendor specific action, with the ESP-NOW element
+    frame[24] = 127; // Vendor specific category
+    memcpy(&frame[25], espressifOui, 3);
+    putLe32(&frame[28], 0); // Random values
+    frame[32] = 221;        // Vendor specific element
+    frame[33] = 5 + len;    // Element length
+    memcpy(&frame[34], espressifOui, 3);
+    frame[37] = 4; // ESP-NOW type
+    frame[38] = 1; // ESP-NOW version
+
+    fwrite(hdr, 1, sizeof(hdr), pcapFile);
+    fwrite(data, 1, len, pcapFile);
+}
+
+/**
+ * @brief Write a 16-bit value in little-endian order
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe16(uint8_t* out, uint16_t val)
+{
+    out[0] = val & 0xFF;
+    out[1] = (val >> 8) & 0xFF;
+}
+
+/**
+ * @brief Write a 32-bit value in little-endian order
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe32(uint8_t* out, uint32_t val)
+{
+    putLe16(out, val & 0xFFFF);
+    putLe16(out + 2, val >> 16);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool espNowOpenCapture(const char* fname);
+void espNowCloseCapture(void);
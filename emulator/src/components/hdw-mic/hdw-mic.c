@@ -2,9 +2,17 @@
 // Includes
 //==============================================================================
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
 #include "hdw-mic.h"
 #include "hdw-mic_emu.h"
 #include "emu_main.h"
+#include "esp_timer_emu.h"
+#include "macros.h"
 
 //==============================================================================
 // Defines
@@ -12,6 +20,47 @@
 
 #define SSBUF 8192
 
+/// @brief The amplitude of synthetic microphone sources, half of full scale
+#define SYNTH_AMPLITUDE 16384
+
+/// @brief The maximum number of notes in a synthetic chord
+#define MAX_CHORD_NOTES 8
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/// @brief The kinds of microphone sources which can replace the audio device
+typedef enum
+{
+    MIC_SRC_NONE,  ///< Samples come from the audio device
+    MIC_SRC_FILE,  ///< Samples come from a WAV or raw PCM file, which is loaded into memory
+    MIC_SRC_SINE,  ///< A sine wave at a fixed frequency
+    MIC_SRC_SWEEP, ///< A sine wave which sweeps exponentially between two frequencies
+    MIC_SRC_CHORD, ///< Several sine waves added together
+    MIC_SRC_NOISE, ///< White noise
+} micSourceType_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/// @brief A source of microphone samples which is advanced in step with the emulator's clock
+typedef struct
+{
+    micSourceType_t type;           ///< The kind of source
+    bool loop;                      ///< Whether to start over when the source ends, rather than play silence
+    int16_t* samples;               ///< For ::MIC_SRC_FILE, the file's samples converted to ::ADC_SAMPLE_RATE_HZ
+    uint32_t numSamples;            ///< The number of samples in a file, or in one sweep
+    uint32_t pos;                   ///< The number of samples played since the source started or looped
+    bool ended;                     ///< Whether the source ended and is playing silence
+    double freqs[MAX_CHORD_NOTES];  ///< The frequencies of the notes, or the start and end of a sweep, in Hz
+    double phases[MAX_CHORD_NOTES]; ///< The phase of each note, in cycles
+    int numFreqs;                   ///< The number of frequencies in \c freqs
+    uint32_t noiseState;            ///< The state of the noise generator, seeded so runs are reproducible
+    uint64_t sampleAccum;           ///< The remainder of elapsed time which didn't add up to a whole sample
+} micSource_t;
+
 //==============================================================================
 // Variables
 //==============================================================================
@@ -22,6 +71,18 @@ static int sshead               = 0;
 static int sstail               = 0;
 static bool adcSampling         = false;
 
+/// @brief The source which replaces the audio device's input, if any
+static micSource_t micSource = {0};
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void micPushSample(int16_t sample);
+static int16_t micSourceNextSample(void);
+static bool loadWavFile(const char* fname, const uint8_t* data, size_t len);
+static bool parseFrequencies(const char* str, char sep, double* freqs, int maxFreqs, int* numFreqs);
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -92,6 +153,12 @@ void deinitMic(void)
  */
 void micHandleSoundInput(short* in, int framesr, short numChannels)
 {
+    // A microphone source replaces the audio device's input
+    if (MIC_SRC_NONE != micSource.type)
+    {
+        return;
+    }
+
     // If there are samples to read
     if (adcSampling && framesr)
     {
@@ -137,3 +204,410 @@ void micHandleSoundInput(short* in, int framesr, short numChannels)
         }
     }
 }
+
+/**
+ * @brief Replace the audio device's input with samples from a file or a synthetic source. The source is advanced by
+ * micHandleVirtualInput() in step with the emulator's clock, so it plays back identically at any speed.
+ *
+ * \c spec may be one of:
+ * - \c sine:FREQ A sine wave at FREQ Hz
+ * - \c sweep:FROM:TO:SECONDS A sine wave which sweeps exponentially from FROM Hz to TO Hz over SECONDS seconds
+ * - \c chord:FREQ,FREQ,... Up to ::MAX_CHORD_NOTES sine waves added together
+ * - \c noise White noise
+ * - The name of a \c .wav file with 8, 16, 24, or 32 bit PCM samples, at any sample rate and with any number of
+ *   channels. Channels are mixed together and the samples are resampled to ::ADC_SAMPLE_RATE_HZ
+ * - The name of any other file, which is read as raw signed 16 bit little-endian mono samples at
+ *   ::ADC_SAMPLE_RATE_HZ
+ *
+ * @param spec The source to use, as described above
+ * @param loop true to start the source over when it ends, false to play silence after it ends
+ * @return true if the source was opened, false if it was invalid or the file couldn't be read
+ */
+bool micOpenSource(const char* spec, bool loop)
+{
+    micCloseSource();
+
+    micSource_t src = {
+        .loop       = loop,
+        .noiseState = 0x2545F491,
+    };
+
+    if (0 == strncmp(spec, "sine:", 5))
+    {
+        src.type = MIC_SRC_SINE;
+        if (!parseFrequencies(spec + 5, '\0', src.freqs, 1, &src.numFreqs))
+        {
+            return false;
+        }
+    }
+    else if (0 == strncmp(spec, "sweep:", 6))
+    {
+        src.type = MIC_SRC_SWEEP;
+
+        // The frequencies are separated by colons, and the last number is the length instead
+        double args[3];
+        int numArgs;
+        if (!parseFrequencies(spec + 6, ':', args, ARRAY_SIZE(args), &numArgs) || 3 != numArgs)
+        {
+            return false;
+        }
+        src.freqs[0]   = args[0];
+        src.freqs[1]   = args[1];
+        src.numFreqs   = 2;
+        src.numSamples = args[2] * ADC_SAMPLE_RATE_HZ;
+        if (0 == src.numSamples)
+        {
+            return false;
+        }
+    }
+    else if (0 == strncmp(spec, "chord:", 6))
+    {
+        src.type = MIC_SRC_CHORD;
+        if (!parseFrequencies(spec + 6, ',', src.freqs, MAX_CHORD_NOTES, &src.numFreqs))
+        {
+            return false;
+        }
+    }
+    else if (0 == strcmp(spec, "noise"))
+    {
+        src.type = MIC_SRC_NOISE;
+    }
+    else
+    {
+        src.type = MIC_SRC_FILE;
+
+        FILE* file = fopen(spec, "rb");
+        if (NULL == file)
+        {
+            return false;
+        }
+
+        fseek(file, 0, SEEK_END);
+        long len = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        uint8_t* data = malloc(len > 0 ? len : 1);
+        bool read     = (len >= 0) && (NULL != data) && ((size_t)len == fread(data, 1, len, file));
+        fclose(file);
+
+        if (!read)
+        {
+            free(data);
+            return false;
+        }
+
+        micSource = src;
+
+        const char* ext = strrchr(spec, '.');
+        if (NULL != ext && 0 == strcasecmp(ext, ".wav"))
+        {
+            if (!loadWavFile(spec, data, len))
+            {
+                free(data);
+                micCloseSource();
+                return false;
+            }
+        }
+        else
+        {
+            // Raw samples, signed 16 bit little-endian
+            micSource.numSamples = len / 2;
+            micSource.samples    = malloc(sizeof(int16_t) * (micSource.numSamples ? micSource.numSamples : 1));
+            for (uint32_t i = 0; i < micSource.numSamples && NULL != micSource.samples; i++)
+            {
+                micSource.samples[i] = (int16_t)(data[2 * i] | (data[2 * i + 1] << 8));
+            }
+        }
+        free(data);
+
+        if (NULL == micSource.samples || 0 == micSource.numSamples)
+        {
+            micCloseSource();
+            return false;
+        }
+        return true;
+    }
+
+    micSource = src;
+    return true;
+}
+
+/**
+ * @brief Stop using a microphone source and go back to the audio device's input
+ */
+void micCloseSource(void)
+{
+    free(micSource.samples);
+    memset(&micSource, 0, sizeof(micSource));
+}
+
+/**
+ * @brief Add samples from the microphone source for the time that passed on the emulator's clock. This does nothing
+ * if there is no microphone source.
+ *
+ * Samples are generated even while the microphone isn't sampling, like a real microphone, but they are only written to
+ * the sample buffer while it is.
+ *
+ * @param elapsedUs The time since this was last called, in microseconds
+ */
+void micHandleVirtualInput(int64_t elapsedUs)
+{
+    if (MIC_SRC_NONE == micSource.type || emuTimerIsPaused() || elapsedUs <= 0)
+    {
+        return;
+    }
+
+    // Carry the remainder between calls so no samples are lost to rounding
+    micSource.sampleAccum += (uint64_t)elapsedUs * ADC_SAMPLE_RATE_HZ;
+    uint64_t numSamples = micSource.sampleAccum / 1000000;
+    micSource.sampleAccum -= numSamples * 1000000;
+
+    while (numSamples--)
+    {
+        int16_t sample = micSourceNextSample();
+        if (adcSampling)
+        {
+            micPushSample(sample);
+        }
+    }
+}
+
+/**
+ * @brief Write a sample to the circular sample buffer as a 12-bit ADC reading, or drop it if the buffer is full
+ *
+ * @param sample The signed 16-bit sample to write
+ */
+static void micPushSample(int16_t sample)
+{
+    if (sstail != ((sshead + 1) % SSBUF))
+    {
+        ssamples[sshead] = (sample + 32768) >> 4;
+        sshead           = (sshead + 1) % SSBUF;
+    }
+}
+
+/**
+ * @brief Generate the next sample from the microphone source and advance it
+ *
+ * @return The next signed 16-bit sample
+ */
+static int16_t micSourceNextSample(void)
+{
+    if (micSource.ended)
+    {
+        return 0;
+    }
+
+    double value = 0;
+    switch (micSource.type)
+    {
+        case MIC_SRC_FILE:
+        {
+            value = micSource.samples[micSource.pos];
+            break;
+        }
+        case MIC_SRC_SINE:
+        case MIC_SRC_CHORD:
+        {
+            for (int i = 0; i < micSource.numFreqs; i++)
+            {
+                value += sin(2 * M_PI * micSource.phases[i]);
+                micSource.phases[i] += micSource.freqs[i] / ADC_SAMPLE_RATE_HZ;
+                micSource.phases[i] -= floor(micSource.phases[i]);
+            }
+            value *= SYNTH_AMPLITUDE / (double)micSource.numFreqs;
+            break;
+        }
+        case MIC_SRC_SWEEP:
+        {
+            // Exponential, so each octave takes the same amount of time
+            double freq = micSource.freqs[0]
+                          * pow(micSource.freqs[1] / micSource.freqs[0], micSource.pos / (double)micSource.numSamples);
+            value = SYNTH_AMPLITUDE * sin(2 * M_PI * micSource.phases[0]);
+            micSource.phases[0] += freq / ADC_SAMPLE_RATE_HZ;
+            micSource.phases[0] -= floor(micSource.phases[0]);
+            break;
+        }
+        case MIC_SRC_NOISE:
+        {
+            // xorshift32, so noise doesn't use or disturb the Swadge's random numbers
+            micSource.noiseState ^= micSource.noiseState << 13;
+            micSource.noiseState ^= micSource.noiseState >> 17;
+            micSource.noiseState ^= micSource.noiseState << 5;
+            value = (int32_t)(micSource.noiseState & 0xFFFF) - 32768;
+            value = value * SYNTH_AMPLITUDE / 32768;
+            break;
+        }
+        case MIC_SRC_NONE:
+        default:
+        {
+            return 0;
+        }
+    }
+
+    // Files and sweeps have an end, where they either start over or go silent
+    micSource.pos++;
+    if ((MIC_SRC_FILE == micSource.type || MIC_SRC_SWEEP == micSource.type) && micSource.pos >= micSource.numSamples)
+    {
+        micSource.pos       = 0;
+        micSource.phases[0] = 0;
+        if (!micSource.loop)
+        {
+            micSource.ended = true;
+            printf("Microphone source ended\n");
+        }
+    }
+
+    return CLAMP(value, INT16_MIN, INT16_MAX);
+}
+
+/**
+ * @brief Read a little-endian integer of up to four bytes
+ *
+ * @param data The bytes to read
+ * @param len The number of bytes to read
+ * @return The value
+ */
+static uint32_t getLe(const uint8_t* data, int len)
+{
+    uint32_t val = 0;
+    for (int i = len - 1; i >= 0; i--)
+    {
+        val = (val << 8) | data[i];
+    }
+    return val;
+}
+
+/**
+ * @brief Load the samples from a PCM WAV file into the microphone source, mixed down to mono and resampled to
+ * ::ADC_SAMPLE_RATE_HZ
+ *
+ * @param fname The name of the file, for error messages
+ * @param data The contents of the file
+ * @param len The length of \c data
+ * @return true if the samples were loaded, false if the file isn't a supported WAV file
+ */
+static bool loadWavFile(const char* fname, const uint8_t* data, size_t len)
+{
+    if (len < 12 || 0 != memcmp(data, "RIFF", 4) || 0 != memcmp(data + 8, "WAVE", 4))
+    {
+        printf("ERR: %s is not a WAV file\n", fname);
+        return false;
+    }
+
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t rate      = 0;
+    const uint8_t* pcm = NULL;
+    uint32_t pcmLen    = 0;
+    size_t off         = 12;
+
+    // Find the format and data chunks
+    while (off + 8 <= len)
+    {
+        uint32_t chunkLen    = getLe(data + off + 4, 4);
+        const uint8_t* chunk = data + off + 8;
+        chunkLen             = MIN(chunkLen, len - off - 8);
+
+        if (0 == memcmp(data + off, "fmt ", 4) && chunkLen >= 16)
+        {
+            format   = getLe(chunk, 2);
+            channels = getLe(chunk + 2, 2);
+            rate     = getLe(chunk + 4, 4);
+            bits     = getLe(chunk + 14, 2);
+        }
+        else if (0 == memcmp(data + off, "data", 4))
+        {
+            pcm    = chunk;
+            pcmLen = chunkLen;
+        }
+
+        // Chunks are padded to an even length
+        off += 8 + chunkLen + (chunkLen & 1);
+    }
+
+    // 0xFFFE is WAVE_FORMAT_EXTENSIBLE, which is used for PCM with more than 16 bits
+    if ((1 != format && 0xFFFE != format) || 0 == channels || 0 == rate || 0 != bits % 8 || bits < 8 || bits > 32
+        || NULL == pcm)
+    {
+        printf("ERR: %s must be a PCM WAV file with 8, 16, 24, or 32 bit samples\n", fname);
+        return false;
+    }
+
+    int bytesPerSamp     = bits / 8;
+    uint32_t numFrames   = pcmLen / (bytesPerSamp * channels);
+    uint32_t numSamples  = ((uint64_t)numFrames * ADC_SAMPLE_RATE_HZ) / rate;
+    micSource.samples    = malloc(sizeof(int16_t) * (numSamples ? numSamples : 1));
+    micSource.numSamples = numSamples;
+    if (NULL == micSource.samples || 0 == numSamples)
+    {
+        return false;
+    }
+
+    // Resample with linear interpolation between the two nearest source frames
+    for (uint32_t i = 0; i < numSamples; i++)
+    {
+        double srcPos = (double)i * rate / ADC_SAMPLE_RATE_HZ;
+        uint32_t f0   = srcPos;
+        uint32_t f1   = MIN(f0 + 1, numFrames - 1);
+        double frac   = srcPos - f0;
+
+        double mix[2]      = {0};
+        uint32_t frames[2] = {f0, f1};
+        for (int f = 0; f < 2; f++)
+        {
+            for (int c = 0; c < channels; c++)
+            {
+                const uint8_t* samp = pcm + ((size_t)frames[f] * channels + c) * bytesPerSamp;
+                int32_t val;
+                if (8 == bits)
+                {
+                    // 8 bit WAV samples are unsigned
+                    val = (samp[0] - 128) << 8;
+                }
+                else
+                {
+                    // Keep the top 16 bits, sign extended
+                    val = (int16_t)getLe(samp + bytesPerSamp - 2, 2);
+                }
+                mix[f] += val;
+            }
+        }
+        micSource.samples[i] = ((mix[0] * (1 - frac)) + (mix[1] * frac)) / channels;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a list of positive numbers separated by a character
+ *
+ * @param str The string to parse
+ * @param sep The character between numbers, or '\0' if there is only one number
+ * @param freqs [out] The numbers which were parsed
+ * @param maxFreqs The maximum number of numbers to parse
+ * @param numFreqs [out] The number of numbers which were parsed
+ * @return true if the string was a list of positive numbers, false if it wasn't or there were too many
+ */
+static bool parseFrequencies(const char* str, char sep, double* freqs, int maxFreqs, int* numFreqs)
+{
+    *numFreqs = 0;
+    while (true)
+    {
+        char* end = NULL;
+        double f  = strtod(str, &end);
+        if (end == str || f <= 0 || *numFreqs >= maxFreqs)
+        {
+            return false;
+        }
+        freqs[(*numFreqs)++] = f;
+
+        if ('\0' == *end)
+        {
+            return true;
+        }
+        else if (sep != *end)
+        {
+            return false;
+        }
+        str = end + 1;
+    }
+}
@@ -1,3 +1,9 @@
 #pragma once
 
-void micHandleSoundInput(short* in, int framesr, short numChannels);
\ No newline at end of file
+#include <stdbool.h>
+#include <stdint.h>
+
+void micHandleSoundInput(short* in, int framesr, short numChannels);
+bool micOpenSource(const char* spec, bool loop);
+void micCloseSource(void);
+void micHandleVirtualInput(int64_t elapsedUs);
@@ -12,9 +12,12 @@
 #include <math.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
 
 #include "hdw-nvs.h"
+#include "hdw-nvs_emu.h"
 #include "cJSON.h"
+#include "hashMap.h"
 #include "emu_main.h"
 #include "emu_utils.h"
 
@@ -29,10 +32,28 @@
 #define NVS_ENTRY_BYTES      32
 #define NVS_OVERHEAD_ENTRIES 12
 
+// Writes are batched, and written to the file once they stop for this long
+#define NVS_FLUSH_QUIET_US 500000
+// Writes which keep happening are still written to the file this often
+#define NVS_FLUSH_MAX_DELAY_US 5000000
+
 #ifdef EMU_WINDOWS
     #include <direct.h>
 #endif
 
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A namespace of the in-memory NVS, with an index of its keys
+ */
+typedef struct
+{
+    cJSON* json;    ///< The JSON object which holds this namespace's values
+    hashMap_t keys; ///< Maps each key name to its item in \c json
+} nvsNamespace_t;
+
 //==============================================================================
 // Function Prototypes
 //==============================================================================
@@ -41,6 +62,16 @@ static char* blobToStr(const void* value, size_t length);
 static int hexCharToInt(char c);
 static void strToBlob(char* str, void* outBlob, size_t blobLen);
 static FILE* openNvsFile(const char* mode);
+static int64_t nvsNowUs(void);
+static bool nvsLoad(void);
+static void nvsUnload(void);
+static void nvsIndexAll(void);
+static nvsNamespace_t* nvsIndexNamespace(cJSON* jsonNs);
+static nvsNamespace_t* nvsGetNamespace(const char* namespace, bool create);
+static cJSON* nvsGetItem(const char* namespace, const char* key);
+static bool nvsSetItem(const char* namespace, const char* key, cJSON* item);
+static void nvsMarkDirty(void);
+static void nvsAtExit(void);
 
 //==============================================================================
 // Constants
@@ -63,6 +94,24 @@ static const char* defaultNvsFiles[] = {
 //==============================================================================
 static const char** nvsFileName = defaultNvsFiles;
 
+/// @brief The whole NVS, parsed from the file, or NULL if it hasn't been loaded yet
+static cJSON* nvsJson = NULL;
+
+/// @brief Maps each namespace name to its ::nvsNamespace_t
+static hashMap_t nvsNamespaces;
+
+/// @brief true to keep NVS in memory and never touch the file
+static bool nvsMemoryOnly = false;
+
+/// @brief true if there are writes which haven't been written to the file yet
+static bool nvsDirty = false;
+
+/// @brief The real time of the first and last writes since the file was written
+static int64_t nvsFirstDirtyUs = 0;
+static int64_t nvsLastDirtyUs  = 0;
+
+static bool nvsAtExitRegistered = false;
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -76,6 +125,19 @@ static const char** nvsFileName = defaultNvsFiles;
  */
 bool initNvs(bool firstTry)
 {
+    // Write any pending changes however the emulator exits
+    if (!nvsAtExitRegistered)
+    {
+        atexit(nvsAtExit);
+        nvsAtExitRegistered = true;
+    }
+
+    if (nvsMemoryOnly)
+    {
+        printf("Using in-memory NVS\n");
+        return nvsLoad();
+    }
+
     const char** curFile;
     for (curFile = defaultNvsFiles; curFile < (defaultNvsFiles + (sizeof(defaultNvsFiles) / sizeof(*defaultNvsFiles)));
          curFile++)
@@ -119,7 +181,7 @@ bool initNvs(bool firstTry)
                         fclose(nvsFile);
                         nvsFileName = curFile;
                         printf("Using NVS file %s\n", *nvsFileName);
-                        return true;
+                        return nvsLoad();
                     }
                     else
                     {
@@ -134,7 +196,7 @@ bool initNvs(bool firstTry)
             // File exists
             nvsFileName = curFile;
             printf("Using NVS file %s\n", *nvsFileName);
-            return true;
+            return nvsLoad();
         }
 
         printf("Could not load NVS file %s\n", *curFile);
@@ -144,13 +206,15 @@ bool initNvs(bool firstTry)
 }
 
 /**
- * @brief Deinitialize NVS
+ * @brief Deinitialize NVS, writing any pending changes to the file
  *
  * @return true
  */
 bool deinitNvs(void)
 {
-    return true; // Nothing to do
+    emuNvsFlush();
+    nvsUnload();
+    return true;
 }
 
 /**
@@ -160,6 +224,14 @@ bool deinitNvs(void)
  */
 bool eraseNvs(void)
 {
+    // Forget everything in memory, including changes which weren't written yet
+    nvsUnload();
+
+    if (nvsMemoryOnly)
+    {
+        return initNvs(true);
+    }
+
     // Check if the json file exists
     if (access(NVS_JSON_FILE, F_OK) != 0)
     {
@@ -215,66 +287,11 @@ bool writeNvs32(const char* key, int32_t val)
  */
 bool readNamespaceNvs32(const char* namespace, const char* key, int32_t* outVal)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    cJSON* item = nvsGetItem(namespace, key);
+    if (NULL != item)
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        if (fsize == 0)
-        {
-            fclose(nvsFile);
-            return false;
-        }
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-            cJSON* jsonIter;
-
-            if (!json)
-            {
-                return false;
-            }
-
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-
-            if (cJSON_IsObject(jsonNs))
-            {
-                // Find the requested key
-                char* current_key = NULL;
-                cJSON_ArrayForEach(jsonIter, jsonNs)
-                {
-                    current_key = jsonIter->string;
-                    if (current_key != NULL)
-                    {
-                        // If the key matches
-                        if (0 == strcmp(current_key, key))
-                        {
-                            // Return the value
-                            *outVal = (int32_t)cJSON_GetNumberValue(jsonIter);
-                            cJSON_Delete(json);
-                            return true;
-                        }
-                    }
-                }
-            }
-            cJSON_Delete(json);
-        }
-        else
-        {
-            fclose(nvsFile);
-        }
+        *outVal = (int32_t)cJSON_GetNumberValue(item);
+        return true;
     }
     return false;
 }
@@ -289,84 +306,22 @@ bool readNamespaceNvs32(const char* namespace, const char* key, int32_t* outVal)
  */
 bool writeNamespaceNvs32(const char* namespace, const char* key, int32_t val)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    cJSON* item = nvsGetItem(namespace, key);
+    if (cJSON_IsNumber(item))
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-
-            if (NULL == jsonNs)
-            {
-                jsonNs = cJSON_CreateObject();
-                cJSON_AddItemToObject(json, namespace, jsonNs);
-            }
-
-            // Check if the key alredy exists
-            cJSON* jsonIter;
-            bool keyExists = false;
-            cJSON_ArrayForEach(jsonIter, jsonNs)
-            {
-                if (0 == strcmp(jsonIter->string, key))
-                {
-                    keyExists = true;
-                }
-            }
-
-            // Add or replace the item
-            cJSON* jsonVal = cJSON_CreateNumber(val);
-            if (keyExists)
-            {
-                cJSON_ReplaceItemInObject(jsonNs, key, jsonVal);
-            }
-            else
-            {
-                cJSON_AddItemToObject(jsonNs, key, jsonVal);
-            }
-
-            // Write the new JSON back to the file
-            FILE* nvsFileW = openNvsFile("wb");
-            if (NULL != nvsFileW)
-            {
-                char* jsonStr = cJSON_Print(json);
-                fprintf(nvsFileW, "%s", jsonStr);
-                fclose(nvsFileW);
-
-                free(jsonStr);
-                cJSON_Delete(json);
-
-                return true;
-            }
-            else
-            {
-                // Couldn't open file to write
-            }
-            cJSON_Delete(json);
-        }
-        else
+        // Modes often write the same value repeatedly, which doesn't need to touch the file
+        if (item->valuedouble != val)
         {
-            // Couldn't read file
-            fclose(nvsFile);
+            cJSON_SetNumberValue(item, val);
+            nvsMarkDirty();
         }
+        return true;
     }
-    else
+
+    if (nvsSetItem(namespace, key, cJSON_CreateNumber(val)))
     {
-        // couldn't open file to read
+        nvsMarkDirty();
+        return true;
     }
     return false;
 }
@@ -385,68 +340,23 @@ bool writeNamespaceNvs32(const char* namespace, const char* key, int32_t val)
  */
 bool readNamespaceNvsBlob(const char* namespace, const char* key, void* out_value, size_t* length)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    char* strBlob = cJSON_GetStringValue(nvsGetItem(namespace, key));
+    if (NULL == strBlob)
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-            cJSON* jsonIter;
-
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-
-            if (NULL != jsonNs && cJSON_IsObject(jsonNs))
-            {
-                // Find the requested key
-                char* current_key = NULL;
-                cJSON_ArrayForEach(jsonIter, jsonNs)
-                {
-                    current_key = jsonIter->string;
-                    if (current_key != NULL)
-                    {
-                        // If the key matches
-                        if (0 == strcmp(current_key, key))
-                        {
-                            // Return the value
-                            char* strBlob = cJSON_GetStringValue(jsonIter);
+        return false;
+    }
 
-                            if (out_value != NULL)
-                            {
-                                // The call to read, using returned length
-                                strToBlob(strBlob, out_value, *length);
-                            }
-                            else
-                            {
-                                // The call to get length of blob
-                                *length = strlen(strBlob) / 2;
-                            }
-                            cJSON_Delete(json);
-                            return true;
-                        }
-                    }
-                }
-            }
-            cJSON_Delete(json);
-        }
-        else
-        {
-            fclose(nvsFile);
-        }
+    if (out_value != NULL)
+    {
+        // The call to read, using returned length
+        strToBlob(strBlob, out_value, *length);
     }
-    return false;
+    else
+    {
+        // The call to get length of blob
+        *length = strlen(strBlob) / 2;
+    }
+    return true;
 }
 
 /**
@@ -460,86 +370,22 @@ bool readNamespaceNvsBlob(const char* namespace, const char* key, void* out_valu
  */
 bool writeNamespaceNvsBlob(const char* namespace, const char* key, const void* value, size_t length)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
-    {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-
-            if (NULL == jsonNs)
-            {
-                jsonNs = cJSON_CreateObject();
-                cJSON_AddItemToObject(json, namespace, jsonNs);
-            }
-
-            // Check if the key alredy exists
-            cJSON* jsonIter;
-            bool keyExists = false;
-            cJSON_ArrayForEach(jsonIter, jsonNs)
-            {
-                if (0 == strcmp(jsonIter->string, key))
-                {
-                    keyExists = true;
-                }
-            }
-
-            // Add or replace the item
-            char* blobStr  = blobToStr(value, length);
-            cJSON* jsonVal = cJSON_CreateString(blobStr);
-            free(blobStr);
-            if (keyExists)
-            {
-                cJSON_ReplaceItemInObject(jsonNs, key, jsonVal);
-            }
-            else
-            {
-                cJSON_AddItemToObject(jsonNs, key, jsonVal);
-            }
-
-            // Write the new JSON back to the file
-            FILE* nvsFileW = openNvsFile("wb");
-            if (NULL != nvsFileW)
-            {
-                char* jsonStr = cJSON_Print(json);
-                fprintf(nvsFileW, "%s", jsonStr);
-                fclose(nvsFileW);
-
-                free(jsonStr);
-                cJSON_Delete(json);
+    char* blobStr = blobToStr(value, length);
 
-                return true;
-            }
-            else
-            {
-                // Couldn't open file to write
-            }
-            cJSON_Delete(json);
-        }
-        else
-        {
-            // Couldn't read file
-            fclose(nvsFile);
-        }
+    // Don't touch the file if the blob didn't change
+    char* oldStr = cJSON_GetStringValue(nvsGetItem(namespace, key));
+    if (NULL != oldStr && 0 == strcmp(oldStr, blobStr))
+    {
+        free(blobStr);
+        return true;
     }
-    else
+
+    cJSON* jsonVal = cJSON_CreateString(blobStr);
+    free(blobStr);
+    if (nvsSetItem(namespace, key, jsonVal))
     {
-        // couldn't open file to read
+        nvsMarkDirty();
+        return true;
     }
     return false;
 }
@@ -593,79 +439,22 @@ bool eraseNvsKey(const char* key)
  */
 bool eraseNamespaceNvsKey(const char* namespace, const char* key)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    nvsNamespace_t* ns = nvsGetNamespace(namespace, false);
+    if (NULL == ns)
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-
-            // Check if the key exists
-            cJSON* jsonIter;
-            bool keyExists = false;
-
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-
-            if (NULL != jsonNs)
-            {
-                cJSON_ArrayForEach(jsonIter, jsonNs)
-                {
-                    if (0 == strcmp(jsonIter->string, key))
-                    {
-                        keyExists = true;
-                    }
-                }
-            }
-
-            // Remove the key if it exists
-            if (keyExists)
-            {
-                cJSON_DeleteItemFromObject(jsonNs, key);
-            }
-
-            // Write the new JSON back to the file
-            FILE* nvsFileW = openNvsFile("wb");
-            if (NULL != nvsFileW)
-            {
-                char* jsonStr = cJSON_Print(json);
-                fprintf(nvsFileW, "%s", jsonStr);
-                fclose(nvsFileW);
-
-                free(jsonStr);
-                cJSON_Delete(json);
-
-                return keyExists;
-            }
-            else
-            {
-                // Couldn't open file to write
-            }
-            cJSON_Delete(json);
-        }
-        else
-        {
-            // Couldn't read file
-            fclose(nvsFile);
-        }
+        return false;
     }
-    else
+
+    // Remove the key from the index before the item which owns its name is deleted
+    cJSON* item = hashRemove(&ns->keys, key);
+    if (NULL == item)
     {
-        // couldn't open file to read
+        return false;
     }
-    return false;
+
+    cJSON_Delete(cJSON_DetachItemViaPointer(ns->json, item));
+    nvsMarkDirty();
+    return true;
 }
 
 /**
@@ -677,93 +466,71 @@ bool eraseNamespaceNvsKey(const char* namespace, const char* key)
  */
 bool readNvsStats(nvs_stats_t* outStats)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    if (!nvsLoad())
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
+        return false;
+    }
 
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-            cJSON* jsonIter;
-            cJSON* namespace;
+    cJSON* jsonIter;
+    cJSON* namespace;
 
-            cJSON_ArrayForEach(namespace, json)
+    cJSON_ArrayForEach(namespace, nvsJson)
+    {
+        // 1 entry is always used by each namespace, and there should only ever be 1 namespace
+        outStats->used_entries++;
+        // TODO: I just checked a Swadge and it said it was using 5 namespaces. Why?
+        outStats->namespace_count++;
+        /**
+         * When running readNvsStats() on an actual Swadge, the total NVS
+         * size is displayed as 12 entries less than the partition size.
+         *
+         * It's unknown if this is a percentage of total size,
+         * or a fixed number of overhead/control entries.
+         * I'm assuming it's a fixed number here.
+         */
+        outStats->total_entries = NVS_PARTITION_SIZE / NVS_ENTRY_BYTES - NVS_OVERHEAD_ENTRIES;
+
+        cJSON_ArrayForEach(jsonIter, namespace)
+        {
+            if (jsonIter->string != NULL)
             {
-                // 1 entry is always used by each namespace, and there should only ever be 1 namespace
-                outStats->used_entries++;
-                // TODO: I just checked a Swadge and it said it was using 5 namespaces. Why?
-                outStats->namespace_count++;
-                /**
-                 * When running readNvsStats() on an actual Swadge, the total NVS
-                 * size is displayed as 12 entries less than the partition size.
-                 *
-                 * It's unknown if this is a percentage of total size,
-                 * or a fixed number of overhead/control entries.
-                 * I'm assuming it's a fixed number here.
-                 */
-                outStats->total_entries = NVS_PARTITION_SIZE / NVS_ENTRY_BYTES - NVS_OVERHEAD_ENTRIES;
-
-                cJSON_ArrayForEach(jsonIter, namespace)
+                switch (jsonIter->type)
                 {
-                    if (jsonIter->string != NULL)
+                    case cJSON_Number:
                     {
-                        switch (jsonIter->type)
-                        {
-                            case cJSON_Number:
-                            {
-                                outStats->used_entries += 1;
-                                break;
-                            }
-                            case cJSON_String:
-                            {
-                                char* strBlob = cJSON_GetStringValue(jsonIter);
-
-                                /**
-                                 * Get length of blob
-                                 *
-                                 * When the ESP32 is storing blobs, it uses 1 entry to index chunks,
-                                 * 1 entry per chunk, then 1 entry for every 32 bytes of data, rounding up.
-                                 *
-                                 * I don't know how to find out how many chunks the ESP32 would split
-                                 * certain length blobs into, so for now I'm assuming 1 chunk per blob.
-                                 *
-                                 * Blobs in the JSON are encoded as hexadecimal, so every 2 characters are
-                                 * 1 byte of data. Then, every 32 bytes of data is an entry.
-                                 */
-                                outStats->used_entries += 2 + ceil(strlen(strBlob) / 2.0f / NVS_ENTRY_BYTES);
-                                break;
-                            }
-                            default:
-                            {
-                                break;
-                            }
-                        }
+                        outStats->used_entries += 1;
+                        break;
+                    }
+                    case cJSON_String:
+                    {
+                        char* strBlob = cJSON_GetStringValue(jsonIter);
+
+                        /**
+                         * Get length of blob
+                         *
+                         * When the ESP32 is storing blobs, it uses 1 entry to index chunks,
+                         * 1 entry per chunk, then 1 entry for every 32 bytes of data, rounding up.
+                         *
+                         * I don't know how to find out how many chunks the ESP32 would split
+                         * certain length blobs into, so for now I'm assuming 1 chunk per blob.
+                         *
+                         * Blobs in the JSON are encoded as hexadecimal, so every 2 characters are
+                         * 1 byte of data. Then, every 32 bytes of data is an entry.
+                         */
+                        outStats->used_entries += 2 + ceil(strlen(strBlob) / 2.0f / NVS_ENTRY_BYTES);
+                        break;
+                    }
+                    default:
+                    {
+                        break;
                     }
                 }
             }
-
-            outStats->free_entries = outStats->total_entries - outStats->used_entries;
-            cJSON_Delete(json);
-            return true;
-        }
-        else
-        {
-            fclose(nvsFile);
         }
     }
-    return false;
+
+    outStats->free_entries = outStats->total_entries - outStats->used_entries;
+    return true;
 }
 
 /**
@@ -782,113 +549,84 @@ bool readNvsStats(nvs_stats_t* outStats)
 bool readNamespaceNvsEntryInfos(const char* namespace, nvs_stats_t* outStats, nvs_entry_info_t* outEntryInfos,
                                 size_t* numEntryInfos)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-    if (NULL != nvsFile)
+    // If the user doesn't want to receive the stats, only use them internally
+    bool freeOutStats = false;
+    if (outStats == NULL)
     {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json = cJSON_Parse(fbuf);
-            cJSON* jsonIter;
-
-            // If the user doesn't want to receive the stats, only use them internally
-            bool freeOutStats = false;
-            if (outStats == NULL)
-            {
-                outStats     = calloc(1, sizeof(nvs_stats_t));
-                freeOutStats = true;
-            }
+        outStats     = calloc(1, sizeof(nvs_stats_t));
+        freeOutStats = true;
+    }
 
-            if (!readNvsStats(outStats))
-            {
-                if (freeOutStats)
-                {
-                    free(outStats);
-                }
-                return false;
-            }
+    if (!readNvsStats(outStats))
+    {
+        if (freeOutStats)
+        {
+            free(outStats);
+        }
+        return false;
+    }
 
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
+    nvsNamespace_t* ns = nvsGetNamespace(namespace, false);
 
-            if (NULL != jsonNs && cJSON_IsObject(jsonNs))
+    if (NULL != ns)
+    {
+        int i = 0;
+        char* current_key;
+        cJSON* jsonIter;
+        cJSON_ArrayForEach(jsonIter, ns->json)
+        {
+            current_key = jsonIter->string;
+            if (current_key != NULL)
             {
-                int i = 0;
-                char* current_key;
-                cJSON_ArrayForEach(jsonIter, jsonNs)
+                if (outEntryInfos != NULL)
                 {
-                    current_key = jsonIter->string;
-                    if (current_key != NULL)
+                    switch (jsonIter->type)
                     {
-                        if (outEntryInfos != NULL)
+                        case cJSON_Number:
                         {
-                            switch (jsonIter->type)
-                            {
-                                case cJSON_Number:
-                                {
 #ifdef USING_U32
-                                    // cJSON cannot store any integer larger than 2^53 or smaller than -(2^53), since
-                                    // those are the limits of a double
-                                    int64_t val = (int64_t)cJSON_GetNumberValue(jsonIter);
-                                    if (val > INT32_MAX)
-                                    {
-                                        outEntryInfos[i].type = NVS_TYPE_U32;
-                                    }
-                                    else
+                            // cJSON cannot store any integer larger than 2^53 or smaller than -(2^53), since
+                            // those are the limits of a double
+                            int64_t val = (int64_t)cJSON_GetNumberValue(jsonIter);
+                            if (val > INT32_MAX)
+                            {
+                                outEntryInfos[i].type = NVS_TYPE_U32;
+                            }
+                            else
 #endif
-                                    {
-                                        outEntryInfos[i].type = NVS_TYPE_I32;
-                                    }
-                                    break;
-                                }
-                                case cJSON_String:
-                                {
-                                    outEntryInfos[i].type = NVS_TYPE_BLOB;
-                                    break;
-                                }
-                                default:
-                                {
-                                    break;
-                                }
+                            {
+                                outEntryInfos[i].type = NVS_TYPE_I32;
                             }
-                            snprintf(outEntryInfos[i].namespace_name, NVS_KEY_NAME_MAX_SIZE, "%s", namespace);
-                            snprintf(outEntryInfos[i].key, NVS_KEY_NAME_MAX_SIZE, "%s", current_key);
+                            break;
+                        }
+                        case cJSON_String:
+                        {
+                            outEntryInfos[i].type = NVS_TYPE_BLOB;
+                            break;
+                        }
+                        default:
+                        {
+                            break;
                         }
-                        i++;
                     }
+                    snprintf(outEntryInfos[i].namespace_name, NVS_KEY_NAME_MAX_SIZE, "%s", namespace);
+                    snprintf(outEntryInfos[i].key, NVS_KEY_NAME_MAX_SIZE, "%s", current_key);
                 }
-
-                if (outEntryInfos == NULL)
-                {
-                    *numEntryInfos = i;
-                }
-            }
-
-            if (freeOutStats)
-            {
-                free(outStats);
+                i++;
             }
-
-            cJSON_Delete(json);
-            return true;
         }
-        else
+
+        if (outEntryInfos == NULL)
         {
-            fclose(nvsFile);
+            *numEntryInfos = i;
         }
     }
-    return false;
+
+    if (freeOutStats)
+    {
+        free(outStats);
+    }
+    return true;
 }
 
 /**
@@ -917,43 +655,8 @@ bool readAllNvsEntryInfos(nvs_stats_t* outStats, nvs_entry_info_t* outEntryInfos
  */
 bool nvsNamespaceInUse(const char* namespace)
 {
-    // Open the file
-    FILE* nvsFile = openNvsFile("rb");
-
-    if (NULL != nvsFile)
-    {
-        // Get the file size
-        fseek(nvsFile, 0L, SEEK_END);
-        size_t fsize = ftell(nvsFile);
-        fseek(nvsFile, 0L, SEEK_SET);
-
-        // Read the file
-        char fbuf[fsize + 1];
-        fbuf[fsize] = 0;
-        if (fsize == fread(fbuf, 1, fsize, nvsFile))
-        {
-            // Close the file
-            fclose(nvsFile);
-
-            // Parse the JSON
-            cJSON* json   = cJSON_Parse(fbuf);
-            cJSON* jsonNs = cJSON_GetObjectItemCaseSensitive(json, namespace);
-            bool result   = false;
-
-            if (NULL != jsonNs && cJSON_IsObject(jsonNs))
-            {
-                result = (cJSON_GetArraySize(jsonNs) != 0);
-            }
-
-            cJSON_Delete(json);
-            return result;
-        }
-        else
-        {
-            fclose(nvsFile);
-        }
-    }
-    return false;
+    nvsNamespace_t* ns = nvsGetNamespace(namespace, false);
+    return (NULL != ns) && (0 != ns->keys.count);
 }
 
 /**
@@ -965,12 +668,16 @@ bool nvsNamespaceInUse(const char* namespace)
  */
 static char* blobToStr(const void* value, size_t length)
 {
+    static const char hexChars[] = "0123456789ABCDEF";
+
     const uint8_t* value8 = (const uint8_t*)value;
     char* blobStr         = malloc((length * 2) + 1);
     for (size_t i = 0; i < length; i++)
     {
-        sprintf(&blobStr[i * 2], "%02X", value8[i]);
+        blobStr[i * 2]       = hexChars[value8[i] >> 4];
+        blobStr[(i * 2) + 1] = hexChars[value8[i] & 0x0F];
     }
+    blobStr[length * 2] = '\0';
     return blobStr;
 }
 
@@ -1007,9 +714,10 @@ static int hexCharToInt(char c)
 static void strToBlob(char* str, void* outBlob, size_t blobLen)
 {
     uint8_t* outBlob8 = (uint8_t*)outBlob;
+    size_t strLen     = strlen(str);
     for (size_t i = 0; i < blobLen; i++)
     {
-        if (((2 * i) + 1) < strlen(str))
+        if (((2 * i) + 1) < strLen)
         {
             uint8_t upperNib = hexCharToInt(str[2 * i]);
             uint8_t lowerNib = hexCharToInt(str[(2 * i) + 1]);
@@ -1028,4 +736,380 @@ static FILE* openNvsFile(const char* mode)
     expandPath(buffer, sizeof(buffer), NVS_JSON_FILE);
 
     return fopen(buffer, mode);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Get the real time, which is used to debounce writes to the file
+ *
+ * @return The monotonic time, in microseconds
+ */
+static int64_t nvsNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief Parse the NVS file into memory and index it, if that hasn't been done yet. A file which can't be read or
+ * parsed is treated as empty, and will be replaced the next time NVS is written.
+ *
+ * @return true if NVS is in memory, false if it could not be allocated
+ */
+static bool nvsLoad(void)
+{
+    if (NULL != nvsJson)
+    {
+        return true;
+    }
+
+    if (nvsMemoryOnly)
+    {
+        nvsJson = cJSON_Parse(defaultNvsValue);
+    }
+    else
+    {
+        FILE* nvsFile = openNvsFile("rb");
+        if (NULL != nvsFile)
+        {
+            // Get the file size
+            fseek(nvsFile, 0L, SEEK_END);
+            long fsize = ftell(nvsFile);
+            fseek(nvsFile, 0L, SEEK_SET);
+
+            // Read the file. This is on the heap because the file may be large
+            char* fbuf = (0 <= fsize) ? malloc(fsize + 1) : NULL;
+            if (NULL != fbuf)
+            {
+                if ((size_t)fsize == fread(fbuf, 1, fsize, nvsFile))
+                {
+                    fbuf[fsize] = 0;
+                    nvsJson     = cJSON_Parse(fbuf);
+                }
+                free(fbuf);
+            }
+            fclose(nvsFile);
+        }
+
+        if (NULL == nvsJson || !cJSON_IsObject(nvsJson))
+        {
+            fprintf(stderr, "WARNING: Couldn't read NVS file %s, starting with empty NVS\n", NVS_JSON_FILE);
+            cJSON_Delete(nvsJson);
+            nvsJson = NULL;
+        }
+    }
+
+    if (NULL == nvsJson)
+    {
+        nvsJson = cJSON_CreateObject();
+        if (NULL == nvsJson)
+        {
+            return false;
+        }
+    }
+
+    nvsIndexAll();
+    return true;
+}
+
+/**
+ * @brief Index every namespace and key in ::nvsJson, so lookups don't walk the JSON lists
+ */
+static void nvsIndexAll(void)
+{
+    hashInit(&nvsNamespaces, 16);
+    cJSON* jsonNs;
+    cJSON_ArrayForEach(jsonNs, nvsJson)
+    {
+        if (NULL != jsonNs->string && cJSON_IsObject(jsonNs) && NULL == hashGet(&nvsNamespaces, jsonNs->string))
+        {
+            nvsIndexNamespace(jsonNs);
+        }
+    }
+
+    nvsDirty = false;
+}
+
+/**
+ * @brief Free NVS from memory without writing it to the file
+ */
+static void nvsUnload(void)
+{
+    if (NULL == nvsJson)
+    {
+        return;
+    }
+
+    // Free the namespaces before the JSON, since the hash maps reference its strings
+    hashIterator_t iter = {0};
+    while (hashIterate(&nvsNamespaces, &iter))
+    {
+        nvsNamespace_t* ns = iter.value;
+        hashDeinit(&ns->keys);
+        free(ns);
+    }
+    hashDeinit(&nvsNamespaces);
+
+    cJSON_Delete(nvsJson);
+    nvsJson  = NULL;
+    nvsDirty = false;
+}
+
+/**
+ * @brief Add a JSON namespace object, and all of its keys, to the index. If a key appears more than once, the first
+ * one is used, which matches cJSON_GetObjectItemCaseSensitive()
+ *
+ * @param jsonNs The namespace's JSON object, which must already be in ::nvsJson
+ * @return The indexed namespace, or NULL if it could not be allocated
+ */
+static nvsNamespace_t* nvsIndexNamespace(cJSON* jsonNs)
+{
+    nvsNamespace_t* ns = calloc(1, sizeof(nvsNamespace_t));
+    if (NULL == ns)
+    {
+        return NULL;
+    }
+    ns->json = jsonNs;
+    hashInit(&ns->keys, 32);
+
+    cJSON* item;
+    cJSON_ArrayForEach(item, jsonNs)
+    {
+        if (NULL != item->string && NULL == hashGet(&ns->keys, item->string))
+        {
+            hashPut(&ns->keys, item->string, item);
+        }
+    }
+
+    hashPut(&nvsNamespaces, jsonNs->string, ns);
+    return ns;
+}
+
+/**
+ * @brief Find a namespace in memory, loading NVS first if needed
+ *
+ * @param namespace The name of the namespace to find
+ * @param create true to create the namespace if it doesn't exist
+ * @return The namespace, or NULL if it doesn't exist and wasn't created
+ */
+static nvsNamespace_t* nvsGetNamespace(const char* namespace, bool create)
+{
+    if (!nvsLoad())
+    {
+        return NULL;
+    }
+
+    nvsNamespace_t* ns = hashGet(&nvsNamespaces, namespace);
+    if (NULL == ns && create)
+    {
+        cJSON* jsonNs = cJSON_AddObjectToObject(nvsJson, namespace);
+        if (NULL != jsonNs)
+        {
+            ns = nvsIndexNamespace(jsonNs);
+        }
+    }
+    return ns;
+}
+
+/**
+ * @brief Find the value of a key in memory
+ *
+ * @param namespace The name of the namespace the key is in
+ * @param key The key to find
+ * @return The key's JSON value, or NULL if it doesn't exist
+ */
+static cJSON* nvsGetItem(const char* namespace, const char* key)
+{
+    nvsNamespace_t* ns = nvsGetNamespace(namespace, false);
+    if (NULL == ns)
+    {
+        return NULL;
+    }
+    return hashGet(&ns->keys, key);
+}
+
+/**
+ * @brief Set the value of a key in memory, replacing any existing value. This does not mark NVS as dirty.
+ *
+ * @param namespace The name of the namespace the key is in, which is created if it doesn't exist
+ * @param key The key to set
+ * @param item The new JSON value, which is owned by NVS after this call, even if it fails
+ * @return true if the value was set, false if it was not
+ */
+static bool nvsSetItem(const char* namespace, const char* key, cJSON* item)
+{
+    nvsNamespace_t* ns = nvsGetNamespace(namespace, true);
+    if (NULL == ns || NULL == item)
+    {
+        cJSON_Delete(item);
+        return false;
+    }
+
+    // The hash map references the key string owned by the old item, so remove it before the item is replaced
+    bool added = false;
+    if (NULL != hashRemove(&ns->keys, key))
+    {
+        added = cJSON_ReplaceItemInObjectCaseSensitive(ns->json, key, item);
+    }
+    else
+    {
+        added = cJSON_AddItemToObject(ns->json, key, item);
+    }
+
+    if (!added)
+    {
+        cJSON_Delete(item);
+        return false;
+    }
+
+    hashPut(&ns->keys, item->string, item);
+    return true;
+}
+
+/**
+ * @brief Note that NVS was changed in memory, so that the file is written by emuNvsCheckFlush()
+ */
+static void nvsMarkDirty(void)
+{
+    int64_t now = nvsNowUs();
+    if (!nvsDirty)
+    {
+        nvsDirty        = true;
+        nvsFirstDirtyUs = now;
+    }
+    nvsLastDirtyUs = now;
+}
+
+/**
+ * @brief Write any pending changes to the file when the emulator exits
+ */
+static void nvsAtExit(void)
+{
+    emuNvsFlush();
+}
+
+//==============================================================================
+// Emulator Functions
+//==============================================================================
+
+/**
+ * @brief Keep NVS in memory only, and never read or write the NVS file. NVS starts with the default values. This must
+ * be called before initNvs()
+ *
+ * @param memoryOnly true to keep NVS in memory only, false to use the NVS file
+ */
+void emuNvsSetMemoryOnly(bool memoryOnly)
+{
+    nvsMemoryOnly = memoryOnly;
+}
+
+/**
+ * @brief Get a copy of everything in NVS, e.g. to save in a replay
+ *
+ * @return NVS as a JSON string, which must be free()'d, or NULL if NVS couldn't be loaded
+ */
+char* emuNvsGetImage(void)
+{
+    if (!nvsLoad())
+    {
+        return NULL;
+    }
+    return cJSON_PrintUnformatted(nvsJson);
+}
+
+/**
+ * @brief Replace everything in NVS with an image from emuNvsGetImage(). NVS is switched to memory only, so the NVS
+ * file is not changed by the restored image or anything written afterwards.
+ *
+ * @param image NVS as a JSON string
+ * @return true if NVS was replaced, false if the image was invalid and NVS was not changed
+ */
+bool emuNvsSetImage(const char* image)
+{
+    cJSON* json = cJSON_Parse(image);
+    if (!cJSON_IsObject(json))
+    {
+        cJSON_Delete(json);
+        return false;
+    }
+
+    // Keep any changes made so far, then stop using the file
+    emuNvsFlush();
+    nvsUnload();
+    nvsMemoryOnly = true;
+
+    nvsJson = json;
+    nvsIndexAll();
+    return true;
+}
+
+/**
+ * @brief Write NVS to the file now, if it has changed. NVS is written to a temporary file which is then renamed, so a
+ * crash while writing doesn't lose the old contents.
+ *
+ * @return true if the file is up to date, false if it could not be written
+ */
+bool emuNvsFlush(void)
+{
+    if (!nvsDirty || NULL == nvsJson || nvsMemoryOnly)
+    {
+        return true;
+    }
+
+    char path[1024];
+    char tmpPath[sizeof(path) + 4];
+    expandPath(path, sizeof(path), NVS_JSON_FILE);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    bool written  = false;
+    char* jsonStr = cJSON_Print(nvsJson);
+    if (NULL != jsonStr)
+    {
+        FILE* nvsFile = fopen(tmpPath, "wb");
+        if (NULL != nvsFile)
+        {
+            size_t len = strlen(jsonStr);
+            written    = (len == fwrite(jsonStr, 1, len, nvsFile));
+            written    = (0 == fclose(nvsFile)) && written;
+        }
+        free(jsonStr);
+    }
+
+#ifdef EMU_WINDOWS
+    // rename() doesn't replace existing files on Windows
+    if (written)
+    {
+        remove(path);
+    }
+#endif
+
+    if (written && 0 == rename(tmpPath, path))
+    {
+        nvsDirty = false;
+        return true;
+    }
+
+    fprintf(stderr, "ERROR: Couldn't write NVS file %s: %s\n", path, strerror(errno));
+    remove(tmpPath);
+
+    // Try again after another quiet period
+    nvsFirstDirtyUs = nvsNowUs();
+    nvsLastDirtyUs  = nvsFirstDirtyUs;
+    return false;
+}
+
+/**
+ * @brief Write NVS to the file if there have been no writes for ::NVS_FLUSH_QUIET_US, or if the oldest unwritten change
+ * is ::NVS_FLUSH_MAX_DELAY_US old. This is called from the main loop.
+ */
+void emuNvsCheckFlush(void)
+{
+    if (nvsDirty)
+    {
+        int64_t now = nvsNowUs();
+        if (now - nvsLastDirtyUs >= NVS_FLUSH_QUIET_US || now - nvsFirstDirtyUs >= NVS_FLUSH_MAX_DELAY_US)
+        {
+            emuNvsFlush();
+        }
+    }
+}
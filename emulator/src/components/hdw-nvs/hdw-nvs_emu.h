@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+void emuNvsSetMemoryOnly(bool memoryOnly);
+bool emuNvsFlush(void);
+void emuNvsCheckFlush(void);
+char* emuNvsGetImage(void);
+bool emuNvsSetImage(const char* image);
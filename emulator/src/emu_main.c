@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
 
 #ifdef ENABLE_GCOV
     #include <gcov.h>
@@ -35,8 +36,10 @@
 
 #include "hdw-mic.h"
 #include "hdw-mic_emu.h"
+#include "hdw-esp-now_emu.h"
 #include "hdw-dac.h"
 #include "hdw-dac_emu.h"
+#include "hdw-nvs_emu.h"
 
 #include "swadge2024.h"
 #include "macros.h"
@@ -115,6 +118,15 @@
 
 static bool isRunning = true;
 
+/// The status the emulator exits with, nonzero if something failed
+static int exitStatus = 0;
+
+/// The real time when the emulator started, in microseconds
+static int64_t realStartUs = 0;
+
+/// Whether drawing the window and sleeping are skipped to run as fast as possible
+static bool skipRendering = false;
+
 /// The sound driver
 static struct CNFADriver* soundDriver = NULL;
 
@@ -127,6 +139,9 @@ void init_crashSignals(void);
 void signalHandler_crash(int signum, siginfo_t* si, void* vcontext);
 #endif
 
+static void drawEmulatorWindow(void);
+static void handleHeadlessAudio(int64_t elapsedUs);
+static int64_t getRealTimeUs(void);
 static void drawBitmapPixel(uint32_t* bitmapDisplay, int w, int h, int x, int y, uint32_t col);
 static void EmuSoundCb(struct CNFADriver* sd, short* out, short* in, int framesp, int framesr);
 void handleArgs(int argc, char** argv);
@@ -144,6 +159,27 @@ void emulatorQuit(void)
     isRunning = false;
 }
 
+/**
+ * @brief Quits the emulator with a nonzero exit status, so scripts running it can tell something failed
+ *
+ */
+void emulatorQuitWithError(void)
+{
+    exitStatus = 1;
+    isRunning  = false;
+}
+
+/**
+ * @brief Skip drawing the emulator window and sleeping between loops, so the emulator runs as fast as possible while
+ * still handling input. This is used to quickly seek through a replay.
+ *
+ * @param skip true to skip rendering, false to render normally
+ */
+void emulatorSkipRendering(bool skip)
+{
+    skipRendering = skip;
+}
+
 /**
  * @brief Parse and handle command line arguments
  *
@@ -196,52 +232,74 @@ int main(int argc, char** argv)
         emulatorSetEspRandomSeed(emulatorArgs.seed);
     }
 
-    // First initialize rawdraw
-    // Screen-specific configurations
-    // Save window dimensions from the last loop
-    if (emulatorArgs.fullscreen)
+    // This must be set before app_main() initializes NVS
+    emuNvsSetMemoryOnly(emulatorArgs.nvsMemory);
+
+    if (NULL != emulatorArgs.micFile && !micOpenSource(emulatorArgs.micFile, emulatorArgs.micLoop))
     {
-        CNFGSetupFullscreen("Swadge 2024 Simulator", 0);
+        printf("ERR: Could not open microphone source %s\n", emulatorArgs.micFile);
+        return 1;
     }
-    else
+
+    if (NULL != emulatorArgs.espNowPcap && !espNowOpenCapture(emulatorArgs.espNowPcap))
     {
-        // Get all the pane info to see how much space we need aside from the simulated TFT screen
-        emuPaneMinimum_t paneMins[4] = {0};
-        calculatePaneMinimums(paneMins);
-        int32_t sidePanesW      = paneMins[PANE_LEFT].min + paneMins[PANE_RIGHT].min;
-        int32_t topBottomPanesH = paneMins[PANE_TOP].min + paneMins[PANE_BOTTOM].min;
-        int32_t winW            = (TFT_WIDTH) * 2 + sidePanesW;
-        int32_t winH            = (TFT_HEIGHT) * 2 + topBottomPanesH;
+        printf("ERR: Could not open %s to capture ESP-NOW packets\n", emulatorArgs.espNowPcap);
+        return 1;
+    }
 
-        if (emulatorArgs.headless)
+    if (emulatorArgs.headless)
+    {
+        // There is no window or audio device, so taskYIELD() pulls audio samples instead
+        if (NULL != emulatorArgs.audioOut && !dacOpenSinkFile(emulatorArgs.audioOut))
         {
-            // If the window dimensions are negative, the window will still exist but not be displayed.
-            // TODO does this work on all platforms?
-            winW = -winW;
-            winH = -winH;
+            printf("ERR: Could not open %s to write audio\n", emulatorArgs.audioOut);
+            return 1;
         }
-
-        // Add the screen size to the minimum pane sizes to get our window size
-        CNFGSetup("Swadge 2024 Simulator", winW, winH);
     }
-
-    // Then initialize audio
-    if (!soundDriver)
+    else
     {
-        soundDriver = CNFAInit(NULL,               // const char* driver_name
-                               "Swadge Emulator",  // const char* your_name
-                               EmuSoundCb,         // CNFACBType cb
-                               DAC_SAMPLE_RATE_HZ, // int reqSPSPlay
-                               ADC_SAMPLE_RATE_HZ, // int reqSPSRec
-                               2,                  // int reqChannelsPlay
-                               1,                  // int reqChannelsRec
-                               DAC_BUF_SIZE,       // int sugBufferSize
-                               NULL,               // const char* outputSelect
-                               NULL,               // const char* inputSelect
-                               NULL                // void* opaque
-        );
+        // First initialize rawdraw
+        // Screen-specific configurations
+        // Save window dimensions from the last loop
+        if (emulatorArgs.fullscreen)
+        {
+            CNFGSetupFullscreen("Swadge 2024 Simulator", 0);
+        }
+        else
+        {
+            // Get all the pane info to see how much space we need aside from the simulated TFT screen
+            emuPaneMinimum_t paneMins[4] = {0};
+            calculatePaneMinimums(paneMins);
+            int32_t sidePanesW      = paneMins[PANE_LEFT].min + paneMins[PANE_RIGHT].min;
+            int32_t topBottomPanesH = paneMins[PANE_TOP].min + paneMins[PANE_BOTTOM].min;
+            int32_t winW            = (TFT_WIDTH) * 2 + sidePanesW;
+            int32_t winH            = (TFT_HEIGHT) * 2 + topBottomPanesH;
+
+            // Add the screen size to the minimum pane sizes to get our window size
+            CNFGSetup("Swadge 2024 Simulator", winW, winH);
+        }
+
+        // Then initialize audio
+        if (!soundDriver)
+        {
+            soundDriver = CNFAInit(NULL,               // const char* driver_name
+                                   "Swadge Emulator",  // const char* your_name
+                                   EmuSoundCb,         // CNFACBType cb
+                                   DAC_SAMPLE_RATE_HZ, // int reqSPSPlay
+                                   ADC_SAMPLE_RATE_HZ, // int reqSPSRec
+                                   2,                  // int reqChannelsPlay
+                                   1,                  // int reqChannelsRec
+                                   DAC_BUF_SIZE,       // int sugBufferSize
+                                   NULL,               // const char* outputSelect
+                                   NULL,               // const char* inputSelect
+                                   NULL                // void* opaque
+            );
+        }
     }
 
+    // Remember when the emulator started, to report the fast-forward speed
+    realStartUs = getRealTimeUs();
+
     // We won't call the pre-frame callback for the very first frame
     // This is because everything isn't initialized and there would have to be emu-specific code to do so
     // post-initialization So, this is fine, we get one frame of peace before the emulator can start messing with stuff.
@@ -266,6 +324,12 @@ void taskYIELD(void)
     static uint64_t frameNum = 0;
     doExtPostFrameCb(frameNum);
 
+    // Stop fast-forwarding after the requested number of frames
+    if (emulatorArgs.fastForwardFrames && frameNum >= emulatorArgs.fastForwardFrames)
+    {
+        isRunning = false;
+    }
+
     // Calculate time between calls
     static int64_t tLastCallUs = 0;
     int64_t tElapsedUs         = 0;
@@ -281,17 +345,13 @@ void taskYIELD(void)
         tLastCallUs    = tNowUs;
     }
 
-    // These are persistent!
-    static short lastWindow_w = 0;
-    static short lastWindow_h = 0;
-
     // Below: Support for pausing and unpausing the emulator
     // Keep track of whether we've called the pre-frame callbacks yet
     bool preFrameCalled = false;
     do
     {
-        // Always handle inputs
-        if (!CNFGHandleInput())
+        // Always handle inputs, if there is a window to get them from
+        if (!emulatorArgs.headless && !CNFGHandleInput())
         {
             isRunning = false;
         }
@@ -304,110 +364,59 @@ void taskYIELD(void)
             // This is registered with atexit()
             // CNFGTearDown();
 
+            if (emulatorArgs.headless)
+            {
+                dacCloseSinkFile();
+            }
+            micCloseSource();
+            espNowCloseCapture();
+
+            if (emulatorArgs.fastForward)
+            {
+                double realSec    = (getRealTimeUs() - realStartUs) / 1000000.0;
+                double virtualSec = esp_timer_get_time() / 1000000.0;
+                printf("Fast-forwarded %" PRIu64 " frames, %.2fs of Swadge time in %.2fs (%.1fx real time)\n",
+                       frameNum, virtualSec, realSec, (realSec > 0) ? virtualSec / realSec : 0);
+            }
+
 #ifdef ENABLE_GCOV
             __gcov_dump();
 #endif
 
-            exit(0);
+            exit(exitStatus);
             return;
         }
 
         // Check things here which are called by interrupts or timers on the Swadge
-        check_esp_timer(tElapsedUs);
-
-        // Grey Background
-        CNFGBGColor = BG_COLOR;
-        CNFGClearFrame();
-
-        // Get the current window dimensions
-        short window_w, window_h;
-        CNFGGetDimensions(&window_w, &window_h);
-        static emuPane_t screenPane;
-
-        emuPaneMinimum_t paneMins[4];
-        bool panesChanged = calculatePaneMinimums(paneMins);
-
-        // If the dimensions changed
-        if (panesChanged || (lastWindow_h != window_h) || (lastWindow_w != window_w))
-        {
-            uint8_t screenMult;
-            // Recalculate the window layout and get the settings for the screen
-            layoutPanes(window_w, window_h, TFT_WIDTH, TFT_HEIGHT, &screenPane, &screenMult);
-
-            // Set the multiplier
-            setDisplayBitmapMultiplier(screenMult);
+        check_esp_timer();
 
-            // Save for the next loop
-            lastWindow_w = window_w;
-            lastWindow_h = window_h;
-        }
+        // Write NVS changes to the file once they settle
+        emuNvsCheckFlush();
 
-        // Draw dividing lines, if they're on-screen
-        CNFGColor(DIV_COLOR);
-
-        // Draw Left Divider
-        if (paneMins[PANE_LEFT].count > 0)
+        if (emulatorArgs.headless)
         {
-            CNFGTackSegment(screenPane.paneX - 1, 0, screenPane.paneX - 1, window_h);
+            // Play the audio for the time that passed, since there's no audio device to ask for it
+            handleHeadlessAudio(tElapsedUs);
         }
-
-        // Draw Right Divider
-        if (paneMins[PANE_RIGHT].count > 0)
+        else if (!skipRendering)
         {
-            CNFGTackSegment(screenPane.paneX + screenPane.paneW, 0, screenPane.paneX + screenPane.paneW, window_h);
+            drawEmulatorWindow();
         }
 
-        // Draw Top Divider
-        if (paneMins[PANE_TOP].count > 0)
-        {
-            CNFGTackSegment(screenPane.paneX, screenPane.paneY - 1, screenPane.paneX + screenPane.paneW,
-                            screenPane.paneY - 1);
-        }
+        // Feed the microphone source for the time that passed, so it stays in step with the clock at any speed
+        micHandleVirtualInput(tElapsedUs);
 
-        // Draw Bottom Divider
-        if (paneMins[PANE_BOTTOM].count > 0)
+        // Sleep for one ms, unless the clock is virtual and there's no window to show, or rendering is being skipped
+        if (!(emulatorArgs.headless && emulatorArgs.fakeTime) && !skipRendering)
         {
-            CNFGTackSegment(screenPane.paneX, screenPane.paneY + screenPane.paneH, screenPane.paneX + screenPane.paneW,
-                            screenPane.paneY + screenPane.paneH);
+            static struct timespec tRemaining = {0};
+            const struct timespec tSleep      = {
+                     .tv_sec  = 0 + tRemaining.tv_sec,
+                     .tv_nsec = 1000000 + tRemaining.tv_nsec,
+            };
+            nanosleep(&tSleep, &tRemaining);
         }
 
-        // Get the display memory
-        uint16_t bitmapWidth, bitmapHeight;
-        uint32_t* bitmapDisplay = getDisplayBitmap(&bitmapWidth, &bitmapHeight);
-
-        if ((0 != bitmapWidth) && (0 != bitmapHeight) && (NULL != bitmapDisplay))
-        {
-#if defined(CONFIG_GC9307_240x280)
-            uint32_t cornerColor = CORNER_COLOR;
-            if (emuTimerIsPaused())
-            {
-                cornerColor = PAUSED_COLOR;
-            }
-            else if (isScreenRecording())
-            {
-                cornerColor = RECORDING_COLOR;
-            }
-
-            plotRoundedCorners(bitmapDisplay, bitmapWidth, bitmapHeight, (bitmapWidth / TFT_WIDTH) * 40, cornerColor);
-#endif
-            // Update the display, centered
-            CNFGBlitImage(bitmapDisplay, screenPane.paneX, screenPane.paneY, bitmapWidth, bitmapHeight);
-        }
-
-        // After the screen has been fully rendered, call all the render callbacks to render anything else
-        doExtRenderCb(window_w, window_h);
-
-        // Display the image and wait for time to display next frame.
-        CNFGSwapBuffers();
-
-        // Sleep for one ms
-        static struct timespec tRemaining = {0};
-        const struct timespec tSleep      = {
-                 .tv_sec  = 0 + tRemaining.tv_sec,
-                 .tv_nsec = 1000000 + tRemaining.tv_nsec,
-        };
-        nanosleep(&tSleep, &tRemaining);
-
         // This means that the pre-frame callback gets called once (assuming the post-frame
         // callback didn't already pause) and then, if one of them pauses, they don't get called
         // again until after, which is good since that's the only way we'd be able to handle input
@@ -432,6 +441,138 @@ void taskYIELD(void)
     } while (isRunning && (!preFrameCalled || emuTimerIsPaused()));
 }
 
+/**
+ * @brief Draw the emulator window, including the TFT, all extension panes, and anything extensions render on top
+ */
+static void drawEmulatorWindow(void)
+{
+    // These are persistent!
+    static short lastWindow_w = 0;
+    static short lastWindow_h = 0;
+    static emuPane_t screenPane;
+
+    // Grey Background
+    CNFGBGColor = BG_COLOR;
+    CNFGClearFrame();
+
+    // Get the current window dimensions
+    short window_w, window_h;
+    CNFGGetDimensions(&window_w, &window_h);
+
+    emuPaneMinimum_t paneMins[4];
+    bool panesChanged = calculatePaneMinimums(paneMins);
+
+    // If the dimensions changed
+    if (panesChanged || (lastWindow_h != window_h) || (lastWindow_w != window_w))
+    {
+        uint8_t screenMult;
+        // Recalculate the window layout and get the settings for the screen
+        layoutPanes(window_w, window_h, TFT_WIDTH, TFT_HEIGHT, &screenPane, &screenMult);
+
+        // Set the multiplier
+        setDisplayBitmapMultiplier(screenMult);
+
+        // Save for the next loop
+        lastWindow_w = window_w;
+        lastWindow_h = window_h;
+    }
+
+    // Draw dividing lines, if they're on-screen
+    CNFGColor(DIV_COLOR);
+
+    // Draw Left Divider
+    if (paneMins[PANE_LEFT].count > 0)
+    {
+        CNFGTackSegment(screenPane.paneX - 1, 0, screenPane.paneX - 1, window_h);
+    }
+
+    // Draw Right Divider
+    if (paneMins[PANE_RIGHT].count > 0)
+    {
+        CNFGTackSegment(screenPane.paneX + screenPane.paneW, 0, screenPane.paneX + screenPane.paneW, window_h);
+    }
+
+    // Draw Top Divider
+    if (paneMins[PANE_TOP].count > 0)
+    {
+        CNFGTackSegment(screenPane.paneX, screenPane.paneY - 1, screenPane.paneX + screenPane.paneW,
+                        screenPane.paneY - 1);
+    }
+
+    // Draw Bottom Divider
+    if (paneMins[PANE_BOTTOM].count > 0)
+    {
+        CNFGTackSegment(screenPane.paneX, screenPane.paneY + screenPane.paneH, screenPane.paneX + screenPane.paneW,
+                        screenPane.paneY + screenPane.paneH);
+    }
+
+    // Get the display memory
+    uint16_t bitmapWidth, bitmapHeight;
+    uint32_t* bitmapDisplay = getDisplayBitmap(&bitmapWidth, &bitmapHeight);
+
+    if ((0 != bitmapWidth) && (0 != bitmapHeight) && (NULL != bitmapDisplay))
+    {
+#if defined(CONFIG_GC9307_240x280)
+        uint32_t cornerColor = CORNER_COLOR;
+        if (emuTimerIsPaused())
+        {
+            cornerColor = PAUSED_COLOR;
+        }
+        else if (isScreenRecording())
+        {
+            cornerColor = RECORDING_COLOR;
+        }
+
+        plotRoundedCorners(bitmapDisplay, bitmapWidth, bitmapHeight, (bitmapWidth / TFT_WIDTH) * 40, cornerColor);
+#endif
+        // Update the display, centered
+        CNFGBlitImage(bitmapDisplay, screenPane.paneX, screenPane.paneY, bitmapWidth, bitmapHeight);
+    }
+
+    // After the screen has been fully rendered, call all the render callbacks to render anything else
+    doExtRenderCb(window_w, window_h);
+
+    // Display the image and wait for time to display next frame.
+    CNFGSwapBuffers();
+}
+
+/**
+ * @brief Pull as many audio samples from the DAC as would have played in the elapsed time, when there is no audio
+ * device to request them
+ *
+ * @param elapsedUs The time since this was last called, in microseconds
+ */
+static void handleHeadlessAudio(int64_t elapsedUs)
+{
+    // Carry the remainder between calls so no samples are lost to rounding
+    static uint64_t sampleAccum = 0;
+
+    if (emuTimerIsPaused() || elapsedUs <= 0)
+    {
+        return;
+    }
+
+    sampleAccum += (uint64_t)elapsedUs * DAC_SAMPLE_RATE_HZ;
+    uint64_t numSamples = sampleAccum / 1000000;
+    sampleAccum -= numSamples * 1000000;
+
+#if defined(CONFIG_SOUND_OUTPUT_SPEAKER)
+    dacHandleHeadlessOutput(numSamples);
+#endif
+}
+
+/**
+ * @brief Get the real time, even when the emulator is using a virtual clock
+ *
+ * @return The monotonic time in microseconds
+ */
+static int64_t getRealTimeUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
 /**
  * @brief Helper function to draw to a bitmap display
  *
@@ -847,6 +988,9 @@ void signalHandler_crash(int signum, siginfo_t* si, void* vcontext)
         }
     }
 
+    // Try to save NVS changes which haven't been written yet
+    emuNvsFlush();
+
     // Exit
     _exit(1);
 }
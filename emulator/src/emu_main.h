@@ -15,4 +15,6 @@
     }
 
 void emulatorQuit(void);
+void emulatorQuitWithError(void);
+void emulatorSkipRendering(bool skip);
 void plotRoundedCorners(uint32_t* bitmapDisplay, int w, int h, int r, uint32_t col);
@@ -75,6 +75,7 @@ static const struct option* findOption(char shortOpt, const char* longOpt);
 static void getOptionsStr(char* buffer, int buflen);
 static void printColWordWrap(const char* text, int* col, int startCol, int wrapCol);
 static bool parseBoolArg(const char* val, bool defaultValue);
+static bool parseFloatArg(const char* val, float min, float max, float* out);
 
 //==============================================================================
 // Variables
@@ -91,7 +92,14 @@ emuArgs_t emulatorArgs = {
     .fuzzTouch   = false,
     .fuzzMotion  = false,
 
-    .headless = false,
+    .fuzzCoverage = NULL,
+
+    .headless          = false,
+    .fastForward       = false,
+    .fastForwardFrames = 0,
+    .audioOut          = NULL,
+    .micFile           = NULL,
+    .micLoop           = false,
 
     .keymap = NULL,
 
@@ -112,12 +120,31 @@ emuArgs_t emulatorArgs = {
 
     .recordFile = NULL,
     .replayFile = NULL,
+    .seekFrame  = 0,
+
+    .frameHashInterval = 0,
+    .verify            = false,
 
     .seed = UINT32_MAX,
 
     .showFps = false,
 
+    .audioProfile = false,
+
     .vsync = true,
+
+    .nvsMemory = false,
+
+    .screenDump = false,
+
+    .espNowLoss    = 0,
+    .espNowBurst   = 1,
+    .espNowDup     = 0,
+    .espNowLatency = 0,
+    .espNowJitter  = 0,
+    .espNowRate    = 0,
+    .espNowPcap    = NULL,
+    .espNowSerial  = NULL,
 };
 
 static const char mainDoc[] = "Emulates a swadge";
@@ -125,29 +152,48 @@ static const char mainDoc[] = "Emulates a swadge";
 // Long argument name definitions
 // These MUST be defined here, so that they are
 // the same in both options and argDocs
-static const char argFakeFps[]     = "fake-fps";
-static const char argFakeTime[]    = "fake-time";
-static const char argFullscreen[]  = "fullscreen";
-static const char argFuzz[]        = "fuzz";
-static const char argFuzzButtons[] = "fuzz-buttons";
-static const char argFuzzTouch[]   = "fuzz-touch";
-static const char argFuzzTime[]    = "fuzz-time";
-static const char argFuzzMotion[]  = "fuzz-motion";
-static const char argHeadless[]    = "headless";
-static const char argHideLeds[]    = "hide-leds";
-static const char argKeymap[]      = "keymap";
-static const char argLock[]        = "lock";
-static const char argMode[]        = "mode";
-static const char argModeSwitch[]  = "mode-switch";
-static const char argModeList[]    = "modes-list";
-static const char argPlayback[]    = "playback";
-static const char argRecord[]      = "record";
-static const char argSeed[]        = "seed";
-static const char argShowFps[]     = "show-fps";
-static const char argTouch[]       = "touch";
-static const char argVsync[]       = "vsync";
-static const char argHelp[]        = "help";
-static const char argUsage[]       = "usage";
+static const char argAudioOut[]     = "audio-out";
+static const char argAudioProfile[] = "audio-profile";
+static const char argEspNowBurst[]  = "espnow-burst";
+static const char argEspNowDup[]    = "espnow-dup";
+static const char argEspNowJitter[] = "espnow-jitter";
+static const char argEspNowLat[]    = "espnow-latency";
+static const char argEspNowLoss[]   = "espnow-loss";
+static const char argEspNowPcap[]   = "espnow-pcap";
+static const char argEspNowRate[]   = "espnow-rate";
+static const char argEspNowSerial[] = "espnow-serial";
+static const char argFakeFps[]      = "fake-fps";
+static const char argFakeTime[]     = "fake-time";
+static const char argFastForward[]  = "fast-forward";
+static const char argFrameHash[]    = "frame-hash";
+static const char argFullscreen[]   = "fullscreen";
+static const char argFuzz[]         = "fuzz";
+static const char argFuzzButtons[]  = "fuzz-buttons";
+static const char argFuzzTouch[]    = "fuzz-touch";
+static const char argFuzzTime[]     = "fuzz-time";
+static const char argFuzzMotion[]   = "fuzz-motion";
+static const char argFuzzCoverage[] = "fuzz-coverage";
+static const char argHeadless[]     = "headless";
+static const char argHideLeds[]     = "hide-leds";
+static const char argKeymap[]       = "keymap";
+static const char argLock[]         = "lock";
+static const char argMicFile[]      = "mic-file";
+static const char argMicLoop[]      = "mic-loop";
+static const char argMode[]         = "mode";
+static const char argModeSwitch[]   = "mode-switch";
+static const char argModeList[]     = "modes-list";
+static const char argNvsMemory[]    = "nvs-memory";
+static const char argPlayback[]     = "playback";
+static const char argRecord[]       = "record";
+static const char argSeed[]         = "seed";
+static const char argScreenDump[]   = "screen-dump";
+static const char argSeek[]         = "seek";
+static const char argShowFps[]      = "show-fps";
+static const char argTouch[]        = "touch";
+static const char argVerify[]       = "verify";
+static const char argVsync[]        = "vsync";
+static const char argHelp[]         = "help";
+static const char argUsage[]        = "usage";
 
 // clang-format off
 /**
@@ -155,29 +201,48 @@ static const char argUsage[]       = "usage";
  */
 static const struct option options[] =
 {
-    { argFakeFps,     required_argument, NULL,                             0    },
-    { argFakeTime,    no_argument,       (int*)&emulatorArgs.fakeTime,     true },
-    { argFullscreen,  no_argument,       (int*)&emulatorArgs.fullscreen,   true },
-    { argFuzz,        no_argument,       (int*)&emulatorArgs.fuzz,         true },
-    { argFuzzButtons, optional_argument, (int*)&emulatorArgs.fuzzButtons,  true },
-    { argFuzzTime,    optional_argument, (int*)&emulatorArgs.fuzzTime,     true },
-    { argFuzzTouch,   optional_argument, (int*)&emulatorArgs.fuzzTouch,    true },
-    { argFuzzMotion,  optional_argument, (int*)&emulatorArgs.fuzzMotion,   true },
-    { argHeadless,    no_argument,       (int*)&emulatorArgs.headless,     true },
-    { argHideLeds,    no_argument,       (int*)&emulatorArgs.hideLeds,     true },
-    { argKeymap,      required_argument, NULL,                             'k'  },
-    { argLock,        no_argument,       (int*)&emulatorArgs.lock,         true },
-    { argMode,        required_argument, NULL,                             'm'  },
-    { argPlayback,    required_argument, (int*)&emulatorArgs.playback,     'p'  },
-    { argRecord,      optional_argument, (int*)&emulatorArgs.record,       'r'  },
-    { argSeed,        required_argument, (int*)&emulatorArgs.seed,         0    },
-    { argShowFps,     optional_argument, (int*)&emulatorArgs.showFps,      'c'  },
-    { argModeSwitch,  optional_argument, NULL,                             10   },
-    { argModeList,    no_argument,       NULL,                             0    },
-    { argTouch,       no_argument,       (int*)&emulatorArgs.emulateTouch, 't'  },
-    { argVsync,       optional_argument, (int*)&emulatorArgs.vsync,        true },
-    { argHelp,        no_argument,       NULL,                             'h'  },
-    { argUsage,       no_argument,       NULL,                             0    },
+    { argAudioOut,     required_argument, NULL,                              0    },
+    { argAudioProfile, no_argument,       (int*)&emulatorArgs.audioProfile,  true },
+    { argEspNowBurst,  required_argument, NULL,                              0    },
+    { argEspNowDup,    required_argument, NULL,                              0    },
+    { argEspNowJitter, required_argument, NULL,                              0    },
+    { argEspNowLat,    required_argument, NULL,                              0    },
+    { argEspNowLoss,   required_argument, NULL,                              0    },
+    { argEspNowPcap,   required_argument, NULL,                              0    },
+    { argEspNowRate,   required_argument, NULL,                              0    },
+    { argEspNowSerial, required_argument, NULL,                              0    },
+    { argFakeFps,      required_argument, NULL,                              0    },
+    { argFakeTime,     no_argument,       (int*)&emulatorArgs.fakeTime,      true },
+    { argFastForward,  optional_argument, NULL,                              0    },
+    { argFrameHash,    optional_argument, NULL,                              0    },
+    { argFullscreen,   no_argument,       (int*)&emulatorArgs.fullscreen,    true },
+    { argFuzz,         no_argument,       (int*)&emulatorArgs.fuzz,          true },
+    { argFuzzButtons,  optional_argument, (int*)&emulatorArgs.fuzzButtons,   true },
+    { argFuzzTime,     optional_argument, (int*)&emulatorArgs.fuzzTime,      true },
+    { argFuzzTouch,    optional_argument, (int*)&emulatorArgs.fuzzTouch,     true },
+    { argFuzzMotion,   optional_argument, (int*)&emulatorArgs.fuzzMotion,    true },
+    { argFuzzCoverage, required_argument, NULL,                              0    },
+    { argHeadless,     no_argument,       (int*)&emulatorArgs.headless,      true },
+    { argHideLeds,     no_argument,       (int*)&emulatorArgs.hideLeds,      true },
+    { argKeymap,       required_argument, NULL,                              'k'  },
+    { argLock,         no_argument,       (int*)&emulatorArgs.lock,          true },
+    { argMicFile,      required_argument, NULL,                              0    },
+    { argMicLoop,      no_argument,       (int*)&emulatorArgs.micLoop,       true },
+    { argMode,         required_argument, NULL,                              'm'  },
+    { argPlayback,     required_argument, (int*)&emulatorArgs.playback,      'p'  },
+    { argRecord,       optional_argument, (int*)&emulatorArgs.record,        'r'  },
+    { argSeed,         required_argument, (int*)&emulatorArgs.seed,          0    },
+    { argScreenDump,   no_argument,       (int*)&emulatorArgs.screenDump,    true },
+    { argSeek,         required_argument, NULL,                              0    },
+    { argShowFps,      optional_argument, (int*)&emulatorArgs.showFps,       'c'  },
+    { argModeSwitch,   optional_argument, NULL,                              10   },
+    { argModeList,     no_argument,       NULL,                              0    },
+    { argNvsMemory,    no_argument,       (int*)&emulatorArgs.nvsMemory,     true },
+    { argTouch,        no_argument,       (int*)&emulatorArgs.emulateTouch,  't'  },
+    { argVerify,       no_argument,       (int*)&emulatorArgs.verify,        true },
+    { argVsync,        optional_argument, (int*)&emulatorArgs.vsync,         true },
+    { argHelp,         no_argument,       NULL,                              'h'  },
+    { argUsage,        no_argument,       NULL,                              0    },
     {0},
 };
 
@@ -186,29 +251,48 @@ static const struct option options[] =
  */
 static const optDoc_t argDocs[] =
 {
-    { 0,  argFakeFps,     "RATE",  "Set a fake framerate. RATE can be a decimal number"},
-    { 0,  argFakeTime,    NULL,    "Use a fake timer that ticks at a constant "},
-    {'f', argFullscreen,  NULL,    "Open in fullscreen mode" },
-    { 0,  argFuzz,        NULL,    "Enable fuzzing mode, which injects random input in order to test modes" },
-    { 0,  argFuzzButtons, "y|n",   "Set whether buttons are fuzzed" },
-    { 0,  argFuzzTouch,   "y|n",   "Set whether touchpad inputs are fuzzed" },
-    { 0,  argFuzzTime,    "y|n",   "Set whether frame durations are fuzzed" },
-    { 0,  argFuzzMotion,  "y|n",   "Set whether motion inputs are fuzzed" },
-    { 0,  argHeadless,    NULL,    "Runs the emulator without a window." },
-    { 0,  argHideLeds,    NULL,    "Don't draw simulated LEDs next to the display" },
-    {'k', argKeymap,     "LAYOUT", "Use an alternative keymap. LAYOUT can be azerty, colemak, or dvorak"},
-    {'l', argLock,        NULL,    "Lock the emulator in the start mode" },
-    {'m', argMode,        "MODE",  "Start the emulator in the swadge mode MODE instead of the main menu"},
-    { 0,  argModeSwitch,  "TIME",  "Enable or set the timer to switch modes automatically" },
-    { 0,  argModeList,    NULL,    "Print out a list of all possible values for MODE" },
-    {'p', argPlayback,    "FILE",  "Play back recorded emulator inputs from a file" },
-    {'r', argRecord,      "FILE",  "Record emulator inputs to a file" },
-    {'s', argSeed,        "SEED",  "Seed the random number generator with a specific value" },
-    {'c', argShowFps,     NULL,    "Display an FPS counter" },
-    {'t', argTouch,       NULL,    "Simulate touch sensor readings with a virtual touchpad" },
-    { 0,  argVsync,       "y|n",   "Set whether VSync is enabled" },
-    {'h', argHelp,        NULL,    "Give this help list" },
-    { 0,  argUsage,       NULL,    "Give a short usage message" },
+    { 0,  argAudioOut,     "FILE",  "Write audio to a WAV file when running headless" },
+    { 0,  argAudioProfile, NULL,    "Measure the time spent generating audio and display it" },
+    { 0,  argEspNowBurst,  "PACKETS", "Lose ESP-NOW packets in bursts of this many on average, with --espnow-loss" },
+    { 0,  argEspNowDup,    "PERCENT", "Deliver this percent of received ESP-NOW packets twice" },
+    { 0,  argEspNowJitter, "MS",    "Delay each received ESP-NOW packet by up to this many extra milliseconds, which reorders them" },
+    { 0,  argEspNowLat,    "MS",    "Delay each received ESP-NOW packet by this many milliseconds" },
+    { 0,  argEspNowLoss,   "PERCENT", "Randomly lose this percent of received ESP-NOW packets, to test lossy links" },
+    { 0,  argEspNowPcap,   "FILE",  "Capture every ESP-NOW packet sent and received to a pcap file, for Wireshark" },
+    { 0,  argEspNowRate,   "KBPS",  "Receive at most this many kilobits of ESP-NOW data per second, queueing the rest" },
+    { 0,  argEspNowSerial, "DEVICE", "Wire ESP-NOW to another Swadge over a serial device, or a new pseudo-terminal with 'pty'" },
+    { 0,  argFakeFps,      "RATE",  "Set a fake framerate. RATE can be a decimal number"},
+    { 0,  argFakeTime,     NULL,    "Use a fake timer that ticks at a constant "},
+    { 0,  argFastForward,  "FRAMES", "Run headless on a virtual clock as fast as possible, optionally quitting after FRAMES frames" },
+    { 0,  argFrameHash,    "N",     "Write a hash of the display to a binary recording every N frames, or every frame" },
+    {'f', argFullscreen,   NULL,    "Open in fullscreen mode" },
+    { 0,  argFuzz,         NULL,    "Enable fuzzing mode, which injects random input in order to test modes" },
+    { 0,  argFuzzButtons,  "y|n",   "Set whether buttons are fuzzed" },
+    { 0,  argFuzzTouch,    "y|n",   "Set whether touchpad inputs are fuzzed" },
+    { 0,  argFuzzTime,     "y|n",   "Set whether frame durations are fuzzed" },
+    { 0,  argFuzzMotion,   "y|n",   "Set whether motion inputs are fuzzed" },
+    { 0,  argFuzzCoverage, "FILE",  "Write the edges of Swadge code which ran to FILE on exit, for tools/emu_fuzz" },
+    { 0,  argHeadless,     NULL,    "Runs the emulator without a window or audio device" },
+    { 0,  argHideLeds,     NULL,    "Don't draw simulated LEDs next to the display" },
+    {'k', argKeymap,       "LAYOUT", "Use an alternative keymap. LAYOUT can be azerty, colemak, or dvorak"},
+    {'l', argLock,         NULL,    "Lock the emulator in the start mode" },
+    { 0,  argMicFile,      "SOURCE", "Use a WAV file, raw 16 bit PCM file, or sine:HZ, sweep:HZ:HZ:SEC, chord:HZ,HZ,..., or noise as the microphone" },
+    { 0,  argMicLoop,      NULL,    "Start the microphone source over when it ends" },
+    {'m', argMode,         "MODE",  "Start the emulator in the swadge mode MODE instead of the main menu"},
+    { 0,  argModeSwitch,   "TIME",  "Enable or set the timer to switch modes automatically" },
+    { 0,  argModeList,     NULL,    "Print out a list of all possible values for MODE" },
+    { 0,  argNvsMemory,    NULL,    "Keep NVS in memory only, never reading or writing the NVS file" },
+    {'p', argPlayback,     "FILE",  "Play back recorded emulator inputs from a file" },
+    {'r', argRecord,       "FILE",  "Record emulator inputs to a file" },
+    { 0,  argScreenDump,   NULL,    "Record the screen to a raw frame dump instead of a GIF" },
+    {'s', argSeed,         "SEED",  "Seed the random number generator with a specific value" },
+    { 0,  argSeek,         "FRAME", "Play back a binary recording without drawing until FRAME is reached" },
+    {'c', argShowFps,      NULL,    "Display an FPS counter" },
+    {'t', argTouch,        NULL,    "Simulate touch sensor readings with a virtual touchpad" },
+    { 0,  argVerify,       NULL,    "Check the display against the hashes in a binary recording, and stop at the first difference" },
+    { 0,  argVsync,        "y|n",   "Set whether VSync is enabled" },
+    {'h', argHelp,         NULL,    "Give this help list" },
+    { 0,  argUsage,        NULL,    "Give a short usage message" },
 };
 // clang-format on
 
@@ -254,6 +338,42 @@ static bool handleArgument(const char* optName, const char* arg, int optVal)
             emulatorArgs.fakeFps = 24.0;
         }
     }
+    else if (argFastForward == optName)
+    {
+        // Fast-forward is headless with a virtual clock. Leaving fakeFps unset makes the clock follow the mode's
+        // frame rate
+        emulatorArgs.fastForward = true;
+        emulatorArgs.headless    = true;
+        emulatorArgs.fakeTime    = true;
+
+        if (arg)
+        {
+            char* end                      = NULL;
+            emulatorArgs.fastForwardFrames = strtoull(arg, &end, 10);
+            if (end == arg || *end != '\0')
+            {
+                printf("ERR: Invalid frame count '%s'\n", arg);
+                return false;
+            }
+        }
+        return true;
+    }
+    else if (argFrameHash == optName)
+    {
+        emulatorArgs.frameHashInterval = 1;
+
+        if (arg)
+        {
+            char* end                      = NULL;
+            emulatorArgs.frameHashInterval = strtoul(arg, &end, 10);
+            if (end == arg || *end != '\0' || 0 == emulatorArgs.frameHashInterval)
+            {
+                printf("ERR: Invalid frame interval '%s'\n", arg);
+                return false;
+            }
+        }
+        return true;
+    }
     else if (argFuzz == optName)
     {
         // Enable Fuzz
@@ -305,6 +425,55 @@ static bool handleArgument(const char* optName, const char* arg, int optVal)
             emulatorArgs.fuzzTime = parseBoolArg(arg, true);
         }
     }
+    else if (argFuzzCoverage == optName)
+    {
+        emulatorArgs.fuzzCoverage = arg;
+        return true;
+    }
+    else if (argEspNowLoss == optName)
+    {
+        return parseFloatArg(arg, 0, 100, &emulatorArgs.espNowLoss);
+    }
+    else if (argEspNowBurst == optName)
+    {
+        return parseFloatArg(arg, 1, 1000, &emulatorArgs.espNowBurst);
+    }
+    else if (argEspNowDup == optName)
+    {
+        return parseFloatArg(arg, 0, 100, &emulatorArgs.espNowDup);
+    }
+    else if (argEspNowLat == optName)
+    {
+        return parseFloatArg(arg, 0, 60000, &emulatorArgs.espNowLatency);
+    }
+    else if (argEspNowJitter == optName)
+    {
+        return parseFloatArg(arg, 0, 60000, &emulatorArgs.espNowJitter);
+    }
+    else if (argEspNowRate == optName)
+    {
+        return parseFloatArg(arg, 0, 1000000, &emulatorArgs.espNowRate);
+    }
+    else if (argEspNowPcap == optName)
+    {
+        emulatorArgs.espNowPcap = arg;
+        return true;
+    }
+    else if (argEspNowSerial == optName)
+    {
+        emulatorArgs.espNowSerial = arg;
+        return true;
+    }
+    else if (argAudioOut == optName)
+    {
+        emulatorArgs.audioOut = arg;
+        return true;
+    }
+    else if (argMicFile == optName)
+    {
+        emulatorArgs.micFile = arg;
+        return true;
+    }
     else if (argKeymap == optName)
     {
         if (arg)
@@ -393,6 +562,17 @@ static bool handleArgument(const char* optName, const char* arg, int optVal)
             }
         }
     }
+    else if (argSeek == optName)
+    {
+        char* end              = NULL;
+        emulatorArgs.seekFrame = strtoull(arg, &end, 10);
+        if (end == arg || *end != '\0')
+        {
+            printf("ERR: Invalid frame number '%s'\n", arg);
+            return false;
+        }
+        return true;
+    }
     else if (argShowFps == optName)
     {
         emulatorArgs.showFps = true;
@@ -1003,3 +1183,26 @@ static bool parseBoolArg(const char* val, bool defaultValue)
 
     return false;
 }
+
+/**
+ * @brief Parse a decimal number and check that it is in a range, printing an error if it isn't
+ *
+ * @param val The string to parse
+ * @param min The smallest allowed value
+ * @param max The largest allowed value
+ * @param[out] out Written with the parsed value
+ * @return true if the whole string was a number between min and max
+ * @return false if it wasn't
+ */
+static bool parseFloatArg(const char* val, float min, float max, float* out)
+{
+    char* end = NULL;
+    float num = val ? strtof(val, &end) : 0;
+    if (NULL == val || end == val || *end != '\0' || num < min || num > max)
+    {
+        printf("ERR: Invalid value '%s', must be a number from %g to %g\n", val ? val : "", min, max);
+        return false;
+    }
+    *out = num;
+    return true;
+}
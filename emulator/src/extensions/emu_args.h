@@ -33,8 +33,27 @@ typedef struct
     bool fuzzTouch;
     bool fuzzMotion;
 
+    /// @brief Name of a file to write the fuzzing coverage map to when the emulator exits, or NULL
+    const char* fuzzCoverage;
+
+    /// @brief Whether to run without a window or an audio device
     bool headless;
 
+    /// @brief Whether to run headless on a virtual clock, as fast as possible
+    bool fastForward;
+
+    /// @brief The number of frames to run before quitting when fast-forwarding, or 0 to run forever
+    uint64_t fastForwardFrames;
+
+    /// @brief Name of a WAV file to write audio to when running headless, or NULL to discard audio
+    const char* audioOut;
+
+    /// @brief A file or synthetic source to use as the microphone instead of the audio device, or NULL
+    const char* micFile;
+
+    /// @brief Whether to start the microphone source over when it ends
+    bool micLoop;
+
     /// @brief Name of the keymap to use, or NULL if none
     const char* keymap;
 
@@ -66,14 +85,58 @@ typedef struct
     /// @brief Name of the file to replay inputs from
     const char* replayFile;
 
+    /// @brief The frame of a binary replay to fast-forward to before drawing anything, or 0 to play normally
+    uint64_t seekFrame;
+
+    /// @brief How many frames apart display hashes are written to a binary recording, or 0 to write none
+    uint32_t frameHashInterval;
+
+    /// @brief Whether to check the display against the hashes in a binary recording while playing it back
+    bool verify;
+
     /// @brief A value to use to manually seed the random number generator
     uint32_t seed;
 
     /// @brief Whether to display an FPS counter
     bool showFps;
 
+    /// @brief Whether to profile the DAC callback and display the results
+    bool audioProfile;
+
     /// @brief Whether VSync is enabled
     bool vsync;
+
+    /// @brief Whether to keep NVS in memory only, without reading or writing the NVS file
+    bool nvsMemory;
+
+    /// @brief Whether screen recordings are raw frame dumps instead of GIFs
+    bool screenDump;
+
+    // ESP-NOW Link
+
+    /// @brief The percent of received ESP-NOW packets which are lost
+    float espNowLoss;
+
+    /// @brief The mean number of ESP-NOW packets lost in a row, or 1 for independent losses
+    float espNowBurst;
+
+    /// @brief The percent of received ESP-NOW packets which are delivered twice
+    float espNowDup;
+
+    /// @brief The time each received ESP-NOW packet is delayed, in milliseconds
+    float espNowLatency;
+
+    /// @brief The most random extra delay added to each received ESP-NOW packet, in milliseconds
+    float espNowJitter;
+
+    /// @brief The most ESP-NOW data received per second, in kilobits, or 0 for no limit
+    float espNowRate;
+
+    /// @brief Name of a pcap file to capture ESP-NOW packets to, or NULL
+    const char* espNowPcap;
+
+    /// @brief A serial device to send ESP-NOW packets over as if wired, "pty" to create one, or NULL to use the network
+    const char* espNowSerial;
 } emuArgs_t;
 
 //==============================================================================
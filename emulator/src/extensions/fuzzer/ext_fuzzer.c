@@ -11,6 +11,7 @@
 #include "hdw-btn_emu.h"
 #include "hdw-imu_emu.h"
 #include "esp_timer_emu.h"
+#include "emu_main.h"
 
 //==============================================================================
 // Function Prototypes
@@ -18,6 +19,10 @@
 
 static bool fuzzerInitCb(emuArgs_t* emuArgs);
 static void fuzzerPreFrameCb(uint64_t frame);
+#ifdef ENABLE_FUZZ_COVERAGE
+static void writeCoverage(void);
+void __sanitizer_cov_trace_pc(void);
+#endif
 
 //==============================================================================
 // Structs
@@ -48,6 +53,17 @@ emuExtension_t fuzzerEmuExtension = {
 
 static fuzzer_t fuzzer = {0};
 
+/// @brief The file to write the coverage map to when the emulator exits
+static const char* coverageFile = NULL;
+
+#ifdef ENABLE_FUZZ_COVERAGE
+/// @brief Hit counts for edges between basic blocks in the Swadge code
+static uint8_t coverageMap[FUZZ_COVERAGE_MAP_SIZE];
+
+/// @brief The location of the previous basic block, shifted so A->B and B->A are different edges
+static __thread uint32_t prevLocation;
+#endif
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -60,6 +76,18 @@ static bool fuzzerInitCb(emuArgs_t* emuArgs)
     fuzzer.motion  = emuArgs->fuzzMotion;
     fuzzer.time    = emuArgs->fuzzTime;
 
+    if (NULL != emuArgs->fuzzCoverage)
+    {
+#ifdef ENABLE_FUZZ_COVERAGE
+        coverageFile = emuArgs->fuzzCoverage;
+        atexit(writeCoverage);
+#else
+        printf("ERR: --fuzz-coverage requires building with 'make ENABLE_FUZZ_COVERAGE=true'\n");
+        emulatorQuit();
+        return false;
+#endif
+    }
+
     if (emuArgs->fuzz)
     {
         printf("\nFuzzing:\n - [%c] Buttons\n - [%c] Touch\n - [%c] Motion\n - [%c] Time\n", fuzzer.buttons ? 'X' : ' ',
@@ -71,7 +99,7 @@ static bool fuzzerInitCb(emuArgs_t* emuArgs)
         }
     }
 
-    return emuArgs->fuzz;
+    return emuArgs->fuzz || NULL != coverageFile;
 }
 
 static void fuzzerPreFrameCb(uint64_t frame)
@@ -129,3 +157,44 @@ static void fuzzerPreFrameCb(uint64_t frame)
         emuSetEspTimerTime(fakeTime);
     }
 }
+
+#ifdef ENABLE_FUZZ_COVERAGE
+/**
+ * @brief Write the coverage map to the file given with --fuzz-coverage. This is called when the emulator exits.
+ */
+static void writeCoverage(void)
+{
+    FILE* file = fopen(coverageFile, "wb");
+    if (NULL == file)
+    {
+        printf("ERR: Could not open %s to write coverage\n", coverageFile);
+        return;
+    }
+
+    if (sizeof(coverageMap) != fwrite(coverageMap, 1, sizeof(coverageMap), file))
+    {
+        printf("ERR: Could not write coverage to %s\n", coverageFile);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Count the edge to the basic block which called this. With -fsanitize-coverage=trace-pc, the compiler calls
+ * this at the start of every basic block in the Swadge code.
+ *
+ * Block addresses are taken relative to this function, so each block gets the same location on every run even when
+ * the executable is loaded at a random address.
+ */
+void __sanitizer_cov_trace_pc(void)
+{
+    uintptr_t pc      = (uintptr_t)__builtin_return_address(0) - (uintptr_t)__sanitizer_cov_trace_pc;
+    uint32_t location = ((uint32_t)pc * 0x9E3779B1u) >> 16;
+
+    uint8_t* counter = &coverageMap[(location ^ prevLocation) & (FUZZ_COVERAGE_MAP_SIZE - 1)];
+    if (UINT8_MAX != *counter)
+    {
+        (*counter)++;
+    }
+    prevLocation = location >> 1;
+}
+#endif
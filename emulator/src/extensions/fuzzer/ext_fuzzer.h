@@ -1,5 +1,21 @@
+/*! \file ext_fuzzer.h
+ *
+ * \section ext_fuzzer Fuzzer Emulator Extension
+ *
+ * The fuzzer extension injects random button, touchpad, and motion inputs every frame, and can fuzz frame times.
+ *
+ * \section ext_fuzzer_coverage Coverage
+ * When the emulator is built with `make ENABLE_FUZZ_COVERAGE=true`, the Swadge code (everything in `main/`) is
+ * instrumented with `-fsanitize-coverage=trace-pc`. Every edge between basic blocks which runs increments a counter in
+ * a map of ::FUZZ_COVERAGE_MAP_SIZE bytes, like AFL. With `--fuzz-coverage=FILE`, the map is written to FILE when the
+ * emulator exits. tools/emu_fuzz uses this to find inputs which reach new code.
+ */
+
 #pragma once
 
 #include "emu_ext.h"
 
+/// @brief The number of edge counters in the coverage map. This must match tools/emu_fuzz
+#define FUZZ_COVERAGE_MAP_SIZE (1 << 16)
+
 extern emuExtension_t fuzzerEmuExtension;
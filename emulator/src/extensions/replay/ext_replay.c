@@ -11,10 +11,13 @@
 #include "ext_tools.h"
 #include "emu_utils.h"
 #include "esp_random_emu.h"
+#include "esp_timer_emu.h"
+#include "hdw-nvs_emu.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 #include <unistd.h>
 
@@ -26,6 +29,27 @@
 
 #define HEADER "Time,Type,Value\n"
 
+/// @brief The first bytes of a binary recording
+#define BINARY_MAGIC "SWRP"
+
+/// @brief The version of the binary recording format
+#define BINARY_VERSION 1
+
+/// @brief The size of the binary recording header: the magic, the version, and three reserved bytes
+#define BINARY_HEADER_SIZE 8
+
+/// @brief The last bytes of a finished binary recording, after the offset of its index
+#define TRAILER_MAGIC "SWRX"
+
+/// @brief The size of the trailer: a 64 bit little-endian index offset and the magic
+#define TRAILER_SIZE 12
+
+/// @brief How many frames apart the index entries of a binary recording are
+#define INDEX_INTERVAL 256
+
+/// @brief The longest string which will be read from a binary recording. The NVS image is the longest
+#define MAX_BINARY_STRING (16 * 1024 * 1024)
+
 #ifdef DEBUG
     #define REPLAY_DEBUG(str, ...) printf(str "\n", __VA_ARGS__);
 #else
@@ -57,14 +81,48 @@ typedef enum
     SCREENSHOT,
     SET_MODE,
     RANDOM_SEED,
+    // The types below are only in binary recordings
+    FRAME,
+    CHECKPOINT,
+    INDEX,
+    FRAME_HASH,
 } replayLogType_t;
 
+/// @brief The last type which can be in a CSV recording
 #define LAST_TYPE RANDOM_SEED
 
+typedef enum
+{
+    FORMAT_CSV,
+    FORMAT_BINARY,
+} replayFormat_t;
+
 //==============================================================================
 // Structs
 //==============================================================================
 
+/**
+ * @brief The emulator state needed to start playing a recording from a given frame
+ */
+typedef struct
+{
+    uint64_t frame;    ///< The recorded frame this checkpoint was taken at
+    int64_t time;      ///< The emulator time, in microseconds
+    bool rngSeeded;    ///< true if the random number generator had been seeded
+    uint32_t rngSeed;  ///< The seed of the random number generator
+    uint64_t rngDraws; ///< The number of random numbers drawn since it was seeded
+    char* modeName;    ///< The name of the Swadge mode started with the recording, or NULL
+    char* nvsImage;    ///< Everything in NVS, as JSON, or NULL
+
+    buttonBit_t buttons;    ///< The buttons which were held
+    int32_t touchPhi;       ///< The touchpad angle
+    int32_t touchR;         ///< The touchpad radius
+    int32_t touchIntensity; ///< The touchpad intensity
+    int16_t accelX;         ///< The accelerometer X reading
+    int16_t accelY;         ///< The accelerometer Y reading
+    int16_t accelZ;         ///< The accelerometer Z reading
+} replayCheckpoint_t;
+
 typedef struct
 {
     int64_t time;
@@ -79,9 +137,33 @@ typedef struct
         uint32_t seedVal;
         char* filename;
         char* modeName;
+        int64_t frameDelta;
+        replayCheckpoint_t* checkpoint;
+        uint64_t hashVal;
     };
 } replayEntry_t;
 
+/**
+ * @brief A position in a binary recording
+ */
+typedef struct
+{
+    uint64_t frame;  ///< The frame number
+    int64_t time;    ///< The time of the frame
+    uint64_t offset; ///< The offset of the frame's record, or the checkpoint's record, in the file
+    bool checkpoint; ///< true if this is a checkpoint, false if it is a frame
+} replayIndexEntry_t;
+
+/**
+ * @brief A growable byte buffer used to build binary records
+ */
+typedef struct
+{
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+} replayBuf_t;
+
 typedef struct
 {
     FILE* file;
@@ -103,6 +185,49 @@ typedef struct
     uint32_t newSeed;
 
     replayEntry_t nextEntry;
+
+    replayFormat_t format;
+
+    /// @brief The number of frames recorded or played back from a binary recording
+    uint64_t frameCount;
+
+    /// @brief The time of the last frame recorded or played back from a binary recording
+    int64_t frameTime;
+
+    /// @brief The duration of the last frame played back, used to keep time moving after the recording ends
+    int64_t lastFrameDelta;
+
+    /// @brief The number of bytes written to a binary recording
+    uint64_t fileOffset;
+
+    /// @brief true while a frame of a binary recording is being built, false between frames
+    bool inFrame;
+
+    /// @brief The records of the frame being built
+    replayBuf_t frameBuf;
+
+    /// @brief Records made between frames, written after the next frame's record
+    replayBuf_t pendingBuf;
+
+    /// @brief Positions of frames and checkpoints in a binary recording
+    replayIndexEntry_t* index;
+    uint32_t indexLen;
+    uint32_t indexCap;
+
+    /// @brief The number of frames in the binary recording being played back, from its index
+    uint64_t totalFrames;
+
+    /// @brief true while frames are played back without drawing, to get to emuArgs_t::seekFrame
+    bool seeking;
+
+    /// @brief The number of display hashes which matched the recording
+    uint64_t hashesMatched;
+
+    /// @brief A copy of the display the last time its hash matched the recording, or NULL
+    paletteColor_t* lastMatch;
+
+    /// @brief The frame lastMatch was copied at
+    uint64_t lastMatchFrame;
 } replay_t;
 
 //==============================================================================
@@ -115,7 +240,29 @@ static void replayPlaybackFrame(uint64_t frame);
 static void replayPreFrame(uint64_t frame);
 
 static bool readEntry(replayEntry_t* out);
+static bool readCsvEntry(replayEntry_t* out);
+static bool readBinaryEntry(replayEntry_t* out);
 static void writeEntry(const replayEntry_t* entry);
+static void writeCsvEntry(const replayEntry_t* entry);
+static void writeBinaryEntry(const replayEntry_t* entry);
+static void freeEntry(replayEntry_t* entry);
+
+static void bufPut(replayBuf_t* buf, const void* data, size_t len);
+static void bufPutByte(replayBuf_t* buf, uint8_t val);
+static void bufPutVarint(replayBuf_t* buf, uint64_t val);
+static void bufPutSigned(replayBuf_t* buf, int64_t val);
+static void bufPutString(replayBuf_t* buf, const char* str);
+static bool readVarint(uint64_t* out);
+static bool readSigned(int64_t* out);
+static bool readString(char** out);
+
+static void addIndexEntry(uint64_t frame, int64_t time, uint64_t offset, bool checkpoint);
+static void writeCheckpoint(void);
+static void applyCheckpoint(const replayCheckpoint_t* checkpoint);
+static void loadIndex(void);
+static void finishRecording(void);
+static uint64_t hashDisplay(const paletteColor_t* pixels);
+static void verifyFrameHash(uint64_t expected);
 
 //==============================================================================
 // Variables
@@ -168,6 +315,34 @@ static bool replayInit(emuArgs_t* emuArgs)
     else if (emuArgs->playback)
     {
         startPlayback(emuArgs->replayFile);
+
+        if (emuArgs->seekFrame)
+        {
+            if (FORMAT_BINARY != replay.format)
+            {
+                printf("ERR: Replay: Only binary recordings can be seeked, ignoring --seek\n");
+            }
+            else
+            {
+                if (emuArgs->seekFrame > replay.totalFrames)
+                {
+                    printf("WARN: Replay: The recording only has %" PRIu64 " frames\n", replay.totalFrames);
+                    emuArgs->seekFrame = replay.totalFrames;
+                }
+
+                // Frames are played back as fast as possible, without drawing, until the target frame
+                printf("Replay: Seeking to frame %" PRIu64 "\n", emuArgs->seekFrame);
+                replay.seeking = true;
+                emulatorSkipRendering(true);
+            }
+        }
+
+        if (emuArgs->verify && FORMAT_BINARY != replay.format)
+        {
+            printf("ERR: Replay: Only binary recordings have display hashes, ignoring --verify\n");
+            emuArgs->verify = false;
+        }
+
         return (replayInitialized = true);
     }
 
@@ -186,6 +361,33 @@ static void replayRecordFrame(uint64_t frame)
 
     logEntry.time = esp_timer_get_time();
 
+    if (FORMAT_BINARY == replay.format)
+    {
+        // Each frame starts with its time, followed by anything recorded since the last frame
+        replay.inFrame = true;
+        logEntry.type  = FRAME;
+        writeEntry(&logEntry);
+
+        bufPut(&replay.frameBuf, replay.pendingBuf.data, replay.pendingBuf.len);
+        replay.pendingBuf.len = 0;
+
+        if (1 == replay.frameCount)
+        {
+            // This goes after the start mode and seed, so the checkpoint takes precedence
+            writeCheckpoint();
+        }
+
+        // The display still shows what the previous frame drew
+        const paletteColor_t* display = getLastTftBitmap();
+        if (emulatorArgs.frameHashInterval && NULL != display
+            && 0 == replay.frameCount % emulatorArgs.frameHashInterval)
+        {
+            logEntry.type    = FRAME_HASH;
+            logEntry.hashVal = hashDisplay(display);
+            writeEntry(&logEntry);
+        }
+    }
+
     int32_t touchPhi, touchR, touchIntensity;
     if (!getTouchJoystick(&touchPhi, &touchR, &touchIntensity))
     {
@@ -238,7 +440,7 @@ static void replayRecordFrame(uint64_t frame)
             {
                 if (touchPhi != replay.lastTouchPhi)
                 {
-                    logEntry.accelVal = touchPhi;
+                    logEntry.touchVal = touchPhi;
                     writeEntry(&logEntry);
                 }
                 break;
@@ -300,6 +502,10 @@ static void replayRecordFrame(uint64_t frame)
             case SCREENSHOT:
             case SET_MODE:
             case RANDOM_SEED:
+            case FRAME:
+            case CHECKPOINT:
+            case INDEX:
+            case FRAME_HASH:
                 break;
         }
     }
@@ -311,6 +517,15 @@ static void replayRecordFrame(uint64_t frame)
     replay.lastAccelY         = accelY;
     replay.lastAccelZ         = accelZ;
 
+    if (FORMAT_BINARY == replay.format)
+    {
+        // Write the whole frame at once
+        fwrite(replay.frameBuf.data, 1, replay.frameBuf.len, replay.file);
+        replay.fileOffset += replay.frameBuf.len;
+        replay.frameBuf.len = 0;
+        replay.inFrame      = false;
+    }
+
     // Flush all the entries to the file so that we can close the file the proper way
     // which is obviously to let the OS deal with it when the process exits
     fflush(replay.file);
@@ -319,6 +534,9 @@ static void replayRecordFrame(uint64_t frame)
 /**
  * @brief Play back any recorded actions queued for the given frame
  *
+ * CSV entries are played back when the emulator time reaches their timestamp. Binary recordings set the emulator time
+ * from each frame record instead, and everything up to the next frame record is played back at once.
+ *
  * @param frame
  */
 static void replayPlaybackFrame(uint64_t frame)
@@ -335,7 +553,10 @@ static void replayPlaybackFrame(uint64_t frame)
         int16_t accelY = replay.lastAccelY;
         int16_t accelZ = replay.lastAccelZ;
 
-        while (time >= replay.nextEntry.time)
+        bool frameStarted = false;
+
+        while ((FORMAT_BINARY == replay.format) ? !(frameStarted && FRAME == replay.nextEntry.type)
+                                                : (time >= replay.nextEntry.time))
         {
             switch (replay.nextEntry.type)
             {
@@ -451,6 +672,53 @@ static void replayPlaybackFrame(uint64_t frame)
                     emulatorSetEspRandomSeed(replay.nextEntry.seedVal);
                     break;
                 }
+
+                case FRAME:
+                {
+                    // The recorded time is used as-is, so the mode sees exactly the same timing
+                    frameStarted = true;
+                    replay.frameCount++;
+                    replay.lastFrameDelta = replay.nextEntry.frameDelta;
+                    emuSetEspTimerTime(replay.nextEntry.time);
+                    break;
+                }
+
+                case CHECKPOINT:
+                {
+                    const replayCheckpoint_t* checkpoint = replay.nextEntry.checkpoint;
+
+                    touchPhi       = checkpoint->touchPhi;
+                    touchR         = checkpoint->touchR;
+                    touchIntensity = checkpoint->touchIntensity;
+                    accelX         = checkpoint->accelX;
+                    accelY         = checkpoint->accelY;
+                    accelZ         = checkpoint->accelZ;
+
+                    applyCheckpoint(checkpoint);
+                    freeEntry(&replay.nextEntry);
+                    break;
+                }
+
+                case INDEX:
+                {
+                    // Never returned by readEntry()
+                    break;
+                }
+
+                case FRAME_HASH:
+                {
+                    if (emulatorArgs.verify)
+                    {
+                        verifyFrameHash(replay.nextEntry.hashVal);
+                    }
+                    break;
+                }
+            }
+
+            if (replay.readCompleted)
+            {
+                // Verification failed, so stop playing back
+                break;
             }
 
             // Get the next entry
@@ -458,6 +726,22 @@ static void replayPlaybackFrame(uint64_t frame)
             {
                 printf("Replay: Reached end of recording\n");
                 replay.readCompleted = true;
+
+                if (emulatorArgs.verify)
+                {
+                    // Verifying is a test, so it's over when the recording is
+                    if (replay.hashesMatched)
+                    {
+                        printf("Replay: The display matched all %" PRIu64 " hashes in the recording\n",
+                               replay.hashesMatched);
+                        emulatorQuit();
+                    }
+                    else
+                    {
+                        printf("ERR: Replay: The recording has no display hashes to verify\n");
+                        emulatorQuitWithError();
+                    }
+                }
                 break;
             }
         }
@@ -481,6 +765,18 @@ static void replayPlaybackFrame(uint64_t frame)
             replay.lastAccelZ = accelZ;
         }
     }
+    else if (FORMAT_BINARY == replay.format)
+    {
+        // Real time is off, so keep the clock moving at the recording's last frame rate
+        emuSetEspTimerTime(esp_timer_get_time() + replay.lastFrameDelta);
+    }
+
+    if (replay.seeking && (replay.readCompleted || replay.frameCount >= emulatorArgs.seekFrame))
+    {
+        replay.seeking = false;
+        emulatorSkipRendering(false);
+        printf("Replay: Reached frame %" PRIu64 "\n", replay.frameCount);
+    }
 }
 
 static void replayPreFrame(uint64_t frame)
@@ -501,7 +797,22 @@ static void replayPreFrame(uint64_t frame)
     }
 }
 
+/**
+ * @brief Read the next entry from the recording, in whichever format it is
+ *
+ * @param entry The entry to read into
+ * @return true if an entry was read, false at the end of the recording or on an error
+ */
 static bool readEntry(replayEntry_t* entry)
+{
+    if (FORMAT_BINARY == replay.format)
+    {
+        return readBinaryEntry(entry);
+    }
+    return readCsvEntry(entry);
+}
+
+static bool readCsvEntry(replayEntry_t* entry)
 {
     char buffer[64];
     if (!replay.headerHandled)
@@ -684,7 +995,186 @@ static bool readEntry(replayEntry_t* entry)
     return true;
 }
 
+/**
+ * @brief Read the next record from a binary recording
+ *
+ * Records don't have their own timestamps. Every record gets the time of the last ::FRAME record before it.
+ *
+ * @param entry The entry to read into. Strings and checkpoints are allocated and must be freed with freeEntry()
+ * @return true if an entry was read, false at the index, the end of the file, or on an error
+ */
+static bool readBinaryEntry(replayEntry_t* entry)
+{
+    int type = fgetc(replay.file);
+    if (EOF == type || INDEX == type)
+    {
+        // The index comes after the last frame
+        return false;
+    }
+
+    entry->type = type;
+    entry->time = replay.frameTime;
+
+    uint64_t val;
+    int64_t sval;
+
+    switch (entry->type)
+    {
+        case FRAME:
+        {
+            if (!readSigned(&sval))
+            {
+                return false;
+            }
+            replay.frameTime += sval;
+            entry->time       = replay.frameTime;
+            entry->frameDelta = sval;
+            break;
+        }
+
+        case BUTTON_PRESS:
+        case BUTTON_RELEASE:
+        {
+            int idx = fgetc(replay.file);
+            if (idx < 0 || idx >= 8)
+            {
+                printf("ERR: Invalid button index %d in recording\n", idx);
+                return false;
+            }
+            entry->buttonVal = (1 << idx);
+            break;
+        }
+
+        case TOUCH_PHI:
+        case TOUCH_R:
+        case TOUCH_INTENSITY:
+        {
+            if (!readSigned(&sval))
+            {
+                return false;
+            }
+            entry->touchVal = sval;
+            break;
+        }
+
+        case ACCEL_X:
+        case ACCEL_Y:
+        case ACCEL_Z:
+        {
+            if (!readSigned(&sval))
+            {
+                return false;
+            }
+            entry->accelVal = sval;
+            break;
+        }
+
+        case FUZZ:
+        case QUIT:
+        {
+            break;
+        }
+
+        case SCREENSHOT:
+        {
+            return readString(&entry->filename);
+        }
+
+        case SET_MODE:
+        {
+            return readString(&entry->modeName);
+        }
+
+        case RANDOM_SEED:
+        {
+            if (!readVarint(&val))
+            {
+                return false;
+            }
+            entry->seedVal = val;
+            break;
+        }
+
+        case CHECKPOINT:
+        {
+            replayCheckpoint_t* checkpoint = calloc(1, sizeof(replayCheckpoint_t));
+            entry->checkpoint              = checkpoint;
+            if (NULL == checkpoint)
+            {
+                return false;
+            }
+
+            uint64_t seed = 0, flags = 0;
+            int64_t phi = 0, r = 0, intensity = 0, x = 0, y = 0, z = 0;
+            int buttons = 0;
+
+            bool ok = readVarint(&checkpoint->frame) && readSigned(&checkpoint->time) && readVarint(&flags)
+                      && readVarint(&seed) && readVarint(&checkpoint->rngDraws) && readString(&checkpoint->modeName)
+                      && readString(&checkpoint->nvsImage) && (EOF != (buttons = fgetc(replay.file)))
+                      && readSigned(&phi) && readSigned(&r) && readSigned(&intensity) && readSigned(&x)
+                      && readSigned(&y) && readSigned(&z);
+
+            checkpoint->rngSeeded      = (flags & 1);
+            checkpoint->rngSeed        = seed;
+            checkpoint->buttons        = buttons;
+            checkpoint->touchPhi       = phi;
+            checkpoint->touchR         = r;
+            checkpoint->touchIntensity = intensity;
+            checkpoint->accelX         = x;
+            checkpoint->accelY         = y;
+            checkpoint->accelZ         = z;
+
+            if (!ok)
+            {
+                freeEntry(entry);
+            }
+            return ok;
+        }
+
+        case FRAME_HASH:
+        {
+            uint8_t bytes[8];
+            if (sizeof(bytes) != fread(bytes, 1, sizeof(bytes), replay.file))
+            {
+                return false;
+            }
+
+            entry->hashVal = 0;
+            for (int8_t i = 7; i >= 0; i--)
+            {
+                entry->hashVal = (entry->hashVal << 8) | bytes[i];
+            }
+            break;
+        }
+
+        default:
+        {
+            printf("ERR: Unknown record type %d in recording\n", type);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write an entry to the recording, in whichever format it is
+ *
+ * @param entry The entry to write
+ */
 static void writeEntry(const replayEntry_t* entry)
+{
+    if (FORMAT_BINARY == replay.format)
+    {
+        writeBinaryEntry(entry);
+    }
+    else
+    {
+        writeCsvEntry(entry);
+    }
+}
+
+static void writeCsvEntry(const replayEntry_t* entry)
 {
     char buffer[256];
     char* ptr = buffer;
@@ -752,54 +1242,749 @@ static void writeEntry(const replayEntry_t* entry)
             snprintf(ptr, BUFSIZE, "%" PRIu32 "\n", entry->seedVal);
             break;
         }
+
+        case FRAME:
+        case CHECKPOINT:
+        case INDEX:
+        case FRAME_HASH:
+        {
+            // Only in binary recordings
+            return;
+        }
     }
 
     fwrite(buffer, 1, strlen(buffer), replay.file);
 }
 
 /**
- * @brief Begins recording emulator inputs to the given filename
+ * @brief Write an entry to a binary recording
  *
- * @param filename The name of the recording file to write
+ * Entries written while a frame is being recorded are added to that frame. Entries written between frames, like
+ * screenshots and the random seed, are held until the next frame so they keep their place in time.
+ *
+ * @param entry The entry to write
  */
-void startRecording(const char* filename)
+static void writeBinaryEntry(const replayEntry_t* entry)
 {
-    if (replay.file != NULL)
-    {
-        fclose(replay.file);
-        replay.file = NULL;
-    }
+    replayBuf_t* buf = replay.inFrame ? &replay.frameBuf : &replay.pendingBuf;
 
-    char buf[128];
-    if (!filename || !*filename)
-    {
-        filename = getTimestampFilename(buf, sizeof(buf) - 1, "rec-", "csv");
-    }
+    // Where this record will be in the file, if it's part of the current frame
+    uint64_t offset = replay.fileOffset + buf->len;
 
-    // If specified, use custom filename, otherwise use timestamp one
-    printf("\nReplay: Recording inputs to file %s\n", filename);
-    replay.file = fopen(filename, "w");
-    replay.mode = RECORD;
-    if (replay.file != NULL)
+    bufPutByte(buf, entry->type);
+
+    switch (entry->type)
     {
-        if (emulatorArgs.startMode)
+        case FRAME:
         {
-            if (!replay.headerHandled)
+            replay.frameCount++;
+            if (0 == (replay.frameCount - 1) % INDEX_INTERVAL)
             {
-                replay.headerHandled = true;
-                fwrite(HEADER, 1, strlen(HEADER), replay.file);
+                addIndexEntry(replay.frameCount, entry->time, offset, false);
             }
 
-            // Immediately record the start mode
-            replayEntry_t modeEntry = {
-                .type     = SET_MODE,
-                .time     = 0,
-                .modeName = emulatorArgs.startMode,
-            };
-            writeEntry(&modeEntry);
+            bufPutSigned(buf, entry->time - replay.frameTime);
+            replay.frameTime = entry->time;
+            break;
         }
 
-        if (emulatorArgs.seed)
+        case BUTTON_PRESS:
+        case BUTTON_RELEASE:
+        {
+            uint8_t i = 0;
+            while ((1 << i) != entry->buttonVal && i < 7)
+            {
+                i++;
+            }
+            bufPutByte(buf, i);
+            break;
+        }
+
+        case TOUCH_PHI:
+        case TOUCH_R:
+        case TOUCH_INTENSITY:
+        {
+            bufPutSigned(buf, entry->touchVal);
+            break;
+        }
+
+        case ACCEL_X:
+        case ACCEL_Y:
+        case ACCEL_Z:
+        {
+            bufPutSigned(buf, entry->accelVal);
+            break;
+        }
+
+        case FUZZ:
+        case QUIT:
+        case INDEX:
+        {
+            break;
+        }
+
+        case SCREENSHOT:
+        {
+            bufPutString(buf, entry->filename);
+            break;
+        }
+
+        case SET_MODE:
+        {
+            bufPutString(buf, entry->modeName);
+            break;
+        }
+
+        case RANDOM_SEED:
+        {
+            bufPutVarint(buf, entry->seedVal);
+            break;
+        }
+
+        case FRAME_HASH:
+        {
+            // Hashes are random, so a varint would usually be longer
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                bufPutByte(buf, (entry->hashVal >> (8 * i)) & 0xFF);
+            }
+            break;
+        }
+
+        case CHECKPOINT:
+        {
+            const replayCheckpoint_t* checkpoint = entry->checkpoint;
+            addIndexEntry(checkpoint->frame, checkpoint->time, offset, true);
+
+            bufPutVarint(buf, checkpoint->frame);
+            bufPutSigned(buf, checkpoint->time);
+            bufPutVarint(buf, checkpoint->rngSeeded ? 1 : 0);
+            bufPutVarint(buf, checkpoint->rngSeed);
+            bufPutVarint(buf, checkpoint->rngDraws);
+            bufPutString(buf, checkpoint->modeName);
+            bufPutString(buf, checkpoint->nvsImage);
+            bufPutByte(buf, checkpoint->buttons);
+            bufPutSigned(buf, checkpoint->touchPhi);
+            bufPutSigned(buf, checkpoint->touchR);
+            bufPutSigned(buf, checkpoint->touchIntensity);
+            bufPutSigned(buf, checkpoint->accelX);
+            bufPutSigned(buf, checkpoint->accelY);
+            bufPutSigned(buf, checkpoint->accelZ);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Free anything which was allocated for an entry when it was read
+ *
+ * @param entry The entry to free the contents of
+ */
+static void freeEntry(replayEntry_t* entry)
+{
+    switch (entry->type)
+    {
+        case SCREENSHOT:
+        {
+            free(entry->filename);
+            entry->filename = NULL;
+            break;
+        }
+
+        case SET_MODE:
+        {
+            free(entry->modeName);
+            entry->modeName = NULL;
+            break;
+        }
+
+        case CHECKPOINT:
+        {
+            if (NULL != entry->checkpoint)
+            {
+                free(entry->checkpoint->modeName);
+                free(entry->checkpoint->nvsImage);
+                free(entry->checkpoint);
+                entry->checkpoint = NULL;
+            }
+            break;
+        }
+
+        default:
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Append bytes to a buffer, growing it if needed
+ *
+ * @param buf The buffer to append to
+ * @param data The bytes to append
+ * @param len The number of bytes to append
+ */
+static void bufPut(replayBuf_t* buf, const void* data, size_t len)
+{
+    if (0 == len)
+    {
+        return;
+    }
+
+    if (buf->len + len > buf->cap)
+    {
+        size_t newCap = buf->cap ? buf->cap : 256;
+        while (newCap < buf->len + len)
+        {
+            newCap *= 2;
+        }
+
+        uint8_t* newData = realloc(buf->data, newCap);
+        if (NULL == newData)
+        {
+            printf("ERR: Replay: Out of memory\n");
+            return;
+        }
+        buf->data = newData;
+        buf->cap  = newCap;
+    }
+
+    memcpy(&buf->data[buf->len], data, len);
+    buf->len += len;
+}
+
+/**
+ * @brief Append a single byte to a buffer
+ *
+ * @param buf The buffer to append to
+ * @param val The byte to append
+ */
+static void bufPutByte(replayBuf_t* buf, uint8_t val)
+{
+    bufPut(buf, &val, 1);
+}
+
+/**
+ * @brief Append an unsigned integer to a buffer, seven bits per byte. The high bit of each byte is set if there are
+ * more bytes to follow
+ *
+ * @param buf The buffer to append to
+ * @param val The value to append
+ */
+static void bufPutVarint(replayBuf_t* buf, uint64_t val)
+{
+    uint8_t bytes[10];
+    size_t len = 0;
+    do
+    {
+        bytes[len] = val & 0x7F;
+        val >>= 7;
+        if (val)
+        {
+            bytes[len] |= 0x80;
+        }
+        len++;
+    } while (val);
+
+    bufPut(buf, bytes, len);
+}
+
+/**
+ * @brief Append a signed integer to a buffer. It is zigzag encoded first, so small negative values are short too
+ *
+ * @param buf The buffer to append to
+ * @param val The value to append
+ */
+static void bufPutSigned(replayBuf_t* buf, int64_t val)
+{
+    bufPutVarint(buf, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+/**
+ * @brief Append a string to a buffer, prefixed with its length. NULL and empty strings are both written as length 0
+ *
+ * @param buf The buffer to append to
+ * @param str The string to append, or NULL
+ */
+static void bufPutString(replayBuf_t* buf, const char* str)
+{
+    size_t len = str ? strlen(str) : 0;
+    bufPutVarint(buf, len);
+    bufPut(buf, str, len);
+}
+
+/**
+ * @brief Read an integer written by bufPutVarint() from the recording
+ *
+ * @param[out] out The value which was read
+ * @return true if a value was read, false at the end of the file or if the value is too long
+ */
+static bool readVarint(uint64_t* out)
+{
+    uint64_t val = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = fgetc(replay.file);
+        if (EOF == c)
+        {
+            return false;
+        }
+
+        val |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            *out = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Read an integer written by bufPutSigned() from the recording
+ *
+ * @param[out] out The value which was read
+ * @return true if a value was read, false otherwise
+ */
+static bool readSigned(int64_t* out)
+{
+    uint64_t val;
+    if (!readVarint(&val))
+    {
+        return false;
+    }
+    *out = (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+    return true;
+}
+
+/**
+ * @brief Read a string written by bufPutString() from the recording
+ *
+ * @param[out] out A newly allocated string, or NULL if the string was empty
+ * @return true if the string was read, false otherwise
+ */
+static bool readString(char** out)
+{
+    uint64_t len;
+    *out = NULL;
+    if (!readVarint(&len) || len > MAX_BINARY_STRING)
+    {
+        return false;
+    }
+
+    if (0 == len)
+    {
+        return true;
+    }
+
+    char* str = malloc(len + 1);
+    if (NULL == str)
+    {
+        return false;
+    }
+
+    if (len != fread(str, 1, len, replay.file))
+    {
+        free(str);
+        return false;
+    }
+    str[len] = '\0';
+
+    *out = str;
+    return true;
+}
+
+/**
+ * @brief Add a position to the index of a binary recording
+ *
+ * @param frame The frame number
+ * @param time The time of the frame
+ * @param offset The offset of the record in the file
+ * @param checkpoint true if the record is a checkpoint, false if it is a frame
+ */
+static void addIndexEntry(uint64_t frame, int64_t time, uint64_t offset, bool checkpoint)
+{
+    if (replay.indexLen == replay.indexCap)
+    {
+        uint32_t newCap                = replay.indexCap ? replay.indexCap * 2 : 64;
+        replayIndexEntry_t* newEntries = realloc(replay.index, newCap * sizeof(replayIndexEntry_t));
+        if (NULL == newEntries)
+        {
+            return;
+        }
+        replay.index    = newEntries;
+        replay.indexCap = newCap;
+    }
+
+    replay.index[replay.indexLen++] = (replayIndexEntry_t){
+        .frame      = frame,
+        .time       = time,
+        .offset     = offset,
+        .checkpoint = checkpoint,
+    };
+}
+
+/**
+ * @brief Record everything needed to start playing back from the current frame
+ */
+static void writeCheckpoint(void)
+{
+    unsigned int seed;
+    replayCheckpoint_t checkpoint = {
+        .frame          = replay.frameCount,
+        .time           = replay.frameTime,
+        .modeName       = emulatorArgs.startMode ? strdup(emulatorArgs.startMode) : NULL,
+        .nvsImage       = emuNvsGetImage(),
+        .buttons        = replay.lastButtons,
+        .touchPhi       = replay.lastTouchPhi,
+        .touchR         = replay.lastTouchR,
+        .touchIntensity = replay.lastTouchIntensity,
+        .accelX         = replay.lastAccelX,
+        .accelY         = replay.lastAccelY,
+        .accelZ         = replay.lastAccelZ,
+    };
+    checkpoint.rngSeeded = emulatorGetEspRandomState(&seed, &checkpoint.rngDraws);
+    checkpoint.rngSeed   = seed;
+
+    replayEntry_t entry = {
+        .time       = replay.frameTime,
+        .type       = CHECKPOINT,
+        .checkpoint = &checkpoint,
+    };
+    writeEntry(&entry);
+
+    free(checkpoint.modeName);
+    free(checkpoint.nvsImage);
+}
+
+/**
+ * @brief Restore the emulator state from a checkpoint. The touchpad and accelerometer are restored by the caller
+ *
+ * @param checkpoint The checkpoint to restore
+ */
+static void applyCheckpoint(const replayCheckpoint_t* checkpoint)
+{
+    if (NULL != checkpoint->nvsImage)
+    {
+        if (emuNvsSetImage(checkpoint->nvsImage))
+        {
+            printf("Replay: Restored NVS from the recording, the NVS file will not be changed\n");
+        }
+        else
+        {
+            printf("ERR: Replay: Couldn't restore NVS from the recording\n");
+        }
+    }
+
+    if (checkpoint->rngSeeded)
+    {
+        emulatorSetEspRandomState(checkpoint->rngSeed, checkpoint->rngDraws);
+    }
+
+    // Restart the mode so it loads the restored NVS
+    if (NULL != checkpoint->modeName && !emulatorSetSwadgeModeByName(checkpoint->modeName))
+    {
+        printf("ERR: Replay: Can't find mode '%s'!\n", checkpoint->modeName);
+    }
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        buttonBit_t btn = (1 << i);
+        if ((checkpoint->buttons & btn) != (replay.lastButtons & btn))
+        {
+            emulatorInjectButton(btn, (checkpoint->buttons & btn) == btn);
+        }
+    }
+    replay.lastButtons = checkpoint->buttons;
+}
+
+/**
+ * @brief Load the index of a binary recording. If the recording has no index because the emulator didn't exit
+ * cleanly, it is rebuilt by reading every record. The file position is restored afterward.
+ */
+static void loadIndex(void)
+{
+    long start = ftell(replay.file);
+
+    replay.indexLen    = 0;
+    replay.totalFrames = 0;
+
+    bool loaded = false;
+    uint8_t trailer[TRAILER_SIZE];
+    if (0 == fseek(replay.file, -TRAILER_SIZE, SEEK_END) && TRAILER_SIZE == fread(trailer, 1, TRAILER_SIZE, replay.file)
+        && !memcmp(&trailer[8], TRAILER_MAGIC, 4))
+    {
+        uint64_t indexOffset = 0;
+        for (int8_t i = 7; i >= 0; i--)
+        {
+            indexOffset = (indexOffset << 8) | trailer[i];
+        }
+
+        uint64_t count;
+        if (0 == fseek(replay.file, indexOffset, SEEK_SET) && INDEX == fgetc(replay.file)
+            && readVarint(&replay.totalFrames) && readVarint(&count))
+        {
+            loaded = true;
+            for (uint64_t i = 0; i < count && loaded; i++)
+            {
+                replayIndexEntry_t entry;
+                uint64_t checkpoint;
+                loaded = readVarint(&entry.frame) && readSigned(&entry.time) && readVarint(&entry.offset)
+                         && readVarint(&checkpoint);
+                if (loaded)
+                {
+                    addIndexEntry(entry.frame, entry.time, entry.offset, 0 != checkpoint);
+                }
+            }
+        }
+    }
+
+    if (!loaded)
+    {
+        printf("Replay: Recording has no index, scanning it\n");
+        replay.indexLen    = 0;
+        replay.totalFrames = 0;
+
+        fseek(replay.file, start, SEEK_SET);
+        long offset         = start;
+        replayEntry_t entry = {0};
+        while (readBinaryEntry(&entry))
+        {
+            if (FRAME == entry.type)
+            {
+                replay.totalFrames++;
+                if (0 == (replay.totalFrames - 1) % INDEX_INTERVAL)
+                {
+                    addIndexEntry(replay.totalFrames, entry.time, offset, false);
+                }
+            }
+            else if (CHECKPOINT == entry.type)
+            {
+                addIndexEntry(entry.checkpoint->frame, entry.checkpoint->time, offset, true);
+            }
+
+            freeEntry(&entry);
+            offset = ftell(replay.file);
+        }
+    }
+
+    fseek(replay.file, start, SEEK_SET);
+    replay.frameTime = 0;
+}
+
+/**
+ * @brief Finish the current recording. Binary recordings get their index and trailer written. This is registered with
+ * atexit()
+ */
+static void finishRecording(void)
+{
+    if (RECORD != replay.mode || NULL == replay.file)
+    {
+        return;
+    }
+
+    if (FORMAT_BINARY == replay.format)
+    {
+        // Anything recorded after the last frame belongs to it
+        fwrite(replay.pendingBuf.data, 1, replay.pendingBuf.len, replay.file);
+        replay.fileOffset += replay.pendingBuf.len;
+        replay.pendingBuf.len = 0;
+
+        uint64_t indexOffset = replay.fileOffset;
+        replayBuf_t* buf     = &replay.frameBuf;
+        buf->len             = 0;
+
+        bufPutByte(buf, INDEX);
+        bufPutVarint(buf, replay.frameCount);
+        bufPutVarint(buf, replay.indexLen);
+        for (uint32_t i = 0; i < replay.indexLen; i++)
+        {
+            bufPutVarint(buf, replay.index[i].frame);
+            bufPutSigned(buf, replay.index[i].time);
+            bufPutVarint(buf, replay.index[i].offset);
+            bufPutVarint(buf, replay.index[i].checkpoint ? 1 : 0);
+        }
+
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            bufPutByte(buf, (indexOffset >> (8 * i)) & 0xFF);
+        }
+        bufPut(buf, TRAILER_MAGIC, 4);
+
+        fwrite(buf->data, 1, buf->len, replay.file);
+        buf->len = 0;
+    }
+
+    fclose(replay.file);
+    replay.file = NULL;
+}
+
+/**
+ * @brief Hash the display. This is FNV-1a over 64 bit words instead of bytes, for speed, followed by a final mix so
+ * every bit of the hash depends on every pixel.
+ *
+ * @param pixels The display's framebuffer, ::TFT_WIDTH * ::TFT_HEIGHT pixels
+ * @return The 64 bit hash of the display
+ */
+static uint64_t hashDisplay(const paletteColor_t* pixels)
+{
+    const size_t len = TFT_WIDTH * TFT_HEIGHT;
+    uint64_t hash    = 0xcbf29ce484222325ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        // Assemble the word byte by byte, so the hash doesn't depend on the host's byte order
+        uint64_t word = 0;
+        for (int8_t b = 7; b >= 0; b--)
+        {
+            word = (word << 8) | pixels[i + b];
+        }
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < len; i++)
+    {
+        hash = (hash ^ pixels[i]) * 0x100000001b3ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @brief Check the display against a hash from the recording. If it doesn't match, the display and the last display
+ * which did match are written to PNG files, and the emulator quits with an error.
+ *
+ * @param expected The hash from the recording
+ */
+static void verifyFrameHash(uint64_t expected)
+{
+    const paletteColor_t* display = getLastTftBitmap();
+    if (NULL == display)
+    {
+        return;
+    }
+
+    uint64_t actual = hashDisplay(display);
+    if (actual == expected)
+    {
+        if (NULL == replay.lastMatch)
+        {
+            replay.lastMatch = malloc(TFT_WIDTH * TFT_HEIGHT);
+        }
+        if (NULL != replay.lastMatch)
+        {
+            memcpy(replay.lastMatch, display, TFT_WIDTH * TFT_HEIGHT);
+            replay.lastMatchFrame = replay.frameCount;
+        }
+        replay.hashesMatched++;
+        return;
+    }
+
+    printf("ERR: Replay: The display at frame %" PRIu64 " doesn't match the recording (expected %016" PRIx64
+           ", got %016" PRIx64 ")\n",
+           replay.frameCount, expected, actual);
+
+    char name[64];
+    snprintf(name, sizeof(name), "verify-frame-%" PRIu64 "-actual.png", replay.frameCount);
+    if (writeTftPng(name, display))
+    {
+        printf("Replay: Wrote the display to %s\n", name);
+    }
+
+    if (NULL != replay.lastMatch)
+    {
+        snprintf(name, sizeof(name), "verify-frame-%" PRIu64 "-last-match.png", replay.lastMatchFrame);
+        if (writeTftPng(name, replay.lastMatch))
+        {
+            printf("Replay: Wrote the last matching display to %s\n", name);
+        }
+    }
+
+    // Drawing the frames after this one would only hide where things went wrong
+    replay.readCompleted = true;
+    emulatorSkipRendering(false);
+    emulatorQuitWithError();
+}
+
+/**
+ * @brief Begins recording emulator inputs to the given filename
+ *
+ * Recordings are binary unless the filename ends in \c .csv
+ *
+ * @param filename The name of the recording file to write
+ */
+void startRecording(const char* filename)
+{
+    static bool atExitRegistered = false;
+
+    finishRecording();
+    if (replay.file != NULL)
+    {
+        fclose(replay.file);
+        replay.file = NULL;
+    }
+
+    replay.headerHandled  = false;
+    replay.frameCount     = 0;
+    replay.frameTime      = 0;
+    replay.fileOffset     = 0;
+    replay.indexLen       = 0;
+    replay.pendingBuf.len = 0;
+
+    char buf[128];
+    if (!filename || !*filename)
+    {
+        filename = getTimestampFilename(buf, sizeof(buf) - 1, "rec-", "rpl");
+    }
+
+    size_t nameLen = strlen(filename);
+    replay.format  = (nameLen >= 4 && !strcasecmp(&filename[nameLen - 4], ".csv")) ? FORMAT_CSV : FORMAT_BINARY;
+
+    // If specified, use custom filename, otherwise use timestamp one
+    printf("\nReplay: Recording inputs to file %s\n", filename);
+    replay.file = fopen(filename, (FORMAT_BINARY == replay.format) ? "wb" : "w");
+    replay.mode = RECORD;
+    if (replay.file != NULL)
+    {
+        if (FORMAT_BINARY == replay.format)
+        {
+            uint8_t header[BINARY_HEADER_SIZE] = {0};
+            memcpy(header, BINARY_MAGIC, 4);
+            header[4] = BINARY_VERSION;
+            fwrite(header, 1, sizeof(header), replay.file);
+            replay.fileOffset = sizeof(header);
+
+            // There's no CSV header to write
+            replay.headerHandled = true;
+
+            if (!atExitRegistered)
+            {
+                atExitRegistered = true;
+                atexit(finishRecording);
+            }
+        }
+
+        if (emulatorArgs.startMode)
+        {
+            if (!replay.headerHandled)
+            {
+                replay.headerHandled = true;
+                fwrite(HEADER, 1, strlen(HEADER), replay.file);
+            }
+
+            // Immediately record the start mode
+            replayEntry_t modeEntry = {
+                .type     = SET_MODE,
+                .time     = 0,
+                .modeName = emulatorArgs.startMode,
+            };
+            writeEntry(&modeEntry);
+        }
+
+        if (emulatorArgs.seed != UINT32_MAX)
         {
             if (!replay.headerHandled)
             {
@@ -819,7 +2004,7 @@ void startRecording(const char* filename)
 }
 
 /**
- * @brief Begins playing back emulator inputs from the given file
+ * @brief Begins playing back emulator inputs from the given file. Binary and CSV recordings are both supported
  *
  * @param recordingName The name of the recording file to play back
  */
@@ -832,11 +2017,54 @@ void startPlayback(const char* recordingName)
     }
 
     printf("\nReplay: Replaying inputs from file %s\n", recordingName);
-    replay.file = fopen(recordingName, "r");
-    replay.mode = REPLAY;
+    replay.file          = fopen(recordingName, "rb");
+    replay.mode          = REPLAY;
+    replay.format        = FORMAT_CSV;
+    replay.headerHandled = false;
+    replay.readCompleted = false;
+    replay.frameCount    = 0;
+    replay.frameTime     = 0;
+
+    if (NULL == replay.file)
+    {
+        printf("ERR: Replay: Couldn't open %s\n", recordingName);
+        replay.readCompleted = true;
+        return;
+    }
+
+    uint8_t header[BINARY_HEADER_SIZE];
+    if (BINARY_HEADER_SIZE == fread(header, 1, BINARY_HEADER_SIZE, replay.file) && !memcmp(header, BINARY_MAGIC, 4))
+    {
+        if (BINARY_VERSION != header[4])
+        {
+            printf("ERR: Replay: Unsupported recording version %" PRIu8 "\n", header[4]);
+            replay.readCompleted = true;
+            return;
+        }
+
+        replay.format = FORMAT_BINARY;
+        loadIndex();
+        printf("Replay: Recording has %" PRIu64 " frames\n", replay.totalFrames);
+
+        // The recorded frame times drive the clock
+        emuSetUseRealTime(false);
+    }
+    else
+    {
+        // Not a binary recording, so reopen it as text
+        replay.file = freopen(recordingName, "r", replay.file);
+        if (NULL == replay.file)
+        {
+            replay.readCompleted = true;
+            return;
+        }
+    }
 
     // Return true if the file was opened OK and has a valid header and first entry
-    readEntry(&replay.nextEntry);
+    if (!readEntry(&replay.nextEntry))
+    {
+        replay.readCompleted = true;
+    }
 }
 
 /**
@@ -11,7 +11,35 @@
  *
  * \section ext_format Recording File Format
  * If not given a custom name, recording files will be created in the current directory with the
- * name 'rec-TIMESTAMP.csv' As suggested by the name, this is simply a CSV file. The first line
+ * name 'rec-TIMESTAMP.rpl'. These are binary recordings, described below. Recordings with a name
+ * ending in '.csv' are written as CSV instead, which is easier to edit by hand.
+ *
+ * \section ext_binary Binary Format
+ * A binary recording starts with the magic bytes `SWRP`, a version byte, and three reserved bytes.
+ * The rest of the file is a series of records, each starting with a one-byte type. Integers are
+ * stored as little-endian base-128 varints, and signed integers are zigzag-encoded first. Strings
+ * are a varint length followed by that many bytes.
+ *
+ * Every emulator frame starts with a `Frame` record holding the time since the previous frame.
+ * Everything up to the next `Frame` record happens during that frame, so on playback the emulator
+ * clock is set from the recording and the inputs land on exactly the same frames. The first frame
+ * also has a `Checkpoint` record with the random number generator state, the NVS contents, the
+ * start mode, and the initial inputs.
+ *
+ * When the recording is finished, an `Index` record is written with the number of frames and the
+ * file offsets of every 256th frame and every checkpoint, followed by a 12 byte trailer: the
+ * offset of the index as a 64 bit little-endian integer, then `SWRX`. If the trailer is missing,
+ * the index is rebuilt on playback by reading every record. The index lets `--seek` check the
+ * target frame before playing the recording back without drawing.
+ *
+ * \section ext_frame_hash Display Hashes
+ * With `--frame-hash`, every frame (or every Nth frame) also gets a `FrameHash` record, which is a 64 bit hash of the
+ * display as the previous frame left it, stored as 8 little-endian bytes. With `--verify`, the display is checked
+ * against each hash on playback. At the first difference, the display and the last display which matched are written
+ * to PNG files and the emulator exits with an error, which makes a recording into a regression test for drawing code.
+ *
+ * \section ext_csv CSV Format
+ * The first line of a CSV recording
  * contains the header, which specifies three columns: Time, Type, and Value. The rest of the lines
  * will be the individual input values or special actions.
  *
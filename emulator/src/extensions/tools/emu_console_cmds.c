@@ -5,12 +5,16 @@
 #include "ext_tools.h"
 #include "emu_utils.h"
 #include "ext_replay.h"
+#include "dacProfiler.h"
+
+#include <string.h>
 
 // Console command handlers
 static int screenshotCommandCb(const char** args, int argCount, char* out);
 static int setModeCommandCb(const char** args, int argCount, char* out);
 static int recordCommandCb(const char** args, int argCount, char* out);
 static int replayCommandCb(const char** args, int argCount, char* out);
+static int audioProfileCommandCb(const char** args, int argCount, char* out);
 static int helpCommandCb(const char** args, int argCount, char* out);
 
 static const consoleCommand_t consoleCommands[] = {
@@ -18,6 +22,7 @@ static const consoleCommand_t consoleCommands[] = {
     {.name = "mode", .cb = setModeCommandCb},
     {.name = "record", .cb = recordCommandCb},
     {.name = "replay", .cb = replayCommandCb},
+    {.name = "audioprof", .cb = audioProfileCommandCb},
     {.name = "help", .cb = helpCommandCb},
 };
 
@@ -105,6 +110,41 @@ static int replayCommandCb(const char** args, int argCount, char* out)
     return sprintf(out, "Playback started");
 }
 
+static int audioProfileCommandCb(const char** args, int argCount, char* out)
+{
+    if (argCount > 0)
+    {
+        if (!strcmp(args[0], "on"))
+        {
+            dacProfilerEnable(true);
+            return sprintf(out, "Audio profiler enabled");
+        }
+        else if (!strcmp(args[0], "off"))
+        {
+            dacProfilerEnable(false);
+            return sprintf(out, "Audio profiler disabled");
+        }
+        else if (!strcmp(args[0], "reset"))
+        {
+            dacProfilerReset();
+            return sprintf(out, "Audio profiler reset");
+        }
+        else if (!strcmp(args[0], "log"))
+        {
+            dacProfilerLog();
+            return sprintf(out, "Audio profile written to log");
+        }
+
+        return sprintf(out, "Usage: audioprof [on|off|reset|log]");
+    }
+    else
+    {
+        // Toggle
+        dacProfilerEnable(!dacProfilerIsEnabled());
+        return sprintf(out, "Audio profiler %s", dacProfilerIsEnabled() ? "enabled" : "disabled");
+    }
+}
+
 static int helpCommandCb(const char** args, int argCount, char* out)
 {
     char* cur = out;
@@ -0,0 +1,477 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include "emu_screen_recorder.h"
+#include "color_utils.h"
+#include "macros.h"
+#include "gifenc.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The shortest GIF frame delay, in hundredths of a second, which viewers show as-is
+#define GIF_MIN_DELAY_CS 2
+
+/// @brief The radius of the transparent rounded corners, in pixels
+#define CORNER_RADIUS 40
+
+/// @brief How long the worker thread sleeps when the queue is empty, in microseconds
+#define WORKER_IDLE_US 1000
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A frame waiting in the queue
+ */
+typedef struct
+{
+    int64_t elapsedUs;      ///< The time since the previous queued frame
+    paletteColor_t* pixels; ///< The frame's pixels, recW * recH of them
+} screenRecFrame_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void screenRecorderStopAtExit(void);
+static void* screenRecorderWorker(void* arg);
+static void encodeGifFrame(const screenRecFrame_t* frame);
+static void finishGif(void);
+static void writeDumpFrame(const screenRecFrame_t* frame);
+static void writeLe(uint64_t val, uint8_t bytes);
+static void makeTransparent(uint8_t* framebuffer, uint16_t width, uint16_t height);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static bool recording = false;
+static screenRecFormat_t recFormat;
+static uint16_t recW;
+static uint16_t recH;
+static bool recRoundCorners;
+static pthread_t workerThread;
+
+static ge_GIF* gif    = NULL;
+static FILE* dumpFile = NULL;
+static screenRecStats_t recStats;
+
+/// @brief The queue's frames, and one block of memory for all their pixels
+static screenRecFrame_t queue[SCREEN_RECORDER_QUEUE_LEN];
+static paletteColor_t* queuePixels = NULL;
+
+/// @brief The number of frames ever queued. Only written by the main thread
+static atomic_uint queueHead;
+
+/// @brief The number of frames ever taken from the queue. Only written by the worker thread
+static atomic_uint queueTail;
+
+/// @brief Set by the main thread when the worker should finish the queued frames and exit
+static atomic_bool stopRequested;
+
+/// @brief The time of frames dropped since the last queued frame, which is added to the next queued frame
+static int64_t droppedUs = 0;
+
+// These are only used by the worker thread
+
+/// @brief The time of the newest frame since the start of the recording
+static int64_t recTimeUs = 0;
+
+/// @brief The time of the newest frame since the one before it
+static int64_t lastElapsedUs = 0;
+
+/// @brief The sum of all GIF frame delays written so far, in hundredths of a second
+static int64_t gifClockCs = 0;
+
+/// @brief Whether gif->frame holds a frame which hasn't been written yet
+static bool gifPending = false;
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Start recording the screen. Frames are added with screenRecorderAddFrame()
+ *
+ * @param filename The file to write to
+ * @param format The format to write
+ * @param width The width of every frame, in pixels
+ * @param height The height of every frame, in pixels
+ * @param roundCorners true to make the corners of GIF frames transparent, like the emulator display
+ * @return true if the recording was started, false if the file couldn't be opened or a recording is already running
+ */
+bool screenRecorderStart(const char* filename, screenRecFormat_t format, uint16_t width, uint16_t height,
+                         bool roundCorners)
+{
+    if (recording)
+    {
+        return false;
+    }
+
+    size_t frameSize = (size_t)width * height;
+    queuePixels      = malloc(SCREEN_RECORDER_QUEUE_LEN * frameSize);
+    if (NULL == queuePixels)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < SCREEN_RECORDER_QUEUE_LEN; i++)
+    {
+        queue[i].pixels = &queuePixels[i * frameSize];
+    }
+
+    uint8_t palette[256 * 3];
+    for (int i = 0; i < 256; i++)
+    {
+        uint8_t* rgbOut = &palette[i * 3];
+        if (i < cTransparent)
+        {
+            uint32_t rgb = paletteToRGB((paletteColor_t)i);
+            rgbOut[0]    = (rgb >> 16) & 0xFF;
+            rgbOut[1]    = (rgb >> 8) & 0xFF;
+            rgbOut[2]    = (rgb & 0xFF);
+        }
+        else
+        {
+            rgbOut[0] = 0;
+            rgbOut[1] = 0;
+            rgbOut[2] = 0;
+        }
+    }
+
+    recFormat       = format;
+    recW            = width;
+    recH            = height;
+    recRoundCorners = roundCorners;
+
+    if (SCREEN_REC_GIF == format)
+    {
+        gif = ge_new_gif(filename, width, height, palette, 8, cTransparent, 0);
+        if (NULL == gif)
+        {
+            free(queuePixels);
+            queuePixels = NULL;
+            return false;
+        }
+        gif->delta = 1;
+    }
+    else
+    {
+        dumpFile = fopen(filename, "wb");
+        if (NULL == dumpFile)
+        {
+            free(queuePixels);
+            queuePixels = NULL;
+            return false;
+        }
+
+        fwrite(SCREEN_DUMP_MAGIC, 1, 4, dumpFile);
+        writeLe(SCREEN_DUMP_VERSION, 1);
+        writeLe(0, 1);
+        writeLe(width, 2);
+        writeLe(height, 2);
+        fwrite(palette, 1, sizeof(palette), dumpFile);
+    }
+
+    memset(&recStats, 0, sizeof(recStats));
+    droppedUs     = 0;
+    recTimeUs     = 0;
+    lastElapsedUs = 0;
+    gifClockCs    = 0;
+    gifPending    = false;
+    atomic_store(&queueHead, 0);
+    atomic_store(&queueTail, 0);
+    atomic_store(&stopRequested, false);
+
+    if (0 != pthread_create(&workerThread, NULL, screenRecorderWorker, NULL))
+    {
+        if (gif)
+        {
+            ge_close_gif(gif);
+            gif = NULL;
+        }
+        if (dumpFile)
+        {
+            fclose(dumpFile);
+            dumpFile = NULL;
+        }
+        free(queuePixels);
+        queuePixels = NULL;
+        return false;
+    }
+
+    static bool atExitRegistered = false;
+    if (!atExitRegistered)
+    {
+        // Finish the file if the emulator exits while recording
+        atExitRegistered = true;
+        atexit(screenRecorderStopAtExit);
+    }
+
+    recording = true;
+    return true;
+}
+
+/**
+ * @brief Queue a frame to be recorded. This never waits for the worker thread. If the queue is full the frame is
+ * dropped, and its time is added to the next frame which is queued.
+ *
+ * @param pixels The frame to record, with the width and height given to screenRecorderStart()
+ * @param elapsedUs The time since the previous frame was added, or 0 for the first frame
+ */
+void screenRecorderAddFrame(const paletteColor_t* pixels, int64_t elapsedUs)
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    unsigned int head = atomic_load_explicit(&queueHead, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queueTail, memory_order_acquire);
+    if (head - tail >= SCREEN_RECORDER_QUEUE_LEN)
+    {
+        droppedUs += elapsedUs;
+        recStats.framesDropped++;
+        return;
+    }
+
+    screenRecFrame_t* frame = &queue[head & (SCREEN_RECORDER_QUEUE_LEN - 1)];
+    memcpy(frame->pixels, pixels, (size_t)recW * recH);
+    frame->elapsedUs = elapsedUs + droppedUs;
+    droppedUs        = 0;
+
+    // Publish the frame to the worker
+    atomic_store_explicit(&queueHead, head + 1, memory_order_release);
+    recStats.framesQueued++;
+}
+
+/**
+ * @brief Stop recording the screen. This waits for the worker thread to write all the queued frames
+ *
+ * @param[out] stats If not NULL, the recording's counters are written here
+ */
+void screenRecorderStop(screenRecStats_t* stats)
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    atomic_store(&stopRequested, true);
+    pthread_join(workerThread, NULL);
+
+    if (gif)
+    {
+        ge_close_gif(gif);
+        gif = NULL;
+    }
+
+    if (dumpFile)
+    {
+        fclose(dumpFile);
+        dumpFile = NULL;
+    }
+
+    free(queuePixels);
+    queuePixels = NULL;
+    recording   = false;
+
+    if (stats)
+    {
+        *stats = recStats;
+    }
+}
+
+/**
+ * @brief Get the number of frames in the queue which haven't been written yet
+ *
+ * @return The number of queued frames, up to ::SCREEN_RECORDER_QUEUE_LEN
+ */
+uint32_t screenRecorderQueued(void)
+{
+    return atomic_load(&queueHead) - atomic_load(&queueTail);
+}
+
+/**
+ * @brief Check if the screen is being recorded
+ *
+ * @return true if a recording was started and not stopped yet
+ */
+bool screenRecorderIsRecording(void)
+{
+    return recording;
+}
+
+/**
+ * @brief Stop recording when the program exits. This is registered with atexit()
+ */
+static void screenRecorderStopAtExit(void)
+{
+    screenRecorderStop(NULL);
+}
+
+/**
+ * @brief The worker thread, which writes queued frames until it is asked to stop and the queue is empty
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void* screenRecorderWorker(void* arg)
+{
+    while (true)
+    {
+        // Check for a stop first, so every frame queued before the stop is seen below
+        bool stop         = atomic_load(&stopRequested);
+        unsigned int tail = atomic_load_explicit(&queueTail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&queueHead, memory_order_acquire);
+
+        if (tail == head)
+        {
+            if (stop)
+            {
+                break;
+            }
+            usleep(WORKER_IDLE_US);
+            continue;
+        }
+
+        const screenRecFrame_t* frame = &queue[tail & (SCREEN_RECORDER_QUEUE_LEN - 1)];
+        if (SCREEN_REC_GIF == recFormat)
+        {
+            encodeGifFrame(frame);
+        }
+        else
+        {
+            writeDumpFrame(frame);
+        }
+
+        // Give the slot back to the main thread
+        atomic_store_explicit(&queueTail, tail + 1, memory_order_release);
+    }
+
+    if (SCREEN_REC_GIF == recFormat)
+    {
+        finishGif();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Add a frame to the GIF. Each frame is held until the next one arrives, since that's when its delay is known.
+ * A frame which would be shown for less than ::GIF_MIN_DELAY_CS is replaced by the next frame.
+ *
+ * @param frame The frame to add
+ */
+static void encodeGifFrame(const screenRecFrame_t* frame)
+{
+    recTimeUs += frame->elapsedUs;
+    lastElapsedUs = frame->elapsedUs;
+
+    if (gifPending)
+    {
+        // Round against the total, so rounding errors don't add up over a long recording
+        int64_t delayCs = (recTimeUs + 5000) / 10000 - gifClockCs;
+        if (delayCs >= GIF_MIN_DELAY_CS)
+        {
+            delayCs = MIN(delayCs, UINT16_MAX);
+            ge_add_frame(gif, delayCs);
+            gifClockCs += delayCs;
+            recStats.framesWritten++;
+        }
+        else
+        {
+            recStats.framesMerged++;
+        }
+    }
+
+    // After ge_add_frame() this is the other buffer, so it's always overwritten completely
+    memcpy(gif->frame, frame->pixels, (size_t)recW * recH);
+    if (recRoundCorners)
+    {
+        makeTransparent(gif->frame, recW, recH);
+    }
+    gifPending = true;
+}
+
+/**
+ * @brief Write the last frame of the GIF, shown for about as long as the frame before it
+ */
+static void finishGif(void)
+{
+    if (gifPending)
+    {
+        int64_t delayCs = (recTimeUs + lastElapsedUs + 5000) / 10000 - gifClockCs;
+        ge_add_frame(gif, CLAMP(delayCs, GIF_MIN_DELAY_CS, UINT16_MAX));
+        recStats.framesWritten++;
+        gifPending = false;
+    }
+}
+
+/**
+ * @brief Write a frame to the raw frame dump
+ *
+ * @param frame The frame to write
+ */
+static void writeDumpFrame(const screenRecFrame_t* frame)
+{
+    recTimeUs += frame->elapsedUs;
+    writeLe(recTimeUs, 8);
+    fwrite(frame->pixels, 1, (size_t)recW * recH, dumpFile);
+    recStats.framesWritten++;
+}
+
+/**
+ * @brief Write a little-endian integer to the raw frame dump
+ *
+ * @param val The value to write
+ * @param bytes The number of bytes to write
+ */
+static void writeLe(uint64_t val, uint8_t bytes)
+{
+    uint8_t buf[8];
+    for (uint8_t i = 0; i < bytes; i++)
+    {
+        buf[i] = (val >> (8 * i)) & 0xFF;
+    }
+    fwrite(buf, 1, bytes, dumpFile);
+}
+
+// This is copy-pasted a lot from plotRoundedCorners() but oh well it's pretty different
+static void makeTransparent(uint8_t* framebuffer, uint16_t width, uint16_t height)
+{
+    int r  = CORNER_RADIUS;
+    int or = r;
+    int x = -r, y = 0, err = 2 - 2 * r; /* bottom left to top right */
+    do
+    {
+        for (int xLine = 0; xLine <= (or +x); xLine++)
+        {
+            framebuffer[(height - (or -y) - 1) * width + (xLine)]             = cTransparent; /* I.   Quadrant -x -y */
+            framebuffer[(height - (or -y) - 1) * width + (width - xLine - 1)] = cTransparent; /* II.  Quadrant +x -y */
+            framebuffer[(or -y) * width + (xLine)]                            = cTransparent; /* III. Quadrant -x -y */
+            framebuffer[(or -y) * width + (width - xLine - 1)]                = cTransparent; /* IV.  Quadrant +x -y */
+        }
+
+        r = err;
+        if (r <= y)
+        {
+            err += ++y * 2 + 1; /* e_xy+e_y < 0 */
+        }
+        if (r > x || err > y) /* e_xy+e_x > 0 or no 2nd y-step */
+        {
+            err += ++x * 2 + 1; /* -> x-step now */
+        }
+    } while (x < 0);
+}
@@ -0,0 +1,65 @@
+/*! \file emu_screen_recorder.h
+ *
+ * \section emu_screen_recorder Screen Recorder
+ *
+ * The screen recorder writes emulator frames to an animated GIF or to a raw frame dump without slowing down the
+ * emulator. The main loop only copies each frame into a lock-free single-producer, single-consumer queue, and a worker
+ * thread does all the encoding and file I/O. If the worker falls behind and the queue is full, the frame is dropped
+ * and its duration is added to the next queued frame, so the emulated frame rate is never affected.
+ *
+ * GIF frames only encode the rectangle which changed since the previous frame, and unchanged pixels inside that
+ * rectangle are written as transparent so they compress well. GIF frame delays are in hundredths of a second and
+ * most viewers don't honor delays shorter than two hundredths, so frames which would be shown for less than that are
+ * replaced by the next frame. The total length of the GIF always matches the recorded time.
+ *
+ * A raw frame dump keeps every frame, uncompressed, with its timestamp. It can be converted to a GIF later with
+ * tools/screen_dump. The format is:
+ *
+ * - The header: ::SCREEN_DUMP_MAGIC, a version byte, a reserved byte, the width and height as 16 bit little-endian
+ *   integers, and the RGB palette, 256 * 3 bytes.
+ * - Each frame: the time since the start of the recording in microseconds as a 64 bit little-endian integer, followed
+ *   by width * height palette indices.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "palette.h"
+
+/// @brief The first bytes of a raw frame dump
+#define SCREEN_DUMP_MAGIC "SWSD"
+
+/// @brief The version of the raw frame dump format
+#define SCREEN_DUMP_VERSION 1
+
+/// @brief The size of the raw frame dump header, including the palette
+#define SCREEN_DUMP_HEADER_SIZE (10 + 256 * 3)
+
+/// @brief The number of frames which may wait to be encoded. This must be a power of two
+#define SCREEN_RECORDER_QUEUE_LEN 32
+
+typedef enum
+{
+    SCREEN_REC_GIF, ///< An animated GIF
+    SCREEN_REC_RAW, ///< A raw frame dump
+} screenRecFormat_t;
+
+/**
+ * @brief Counters which describe a finished or ongoing screen recording
+ */
+typedef struct
+{
+    uint32_t framesQueued;  ///< Frames passed to the worker thread
+    uint32_t framesDropped; ///< Frames dropped because the queue was full
+    uint32_t framesWritten; ///< Frames written to the file
+    uint32_t framesMerged;  ///< Frames too short for a GIF delay, which were replaced by the next frame
+} screenRecStats_t;
+
+bool screenRecorderStart(const char* filename, screenRecFormat_t format, uint16_t width, uint16_t height,
+                         bool roundCorners);
+void screenRecorderAddFrame(const paletteColor_t* pixels, int64_t elapsedUs);
+void screenRecorderStop(screenRecStats_t* stats);
+uint32_t screenRecorderQueued(void);
+bool screenRecorderIsRecording(void);
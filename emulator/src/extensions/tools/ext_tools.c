@@ -5,6 +5,7 @@
 #include "hdw-btn_emu.h"
 #include "hdw-imu.h"
 #include "hdw-imu_emu.h"
+#include "hdw-dac_emu.h"
 #include "macros.h"
 #include "emu_main.h"
 #include "ext_replay.h"
@@ -13,6 +14,8 @@
 #include "ext_modes.h"
 #include "emu_utils.h"
 #include "emu_console_cmds.h"
+#include "emu_screen_recorder.h"
+#include "color_utils.h"
 
 #if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ > 5))))
     #pragma GCC diagnostic push
@@ -29,8 +32,6 @@
     #pragma GCC diagnostic pop
 #endif
 
-#include "gifenc.h"
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,18 +43,27 @@
 #include "hdw-tft_emu.h"
 #include "esp_timer_emu.h"
 #include "swadge2024.h"
+#include "dacProfiler.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The minimum height of the audio profiler pane, enough for one line per section and a summary
+#define AUDIO_PROFILE_PANE_H 75
 
 //==============================================================================
 // Function Prototypes
 //==============================================================================
 
+static uint64_t getModeFrameTimeUs(void);
 static bool toolsInit(emuArgs_t* emuArgs);
 static int32_t toolsKeyCb(uint32_t keycode, bool down, modKey_t modifiers);
 static void toolsPreFrame(uint64_t frame);
 static void toolsPostFrame(uint64_t frame);
 static void toolsRenderCb(uint32_t winW, uint32_t winH, const emuPane_t* panes, uint8_t numPanes);
 static void handleConsoleCommand(const char* command);
-static void makeTransparent(uint8_t* framebuffer);
+static void drawAudioProfile(const emuPane_t* pane);
 
 static const char* getScreenshotName(char* buffer, size_t maxlen);
 
@@ -76,6 +86,9 @@ static bool useFakeTime       = false;
 static uint64_t fakeTime      = 0;
 static uint64_t fakeFrameTime = 0;
 
+/// @brief Whether the fake frame time follows the Swadge mode's frame rate, rather than a fixed rate
+static bool followFrameRate = false;
+
 static bool recordScreen           = false;
 static char recordingFilename[256] = {0};
 
@@ -92,6 +105,9 @@ static int frameEndIndex       = 0;
 static int64_t lastFrameTime = 0;
 static float lastFps         = 0.0;
 
+static bool showAudioProfile  = false;
+static int audioProfilePaneId = -1;
+
 static bool showConsole         = false;
 static int consolePaneId        = -1;
 static char consoleBuffer[1024] = {0};
@@ -103,6 +119,18 @@ static char consoleOutput[1024] = {0};
 // Functions
 //==============================================================================
 
+/**
+ * @brief Get the length of one of the Swadge mode's frames, for the fake clock to advance by
+ *
+ * @return The mode's frame time in microseconds, or ::DEFAULT_FRAME_RATE_US if the mode set its frame rate to 0 to run
+ * as fast as possible, so the fake clock never stops
+ */
+static uint64_t getModeFrameTimeUs(void)
+{
+    uint32_t frameRateUs = getFrameRateUs();
+    return (0 == frameRateUs) ? DEFAULT_FRAME_RATE_US : frameRateUs;
+}
+
 static bool toolsInit(emuArgs_t* emuArgs)
 {
     if (emuArgs->fakeTime)
@@ -113,10 +141,20 @@ static bool toolsInit(emuArgs_t* emuArgs)
         //
         fakeTime = 1;
 
-        // Calculate the frame time time in us from the FPS value
-        fakeFrameTime = (uint64_t)(1000000.0 / emulatorArgs.fakeFps);
+        if (0.0 == emuArgs->fakeFps)
+        {
+            // No frame rate was given, so advance by exactly one of the mode's frames every loop
+            followFrameRate = true;
+            fakeFrameTime   = getModeFrameTimeUs();
+            printf("Using fake frame rate that matches the Swadge mode\n");
+        }
+        else
+        {
+            // Calculate the frame time time in us from the FPS value
+            fakeFrameTime = (uint64_t)(1000000.0 / emulatorArgs.fakeFps);
 
-        printf("Using fake frame rate of %.1fFPS -- %" PRIu64 "us per frame\n", emuArgs->fakeFps, fakeFrameTime);
+            printf("Using fake frame rate of %.1fFPS -- %" PRIu64 "us per frame\n", emuArgs->fakeFps, fakeFrameTime);
+        }
     }
 
     if (emuArgs->showFps)
@@ -126,6 +164,13 @@ static bool toolsInit(emuArgs_t* emuArgs)
         frameStartTime = esp_timer_get_time();
     }
 
+    if (emuArgs->audioProfile)
+    {
+        audioProfilePaneId = requestPane(&toolsEmuExtension, PANE_BOTTOM, 30, AUDIO_PROFILE_PANE_H);
+        showAudioProfile   = true;
+        dacProfilerEnable(true);
+    }
+
     return true;
 }
 
@@ -222,6 +267,21 @@ static int32_t toolsKeyCb(uint32_t keycode, bool down, modKey_t modifiers)
             setPaneVisibility(&toolsEmuExtension, fpsPaneId, showFps);
         }
     }
+    else if (keycode == CNFG_KEY_F6)
+    {
+        // Toggle audio profiler
+        if (!down)
+        {
+            showAudioProfile = !showAudioProfile;
+            dacProfilerEnable(showAudioProfile);
+
+            if (showAudioProfile && audioProfilePaneId == -1)
+            {
+                audioProfilePaneId = requestPane(&toolsEmuExtension, PANE_BOTTOM, 30, AUDIO_PROFILE_PANE_H);
+            }
+            setPaneVisibility(&toolsEmuExtension, audioProfilePaneId, showAudioProfile);
+        }
+    }
     else if (keycode == CNFG_KEY_F9)
     {
         // Single-frame step
@@ -287,6 +347,7 @@ static int32_t toolsKeyCb(uint32_t keycode, bool down, modKey_t modifiers)
             {
                 fakeFrameTime += 1000;
             }
+            followFrameRate = false;
             printf("Frame time set to %" PRIu64 "\n", fakeFrameTime);
         }
     }
@@ -307,12 +368,14 @@ static int32_t toolsKeyCb(uint32_t keycode, bool down, modKey_t modifiers)
             {
                 fakeFrameTime -= 1000;
             }
+            followFrameRate = false;
             printf("Frame time set to %" PRIu64 "\n", fakeFrameTime);
         }
     }
     else if (useFakeTime && keycode == CNFG_KEY_HOME)
     {
-        fakeFrameTime = getFrameRateUs();
+        fakeFrameTime   = getModeFrameTimeUs();
+        followFrameRate = true;
     }
 
     return 0;
@@ -323,8 +386,25 @@ static void toolsPreFrame(uint64_t frame)
     // handle fake clock
     if (useFakeTime)
     {
-        emuSetEspTimerTime(fakeTime);
-        fakeTime += fakeFrameTime;
+        if (followFrameRate)
+        {
+            // The mode may change its frame rate at any time
+            fakeFrameTime = getModeFrameTimeUs();
+        }
+
+        // fakeTime is the start of the next frame. When fast-forwarding, stop the clock at any timer which expires
+        // before then, so timers are called at the right time instead of at the next frame
+        int64_t deadline;
+        if (emulatorArgs.fastForward && emuTimerNextDeadline(&deadline) && deadline > esp_timer_get_time()
+            && deadline < (int64_t)fakeTime)
+        {
+            emuSetEspTimerTime(deadline);
+        }
+        else
+        {
+            emuSetEspTimerTime(fakeTime);
+            fakeTime += fakeFrameTime;
+        }
     }
 
     if (pauseNextFrame)
@@ -362,127 +442,45 @@ static void toolsPreFrame(uint64_t frame)
 
 static void toolsPostFrame(uint64_t frame)
 {
-    static uint64_t index = 0;
-    static bool setup     = false;
-    static ge_GIF* gif    = NULL;
-
-    // Cumulative time of all GIF frames
-    static float gifTime = 0;
-    // Cumulative real time since first frame, from swadge perspective
-    static float realTime = 0;
-
-    // The time of the last GIF frame
-    static int64_t lastGifFrame   = 0;
-    static uint32_t skippedFrames = 0;
-    static uint32_t longFrames    = 0;
+    // The time the last frame was passed to the screen recorder
+    static int64_t lastRecordedFrame = 0;
 
-    if (recordScreen)
+    if (recordScreen && !screenRecorderIsRecording())
     {
-        static const paletteColor_t* fb = NULL;
-        if (!fb)
+        if (!recordingFilename[0])
         {
-            fb = getLastTftBitmap();
+            getTimestampFilename(recordingFilename, sizeof(recordingFilename) - 1, "screen-recording-",
+                                 emulatorArgs.screenDump ? "raw" : "gif");
         }
 
-        if (!setup)
-        {
-            if (!recordingFilename[0])
-            {
-                getTimestampFilename(recordingFilename, sizeof(recordingFilename) - 1, "screen-recording-", "gif");
-            }
-
-            uint8_t gifPalette[256 * 3];
-            for (int i = 0; i < 256; i++)
-            {
-                uint8_t* r = &gifPalette[i * 3];
-                uint8_t* g = &gifPalette[i * 3 + 1];
-                uint8_t* b = &gifPalette[i * 3 + 2];
+        size_t nameLen           = strlen(recordingFilename);
+        screenRecFormat_t format = (nameLen > 4 && !strcmp(&recordingFilename[nameLen - 4], ".raw")) ? SCREEN_REC_RAW
+                                                                                                     : SCREEN_REC_GIF;
 
-                if (i < cTransparent)
-                {
-                    uint32_t rgb = paletteToRGB((paletteColor_t)i);
-                    *r           = (rgb >> 16) & 0xFF;
-                    *g           = (rgb >> 8) & 0xFF;
-                    *b           = (rgb & 0xFF);
-                }
-                else
-                {
-                    *r = 0;
-                    *g = 0;
-                    *b = 0;
-                }
-            }
-
-            gif = ge_new_gif(recordingFilename, TFT_WIDTH, TFT_HEIGHT, gifPalette, 8, cTransparent, 0);
-            if (!gif)
-            {
-                printf("ERR! ext_tools.c: Unable to write to file %s for recording.\n", recordingFilename);
-                return;
-            }
-
-            index         = 0;
-            gifTime       = 0;
-            realTime      = 0;
-            skippedFrames = 0;
-            longFrames    = 0;
-            lastGifFrame  = esp_timer_get_time();
-            setup         = true;
-        }
-
-        int64_t frameNow       = esp_timer_get_time();
-        int64_t elapsedFrameUs = frameNow - lastGifFrame;
-
-        memcpy(gif->frame, fb, TFT_WIDTH * TFT_HEIGHT);
-
-        // Make the corners of the image transparent
-        makeTransparent(gif->frame);
-        float desiredFramerate = elapsedFrameUs / 10000.0;
-        uint16_t actualLength  = MAX(2, (int)(desiredFramerate));
-        // Cumulative time error, relative to the minimum frame time
-        // Use this to determine when to drop frames, as we cannot drop half a frame
-        float frameError = (gifTime - realTime) / ((float)actualLength * 10.0);
-        // Cumulative time error, relative to the minimum frame *STEP* time
-        // Use this to determine when a frame is too short, since we can always ADD a single step
-        float gifLengthError = (gifTime - realTime) / 10.0;
-
-        if (index != 0)
+        // Encoding happens on another thread, so recording doesn't slow down the emulator
+        if (!screenRecorderStart(recordingFilename, format, TFT_WIDTH, TFT_HEIGHT, true))
         {
-            realTime += elapsedFrameUs / 1000;
+            printf("ERR! ext_tools.c: Unable to write to file %s for recording.\n", recordingFilename);
+            recordScreen = false;
+            return;
         }
 
-        if (frameError <= 0.5)
-        {
-            if (index != 0)
-            {
-                if (gifLengthError <= -1)
-                {
-                    actualLength += (uint16_t)(-gifLengthError);
-                    longFrames++;
-                }
-
-                gifTime += actualLength * 10.0;
-            }
-            ge_add_frame(gif, actualLength);
-
-            // Only update the last frame time when we actually emit a frame!
-            lastGifFrame = frameNow;
+        lastRecordedFrame = esp_timer_get_time();
+    }
 
-            // Count frames
-            index++;
-        }
-        else
-        {
-            skippedFrames++;
-        }
+    if (recordScreen)
+    {
+        int64_t now = esp_timer_get_time();
+        screenRecorderAddFrame(getLastTftBitmap(), now - lastRecordedFrame);
+        lastRecordedFrame = now;
     }
-    else if (setup)
+    else if (screenRecorderIsRecording())
     {
-        ge_close_gif(gif);
-        gif = NULL;
+        screenRecStats_t stats;
+        screenRecorderStop(&stats);
 
-        printf("Done Recording! Wrote %" PRIu64 " frames to %s (dropped %" PRIu32 ", lengthened %" PRIu32 ")\n", index,
-               recordingFilename, skippedFrames, longFrames);
-        setup = false;
+        printf("Done Recording! Wrote %" PRIu32 " frames to %s (merged %" PRIu32 ", dropped %" PRIu32 ")\n",
+               stats.framesWritten, recordingFilename, stats.framesMerged, stats.framesDropped);
     }
 }
 
@@ -505,6 +503,10 @@ static void toolsRenderCb(uint32_t winW, uint32_t winH, const emuPane_t* panes,
             CNFGPenY = fpsPane->paneY + (fpsPane->paneH - h) / 2;
             CNFGDrawText(buf, 5);
         }
+        else if (paneId == audioProfilePaneId)
+        {
+            drawAudioProfile(&panes[i]);
+        }
     }
 
     if (showConsole)
@@ -553,6 +555,50 @@ static void toolsRenderCb(uint32_t winW, uint32_t winH, const emuPane_t* panes,
     }
 }
 
+/**
+ * @brief Draw the DAC profiler statistics, one line per section of the DAC path plus a summary line
+ *
+ * @param pane The pane to draw in
+ */
+static void drawAudioProfile(const emuPane_t* pane)
+{
+    const dacProfStats_t* stats = dacProfilerGetStats();
+
+    char lines[DAC_PROF_NUM_SECTIONS + 1][128];
+    for (int s = 0; s < DAC_PROF_NUM_SECTIONS; s++)
+    {
+        const dacProfSectionStats_t* sec = &stats->sections[s];
+        if (0 == sec->calls)
+        {
+            snprintf(lines[s], sizeof(lines[s]), "%-8s -", dacProfilerSectionName(s));
+        }
+        else
+        {
+            snprintf(lines[s], sizeof(lines[s]),
+                     "%-8s avg %3" PRIu32 "%%  max %3" PRIu32 "%%  over %" PRIu32 "  (%" PRIu64 " cyc)",
+                     dacProfilerSectionName(s), dacProfilerPercent(sec->totalCycles, sec->totalBudget),
+                     dacProfilerPercent(sec->maxCycles, sec->maxBudget), sec->histogram[DAC_PROF_HIST_BINS - 1],
+                     sec->totalCycles / sec->calls);
+        }
+    }
+    uint32_t ringFill, ringCapacity;
+    dacGetRingStats(&ringFill, &ringCapacity, NULL);
+    snprintf(lines[DAC_PROF_NUM_SECTIONS], sizeof(lines[0]),
+             "clipped %" PRIu32 "  late %" PRIu32 "  dropped %" PRIu32 "  ring %" PRIu32 "/%" PRIu32,
+             stats->clippedSamples, stats->lateRefills, stats->droppedBuffers, ringFill, ringCapacity);
+
+    CNFGColor(0xFFFFFFFF);
+    int lineH = pane->paneH / ARRAY_SIZE(lines);
+    for (int l = 0; l < ARRAY_SIZE(lines); l++)
+    {
+        int w, h;
+        CNFGGetTextExtents(lines[l], &w, &h, 2);
+        CNFGPenX = pane->paneX + 5;
+        CNFGPenY = pane->paneY + l * lineH + (lineH - h) / 2;
+        CNFGDrawText(lines[l], 2);
+    }
+}
+
 static void handleConsoleCommand(const char* command)
 {
     char tmpBuffer[sizeof(consoleBuffer)];
@@ -624,35 +670,6 @@ static void handleConsoleCommand(const char* command)
     }
 }
 
-// This is copy-pasted a lot from plotRoundedCorners() but oh well it's pretty different
-static void makeTransparent(uint8_t* framebuffer)
-{
-    int r  = 40;
-    int or = r;
-    int x = -r, y = 0, err = 2 - 2 * r; /* bottom left to top right */
-    do
-    {
-        for (int xLine = 0; xLine <= (or +x); xLine++)
-        {
-            framebuffer[(TFT_HEIGHT - (or -y) - 1) * TFT_WIDTH + (xLine)] = cTransparent; /* I.   Quadrant -x -y */
-            framebuffer[(TFT_HEIGHT - (or -y) - 1) * TFT_WIDTH + (TFT_WIDTH - xLine - 1)]
-                = cTransparent;                                                        /* II.  Quadrant +x -y */
-            framebuffer[(or -y) * TFT_WIDTH + (xLine)]                 = cTransparent; /* III. Quadrant -x -y */
-            framebuffer[(or -y) * TFT_WIDTH + (TFT_WIDTH - xLine - 1)] = cTransparent; /* IV.  Quadrant +x -y */
-        }
-
-        r = err;
-        if (r <= y)
-        {
-            err += ++y * 2 + 1; /* e_xy+e_y < 0 */
-        }
-        if (r > x || err > y) /* e_xy+e_x > 0 or no 2nd y-step */
-        {
-            err += ++x * 2 + 1; /* -> x-step now */
-        }
-    } while (x < 0);
-}
-
 static const char* getScreenshotName(char* buffer, size_t maxlen)
 {
     return getTimestampFilename(buffer, maxlen, "screenshot-", "png");
@@ -676,8 +693,17 @@ bool takeScreenshot(const char* name)
         emuTimerPause();
     }
 
-    // We need to swap some channels for PNG output
-    uint32_t converted[width * height];
+    // We need to swap some channels for PNG output. This is the size of the whole window, which is far too big for the
+    // stack or the mode's frame scratch arena, so it's allocated
+    uint32_t* converted = malloc(sizeof(uint32_t) * width * height);
+    if (NULL == converted)
+    {
+        if (!timerWasPaused)
+        {
+            emuTimerUnpause();
+        }
+        return false;
+    }
     for (int row = 0; row < height; row++)
     {
         for (int col = 0; col < width; col++)
@@ -716,6 +742,7 @@ bool takeScreenshot(const char* name)
     plotRoundedCorners(converted, width, height, (width / TFT_WIDTH) * 40, 0x000000);
 
     int res = stbi_write_png(name, width, height, 4, converted, width * sizeof(uint32_t));
+    free(converted);
 
     if (!timerWasPaused)
     {
@@ -725,11 +752,44 @@ bool takeScreenshot(const char* name)
     return 0 != res;
 }
 
+/**
+ * @brief Write a TFT framebuffer to a PNG file at its native size, without the emulator window's scaling or rounded
+ * corners. Unlike takeScreenshot(), this works when running headless.
+ *
+ * @param name The filename to write to
+ * @param pixels The framebuffer to write, ::TFT_WIDTH * ::TFT_HEIGHT pixels
+ * @return true If the PNG was successfully written
+ * @return false If there was an error writing the PNG
+ */
+bool writeTftPng(const char* name, const paletteColor_t* pixels)
+{
+    uint8_t* rgb = malloc(TFT_WIDTH * TFT_HEIGHT * 3);
+    if (NULL == rgb)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < TFT_WIDTH * TFT_HEIGHT; i++)
+    {
+        uint32_t col   = paletteToRGB(pixels[i]);
+        rgb[i * 3]     = (col >> 16) & 0xFF;
+        rgb[i * 3 + 1] = (col >> 8) & 0xFF;
+        rgb[i * 3 + 2] = col & 0xFF;
+    }
+
+    int res = stbi_write_png(name, TFT_WIDTH, TFT_HEIGHT, 3, rgb, TFT_WIDTH * 3);
+    free(rgb);
+
+    return 0 != res;
+}
+
 void startScreenRecording(const char* name)
 {
     if (name && *name)
     {
-        if (strlen(name) <= 4 || strncmp(name + strlen(name) - 4, ".gif", 4))
+        // Names ending in .raw are raw frame dumps, everything else is a GIF
+        if (strlen(name) <= 4
+            || (strncmp(name + strlen(name) - 4, ".gif", 4) && strncmp(name + strlen(name) - 4, ".raw", 4)))
         {
             snprintf(recordingFilename, sizeof(recordingFilename), "%s.gif", name);
         }
@@ -741,7 +801,8 @@ void startScreenRecording(const char* name)
     }
     else
     {
-        getTimestampFilename(recordingFilename, sizeof(recordingFilename), "screen-recording-", "gif");
+        getTimestampFilename(recordingFilename, sizeof(recordingFilename), "screen-recording-",
+                             emulatorArgs.screenDump ? "raw" : "gif");
     }
 
     recordScreen = true;
@@ -13,9 +13,12 @@
 
 #include <stddef.h>
 
+#include "palette.h"
+
 extern emuExtension_t toolsEmuExtension;
 
 bool takeScreenshot(const char* name);
+bool writeTftPng(const char* name, const paletteColor_t* pixels);
 void startScreenRecording(const char* name);
 void stopScreenRecording(void);
 bool isScreenRecording(void);
\ No newline at end of file
@@ -15,6 +15,9 @@ static bool seeded       = false;
 static bool seedValueSet = false;
 static unsigned int seed = 0;
 
+/// @brief The number of values drawn since the generator was last seeded
+static uint64_t draws = 0;
+
 uint32_t esp_random(void)
 {
     if (!seeded)
@@ -28,12 +31,14 @@ uint32_t esp_random(void)
 
         seeded = true;
         srand(seed);
+        draws = 0;
 
         printf("Random Seed: %" PRIu32 "\n", seed);
 
         emulatorRecordRandomSeed(seed);
     }
     uint32_t val = rand();
+    draws++;
     return val;
 }
 
@@ -44,6 +49,7 @@ void emulatorSetEspRandomSeed(uint32_t seed_)
     if (seedValueSet)
     {
         srand(seed);
+        draws = 0;
     }
 
     seedValueSet = true;
@@ -53,3 +59,35 @@ unsigned int emulatorGetEspRandomSeed(void)
 {
     return seed;
 }
+
+/**
+ * @brief Get the state of the random number generator, so it can be restored later
+ *
+ * @param[out] outSeed The seed the generator was last seeded with
+ * @param[out] outDraws The number of values drawn since it was seeded
+ * @return true if the generator has been seeded, false if it will be seeded when the first value is drawn
+ */
+bool emulatorGetEspRandomState(unsigned int* outSeed, uint64_t* outDraws)
+{
+    *outSeed  = seed;
+    *outDraws = draws;
+    return seeded;
+}
+
+/**
+ * @brief Restore the state of the random number generator by reseeding it and drawing the same number of values
+ *
+ * @param seed_ The seed to use
+ * @param drawCount The number of values to draw after seeding
+ */
+void emulatorSetEspRandomState(unsigned int seed_, uint64_t drawCount)
+{
+    seed         = seed_;
+    seedValueSet = true;
+    seeded       = true;
+    srand(seed);
+    for (draws = 0; draws < drawCount; draws++)
+    {
+        rand();
+    }
+}
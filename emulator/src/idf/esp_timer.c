@@ -16,12 +16,29 @@
 //==============================================================================
 
 static list_t* timerList                 = NULL;
+static esp_timer_handle_t* timerHeap     = NULL;
+static uint32_t timerHeapLen             = 0;
+static uint32_t timerHeapCap             = 0;
+static uint64_t timerSeq                 = 0;
+static int64_t lastCheckTime             = 0;
 static unsigned long boot_time_in_micros = 0;
 static unsigned long pause_start_micros  = 0;
 static unsigned long total_pause_micros  = 0;
 static bool useRealTime                  = true;
 static int64_t fakeTime                  = 0;
 
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static bool timerBefore(esp_timer_handle_t a, esp_timer_handle_t b);
+static void heapSet(uint32_t idx, esp_timer_handle_t timer);
+static void heapSiftUp(uint32_t idx);
+static void heapSiftDown(uint32_t idx);
+static void heapPush(esp_timer_handle_t timer);
+static void heapRemove(esp_timer_handle_t timer);
+static void armTimer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period);
+
 //==============================================================================
 // Functions
 //==============================================================================
@@ -61,6 +78,11 @@ esp_err_t esp_timer_deinit(void)
 {
     if (timerList)
     {
+        free(timerHeap);
+        timerHeap    = NULL;
+        timerHeapLen = 0;
+        timerHeapCap = 0;
+
         void* val;
         while (NULL != (val = shift(timerList)))
         {
@@ -126,13 +148,22 @@ esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer
     {
         // Allocate memory for a timer
         (*out_handle) = (esp_timer_handle_t)calloc(1, sizeof(struct esp_timer));
+
+        // Link the node
+        push(timerList, *out_handle);
+    }
+    else
+    {
+        // The handle is being reused, so make sure it isn't running. It's already linked
+        heapRemove(*out_handle);
     }
 
     // Initialize the timer
-    (*out_handle)->callback = create_args->callback;
-    (*out_handle)->arg      = create_args->arg;
-    (*out_handle)->alarm    = 0;
-    (*out_handle)->period   = 0;
+    (*out_handle)->callback   = create_args->callback;
+    (*out_handle)->arg        = create_args->arg;
+    (*out_handle)->alarm      = 0;
+    (*out_handle)->period     = 0;
+    (*out_handle)->heap_index = 0;
     if (create_args->skip_unhandled_events)
     {
         (*out_handle)->flags |= FL_SKIP_UNHANDLED_EVENTS;
@@ -149,9 +180,6 @@ esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer
     }
 #endif
 
-    // Link the node
-    push(timerList, *out_handle);
-
     return ESP_OK;
 }
 
@@ -168,6 +196,8 @@ esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer
  */
 esp_err_t esp_timer_delete(const esp_timer_handle_t timer)
 {
+    heapRemove(timer);
+
     for (node_t* node = timerList->first; NULL != node; node = node->next)
     {
         if (node->val == timer)
@@ -194,6 +224,7 @@ esp_err_t esp_timer_delete(const esp_timer_handle_t timer)
  */
 esp_err_t esp_timer_stop(esp_timer_handle_t timer)
 {
+    heapRemove(timer);
     timer->alarm  = 0;
     timer->period = 0;
     return ESP_OK;
@@ -213,8 +244,7 @@ esp_err_t esp_timer_stop(esp_timer_handle_t timer)
  */
 esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
 {
-    timer->alarm  = timeout_us;
-    timer->period = 0;
+    armTimer(timer, timeout_us, 0);
     return ESP_OK;
 }
 
@@ -233,53 +263,236 @@ esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
  */
 esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
 {
-    timer->alarm  = period;
-    timer->period = period;
+    armTimer(timer, period, period);
     return ESP_OK;
 }
 
 /**
- * @brief Check running timers and call any that expire
+ * @brief Returns status of a timer, active or not
+ *
+ * @param timer timer handle created using esp_timer_create
+ * @return
+ *      - 1 if timer is still active
+ *      - 0 if timer is not active.
+ */
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return 0 != timer->heap_index;
+}
+
+/**
+ * @brief Call every timer which has expired, in order of when they expire. Timers with the same alarm are called in
+ * the order they were started. Timers started by a callback are never called until the next check, even if they
+ * expire immediately.
  *
- * @param elapsed_us The elapsed time in microseconds since this was last called
+ * Only the expired timers are looked at, so this costs nothing when no timer has expired, however many are running.
  */
-void check_esp_timer(uint64_t elapsed_us)
+void check_esp_timer(void)
 {
-    if (0 == timerList->length)
+    int64_t now = esp_timer_get_time();
+
+    if (now < lastCheckTime)
     {
-        // Nothing linked, so return
-        return;
+        // The clock went backwards, e.g. a replay switched to recorded time. Keep the time each timer has left. Every
+        // alarm moves by the same amount, so the heap stays in order
+        int64_t shift = lastCheckTime - now;
+        for (uint32_t i = 0; i < timerHeapLen; i++)
+        {
+            timerHeap[i]->alarm = (timerHeap[i]->alarm > (uint64_t)shift) ? timerHeap[i]->alarm - shift : 0;
+        }
     }
+    lastCheckTime = now;
 
-    for (node_t* node = timerList->first; NULL != node; node = node->next)
+    // Timers started after this point, including periodic timers which are restarted, wait for the next check
+    uint64_t seqLimit = timerSeq;
+
+    while (timerHeapLen && (int64_t)timerHeap[0]->alarm <= now && timerHeap[0]->seq < seqLimit)
     {
-        bool timerExpired      = false;
-        esp_timer_handle_t tmr = node->val;
-        if (tmr->alarm > elapsed_us)
-        {
-            tmr->alarm -= elapsed_us;
+        esp_timer_handle_t tmr = timerHeap[0];
+        heapRemove(tmr);
 
-            if (0 == tmr->alarm)
+        if (tmr->period)
+        {
+            // Missed periods are skipped, so a periodic timer is called at most once per check
+            uint64_t nextAlarm = tmr->alarm + tmr->period;
+            if ((int64_t)nextAlarm <= now)
             {
-                // If it decrements to 0 exactly, expire
-                timerExpired = true;
+                nextAlarm = now + tmr->period;
             }
+            tmr->alarm = nextAlarm;
+            tmr->seq   = timerSeq++;
+            heapPush(tmr);
+        }
+
+        // Call the callback after the timer is rescheduled, so the callback can stop or restart it
+        tmr->callback(tmr->arg);
+    }
+}
+
+/**
+ * @brief Get when the next running timer expires. With a virtual clock, this lets the emulator skip straight to it.
+ *
+ * @param[out] deadlineUs Written with the emulator time of the next timer, in microseconds
+ * @return true if a timer is running, false if none are, in which case deadlineUs is not written
+ */
+bool emuTimerNextDeadline(int64_t* deadlineUs)
+{
+    if (0 == timerHeapLen)
+    {
+        return false;
+    }
+    *deadlineUs = timerHeap[0]->alarm;
+    return true;
+}
+
+/**
+ * @brief Start a timer, restarting it if it's already running
+ *
+ * @param timer The timer to start
+ * @param timeout_us The time until the timer expires, in microseconds
+ * @param period The period of the timer, or 0 for a one-shot timer
+ */
+static void armTimer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period)
+{
+    heapRemove(timer);
+
+    // Times are absolute, so a timer started between checks still expires exactly timeout_us from now
+    timer->alarm  = esp_timer_get_time() + timeout_us;
+    timer->period = period;
+    timer->seq    = timerSeq++;
+    heapPush(timer);
+}
+
+/**
+ * @brief Check if a timer expires before another. Ties are broken by the order the timers were started, so the order
+ * callbacks are called in never depends on the shape of the heap.
+ *
+ * @param a A timer
+ * @param b Another timer
+ * @return true if a expires first
+ */
+static bool timerBefore(esp_timer_handle_t a, esp_timer_handle_t b)
+{
+    if (a->alarm != b->alarm)
+    {
+        return a->alarm < b->alarm;
+    }
+    return a->seq < b->seq;
+}
+
+/**
+ * @brief Put a timer at a position in the heap and record the position in the timer
+ *
+ * @param idx The 0-based position in the heap
+ * @param timer The timer to put there
+ */
+static void heapSet(uint32_t idx, esp_timer_handle_t timer)
+{
+    timerHeap[idx]    = timer;
+    timer->heap_index = idx + 1;
+}
+
+/**
+ * @brief Move a timer toward the top of the heap until its parent expires before it
+ *
+ * @param idx The 0-based position of the timer to move
+ */
+static void heapSiftUp(uint32_t idx)
+{
+    esp_timer_handle_t timer = timerHeap[idx];
+    while (idx > 0)
+    {
+        uint32_t parent = (idx - 1) / 2;
+        if (!timerBefore(timer, timerHeap[parent]))
+        {
+            break;
+        }
+        heapSet(idx, timerHeap[parent]);
+        idx = parent;
+    }
+    heapSet(idx, timer);
+}
+
+/**
+ * @brief Move a timer toward the bottom of the heap until both its children expire after it
+ *
+ * @param idx The 0-based position of the timer to move
+ */
+static void heapSiftDown(uint32_t idx)
+{
+    esp_timer_handle_t timer = timerHeap[idx];
+    while (true)
+    {
+        uint32_t child = (2 * idx) + 1;
+        if (child >= timerHeapLen)
+        {
+            break;
+        }
+        if (child + 1 < timerHeapLen && timerBefore(timerHeap[child + 1], timerHeap[child]))
+        {
+            child++;
         }
-        else if (tmr->alarm)
+        if (!timerBefore(timerHeap[child], timer))
         {
-            // If there's less time on left than elapsed, expire
-            timerExpired = true;
+            break;
         }
+        heapSet(idx, timerHeap[child]);
+        idx = child;
+    }
+    heapSet(idx, timer);
+}
 
-        if (timerExpired)
+/**
+ * @brief Add a timer to the heap of running timers
+ *
+ * @param timer The timer to add, which must not be in the heap already
+ */
+static void heapPush(esp_timer_handle_t timer)
+{
+    if (timerHeapLen == timerHeapCap)
+    {
+        uint32_t newCap             = timerHeapCap ? timerHeapCap * 2 : 16;
+        esp_timer_handle_t* newHeap = realloc(timerHeap, newCap * sizeof(esp_timer_handle_t));
+        if (NULL == newHeap)
         {
-            // Call the callback
-            tmr->callback(tmr->arg);
-            // Reset the timer if periodic
-            if (tmr->period)
-            {
-                tmr->alarm = tmr->period;
-            }
+            ESP_LOGE("EMU", "Can't start timer, out of memory");
+            return;
+        }
+        timerHeap    = newHeap;
+        timerHeapCap = newCap;
+    }
+
+    heapSet(timerHeapLen, timer);
+    heapSiftUp(timerHeapLen++);
+}
+
+/**
+ * @brief Remove a timer from the heap of running timers, if it's in it
+ *
+ * @param timer The timer to remove
+ */
+static void heapRemove(esp_timer_handle_t timer)
+{
+    if (0 == timer->heap_index)
+    {
+        return;
+    }
+
+    uint32_t idx      = timer->heap_index - 1;
+    timer->heap_index = 0;
+
+    esp_timer_handle_t last = timerHeap[--timerHeapLen];
+    if (idx < timerHeapLen)
+    {
+        // Fill the hole with the last timer, then move it up or down to where it belongs
+        heapSet(idx, last);
+        if (idx > 0 && timerBefore(last, timerHeap[(idx - 1) / 2]))
+        {
+            heapSiftUp(idx);
+        }
+        else
+        {
+            heapSiftDown(idx);
         }
     }
 }
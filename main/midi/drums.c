@@ -5,9 +5,43 @@
 #include "midiUtil.h"
 #include "cnfs.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
 #define FREQ_HZ(whole)     (((whole) & 0xFFFFu) << 16)
 #define FREQ_HZ_FRAC(flhz) ((((uint32_t)(flhz)) << 16) | ((uint32_t)(((flhz) - ((float)((uint32_t)(flhz)))) * 65536.0)))
 
+/// @brief The first drum which is pre-rendered
+#define FIRST_TABLE_DRUM ACOUSTIC_BASS_DRUM_OR_LOW_BASS_DRUM
+/// @brief The number of drums which are pre-rendered for each drumkit
+#define NUM_TABLE_DRUMS (OPEN_TRIANGLE - FIRST_TABLE_DRUM + 1)
+
+/**
+ * @brief The pre-rendered sounds for every drum in a drumkit
+ */
+typedef struct
+{
+    /// @brief The drumkit function these tables were rendered from, or NULL if this slot is unused
+    percussionFunc_t playFunc;
+
+    /// @brief The drumkit data these tables were rendered with
+    void* data;
+
+    /// @brief A single allocation holding every drum's samples, back to back
+    int8_t* samples;
+
+    /// @brief The index of each drum's first sample in \c samples
+    uint32_t offsets[NUM_TABLE_DRUMS];
+
+    /// @brief The number of samples for each drum
+    uint32_t lengths[NUM_TABLE_DRUMS];
+} drumkitTables_t;
+
+static drumkitTables_t drumkitTables[DRUM_TABLE_MAX_KITS];
+
 static int8_t linearNoiseImpulse(uint32_t length, uint32_t idx, bool* done);
 static int8_t linearWaveImpulse(oscillatorShape_t shape, uq16_16 freq, uint32_t length, uint32_t idx, bool* done);
 static inline int8_t sampleWaveAt(uint32_t idx, oscillatorShape_t shape, uq16_16 freq);
@@ -15,6 +49,8 @@ static inline int8_t sampleTable(uint32_t idx, int8_t* table, uint16_t len, uq16
 static int16_t adrLerp(uint32_t tick, uint32_t attackTime, uint32_t decayTime, int16_t attackLevel, int16_t decayLevel);
 static uq16_16 freqLerp(uint32_t tick, uint32_t len, uq16_16 start, uq16_16 end);
 static uq16_16 tremolo(uint32_t tick, uint32_t period, uq16_16 freq, int8_t centRange);
+static uint32_t renderDrum(percussionFunc_t playFunc, void* data, percussionNote_t drum, int8_t* out, uint32_t maxLen);
+static drumkitTables_t* findDrumkitTables(const midiTimbre_t* drumkit);
 
 /**
  * @brief Return random noise sampled with a linearly decreasing volume
@@ -624,4 +660,135 @@ int8_t donutDrumkitFunc(percussionNote_t drum, uint32_t idx, bool* done, uint32_
     }
 
     return wave * volume >> 8;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Render a single drum by calling its function until it is done
+ *
+ * @param playFunc The drumkit function to call
+ * @param data The drumkit data to pass to \c playFunc
+ * @param drum The drum to render
+ * @param out The buffer to write samples to, or NULL to only measure the drum's length
+ * @param maxLen The maximum number of samples to render
+ * @return The number of samples rendered, including the one generated when the drum finished
+ */
+static uint32_t renderDrum(percussionFunc_t playFunc, void* data, percussionNote_t drum, int8_t* out, uint32_t maxLen)
+{
+    uint32_t scratch[4] = {0};
+    bool done           = false;
+    uint32_t idx        = 0;
+
+    while (!done && idx < maxLen)
+    {
+        int8_t sample = playFunc(drum, idx, &done, scratch, data);
+        if (out)
+        {
+            out[idx] = sample;
+        }
+        idx++;
+    }
+
+    return idx;
+}
+
+/**
+ * @brief Find the pre-rendered tables for a drumkit
+ *
+ * @param drumkit The drumkit timbre to find tables for
+ * @return The drumkit's tables, or NULL if it has not been pre-rendered
+ */
+static drumkitTables_t* findDrumkitTables(const midiTimbre_t* drumkit)
+{
+    for (int32_t i = 0; i < DRUM_TABLE_MAX_KITS; i++)
+    {
+        if (drumkitTables[i].playFunc == drumkit->percussion.playFunc
+            && drumkitTables[i].data == drumkit->percussion.data)
+        {
+            return &drumkitTables[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool prerenderDrumkit(const midiTimbre_t* drumkit, bool spiRam)
+{
+    if (!(drumkit->flags & TF_PERCUSSION) || NULL == drumkit->percussion.playFunc)
+    {
+        return false;
+    }
+
+    if (NULL != findDrumkitTables(drumkit))
+    {
+        // Already done!
+        return true;
+    }
+
+    // Find an unused slot by searching for a NULL playFunc
+    const midiTimbre_t unused = {0};
+    drumkitTables_t* tables   = findDrumkitTables(&unused);
+    if (NULL == tables)
+    {
+        ESP_LOGW("MIDI", "No room to pre-render another drumkit");
+        return false;
+    }
+
+    // Measure every drum first, so they can all go in one allocation
+    uint32_t total = 0;
+    for (int32_t i = 0; i < NUM_TABLE_DRUMS; i++)
+    {
+        tables->offsets[i] = total;
+        tables->lengths[i] = renderDrum(drumkit->percussion.playFunc, drumkit->percussion.data, FIRST_TABLE_DRUM + i,
+                                        NULL, DRUM_TABLE_MAX_LEN);
+        total += tables->lengths[i];
+    }
+
+    tables->samples = heap_caps_calloc(total, sizeof(int8_t), spiRam ? MALLOC_CAP_SPIRAM : 0);
+    if (NULL == tables->samples)
+    {
+        ESP_LOGE("MIDI", "Couldn't allocate %" PRIu32 " bytes for drumkit tables", total);
+        return false;
+    }
+
+    for (int32_t i = 0; i < NUM_TABLE_DRUMS; i++)
+    {
+        renderDrum(drumkit->percussion.playFunc, drumkit->percussion.data, FIRST_TABLE_DRUM + i,
+                   &tables->samples[tables->offsets[i]], tables->lengths[i]);
+    }
+
+    // Only claim the slot once the tables are complete
+    tables->playFunc = drumkit->percussion.playFunc;
+    tables->data     = drumkit->percussion.data;
+
+    ESP_LOGI("MIDI", "Pre-rendered drumkit %s in %" PRIu32 " bytes", drumkit->name ? drumkit->name : "", total);
+    return true;
+}
+
+void freeDrumkitTables(void)
+{
+    for (int32_t i = 0; i < DRUM_TABLE_MAX_KITS; i++)
+    {
+        if (drumkitTables[i].samples)
+        {
+            free(drumkitTables[i].samples);
+        }
+    }
+    memset(drumkitTables, 0, sizeof(drumkitTables));
+}
+
+const int8_t* getDrumTable(const midiTimbre_t* drumkit, percussionNote_t drum, uint32_t* len)
+{
+    if (drum < FIRST_TABLE_DRUM || drum >= FIRST_TABLE_DRUM + NUM_TABLE_DRUMS || NULL == drumkit->percussion.playFunc)
+    {
+        return NULL;
+    }
+
+    const drumkitTables_t* tables = findDrumkitTables(drumkit);
+    if (NULL == tables)
+    {
+        return NULL;
+    }
+
+    *len = tables->lengths[drum - FIRST_TABLE_DRUM];
+    return &tables->samples[tables->offsets[drum - FIRST_TABLE_DRUM]];
+}
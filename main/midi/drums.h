@@ -1,5 +1,12 @@
 #pragma once
 #include "midiPlayer.h"
+#include "hdw-dac.h"
+
+/// @brief The longest drum sound which will be pre-rendered, in samples. Longer drums are truncated
+#define DRUM_TABLE_MAX_LEN (DAC_SAMPLE_RATE_HZ * 4)
+
+/// @brief The number of drumkits which may be pre-rendered at the same time
+#define DRUM_TABLE_MAX_KITS 2
 
 /**
  * @brief Produces sounds for a standard drumkit according to the General MIDI standard
@@ -26,3 +33,37 @@ int8_t defaultDrumkitFunc(percussionNote_t drum, uint32_t idx, bool* done, uint3
  * @return int8_t The signed 8-bit sample generated for this tick of the drumkit
  */
 int8_t donutDrumkitFunc(percussionNote_t drum, uint32_t idx, bool* done, uint32_t scratch[4], void* data);
+
+/**
+ * @brief Render every drum in a drumkit into a table, so it can be played back without being synthesized
+ *
+ * Procedural drums are expensive to synthesize every sample, so drum-heavy songs can use a lot of the DAC's time
+ * budget. Once a drumkit has been pre-rendered, the MIDI player plays every note started with it by reading the table
+ * instead of calling its ::percussionFunc_t. Tables are matched by the drumkit's \c playFunc and \c data, so this
+ * applies to every channel and player using the drumkit.
+ *
+ * Each drum is rendered once, so random noise is the same every time a drum is played. The tables are large, about
+ * 370KB for ::defaultDrumkitTimbre and 750KB for ::donutDrumkitTimbre, so they should usually be put in SPIRAM.
+ *
+ * @param drumkit The drumkit timbre to render. It must have the ::TF_PERCUSSION flag
+ * @param spiRam true to allocate the tables in SPIRAM, false to allocate them in normal RAM
+ * @return true if the drumkit is pre-rendered, false if it could not be
+ */
+bool prerenderDrumkit(const midiTimbre_t* drumkit, bool spiRam);
+
+/**
+ * @brief Free all pre-rendered drumkit tables
+ *
+ * This must not be called while any MIDI player is playing a pre-rendered drum
+ */
+void freeDrumkitTables(void);
+
+/**
+ * @brief Get the pre-rendered table for a single drum
+ *
+ * @param drumkit The drumkit timbre the drum is played with
+ * @param drum The drum to get the table for
+ * @param[out] len A pointer which will be set to the number of samples in the table
+ * @return A pointer to the signed 8-bit samples, or NULL if the drumkit has not been pre-rendered
+ */
+const int8_t* getDrumTable(const midiTimbre_t* drumkit, percussionNote_t drum, uint32_t* len);
@@ -16,6 +16,10 @@
 
 #define OSC_DITHER
 
+// Define this to use cubic instead of linear interpolation for sampled timbres. It sounds a bit smoother at higher
+// pitches, but costs more cycles per sample
+// #define MIDI_SAMPLE_CUBIC
+
 //==============================================================================
 // Generated by tools/midi/freqs.py
 //==============================================================================
@@ -74,6 +78,9 @@ static void setVoiceTimbre(midiVoice_t* voice, midiTimbre_t* timbre);
 static void initTimbre(midiTimbre_t* dest, const midiTimbre_t* config);
 static const midiTimbre_t* getTimbreForProgram(bool percussion, uint8_t bank, uint8_t program);
 static int32_t midiSumPercussion(midiPlayer_t* player);
+static uq16_16 calcSampleStep(const midiTimbre_t* timbre, uint8_t note, uint16_t pitchBend);
+static inline int32_t readSampleAt(const midiTimbre_t* timbre, uint32_t sampleLoops, uint32_t idx);
+static int32_t midiSumSamples(midiPlayer_t* player);
 static void handleMidiEvent(midiPlayer_t* player, const midiStatusEvent_t* event);
 static void handleSysexEvent(midiPlayer_t* player, const midiSysexEvent_t* sysex);
 static void handleMetaEvent(midiPlayer_t* player, const midiMetaEvent_t* event);
@@ -421,6 +428,16 @@ static void initTimbre(midiTimbre_t* dest, const midiTimbre_t* config)
             ESP_LOGE("MIDI", "Failed to get data for sample '%s'!", config->sample.config.sampleName);
             dest->sample.count = 0;
         }
+
+        // Validate the loop points so the player never has to
+        if (0 == dest->sample.loopEnd || dest->sample.loopEnd > dest->sample.count)
+        {
+            dest->sample.loopEnd = dest->sample.count;
+        }
+        if (dest->sample.loopStart >= dest->sample.loopEnd)
+        {
+            dest->sample.loopStart = 0;
+        }
     }
 }
 
@@ -487,10 +504,20 @@ static int32_t midiSumPercussion(midiPlayer_t* player)
         playingVoices &= ~(1 << voiceIdx);
 
         bool done = false;
-        sum += voices[voiceIdx].timbre->percussion.playFunc(voices[voiceIdx].note, voices[voiceIdx].sampleTick++, &done,
-                                                            voices[voiceIdx].percScratch,
-                                                            voices[voiceIdx].timbre->percussion.data)
-               * voices[voiceIdx].velocity / 127;
+        int32_t sample;
+        if (voices[voiceIdx].drumTable)
+        {
+            // Pre-rendered drums are just a table lookup
+            sample = voices[voiceIdx].drumTable[voices[voiceIdx].sampleTick++];
+            done   = (voices[voiceIdx].sampleTick >= voices[voiceIdx].drumTableLen);
+        }
+        else
+        {
+            sample = voices[voiceIdx].timbre->percussion.playFunc(
+                voices[voiceIdx].note, voices[voiceIdx].sampleTick++, &done, voices[voiceIdx].percScratch,
+                voices[voiceIdx].timbre->percussion.data);
+        }
+        sum += sample * voices[voiceIdx].velocity / 127;
 
         if (done)
         {
@@ -539,6 +566,7 @@ static int32_t midiSumPercussion(midiPlayer_t* player)
             states->on &= ~(1 << voiceIdx);
             player->channels[voices[voiceIdx].channel].allocedVoices &= ~(1 << voiceIdx);
             voices[voiceIdx].sampleTick = 0;
+            voices[voiceIdx].drumTable  = NULL;
             memset(voices[voiceIdx].percScratch, 0, 4 * sizeof(uint32_t));
         }
     }
@@ -546,6 +574,50 @@ static int32_t midiSumPercussion(midiPlayer_t* player)
     return sum;
 }
 
+/**
+ * @brief Calculate the number of source samples a sampled voice should advance per DAC sample
+ *
+ * @param timbre The sampled timbre being played
+ * @param note The MIDI note being played
+ * @param pitchBend The pitch wheel value of the channel playing the note
+ * @return The step, in source samples per DAC sample
+ */
+static uq16_16 calcSampleStep(const midiTimbre_t* timbre, uint8_t note, uint16_t pitchBend)
+{
+    // The sample rate ratio, scaled by how far the played note is from the base note
+    uint64_t step = ((uint64_t)timbre->sample.rate) << 16;
+    if (0 != timbre->sample.baseNote)
+    {
+        step *= bendPitchWheel(note, pitchBend);
+        step /= timbre->sample.baseNote;
+    }
+    return step / DAC_SAMPLE_RATE_HZ;
+}
+
+/**
+ * @brief Read a signed source sample for a sampled voice, following the loop point
+ *
+ * @param timbre The sampled timbre being played
+ * @param sampleLoops The number of loops the voice has remaining
+ * @param idx The index to read, which may be past the loop end
+ * @return The signed sample at the index, or 0 if the index is after the end of the sample
+ */
+static inline int32_t readSampleAt(const midiTimbre_t* timbre, uint32_t sampleLoops, uint32_t idx)
+{
+    if (idx >= timbre->sample.loopEnd && 1 != sampleLoops)
+    {
+        // This sample will loop again before reaching this index
+        idx -= (timbre->sample.loopEnd - timbre->sample.loopStart);
+    }
+
+    if (idx >= timbre->sample.count)
+    {
+        return 0;
+    }
+
+    return (int32_t)timbre->sample.data[idx] - 128;
+}
+
 static int32_t midiSumSamples(midiPlayer_t* player)
 {
     voiceStates_t* states = &player->poolVoiceStates;
@@ -561,73 +633,65 @@ static int32_t midiSumSamples(midiPlayer_t* player)
         uint8_t voiceIdx = __builtin_ctz(playingVoices);
         playingVoices &= ~(1 << voiceIdx);
 
-        if (voices[voiceIdx].timbre->type != SAMPLE)
+        midiVoice_t* voice         = &voices[voiceIdx];
+        const midiTimbre_t* timbre = voice->timbre;
+
+        if (timbre->type != SAMPLE)
         {
             // Only sample timbres past here!
             continue;
         }
 
-        // Same rate for now -- this is the number of times we need to output each source sample
-        // in order to maintain the desired speed/pitch ratio
-        uq24_8 sampleRateRatio = (1 << 8) * 32768 / voices[voiceIdx].timbre->sample.rate;
-        sampleRateRatio *= voices[voiceIdx].timbre->sample.baseNote;
-        sampleRateRatio /= bendPitchWheel(voices[voiceIdx].note, player->channels[voices[voiceIdx].channel].pitchBend);
-        // Assume C4 is the base note? A4? doesn't really matter
-        // Divide the desired note freq
+        bool done = (0 == timbre->sample.count);
+        if (!done)
+        {
+            uint32_t tick  = voice->sampleTick;
+            int32_t sample = readSampleAt(timbre, voice->sampleLoops, tick);
+            int32_t next   = readSampleAt(timbre, voice->sampleLoops, tick + 1);
+#ifdef MIDI_SAMPLE_CUBIC
+            // Catmull-Rom spline through the two samples on either side, with an 8-bit fraction to avoid overflow
+            int32_t prev  = (tick > 0) ? readSampleAt(timbre, voice->sampleLoops, tick - 1) : sample;
+            int32_t next2 = readSampleAt(timbre, voice->sampleLoops, tick + 2);
+            int32_t t     = voice->sampleFrac >> 8;
+            int32_t a     = 3 * (sample - next) + next2 - prev;
+            int32_t b     = 2 * prev - 5 * sample + 4 * next - next2;
+            int32_t c     = next - prev;
+            int32_t v     = ((((((a * t) >> 8) + b) * t) >> 8) + c) * t;
+            sample += v >> 9;
+#else
+            // Linearly interpolate between this source sample and the next one
+            sample += ((next - sample) * (int32_t)voice->sampleFrac) >> 16;
+#endif
+            sum += sample * voice->velocity / 127;
 
-        bool done      = false;
-        int32_t sample = (int)voices[voiceIdx].timbre->sample.data[voices[voiceIdx].sampleTick] - 128;
+            // Advance by the cached step
+            voice->sampleFrac += voice->sampleStep;
+            voice->sampleTick += voice->sampleFrac >> 16;
+            voice->sampleFrac &= 0xFFFF;
 
-        // TODO: Possibly change to 0x08000 for rounding at the half?
-        if (voices[voiceIdx].sampleError > 0x100)
-        {
-            voices[voiceIdx].sampleError -= 0x100;
-        }
-        else
-        {
-            do
+            while (voice->sampleTick >= timbre->sample.loopEnd)
             {
-                // TODO this probably will not work if we go backwards
-                voices[voiceIdx].sampleTick++;
-                // We now need to omit (playRate / sampleDataRate) samples before continuing
-                voices[voiceIdx].sampleError += sampleRateRatio;
-                // And account for the sample we just played
-
-                if (voices[voiceIdx].sampleTick == voices[voiceIdx].timbre->sample.count)
+                if (1 == voice->sampleLoops)
                 {
-                    if (voices[voiceIdx].sampleLoops > 0)
-                    {
-                        voices[voiceIdx].sampleLoops--;
-
-                        if (!voices[voiceIdx].sampleLoops)
-                        {
-                            done = true;
-                            break;
-                        }
-                        else
-                        {
-                            voices[voiceIdx].sampleTick = 0;
-                        }
-                    }
-                    else
-                    {
-                        voices[voiceIdx].sampleTick = 0;
-                    }
+                    // This is the final pass, play through to the end of the sample
+                    done = (voice->sampleTick >= timbre->sample.count);
+                    break;
                 }
-            } while (voices[voiceIdx].sampleError < 0x100);
-
-            voices[voiceIdx].sampleError -= 0x100;
+                else if (voice->sampleLoops > 1)
+                {
+                    voice->sampleLoops--;
+                }
+                voice->sampleTick -= (timbre->sample.loopEnd - timbre->sample.loopStart);
+            }
         }
 
-        sum += sample * voices[voiceIdx].velocity / 127;
-
         if (done)
         {
             states->on &= ~(1 << voiceIdx);
-            player->channels[voices[voiceIdx].channel].allocedVoices &= ~(1 << voiceIdx);
-            voices[voiceIdx].sampleTick  = 0;
-            voices[voiceIdx].sampleLoops = 0;
-            voices[voiceIdx].sampleError = 0;
+            player->channels[voice->channel].allocedVoices &= ~(1 << voiceIdx);
+            voice->sampleTick  = 0;
+            voice->sampleLoops = 0;
+            voice->sampleFrac  = 0;
         }
     }
 
@@ -1344,14 +1408,16 @@ void midiNoteOn(midiPlayer_t* player, uint8_t chanId, uint8_t note, uint8_t velo
 
     if ((chan->timbre.flags & TF_PERCUSSION))
     {
-        // Reset the percussion voice state
+        // Reset the percussion voice state, and use the pre-rendered drum if there is one
         voice->sampleTick = 0;
+        voice->drumTable  = getDrumTable(&chan->timbre, note, &voice->drumTableLen);
     }
     else if (chan->timbre.type == SAMPLE)
     {
         voice->sampleTick  = 0;
-        voice->sampleError = 0;
+        voice->sampleFrac  = 0;
         voice->sampleLoops = chan->timbre.sample.loop;
+        voice->sampleStep  = calcSampleStep(&chan->timbre, note, chan->pitchBend);
     }
     else
     {
@@ -1770,29 +1836,35 @@ void midiPitchWheel(midiPlayer_t* player, uint8_t channel, uint16_t value)
     voiceStates_t* states = player->channels[channel].percussion ? &player->percVoiceStates : &player->poolVoiceStates;
     midiVoice_t* voices   = player->channels[channel].percussion ? player->percVoices : player->poolVoices;
 
-    if (player->channels[channel].timbre.type != SAMPLE)
+    // Find all the voices currently sounding for this channel and update their pitch. Each voice is checked by its own
+    // timbre rather than the channel's, since a program change doesn't affect notes which are already playing
+    uint32_t playingVoices = (VS_ANY(states) | states->held) & player->channels[channel].allocedVoices;
+
+    while (playingVoices != 0)
     {
-        // Find all the voices currently sounding for this channel and update their frequencies
-        uint32_t playingVoices = (VS_ANY(states) | states->held) & player->channels[channel].allocedVoices;
+        uint8_t voiceIdx   = __builtin_ctz(playingVoices);
+        uint32_t voiceBit  = (1 << voiceIdx);
+        midiVoice_t* voice = &voices[voiceIdx];
 
-        while (playingVoices != 0)
+        if (voice->timbre->type == SAMPLE)
+        {
+            // Recalculate the step through the sample
+            voice->sampleStep = calcSampleStep(voice->timbre, voice->note, value);
+        }
+        else
         {
-            uint8_t voiceIdx  = __builtin_ctz(playingVoices);
-            uint32_t voiceBit = (1 << voiceIdx);
-
             for (uint8_t oscIdx = 0; oscIdx < OSC_PER_VOICE; oscIdx++)
             {
                 // Apply the pitch bend to all this channel's oscillators
                 // TODO: If each voice has multiple oscillators, we would obviously
                 // want to be able to control them separately here.
                 // Maybe we only apply that for like, chorus?
-                swSynthSetFreqPrecise(&voices[voiceIdx].oscillators[oscIdx],
-                                      bendPitchWheel(voices[voiceIdx].note, value));
+                swSynthSetFreqPrecise(&voice->oscillators[oscIdx], bendPitchWheel(voice->note, value));
             }
-
-            // Next!
-            playingVoices &= ~voiceBit;
         }
+
+        // Next!
+        playingVoices &= ~voiceBit;
     }
 }
 
@@ -13,6 +13,13 @@
  * 24 melodic notes and 8 percussion notes, shared across all channels. All 128 General MIDI
  * instruments are supported, as well as the full General MIDI percussion range.
  *
+ * Instruments may also be made from PCM samples. Sampled voices are resampled to ::DAC_SAMPLE_RATE_HZ with linear
+ * interpolation, or cubic interpolation if \c MIDI_SAMPLE_CUBIC is defined in midiPlayer.c.
+ *
+ * Drumkits synthesize each drum procedurally, which is expensive for drum-heavy songs. A mode with spare SPIRAM may call
+ * prerenderDrumkit() from drums.h to render a drumkit into tables once, after which its drums are played by reading the
+ * tables.
+ *
  * \code{.c}
  * // Load a MIDI file
  * midiFile_t ode_to_joy;
@@ -458,10 +465,17 @@ typedef struct
             uint32_t rate;
 
             /// @brief The base frequency, at which the sample plays at normal speed
-            uq8_24 baseNote;
+            uq16_16 baseNote;
 
             /// @brief 0 to loop forever, or the number of loops to play
             uint32_t loop;
+
+            /// @brief The index of the first sample in the loop. Playback starts at 0 and jumps back here when looping
+            uint32_t loopStart;
+
+            /// @brief The index after the last sample in the loop, or 0 to loop at the end of the sample. The final
+            /// pass plays through to the end of the sample
+            uint32_t loopEnd;
         } sample;
 
         struct
@@ -508,6 +522,12 @@ typedef struct
     /// @brief The monotonic tick counter for playback of sampled timbres
     uint32_t sampleTick;
 
+    /// @brief The pre-rendered drum sound this voice is playing, or NULL to call the drumkit's ::percussionFunc_t
+    const int8_t* drumTable;
+
+    /// @brief The number of samples in \c drumTable
+    uint32_t drumTableLen;
+
     /// @brief The MIDI note number for the sound being played
     uint8_t note;
 
@@ -529,11 +549,15 @@ typedef struct
 
         struct
         {
-            /// @brief The number of fractional samples remaining
-            uint32_t sampleError;
+            /// @brief The fractional position between \c sampleTick and the next source sample, in 1/65536ths
+            uint32_t sampleFrac;
 
             /// @brief The number of loops remaining
             uint32_t sampleLoops;
+
+            /// @brief The number of source samples to advance per DAC sample. This is only recalculated when the note
+            /// starts or the pitch wheel moves
+            uq16_16 sampleStep;
         };
     };
 
@@ -164,9 +164,6 @@ static void tttEnterMode(void)
         writeNvs32(tttTutorialKey, ttt->tutorialRead);
     }
 
-    // Initialize p2p
-    p2pInitialize(&ttt->game.p2p, 0x25, tttConCb, tttMsgRxCb, -70);
-
     // Measure the display
     ttt->gameSize    = MIN(TFT_WIDTH, TFT_HEIGHT);
     ttt->cellSize    = ttt->gameSize / 9;
@@ -331,6 +328,8 @@ static void tttMenuCb(const char* label, bool selected, uint32_t value)
         {
             // Show connection UI
             tttShowUi(TUI_CONNECTING);
+            // Initialize p2p for each game, since it's deinitialized when the game ends or is canceled
+            p2pInitialize(&ttt->game.p2p, 0x25, tttConCb, tttMsgRxCb, -70);
             // Start multiplayer
             p2pStartConnection(&ttt->game.p2p);
         }
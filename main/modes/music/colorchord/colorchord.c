@@ -19,6 +19,8 @@
 #define TEXT_Y      10
 #define TEXT_MARGIN 20
 
+#define SAMPLE_HIST_COUNT 512
+
 //==============================================================================
 // Enums
 //==============================================================================
@@ -74,6 +76,7 @@ swadgeMode_t colorchordMode = {
     .usesAccelerometer        = false,
     .usesThermometer          = false,
     .overrideSelectBtn        = false,
+    .modeArenaInternalSize    = 2 * ARENA_ALIGN + sizeof(colorchord_t) + SAMPLE_HIST_COUNT * sizeof(uint16_t),
     .fnEnterMode              = colorchordEnterMode,
     .fnExitMode               = colorchordExitMode,
     .fnMainLoop               = colorchordMainLoop,
@@ -93,11 +96,12 @@ swadgeMode_t colorchordMode = {
  */
 void colorchordEnterMode(void)
 {
-    // Allocate memory for this mode
-    colorchord = (colorchord_t*)calloc(1, sizeof(colorchord_t));
+    // Allocate memory for this mode from the mode arena, which is freed after colorchordExitMode()
+    arena_t* arena = getModeArena(ARENA_INTERNAL);
+    colorchord     = (colorchord_t*)arenaCalloc(arena, 1, sizeof(colorchord_t));
 
-    colorchord->sampleHistCount = 512;
-    colorchord->sampleHist      = (uint16_t*)calloc(colorchord->sampleHistCount, sizeof(uint16_t));
+    colorchord->sampleHistCount = SAMPLE_HIST_COUNT;
+    colorchord->sampleHist      = (uint16_t*)arenaCalloc(arena, colorchord->sampleHistCount, sizeof(uint16_t));
     colorchord->sampleHistHead  = 0;
 
     // Load a font
@@ -109,16 +113,11 @@ void colorchordEnterMode(void)
 }
 
 /**
- * @brief Exit colorchord mode, free memory
+ * @brief Exit colorchord mode, free the font. The rest of the memory is freed with the mode arena
  */
 void colorchordExitMode(void)
 {
-    if (colorchord->sampleHist)
-    {
-        free(colorchord->sampleHist);
-    }
     freeFont(&colorchord->ibm_vga8);
-    free(colorchord);
 }
 
 /**
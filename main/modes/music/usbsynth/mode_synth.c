@@ -38,6 +38,9 @@
 
 #define SYNTH_BG_COLOR c112
 
+/// The size of the buffers MIDI text is collected into for drawing
+#define MIDI_TEXT_LEN 1024
+
 //==============================================================================
 // Enums
 //==============================================================================
@@ -1316,6 +1319,7 @@ swadgeMode_t synthMode = {
     .usesAccelerometer        = false,
     .usesThermometer          = false,
     .overrideSelectBtn        = false,
+    .frameScratchSpiramSize   = 4 * MIDI_TEXT_LEN,
     .fnEnterMode              = synthEnterMode,
     .fnExitMode               = synthExitMode,
     .fnMainLoop               = synthMainLoop,
@@ -2968,8 +2972,13 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
         return;
     }
 
-    int msgLen = 0;
-    char textMessages[1024];
+    // This is only needed while drawing, so it comes from the frame scratch rather than the stack
+    char* textMessages = arenaAlloc(getFrameScratch(ARENA_SPIRAM), MIDI_TEXT_LEN);
+    if (NULL == textMessages)
+    {
+        return;
+    }
+    int msgLen      = 0;
     textMessages[0] = '\0';
 
     uint32_t now          = ticks;
@@ -3019,7 +3028,7 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
     } while (0)
 
     node_t* curNode = karInfo->lyrics.first;
-    while (curNode != NULL && msgLen + 1 < sizeof(textMessages))
+    while (curNode != NULL && msgLen + 1 < MIDI_TEXT_LEN)
     {
         midiTextInfo_t* curInfo  = curNode->val;
         midiTextInfo_t* nextInfo = curNode->next ? ((midiTextInfo_t*)curNode->next->val) : NULL;
@@ -3038,15 +3047,14 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
             // Lyric is older than 1 note
 
             // Add a newline between measures, for files without KAR-style formatting
-            if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < sizeof(textMessages) - 1)
+            if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < MIDI_TEXT_LEN - 1)
             {
                 textMessages[msgLen++] = '\n';
                 textMessages[msgLen]   = '\0';
             }
 
             // Draw entire lyric
-            msgLen
-                += writeMidiText(textMessages + msgLen, sizeof(textMessages) - msgLen - 1, curInfo, karInfo->karFormat);
+            msgLen += writeMidiText(textMessages + msgLen, MIDI_TEXT_LEN - msgLen - 1, curInfo, karInfo->karFormat);
 
             // Lyrics are on screen currently, so no need to draw big progress bar
             drawBar = false;
@@ -3061,15 +3069,14 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
                 // NEXT lyric is also in the past
 
                 // Add a newline between measures, for files without KAR-style formatting
-                if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < sizeof(textMessages) - 1)
+                if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < MIDI_TEXT_LEN - 1)
                 {
                     textMessages[msgLen++] = '\n';
                     textMessages[msgLen]   = '\0';
                 }
 
                 // Draw this entire lyric
-                msgLen += writeMidiText(textMessages + msgLen, sizeof(textMessages) - msgLen - 1, curInfo,
-                                        karInfo->karFormat);
+                msgLen += writeMidiText(textMessages + msgLen, MIDI_TEXT_LEN - msgLen - 1, curInfo, karInfo->karFormat);
             }
             else
             {
@@ -3087,15 +3094,14 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
                 FLUSH();
 
                 // Add a newline between measures, for files without KAR-style formatting
-                if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < sizeof(textMessages) - 1)
+                if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < MIDI_TEXT_LEN - 1)
                 {
                     textMessages[msgLen++] = '\n';
                     textMessages[msgLen]   = '\0';
                 }
 
                 // Write the message into the buffer
-                msgLen += writeMidiText(textMessages + msgLen, sizeof(textMessages) - msgLen - 1, curInfo,
-                                        karInfo->karFormat);
+                msgLen += writeMidiText(textMessages + msgLen, MIDI_TEXT_LEN - msgLen - 1, curInfo, karInfo->karFormat);
                 // Make a temporary pointer to the buffer text so we can move it if needed
                 char* cur = textMessages;
 
@@ -3166,14 +3172,13 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
             // Note is less than (3 bars - 1 tick) in the future
 
             // Add a newline between measures, for files without KAR-style formatting
-            if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < sizeof(textMessages) - 1)
+            if (!karInfo->karFormat && lastLyricBar != curLyricBar && msgLen < MIDI_TEXT_LEN - 1)
             {
                 textMessages[msgLen++] = '\n';
                 textMessages[msgLen]   = '\0';
             }
 
-            msgLen
-                += writeMidiText(textMessages + msgLen, sizeof(textMessages) - msgLen - 1, curInfo, karInfo->karFormat);
+            msgLen += writeMidiText(textMessages + msgLen, MIDI_TEXT_LEN - msgLen - 1, curInfo, karInfo->karFormat);
         }
         else
         {
@@ -3213,15 +3218,19 @@ static void drawKaraokeLyrics(uint32_t ticks, karaokeInfo_t* karInfo)
 
 static void drawMidiText(bool filter, uint32_t types)
 {
-    int msgLen = 0;
-    char textMessages[1024];
+    char* textMessages = arenaAlloc(getFrameScratch(ARENA_SPIRAM), MIDI_TEXT_LEN);
+    if (NULL == textMessages)
+    {
+        return;
+    }
+    int msgLen      = 0;
     textMessages[0] = '\0';
 
     paletteColor_t midiTextColor = c550;
     bool colorSet                = false;
 
     node_t* curNode = sd->midiTexts.first;
-    while (curNode != NULL && msgLen + 1 < sizeof(textMessages))
+    while (curNode != NULL && msgLen + 1 < MIDI_TEXT_LEN)
     {
         midiTextInfo_t* curInfo = curNode->val;
 
@@ -3273,7 +3282,7 @@ static void drawMidiText(bool filter, uint32_t types)
                 textMessages[msgLen++] = ' ';
             }
         }
-        msgLen += writeMidiText(textMessages + msgLen, sizeof(textMessages) - msgLen - 1, curInfo, false);
+        msgLen += writeMidiText(textMessages + msgLen, MIDI_TEXT_LEN - msgLen - 1, curInfo, false);
 
         curNode = curNode->next;
     }
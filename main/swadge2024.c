@@ -87,6 +87,7 @@
  *
  * - hdw-esp-now.h: Broadcast and receive messages. This is fast and unreliable.
  * - p2pConnection.h: Connect to another Swadge and exchange messages. This is slower and more reliable.
+ * - p2pBulk.h: Send buffers too big for a single p2p message, like drawings or saved images, over a p2p connection
  *
  * \subsection pm_api Persistent Memory APIs
  *
@@ -126,6 +127,8 @@
  * macros should be used instead of calling buzzer or DAC functions directly!
  * - swSynth.h: Learn how to generate oscillating output for the DAC speaker
  * - midiPlayer.h: Learn how to play MIDI files on the DAC speaker
+ * - sfxMixer.h: Learn how to play many overlapping PCM sound effects on the DAC speaker
+ * - dacProfiler.h: Measure how much of the DAC's time budget is spent generating audio
  *
  * \subsection math_api Math APIs
  *
@@ -140,6 +143,7 @@
  *
  * - linked_list.h: A basic data structure
  * - hashMap.h: A data structure for storing data in key-value pairs
+ * - arena.h: Fast allocation for memory which is all freed at once, like a mode's state or a frame's scratch buffers
  * - macros.h: Convenient macros like MIN() and MAX()
  * - coreutil.h: General utilities for system profiling
  * - hdw-usb.h: Learn how to be a USB HID Gamepad
@@ -168,6 +172,7 @@
 #include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_sleep.h>
+#include <esp_heap_caps.h>
 #include <rom/usb/usb_persist.h>
 #include <rom/usb/chip_usb_dw_wrapper.h>
 #include <soc/rtc_cntl_reg.h>
@@ -180,6 +185,8 @@
 #include "mainMenu.h"
 #include "quickSettings.h"
 #include "midiPlayer.h"
+#include "sfxMixer.h"
+#include "dacProfiler.h"
 #include "introMode.h"
 
 //==============================================================================
@@ -214,6 +221,21 @@ static uint32_t frameRateUs = DEFAULT_FRAME_RATE_US;
 /// @brief Timer to return to the main menu
 static int64_t timeExitPressed = 0;
 
+/// @brief The current mode's arenas, which live from before it's entered until after it exits
+static arena_t modeArenas[NUM_ARENA_MEMS];
+
+/// @brief The current mode's frame scratch arenas, which are reset every pass through the main loop
+static arena_t frameScratches[NUM_ARENA_MEMS];
+
+/// @brief The heap capabilities for each kind of arena memory
+static const uint32_t arenaCaps[NUM_ARENA_MEMS] = {
+    MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+};
+
+/// @brief The name of each kind of arena memory, for logging
+static const char* const arenaMemNames[NUM_ARENA_MEMS] = {"SPIRAM", "internal"};
+
 //==============================================================================
 // Function declarations
 //==============================================================================
@@ -222,6 +244,8 @@ static void swadgeModeEspNowRecvCb(const esp_now_recv_info_t* esp_now_info, cons
                                    int8_t rssi);
 static void swadgeModeEspNowSendCb(const uint8_t* mac_addr, esp_now_send_status_t status);
 static void setSwadgeMode(void* swadgeMode);
+static void enterSwadgeMode(void);
+static void exitSwadgeMode(void);
 static void initOptionalPeripherals(void);
 static void dacCallback(uint8_t* samples, int16_t len);
 
@@ -345,10 +369,7 @@ void app_main(void)
     tLastLoopUs                = esp_timer_get_time();
 
     // Initialize the swadge mode
-    if (NULL != cSwadgeMode->fnEnterMode)
-    {
-        cSwadgeMode->fnEnterMode();
-    }
+    enterSwadgeMode();
 
     // Run the main loop, forever
     while (true)
@@ -358,6 +379,12 @@ void app_main(void)
         int64_t tElapsedUs = tNowUs - tLastLoopUs;
         tLastLoopUs        = tNowUs;
 
+        // Free everything allocated from the frame scratch arenas last time through the loop
+        for (int32_t mem = 0; mem < NUM_ARENA_MEMS; mem++)
+        {
+            arenaReset(&frameScratches[mem]);
+        }
+
         // Process ADC samples
         if (NULL != cSwadgeMode->fnAudioCallback)
         {
@@ -390,6 +417,8 @@ void app_main(void)
 #if defined(CONFIG_SOUND_OUTPUT_SPEAKER)
         // Check if a DAC buffer needs to be filled
         dacPoll();
+        // Periodically log audio timing, if enabled
+        dacProfilerCheckLog(tElapsedUs);
 #elif defined(CONFIG_SOUND_OUTPUT_BUZZER)
         // Check for buzzer callback flags from the ISR
         bzrCheckSongDone();
@@ -497,10 +526,7 @@ void app_main(void)
     }
 
     // Deinitialize the swadge mode
-    if (NULL != cSwadgeMode->fnExitMode)
-    {
-        cSwadgeMode->fnExitMode();
-    }
+    exitSwadgeMode();
 
     deinitSystem();
 }
@@ -529,6 +555,7 @@ static void initOptionalPeripherals(void)
         initDac(dacCallback);
         dacStart();
         initGlobalMidiPlayer();
+        initGlobalSfxMixer();
 #elif defined(CONFIG_SOUND_OUTPUT_BUZZER)
         // Init buzzer. This must be called before initMic()
         initBuzzer(GPIO_NUM_40, LEDC_TIMER_0, LEDC_CHANNEL_0, //
@@ -565,15 +592,13 @@ static void initOptionalPeripherals(void)
 void deinitSystem(void)
 {
     // Deinit the swadge mode
-    if (NULL != cSwadgeMode->fnExitMode)
-    {
-        cSwadgeMode->fnExitMode();
-    }
+    exitSwadgeMode();
 
     // Deinitialize everything
     deinitButtons();
 #if defined(CONFIG_SOUND_OUTPUT_SPEAKER)
     deinitGlobalMidiPlayer();
+    deinitGlobalSfxMixer();
     deinitDac();
 #elif defined(CONFIG_SOUND_OUTPUT_BUZZER)
     deinitBuzzer();
@@ -636,19 +661,74 @@ static void setSwadgeMode(void* swadgeMode)
     }
 
     // Stop the prior mode
-    if (cSwadgeMode->fnExitMode)
-    {
-        cSwadgeMode->fnExitMode();
-    }
+    exitSwadgeMode();
 
     // Set and start the new mode
     cSwadgeMode = swadgeMode;
-    if (cSwadgeMode->fnEnterMode)
+    enterSwadgeMode();
+}
+
+/**
+ * @brief Create the current Swadge mode's arenas, then enter it
+ */
+static void enterSwadgeMode(void)
+{
+    const uint32_t modeSizes[NUM_ARENA_MEMS] = {
+        cSwadgeMode->modeArenaSpiramSize,
+        cSwadgeMode->modeArenaInternalSize,
+    };
+    const uint32_t scratchSizes[NUM_ARENA_MEMS] = {
+        cSwadgeMode->frameScratchSpiramSize,
+        cSwadgeMode->frameScratchInternalSize,
+    };
+
+    for (int32_t mem = 0; mem < NUM_ARENA_MEMS; mem++)
+    {
+        if (!arenaCreate(&modeArenas[mem], modeSizes[mem], arenaCaps[mem]))
+        {
+            ESP_LOGE("SWADGE", "Couldn't allocate %" PRIu32 " byte %s mode arena for %s", modeSizes[mem],
+                     arenaMemNames[mem], cSwadgeMode->modeName);
+        }
+        if (!arenaCreate(&frameScratches[mem], scratchSizes[mem], arenaCaps[mem]))
+        {
+            ESP_LOGE("SWADGE", "Couldn't allocate %" PRIu32 " byte %s frame scratch for %s", scratchSizes[mem],
+                     arenaMemNames[mem], cSwadgeMode->modeName);
+        }
+    }
+
+    if (NULL != cSwadgeMode->fnEnterMode)
     {
         cSwadgeMode->fnEnterMode();
     }
 }
 
+/**
+ * @brief Exit the current Swadge mode, then log how much of its arenas it used and free them
+ */
+static void exitSwadgeMode(void)
+{
+    if (NULL != cSwadgeMode->fnExitMode)
+    {
+        cSwadgeMode->fnExitMode();
+    }
+
+    for (int32_t mem = 0; mem < NUM_ARENA_MEMS; mem++)
+    {
+        if (0 != modeArenas[mem].size)
+        {
+            ESP_LOGI("SWADGE", "%s %s mode arena peak: %zu of %zu bytes", cSwadgeMode->modeName, arenaMemNames[mem],
+                     modeArenas[mem].peak, modeArenas[mem].size);
+        }
+        if (0 != frameScratches[mem].size)
+        {
+            ESP_LOGI("SWADGE", "%s %s frame scratch peak: %zu of %zu bytes", cSwadgeMode->modeName,
+                     arenaMemNames[mem], frameScratches[mem].peak, frameScratches[mem].size);
+        }
+        arenaDestroy(&modeArenas[mem]);
+        arenaDestroy(&frameScratches[mem]);
+    }
+}
+
 /**
  * Set up variables to synchronously switch the swadge mode in the main loop
  *
@@ -670,13 +750,11 @@ void softSwitchToPendingSwadge(void)
     if (pendingSwadgeMode)
     {
         // Exit the current mode
-        if (NULL != cSwadgeMode->fnExitMode)
-        {
-            cSwadgeMode->fnExitMode();
-        }
+        exitSwadgeMode();
 
         // Stop the music
         soundStop(true);
+        sfxMixerStopAll(globalSfxMixerGet());
 
         // Switch the mode pointer
         cSwadgeMode       = pendingSwadgeMode;
@@ -686,10 +764,7 @@ void softSwitchToPendingSwadge(void)
         initOptionalPeripherals();
 
         // Enter the next mode
-        if (NULL != cSwadgeMode->fnEnterMode)
-        {
-            cSwadgeMode->fnEnterMode();
-        }
+        enterSwadgeMode();
 
         // Reenable the TFT backlight
         enableTFTBacklight();
@@ -773,6 +848,31 @@ uint32_t getFrameRateUs(void)
     return frameRateUs;
 }
 
+/**
+ * @brief Get the current mode's arena. Everything allocated from it is freed after the mode exits. If the mode didn't
+ * ask for an arena of this kind in its ::swadgeMode_t, the arena is empty and every allocation fails
+ *
+ * @param mem The kind of memory the arena uses
+ * @return The mode arena
+ */
+arena_t* getModeArena(arenaMem_t mem)
+{
+    return &modeArenas[mem];
+}
+
+/**
+ * @brief Get the current mode's frame scratch arena. Everything allocated from it is freed at the start of the next
+ * pass through the main loop. If the mode didn't ask for an arena of this kind in its ::swadgeMode_t, the arena is
+ * empty and every allocation fails
+ *
+ * @param mem The kind of memory the arena uses
+ * @return The frame scratch arena
+ */
+arena_t* getFrameScratch(arenaMem_t mem)
+{
+    return &frameScratches[mem];
+}
+
 /**
  * @brief
  *
@@ -781,15 +881,29 @@ uint32_t getFrameRateUs(void)
  */
 void dacCallback(uint8_t* samples, int16_t len)
 {
+    uint32_t tCallback = dacProfilerBegin();
+
     // If there is a DAC callback for the current mode
     if (cSwadgeMode->fnDacCb)
     {
         // Call that
+        uint32_t tMode = dacProfilerBegin();
         cSwadgeMode->fnDacCb(samples, len);
+        dacProfilerEnd(DAC_PROF_MODE, tMode, len);
     }
     else
     {
         // Otherwise use the song player
+        uint32_t tMidi = dacProfilerBegin();
         globalMidiPlayerFillBuffer(samples, len);
+        dacProfilerEnd(DAC_PROF_MIDI, tMidi, len);
     }
+
+    // Mix any playing sound effects on top
+    uint32_t tSfx = dacProfilerBegin();
+    globalSfxMixerMixBuffer(samples, len);
+    dacProfilerEnd(DAC_PROF_SFX, tSfx, len);
+
+    dacProfilerEnd(DAC_PROF_CALLBACK, tCallback, len);
+    dacProfilerCountOutput(samples, len);
 }
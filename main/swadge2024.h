@@ -28,6 +28,24 @@
  * mode's functions or variables. When possible, functions and variables should be prefixed with something unique, like
  * \c demo in the example below.
  *
+ * \section swadgeMode_memory Mode Memory
+ *
+ * Modes usually allocate their state when entered and must free every piece of it when exited. Instead, a mode may
+ * ask for a mode arena by setting ::swadgeMode_t.modeArenaSpiramSize or ::swadgeMode_t.modeArenaInternalSize. The
+ * system creates the arena before calling ::swadgeMode_t.fnEnterMode and frees all of it at once after calling
+ * ::swadgeMode_t.fnExitMode, so anything allocated from getModeArena() with arenaAlloc() or arenaCalloc() never needs
+ * to be freed and can't leak.
+ *
+ * A mode may also ask for a frame scratch arena by setting ::swadgeMode_t.frameScratchSpiramSize or
+ * ::swadgeMode_t.frameScratchInternalSize. The frame scratch arena is reset at the start of every pass through the
+ * main loop, so it's meant for temporary buffers which are used while drawing a frame or handling an event, and
+ * which would otherwise be large stack arrays or a malloc() and free() every frame. Nothing allocated from
+ * getFrameScratch() may be kept after the function which allocated it returns.
+ *
+ * SPIRAM is plentiful but slower, and internal RAM is fast but scarce, so most modes should only use SPIRAM. When a
+ * mode exits, the most memory it used from each arena is logged, so the sizes can be tuned. The quick settings menu
+ * runs on top of the current mode and shares its arenas, so it doesn't allocate from them.
+ *
  * \section swadgeMode_example Example
  *
  * Adding a mode to the CMakeFile requires adding two separate lines in the idf_component_register section.
@@ -203,9 +221,11 @@
 
 // Connection interface
 #include "p2pConnection.h"
+#include "p2pBulk.h"
 
 // General utilities
 #include "linked_list.h"
+#include "arena.h"
 #include "macros.h"
 #include "trigonometry.h"
 #include "vector2d.h"
@@ -224,6 +244,16 @@
 /// @brief the default time between drawn frames, in microseconds
 #define DEFAULT_FRAME_RATE_US 40000
 
+/**
+ * @brief The kinds of memory a mode arena or frame scratch arena can use
+ */
+typedef enum
+{
+    ARENA_SPIRAM,   ///< SPIRAM, which is plentiful but slower
+    ARENA_INTERNAL, ///< Internal RAM, which is fast but scarce
+    NUM_ARENA_MEMS, ///< The number of kinds of memory
+} arenaMem_t;
+
 /**
  * @struct swadgeMode_t
  * @brief A struct of all the function pointers necessary for a swadge mode. If a mode does not need a particular
@@ -268,6 +298,31 @@ typedef struct
      */
     bool overrideSelectBtn;
 
+    /**
+     * @brief This is a setting, not a function pointer. The size of the mode's SPIRAM arena in bytes, or 0 for none.
+     * The arena is created before fnEnterMode() is called and freed after fnExitMode() is called. See getModeArena()
+     */
+    uint32_t modeArenaSpiramSize;
+
+    /**
+     * @brief This is a setting, not a function pointer. The size of the mode's internal RAM arena in bytes, or 0 for
+     * none. The arena is created before fnEnterMode() is called and freed after fnExitMode() is called. See
+     * getModeArena()
+     */
+    uint32_t modeArenaInternalSize;
+
+    /**
+     * @brief This is a setting, not a function pointer. The size of the mode's SPIRAM frame scratch arena in bytes, or
+     * 0 for none. The arena is reset at the start of every pass through the main loop. See getFrameScratch()
+     */
+    uint32_t frameScratchSpiramSize;
+
+    /**
+     * @brief This is a setting, not a function pointer. The size of the mode's internal RAM frame scratch arena in
+     * bytes, or 0 for none. The arena is reset at the start of every pass through the main loop. See getFrameScratch()
+     */
+    uint32_t frameScratchInternalSize;
+
     /**
      * @brief This function is called when this mode is started. It should initialize variables and start the mode.
      */
@@ -356,4 +411,7 @@ void openQuickSettings(void);
 void setFrameRateUs(uint32_t newFrameRateUs);
 uint32_t getFrameRateUs(void);
 
+arena_t* getModeArena(arenaMem_t mem);
+arena_t* getFrameScratch(arenaMem_t mem);
+
 #endif
@@ -0,0 +1,131 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_heap_caps.h>
+
+#include "arena.h"
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Set up an arena which allocates from a block of memory
+ *
+ * @param arena The arena to set up
+ * @param mem The memory to allocate from. It must stay valid as long as the arena is used
+ * @param size The size of mem, in bytes
+ */
+void arenaInit(arena_t* arena, void* mem, size_t size)
+{
+    arena->mem     = mem;
+    arena->size    = size;
+    arena->used    = 0;
+    arena->peak    = 0;
+    arena->ownsMem = false;
+}
+
+/**
+ * @brief Set up an arena which allocates from a block of memory it allocates from the heap. Call arenaDestroy() to
+ * free the block
+ *
+ * @param arena The arena to set up
+ * @param size The size of the block, in bytes. If this is 0, the arena is empty and nothing is allocated
+ * @param caps The capabilities of the block, like MALLOC_CAP_SPIRAM or MALLOC_CAP_INTERNAL
+ * @return true if the arena was set up, false if the block couldn't be allocated. The arena is empty in that case
+ */
+bool arenaCreate(arena_t* arena, size_t size, uint32_t caps)
+{
+    void* mem = NULL;
+    if (0 != size)
+    {
+        mem = heap_caps_malloc(size, caps);
+        if (NULL == mem)
+        {
+            size = 0;
+        }
+    }
+
+    arenaInit(arena, mem, size);
+    arena->ownsMem = (NULL != mem);
+    return (0 == size) || (NULL != mem);
+}
+
+/**
+ * @brief Free an arena's block if it was allocated by arenaCreate(), and leave the arena empty. Everything allocated
+ * from the arena must not be used after this. This may be called more than once
+ *
+ * @param arena The arena to destroy
+ */
+void arenaDestroy(arena_t* arena)
+{
+    if (arena->ownsMem)
+    {
+        free(arena->mem);
+    }
+    arenaInit(arena, NULL, 0);
+}
+
+/**
+ * @brief Allocate memory from an arena. The memory isn't cleared
+ *
+ * @param arena The arena to allocate from
+ * @param size The number of bytes to allocate
+ * @return The memory, aligned to ::ARENA_ALIGN bytes, or NULL if the arena doesn't have enough left
+ */
+void* arenaAlloc(arena_t* arena, size_t size)
+{
+    // Align the address rather than the offset, since mem may not be aligned itself
+    uintptr_t addr = (uintptr_t)arena->mem + arena->used;
+    size_t pad     = (ARENA_ALIGN - (addr % ARENA_ALIGN)) % ARENA_ALIGN;
+
+    if (NULL == arena->mem || pad > arena->size - arena->used || size > arena->size - arena->used - pad)
+    {
+        return NULL;
+    }
+
+    void* ptr = &arena->mem[arena->used + pad];
+    arena->used += pad + size;
+    if (arena->used > arena->peak)
+    {
+        arena->peak = arena->used;
+    }
+    return ptr;
+}
+
+/**
+ * @brief Allocate cleared memory for an array from an arena
+ *
+ * @param arena The arena to allocate from
+ * @param count The number of elements
+ * @param size The size of each element, in bytes
+ * @return The cleared memory, aligned to ::ARENA_ALIGN bytes, or NULL if the arena doesn't have enough left
+ */
+void* arenaCalloc(arena_t* arena, size_t count, size_t size)
+{
+    if (0 != size && count > SIZE_MAX / size)
+    {
+        return NULL;
+    }
+
+    void* ptr = arenaAlloc(arena, count * size);
+    if (NULL != ptr)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+/**
+ * @brief Free everything allocated from an arena at once. The arena's peak usage is kept
+ *
+ * @param arena The arena to reset
+ */
+void arenaReset(arena_t* arena)
+{
+    arena->used = 0;
+}
@@ -0,0 +1,106 @@
+/*! \file arena.h
+ *
+ * \section arena_design Design Philosophy
+ *
+ * An arena hands out memory from one block by bumping an offset, so each allocation is just an addition and there is
+ * no per-allocation header. Allocations are never freed one at a time. Instead the whole arena is reset at once, which
+ * makes it a good fit for memory which all lives exactly as long, like the entries of a map which is built once and
+ * thrown away, or buffers which are only needed for one frame.
+ *
+ * An arena can use memory the caller passes in from wherever it likes, such as a static array or the stack, or it can
+ * allocate its block from the heap with particular capabilities, like SPIRAM or internal RAM. Every allocation is
+ * aligned to ::ARENA_ALIGN bytes.
+ *
+ * Each arena remembers the most memory it ever had allocated at once, including across resets, so it can be sized to
+ * fit what it's actually used for.
+ *
+ * \section arena_usage Usage
+ *
+ * arenaInit() sets up an arena over a block of memory. arenaCreate() sets up an arena over a block it allocates with
+ * heap_caps_malloc(), and arenaDestroy() frees that block.
+ *
+ * arenaAlloc() and arenaCalloc() take memory from the arena, and return NULL when it is full.
+ *
+ * arenaReset() gives all of the memory back at once. Everything allocated from the arena must not be used after this.
+ *
+ * ::arena_t.peak is the most memory that was allocated at once, in bytes.
+ *
+ * \section arena_example Example
+ *
+ * \code{.c}
+ * static uint8_t arenaMem[4096];
+ * arena_t arena;
+ *
+ * arenaInit(&arena, arenaMem, sizeof(arenaMem));
+ *
+ * // Allocate some things which are all thrown away together
+ * point_t* points = arenaCalloc(&arena, 64, sizeof(point_t));
+ * char* name      = arenaAlloc(&arena, 16);
+ *
+ * ...
+ *
+ * // Free everything
+ * arenaReset(&arena);
+ * \endcode
+ *
+ * An arena in SPIRAM:
+ * \code{.c}
+ * arena_t arena;
+ * if (arenaCreate(&arena, 64 * 1024, MALLOC_CAP_SPIRAM))
+ * {
+ *     uint16_t* samples = arenaAlloc(&arena, 4096 * sizeof(uint16_t));
+ *
+ *     ...
+ *
+ *     printf("Used %zu of %zu bytes\n", arena.peak, arena.size);
+ *     arenaDestroy(&arena);
+ * }
+ * \endcode
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// The alignment of every allocation, which is enough for any type on the ESP32-S2 and the emulator
+#define ARENA_ALIGN 8
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A block of memory which allocations are bumped out of
+ */
+typedef struct
+{
+    uint8_t* mem; ///< The memory allocations come from
+    size_t size;  ///< The size of mem, in bytes
+    size_t used;  ///< The number of bytes allocated, including padding for alignment
+    size_t peak;  ///< The most bytes that were allocated at once
+    bool ownsMem; ///< true if mem was allocated by arenaCreate(), and is freed by arenaDestroy()
+} arena_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+void arenaInit(arena_t* arena, void* mem, size_t size);
+bool arenaCreate(arena_t* arena, size_t size, uint32_t caps);
+void arenaDestroy(arena_t* arena);
+void* arenaAlloc(arena_t* arena, size_t size);
+void* arenaCalloc(arena_t* arena, size_t count, size_t size);
+void arenaReset(arena_t* arena);
+
+#endif
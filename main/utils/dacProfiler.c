@@ -0,0 +1,310 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "hdw-dac.h"
+#include "coreutil.h"
+#include "macros.h"
+#include "dacProfiler.h"
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static bool profilerEnabled = false;
+static dacProfStats_t profStats;
+
+/// @brief Underrun counts from hdw-dac.h when the stats were last reset
+static uint32_t lateRefillsBase;
+static uint32_t droppedBuffersBase;
+
+static int64_t logIntervalUs = 0;
+static int64_t logAccumUs    = 0;
+
+static const char* const sectionNames[] = {
+    "Callback",
+    "Mode",
+    "MIDI",
+    "SFX",
+};
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static uint32_t dacProfilerNow(void);
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Get the current time in CPU cycles
+ *
+ * @return The cycle count on hardware, or the emulator's microsecond timer scaled to ::DAC_PROF_CPU_MHZ
+ */
+static uint32_t dacProfilerNow(void)
+{
+#if defined(__XTENSA__)
+    return getCycleCount();
+#else
+    return (uint32_t)(esp_timer_get_time() * DAC_PROF_CPU_MHZ);
+#endif
+}
+
+/**
+ * @brief Enable or disable the DAC profiler. Statistics are kept while disabled, use dacProfilerReset() to clear them
+ *
+ * @param enable true to start measuring, false to stop
+ */
+void dacProfilerEnable(bool enable)
+{
+    if (enable && !profilerEnabled)
+    {
+        dacProfilerReset();
+    }
+    profilerEnabled = enable;
+}
+
+/**
+ * @brief Check if the DAC profiler is enabled
+ *
+ * @return true if the DAC path is being measured
+ */
+bool dacProfilerIsEnabled(void)
+{
+    return profilerEnabled;
+}
+
+/**
+ * @brief Clear all DAC profiler statistics
+ */
+void dacProfilerReset(void)
+{
+    memset(&profStats, 0, sizeof(profStats));
+    for (int32_t i = 0; i < DAC_PROF_NUM_SECTIONS; i++)
+    {
+        profStats.sections[i].minCycles = UINT32_MAX;
+    }
+    dacGetUnderruns(&lateRefillsBase, &droppedBuffersBase);
+    logAccumUs = 0;
+}
+
+/**
+ * @brief Start measuring a section of the DAC path
+ *
+ * @return A timestamp which must be passed to dacProfilerEnd(), or 0 if the profiler is disabled
+ */
+uint32_t dacProfilerBegin(void)
+{
+    if (!profilerEnabled)
+    {
+        return 0;
+    }
+    return dacProfilerNow();
+}
+
+/**
+ * @brief Finish measuring a section of the DAC path and record the result
+ *
+ * @param section The section which was measured
+ * @param start The timestamp returned by dacProfilerBegin()
+ * @param len The number of samples which were generated by the section, used to calculate the budget
+ */
+void dacProfilerEnd(dacProfSection_t section, uint32_t start, int16_t len)
+{
+    if (!profilerEnabled || section >= DAC_PROF_NUM_SECTIONS || len <= 0)
+    {
+        return;
+    }
+
+    // Unsigned subtraction handles the counter wrapping around
+    uint32_t cycles = dacProfilerNow() - start;
+    uint32_t budget = ((uint64_t)len * DAC_PROF_CPU_MHZ * 1000000) / DAC_SAMPLE_RATE_HZ;
+
+    dacProfSectionStats_t* stats = &profStats.sections[section];
+    stats->calls++;
+    stats->totalCycles += cycles;
+    stats->totalBudget += budget;
+    if (cycles < stats->minCycles)
+    {
+        stats->minCycles = cycles;
+    }
+    if (cycles > stats->maxCycles)
+    {
+        stats->maxCycles = cycles;
+        stats->maxBudget = budget;
+    }
+
+    // Bin by 10% of the budget, anything over budget goes in the last bin
+    uint32_t bin = dacProfilerPercent(cycles, budget) / 10;
+    if (cycles > budget || bin >= DAC_PROF_HIST_BINS)
+    {
+        bin = DAC_PROF_HIST_BINS - 1;
+    }
+    else if (bin == DAC_PROF_HIST_BINS - 1)
+    {
+        // Exactly 100% is still within budget
+        bin--;
+    }
+    stats->histogram[bin]++;
+
+    if (DAC_PROF_CALLBACK == section)
+    {
+        profStats.samples += len;
+    }
+}
+
+/**
+ * @brief Count the clipped samples in a finished DAC buffer. A sample is clipped if it is pinned at either rail.
+ *
+ * @param samples The samples which will be sent to the DAC
+ * @param len The number of samples
+ */
+void dacProfilerCountOutput(const uint8_t* samples, int16_t len)
+{
+    if (!profilerEnabled)
+    {
+        return;
+    }
+
+    uint32_t clipped = 0;
+    for (int16_t i = 0; i < len; i++)
+    {
+        if (0 == samples[i] || UINT8_MAX == samples[i])
+        {
+            clipped++;
+        }
+    }
+    profStats.clippedSamples += clipped;
+}
+
+/**
+ * @brief Get all DAC profiler statistics
+ *
+ * @return A pointer to the statistics, which are updated as the DAC runs
+ */
+const dacProfStats_t* dacProfilerGetStats(void)
+{
+    uint32_t late, dropped;
+    dacGetUnderruns(&late, &dropped);
+    profStats.lateRefills    = late - lateRefillsBase;
+    profStats.droppedBuffers = dropped - droppedBuffersBase;
+    return &profStats;
+}
+
+/**
+ * @brief Get the timing statistics for one section of the DAC path
+ *
+ * @param section The section to get statistics for
+ * @return A pointer to the statistics, or NULL if \c section is invalid
+ */
+const dacProfSectionStats_t* dacProfilerGetSection(dacProfSection_t section)
+{
+    if (section >= DAC_PROF_NUM_SECTIONS)
+    {
+        return NULL;
+    }
+    return &profStats.sections[section];
+}
+
+/**
+ * @brief Get a short human readable name for a section
+ *
+ * @param section The section to name
+ * @return The name of the section
+ */
+const char* dacProfilerSectionName(dacProfSection_t section)
+{
+    if (section >= ARRAY_SIZE(sectionNames))
+    {
+        return "?";
+    }
+    return sectionNames[section];
+}
+
+/**
+ * @brief Calculate the percentage of a budget which was used
+ *
+ * @param cycles The number of cycles used
+ * @param budget The number of cycles available
+ * @return The percent of \c budget used by \c cycles, which may be over 100, or 0 if \c budget is 0
+ */
+uint32_t dacProfilerPercent(uint64_t cycles, uint64_t budget)
+{
+    if (0 == budget)
+    {
+        return 0;
+    }
+    return (cycles * 100) / budget;
+}
+
+/**
+ * @brief Print all DAC profiler statistics to the log
+ */
+void dacProfilerLog(void)
+{
+    const dacProfStats_t* stats = dacProfilerGetStats();
+
+    for (int32_t s = 0; s < DAC_PROF_NUM_SECTIONS; s++)
+    {
+        const dacProfSectionStats_t* sec = &stats->sections[s];
+        if (0 == sec->calls)
+        {
+            continue;
+        }
+
+        char hist[DAC_PROF_HIST_BINS * 11 + 1];
+        char* cur = hist;
+        for (int32_t b = 0; b < DAC_PROF_HIST_BINS; b++)
+        {
+            cur += snprintf(cur, sizeof(hist) - (cur - hist), " %" PRIu32, sec->histogram[b]);
+        }
+
+        ESP_LOGI("DAC", "%-8s n=%" PRIu32 " cyc min/avg/max=%" PRIu32 "/%" PRIu64 "/%" PRIu32 " budget avg=%" PRIu32
+                        "%% max=%" PRIu32 "%% hist:%s",
+                 dacProfilerSectionName(s), sec->calls, sec->minCycles, sec->totalCycles / sec->calls, sec->maxCycles,
+                 dacProfilerPercent(sec->totalCycles, sec->totalBudget),
+                 dacProfilerPercent(sec->maxCycles, sec->maxBudget), hist);
+    }
+
+    ESP_LOGI("DAC", "samples=%" PRIu64 " clipped=%" PRIu32 " late=%" PRIu32 " dropped=%" PRIu32, stats->samples,
+             stats->clippedSamples, stats->lateRefills, stats->droppedBuffers);
+}
+
+/**
+ * @brief Set how often the DAC profiler statistics are printed to the log by dacProfilerCheckLog()
+ *
+ * @param intervalUs The time between prints, in microseconds, or 0 to never print
+ */
+void dacProfilerSetLogInterval(int64_t intervalUs)
+{
+    logIntervalUs = intervalUs;
+    logAccumUs    = 0;
+}
+
+/**
+ * @brief Print the DAC profiler statistics if the profiler is enabled and the log interval has elapsed. This is called
+ * from the main loop.
+ *
+ * @param elapsedUs The time since this was last called, in microseconds
+ */
+void dacProfilerCheckLog(int64_t elapsedUs)
+{
+    if (profilerEnabled && 0 < logIntervalUs)
+    {
+        logAccumUs += elapsedUs;
+        if (logAccumUs >= logIntervalUs)
+        {
+            logAccumUs -= logIntervalUs;
+            dacProfilerLog();
+        }
+    }
+}
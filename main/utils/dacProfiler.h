@@ -0,0 +1,155 @@
+/*! \file dacProfiler.h
+ *
+ * \section dacProfiler_design Design Philosophy
+ *
+ * This utility code measures how much of the DAC's time budget is spent generating audio. Every DAC buffer of
+ * \c len samples must be filled in less than <tt>len / DAC_SAMPLE_RATE_HZ</tt> seconds, or the DMA will run out of
+ * samples and the speaker will replay stale data. Knowing how close each mode gets to that limit tells us how many
+ * MIDI voices and sound effects a mode can afford.
+ *
+ * Time is measured in CPU cycles with getCycleCount() from coreutil.h. In the emulator getCycleCount() always returns
+ * zero, so the elapsed time is measured with esp_timer_get_time() and scaled to ::DAC_PROF_CPU_MHZ cycles instead.
+ * Emulator numbers are only useful for comparing modes against each other, not for predicting hardware performance.
+ *
+ * Each ::dacProfSection_t tracks its own call count, minimum, average, and maximum cycles, and a histogram of the
+ * percentage of the buffer period used per call. The last histogram bin counts calls which took longer than the buffer
+ * period. Output samples which are pinned at 0 or 255 are counted as clipped, regardless of which player clipped them,
+ * and late or dropped DAC refills are read from hdw-dac.h.
+ *
+ * Profiling is disabled by default. When it is disabled the measurement functions return immediately, so they can be
+ * left in the DAC path.
+ *
+ * \section dacProfiler_usage Usage
+ *
+ * The DAC callback in swadge2024.c is already instrumented. Enable profiling with dacProfilerEnable(), read the
+ * results with dacProfilerGetStats() and dacProfilerGetSection(), or print them to the USB log with dacProfilerLog().
+ * dacProfilerSetLogInterval() prints them periodically from the main loop.
+ *
+ * To profile additional code in the DAC path, wrap it in dacProfilerBegin() and dacProfilerEnd().
+ *
+ * In the emulator, press F6 or pass <tt>--audio-profile</tt> to show the results in a pane.
+ *
+ * \section dacProfiler_example Example
+ *
+ * \code{.c}
+ * // Start profiling and log the results every five seconds
+ * dacProfilerEnable(true);
+ * dacProfilerSetLogInterval(5000000);
+ *
+ * // Later, check how much of the budget the MIDI player uses
+ * const dacProfSectionStats_t* midi = dacProfilerGetSection(DAC_PROF_MIDI);
+ * printf("MIDI peak: %" PRIu32 "%%\n", dacProfilerPercent(midi->maxCycles, midi->maxBudget));
+ * \endcode
+ */
+
+#pragma once
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The CPU frequency used to convert a buffer length to a cycle budget
+#ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+    #define DAC_PROF_CPU_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#else
+    #define DAC_PROF_CPU_MHZ 240
+#endif
+
+/// @brief The number of histogram bins. Each bin is 10% of the buffer period, and the last is for calls over budget
+#define DAC_PROF_HIST_BINS 11
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/**
+ * @brief The sections of the DAC path which are profiled separately
+ */
+typedef enum
+{
+    DAC_PROF_CALLBACK,    ///< The whole DAC callback, including everything below
+    DAC_PROF_MODE,        ///< The current Swadge mode's fnDacCb
+    DAC_PROF_MIDI,        ///< The global MIDI players
+    DAC_PROF_SFX,         ///< The global sound effect mixer
+    DAC_PROF_NUM_SECTIONS ///< The number of profiled sections
+} dacProfSection_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Timing statistics for a single section of the DAC path
+ */
+typedef struct
+{
+    /// @brief The number of times this section was measured
+    uint32_t calls;
+
+    /// @brief The fewest cycles a single call took
+    uint32_t minCycles;
+
+    /// @brief The most cycles a single call took
+    uint32_t maxCycles;
+
+    /// @brief The cycle budget of the call which took \c maxCycles
+    uint32_t maxBudget;
+
+    /// @brief The sum of all measured cycles, used for the average
+    uint64_t totalCycles;
+
+    /// @brief The sum of all cycle budgets, used for the average percentage
+    uint64_t totalBudget;
+
+    /// @brief The number of calls in each 10% slice of the budget. The last bin counts calls over budget
+    uint32_t histogram[DAC_PROF_HIST_BINS];
+} dacProfSectionStats_t;
+
+/**
+ * @brief All statistics gathered by the DAC profiler
+ */
+typedef struct
+{
+    /// @brief Per-section timing statistics
+    dacProfSectionStats_t sections[DAC_PROF_NUM_SECTIONS];
+
+    /// @brief The number of samples which were generated
+    uint64_t samples;
+
+    /// @brief The number of output samples pinned at 0 or 255
+    uint32_t clippedSamples;
+
+    /// @brief The number of DAC buffers which were refilled at least one buffer period late
+    uint32_t lateRefills;
+
+    /// @brief The number of DAC buffers which were never refilled and played stale data
+    uint32_t droppedBuffers;
+} dacProfStats_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+void dacProfilerEnable(bool enable);
+bool dacProfilerIsEnabled(void);
+void dacProfilerReset(void);
+
+uint32_t dacProfilerBegin(void);
+void dacProfilerEnd(dacProfSection_t section, uint32_t start, int16_t len);
+void dacProfilerCountOutput(const uint8_t* samples, int16_t len);
+
+const dacProfStats_t* dacProfilerGetStats(void);
+const dacProfSectionStats_t* dacProfilerGetSection(dacProfSection_t section);
+const char* dacProfilerSectionName(dacProfSection_t section);
+uint32_t dacProfilerPercent(uint64_t cycles, uint64_t budget);
+
+void dacProfilerLog(void);
+void dacProfilerSetLogInterval(int64_t intervalUs);
+void dacProfilerCheckLog(int64_t elapsedUs);
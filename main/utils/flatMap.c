@@ -0,0 +1,516 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include "flatMap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+// The fewest slots a map has
+#define FLAT_MIN_SIZE 8
+
+// The map grows when it would be fuller than FLAT_LOAD_NUM / FLAT_LOAD_DEN. Linear probing slows down quickly past this
+#define FLAT_LOAD_NUM 3
+#define FLAT_LOAD_DEN 4
+
+// Hashes are multiplied by this before taking the top bits as the home slot (Fibonacci hashing), so that hash functions
+// with weak low bits, like hashString() on short keys, still spread out
+#define FLAT_MIX 0x9E3779B9u
+
+//==============================================================================
+// Static Function Prototypes
+//==============================================================================
+
+static uint32_t flatHashKey(const flatMap_t* map, const void* key);
+static int flatHome(const flatMap_t* map, uint32_t hash);
+static int flatDist(const flatMap_t* map, int slot, uint32_t hash);
+static int flatFind(const flatMap_t* map, const void* key, uint32_t hash);
+static void flatInsertNew(flatMap_t* map, uint32_t hash, const void* key, void* value);
+static void flatRemoveSlot(flatMap_t* map, int slot);
+static bool flatResize(flatMap_t* map, int size);
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Hash a key with the map's hash function. 0 marks an empty slot, so a hash of 0 is changed to 1
+ *
+ * @param map The map the key is for
+ * @param key The key to hash
+ * @return The key's hash, never 0
+ */
+static uint32_t flatHashKey(const flatMap_t* map, const void* key)
+{
+    uint32_t hash = map->hashFunc ? map->hashFunc(key) : hashString(key);
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Get the slot an entry would be in if nothing collided with it
+ *
+ * @param map The map
+ * @param hash The entry's cached hash
+ * @return The entry's home slot
+ */
+static int flatHome(const flatMap_t* map, uint32_t hash)
+{
+    return (hash * FLAT_MIX) >> map->shift;
+}
+
+/**
+ * @brief Get how far an entry is from its home slot
+ *
+ * @param map The map
+ * @param slot The slot the entry is in
+ * @param hash The entry's cached hash
+ * @return The number of slots the entry was pushed past its home slot
+ */
+static int flatDist(const flatMap_t* map, int slot, uint32_t hash)
+{
+    return (slot - flatHome(map, hash)) & (map->size - 1);
+}
+
+/**
+ * @brief Find the slot holding a key
+ *
+ * Runtime: O(1) average case. Probing stops at an empty slot, or at an entry closer to its home than the key would be,
+ * since Robin Hood insertion would have put the key before that entry
+ *
+ * @param map The map to search
+ * @param key The key to find
+ * @param hash The key's hash, from flatHashKey()
+ * @return The slot holding the key, or -1 if it isn't in the map
+ */
+static int flatFind(const flatMap_t* map, const void* key, uint32_t hash)
+{
+    if (0 == map->count)
+    {
+        return -1;
+    }
+
+    eqFunction_t eqFn = map->eqFunc ? map->eqFunc : strEq;
+    int mask          = map->size - 1;
+    int slot          = flatHome(map, hash);
+    for (int dist = 0;; dist++)
+    {
+        uint32_t slotHash = map->hashes[slot];
+        if (0 == slotHash || dist > flatDist(map, slot, slotHash))
+        {
+            return -1;
+        }
+        else if (slotHash == hash && eqFn(map->entries[slot].key, key))
+        {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/**
+ * @brief Insert an entry which isn't in the map yet. There must be at least one empty slot
+ *
+ * Robin Hood insertion: walking from the home slot, an entry which is further from home than the one in a slot takes
+ * that slot, and the displaced entry carries on looking for a slot of its own
+ *
+ * @param map The map to insert into
+ * @param hash The entry's hash, from flatHashKey()
+ * @param key The entry's key
+ * @param value The entry's value
+ */
+static void flatInsertNew(flatMap_t* map, uint32_t hash, const void* key, void* value)
+{
+    flatEntry_t entry = {.key = key, .value = value};
+    int mask          = map->size - 1;
+    int slot          = flatHome(map, hash);
+    int dist          = 0;
+    while (0 != map->hashes[slot])
+    {
+        int slotDist = flatDist(map, slot, map->hashes[slot]);
+        if (slotDist < dist)
+        {
+            // Swap with the entry which is closer to home
+            uint32_t tmpHash     = map->hashes[slot];
+            flatEntry_t tmpEntry = map->entries[slot];
+            map->hashes[slot]    = hash;
+            map->entries[slot]   = entry;
+            hash                 = tmpHash;
+            entry                = tmpEntry;
+            dist                 = slotDist;
+        }
+        slot = (slot + 1) & mask;
+        dist++;
+    }
+
+    map->hashes[slot]  = hash;
+    map->entries[slot] = entry;
+}
+
+/**
+ * @brief Remove the entry in a slot, shifting the entries after it back so there are no gaps in their probe sequences
+ *
+ * @param map The map to remove from
+ * @param slot The slot to empty
+ */
+static void flatRemoveSlot(flatMap_t* map, int slot)
+{
+    int mask = map->size - 1;
+    int next = (slot + 1) & mask;
+
+    // Stop at an empty slot or an entry which is already home
+    while (0 != map->hashes[next] && 0 != flatDist(map, next, map->hashes[next]))
+    {
+        map->hashes[slot]  = map->hashes[next];
+        map->entries[slot] = map->entries[next];
+        slot               = next;
+        next               = (next + 1) & mask;
+    }
+
+    map->hashes[slot]  = 0;
+    map->entries[slot] = (flatEntry_t){0};
+    map->count--;
+}
+
+/**
+ * @brief Move every entry into newly allocated arrays with a different number of slots
+ *
+ * Runtime: O(n)
+ *
+ * @param map The map to resize
+ * @param size The new number of slots, a power of two which is more than the number of entries
+ * @return true if the map was resized, false if memory couldn't be allocated
+ */
+static bool flatResize(flatMap_t* map, int size)
+{
+    // The hashes and entries share one allocation. The hashes come first and there are at least FLAT_MIN_SIZE of them,
+    // so the entries are aligned
+    size_t bytes     = (size_t)size * (sizeof(uint32_t) + sizeof(flatEntry_t));
+    uint32_t* hashes = map->arena ? arenaCalloc(map->arena, 1, bytes) : calloc(1, bytes);
+    if (NULL == hashes)
+    {
+        ESP_LOGE("FlatMap", "Failed to resize FlatMap to %d slots", size);
+        return false;
+    }
+
+    uint32_t* oldHashes     = map->hashes;
+    flatEntry_t* oldEntries = map->entries;
+    int oldSize             = map->size;
+    map->hashes             = hashes;
+    map->entries            = (flatEntry_t*)(hashes + size);
+    map->size               = size;
+    map->shift              = 32 - __builtin_ctz(size);
+
+    for (int i = 0; i < oldSize; i++)
+    {
+        if (0 != oldHashes[i])
+        {
+            flatInsertNew(map, oldHashes[i], oldEntries[i].key, oldEntries[i].value);
+        }
+    }
+
+    // Memory from an arena is freed with the arena
+    if (NULL == map->arena)
+    {
+        free(oldHashes);
+    }
+    return true;
+}
+
+/**
+ * @brief Initialize a flat map for string keys
+ *
+ * @param map A pointer to a flatMap_t struct to be initialized
+ * @param initialSize The number of entries to make room for
+ */
+void flatInit(flatMap_t* map, int initialSize)
+{
+    flatInitArena(map, initialSize, NULL, NULL, NULL);
+}
+
+/**
+ * @brief Initialize a flat map for non-string keys, using the given functions for hashing and comparison
+ *
+ * @param map A pointer to a flatMap_t struct to be initialized
+ * @param initialSize The number of entries to make room for
+ * @param hashFunc The hash function to use for the key datatype
+ * @param eqFunc The comparison function to use for the key datatype
+ */
+void flatInitBin(flatMap_t* map, int initialSize, hashFunction_t hashFunc, eqFunction_t eqFunc)
+{
+    flatInitArena(map, initialSize, hashFunc, eqFunc, NULL);
+}
+
+/**
+ * @brief Initialize a flat map which allocates from an arena instead of the heap
+ *
+ * @param map A pointer to a flatMap_t struct to be initialized
+ * @param initialSize The number of entries to make room for
+ * @param hashFunc The hash function to use for the key datatype, or NULL for string keys
+ * @param eqFunc The comparison function to use for the key datatype, or NULL for string keys
+ * @param arena The arena to allocate from, or NULL to use the heap. It must not be reset while the map is used
+ */
+void flatInitArena(flatMap_t* map, int initialSize, hashFunction_t hashFunc, eqFunction_t eqFunc, arena_t* arena)
+{
+    *map = (flatMap_t){
+        .hashFunc = hashFunc,
+        .eqFunc   = eqFunc,
+        .arena    = arena,
+    };
+    flatReserve(map, initialSize);
+}
+
+/**
+ * @brief Make room for a number of entries, so the map doesn't need to grow until there are more than that
+ *
+ * @param map The map to make room in
+ * @param count The number of entries to make room for, including ones already in the map
+ * @return true if there is room, false if memory couldn't be allocated
+ */
+bool flatReserve(flatMap_t* map, int count)
+{
+    int size = FLAT_MIN_SIZE;
+    while ((int64_t)size * FLAT_LOAD_NUM < (int64_t)count * FLAT_LOAD_DEN)
+    {
+        size *= 2;
+    }
+
+    if (size <= map->size)
+    {
+        return true;
+    }
+    return flatResize(map, size);
+}
+
+/**
+ * @brief Deinitialize and free all memory associated with the given flat map. Memory from an arena is freed with the
+ * arena instead
+ *
+ * @param map The map to deinitialize
+ */
+void flatDeinit(flatMap_t* map)
+{
+    if (NULL == map->arena)
+    {
+        free(map->hashes);
+    }
+    *map = (flatMap_t){0};
+}
+
+/**
+ * @brief Create or update a key-value pair in the flat map with a string key
+ *
+ * @warning A reference to the key will be stored in the map until the entry is removed
+ *
+ * @param map The map to update
+ * @param key The string key to associate the value with
+ * @param value The value to add to the map
+ * @return true if the value was stored, false if the map was full and couldn't grow
+ */
+bool flatPut(flatMap_t* map, const char* key, void* value)
+{
+    return flatPutBin(map, key, value);
+}
+
+/**
+ * @brief Return the value in the flat map associated with the given string key
+ *
+ * @param map The map to search
+ * @param key The string key to retrieve the value for
+ * @return A pointer to the mapped value, or NULL if it was not found
+ */
+void* flatGet(flatMap_t* map, const char* key)
+{
+    return flatGetBin(map, key);
+}
+
+/**
+ * @brief Remove the value with a given string key from the flat map
+ *
+ * @param map The map to remove from
+ * @param key The string key to remove the value for
+ * @return The value that was removed, or NULL if no value was found for the given key
+ */
+void* flatRemove(flatMap_t* map, const char* key)
+{
+    return flatRemoveBin(map, key);
+}
+
+/**
+ * @brief Create or update a key-value pair in the flat map with a non-string key
+ *
+ * @param map The map to update
+ * @param key The key to associate the value with
+ * @param value The value to add to the map
+ * @return true if the value was stored, false if the map was full and couldn't grow
+ */
+bool flatPutBin(flatMap_t* map, const void* key, void* value)
+{
+    uint32_t hash = flatHashKey(map, key);
+    int slot      = flatFind(map, key, hash);
+    if (slot >= 0)
+    {
+        map->entries[slot].value = value;
+        return true;
+    }
+
+    // Grow when the map would be too full. If it can't grow, it can still be filled up to one empty slot, which ends
+    // probe sequences and iteration
+    if ((int64_t)(map->count + 1) * FLAT_LOAD_DEN > (int64_t)map->size * FLAT_LOAD_NUM
+        && !flatResize(map, map->size ? map->size * 2 : FLAT_MIN_SIZE) && map->count + 1 >= map->size)
+    {
+        return false;
+    }
+
+    flatInsertNew(map, hash, key, value);
+    map->count++;
+    return true;
+}
+
+/**
+ * @brief Return the value in the flat map associated with the given key
+ *
+ * @param map The map to search
+ * @param key The key to retrieve the value for
+ * @return A pointer to the mapped value, or NULL if it was not found
+ */
+void* flatGetBin(flatMap_t* map, const void* key)
+{
+    int slot = flatFind(map, key, flatHashKey(map, key));
+    return (slot >= 0) ? map->entries[slot].value : NULL;
+}
+
+/**
+ * @brief Remove the value with a given non-string key from the flat map
+ *
+ * @param map The map to remove from
+ * @param key The key to remove the value for
+ * @return The value that was removed, or NULL if no value was found for the given key
+ */
+void* flatRemoveBin(flatMap_t* map, const void* key)
+{
+    int slot = flatFind(map, key, flatHashKey(map, key));
+    if (slot < 0)
+    {
+        return NULL;
+    }
+
+    void* value = map->entries[slot].value;
+    flatRemoveSlot(map, slot);
+    return value;
+}
+
+/**
+ * @brief Advance the given iterator to the next entry, or return false if there is no next entry
+ *
+ * The \c iter should point to a zero-initialized struct at the start of iteration. Once iteration completes and this
+ * function returns \c false, \c iter is reset. Unlike hashIterate(), stopping early doesn't leak anything, but the
+ * iterator must still be reset with flatIterReset() before it is used again.
+ *
+ * Entries are not returned in any particular order. Entries may be removed during iteration with flatIterRemove(), and
+ * values may be updated, but entries must not be added.
+ *
+ * @param[in] map The map to iterate over
+ * @param[in,out] iter A pointer to a flatIterator_t struct
+ * @return true if the iterator returned an entry
+ * @return false if iteration is complete and no entry was returned
+ */
+bool flatIterate(const flatMap_t* map, flatIterator_t* iter)
+{
+    int mask = map->size - 1;
+    if (!iter->_started)
+    {
+        if (0 == map->count)
+        {
+            flatIterReset(iter);
+            return false;
+        }
+
+        // Start just after an empty slot. Removing an entry only shifts entries in its cluster back, and no cluster
+        // crosses that empty slot, so entries which were already returned never move ahead of the iterator
+        int empty = 0;
+        while (0 != map->hashes[empty])
+        {
+            empty++;
+        }
+        iter->_start   = (empty + 1) & mask;
+        iter->_started = true;
+    }
+    else if (iter->_returned >= map->count)
+    {
+        // Every entry was returned
+        flatIterReset(iter);
+        return false;
+    }
+
+    while (iter->_steps < map->size)
+    {
+        int slot = (iter->_start + iter->_steps) & mask;
+        iter->_steps++;
+        if (0 != map->hashes[slot])
+        {
+            iter->key   = map->entries[slot].key;
+            iter->value = map->entries[slot].value;
+            iter->_returned++;
+            iter->_removed = false;
+            return true;
+        }
+    }
+
+    flatIterReset(iter);
+    return false;
+}
+
+/**
+ * @brief Remove the last entry returned by the iterator from the flat map
+ *
+ * This function does not need to search and so it always runs in constant time, apart from shifting the entries after
+ * the removed one.
+ *
+ * @warning If this function returns false, iteration is complete and the iterator was reset.
+ *
+ * @param map The map to remove the entry from
+ * @param iter The iterator whose current entry to remove from the map
+ * @return true if there are still entries remaining in the iterator
+ * @return false if there are no more entries remaining in the iterator
+ */
+bool flatIterRemove(flatMap_t* map, flatIterator_t* iter)
+{
+    if (!iter->_started || 0 == iter->_steps)
+    {
+        return false;
+    }
+
+    if (!iter->_removed)
+    {
+        flatRemoveSlot(map, (iter->_start + iter->_steps - 1) & (map->size - 1));
+        iter->_returned--;
+        iter->_removed = true;
+
+        // The next entry may have been shifted back into this slot, so look at it again
+        iter->_steps--;
+    }
+
+    if (iter->_returned >= map->count)
+    {
+        flatIterReset(iter);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Reset the given iterator struct so it can be used again
+ *
+ * @param iter A pointer to the iterator struct to be reset
+ */
+void flatIterReset(flatIterator_t* iter)
+{
+    *iter = (flatIterator_t){0};
+}
@@ -0,0 +1,155 @@
+/*!
+ * \file flatMap.h
+ * \brief A hash map which keeps its entries in flat arrays, for maps which are used often
+ *
+ * \section flatMap_design Design Philosophy
+ *
+ * This is an alternative to hashMap.h with the same operations and the same key functions. hashMap.h chains entries
+ * which collide, allocating a list node for each one, so a busy map makes many small heap allocations and lookups
+ * follow pointers around memory. A flat map stores every entry directly in an array instead, and never allocates
+ * anything besides that array.
+ *
+ * Collisions are handled with Robin Hood linear probing. An entry which doesn't fit in its home slot goes in the next
+ * free slot, and while inserting, an entry which is further from its home slot takes the place of one which is closer
+ * to its own. This keeps every entry close to home, so a lookup checks only a few neighboring slots, and a lookup for a
+ * missing key stops as soon as it reaches an entry which is closer to home than the key would be. Removing an entry
+ * shifts the entries after it back by one, so there are no tombstones and lookups don't slow down as entries are
+ * removed.
+ *
+ * Each key's hash is cached in a separate array of 32 bit values. Probing reads only that array, which is small and
+ * contiguous, and the key equality function is only called when the hashes match. A cached hash of 0 marks an empty
+ * slot.
+ *
+ * The number of slots is always a power of two, and the map grows to twice as many slots when it's 3/4 full. The map
+ * may be given an ::arena_t to allocate its arrays from instead of the heap, in which case growing doesn't free the old
+ * arrays, so it's best to call flatReserve() with the largest expected number of entries first. If the map can't grow,
+ * it keeps working until only one slot is empty, then flatPut() and flatPutBin() fail.
+ *
+ * Like hashMap.h, keys must remain valid and unchanged while they are in the map, since only a reference is kept.
+ *
+ * \section flatMap_usage Usage
+ *
+ * flatInit(), flatPut(), flatGet(), flatRemove(), flatDeinit(), flatIterate(), flatIterRemove(), and flatIterReset()
+ * work like hashInit(), hashPut(), hashGet(), hashRemove(), hashDeinit(), hashIterate(), hashIterRemove(), and
+ * hashIterReset(). The \c Bin variants take non-string keys, and flatInitBin() takes the same hash and equality
+ * functions as hashInitBin(), such as hashInt() and intsEq().
+ *
+ * flatInitArena() initializes a map which allocates from an arena instead of the heap.
+ *
+ * flatReserve() makes room for a number of entries up front, so the map doesn't grow while they are added.
+ *
+ * \section flatMap_example Example
+ *
+ * \code{.c}
+ * flatMap_t map;
+ * flatInit(&map, 16);
+ *
+ * flatPut(&map, "greeting", "Hello");
+ * flatPut(&map, "name", "King Donut");
+ * printf("%s! Your name is %s!\n", (const char*)flatGet(&map, "greeting"), (const char*)flatGet(&map, "name"));
+ *
+ * // Iterate over every entry, in no particular order
+ * flatIterator_t iter = {0};
+ * while (flatIterate(&map, &iter))
+ * {
+ *     printf("%s: %s\n", (const char*)iter.key, (const char*)iter.value);
+ * }
+ *
+ * flatDeinit(&map);
+ * \endcode
+ *
+ * A map with integer keys, allocated from an arena:
+ * \code{.c}
+ * static uint8_t mem[2048];
+ * arena_t arena;
+ * arenaInit(&arena, mem, sizeof(mem));
+ *
+ * flatMap_t map;
+ * flatInitArena(&map, 64, hashInt, intsEq, &arena);
+ * flatPutBin(&map, (const void*)PB_A, "Jump");
+ * flatPutBin(&map, (const void*)PB_B, "Run");
+ *
+ * // Nothing to free besides the arena
+ * arenaReset(&arena);
+ * \endcode
+ */
+
+#ifndef _FLAT_MAP_H_
+#define _FLAT_MAP_H_
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "hashMap.h"
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief The key and value in one slot of a flat map
+ */
+typedef struct
+{
+    const void* key; ///< The key of this entry
+    void* value;     ///< The value of this entry
+} flatEntry_t;
+
+/**
+ * @brief Struct used for iterating through a flat map. Zero it before starting
+ */
+typedef struct
+{
+    const void* key; ///< The key of the current entry
+    void* value;     ///< The value of the current entry
+
+    int _start;    ///< @internal The slot iteration started at, which follows an empty slot
+    int _steps;    ///< @internal The number of slots visited so far
+    int _returned; ///< @internal The number of entries returned which are still in the map
+    bool _started; ///< @internal Whether iteration has started
+    bool _removed; ///< @internal Whether the current entry was removed with flatIterRemove()
+} flatIterator_t;
+
+/**
+ * @brief A hash map which stores its entries in flat arrays with Robin Hood probing
+ */
+typedef struct
+{
+    int size;                ///< The number of slots, a power of two
+    int count;               ///< The number of entries in the map
+    uint8_t shift;           ///< How far a mixed hash is shifted right to get its home slot
+    uint32_t* hashes;        ///< The cached hash of each slot's key, or 0 for an empty slot
+    flatEntry_t* entries;    ///< The key and value of each slot
+    hashFunction_t hashFunc; ///< The key hash function to use, or NULL to use hashString()
+    eqFunction_t eqFunc;     ///< The key equality function to use, or NULL to use strEq()
+    arena_t* arena;          ///< The arena to allocate from, or NULL to use the heap
+} flatMap_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+void flatInit(flatMap_t* map, int initialSize);
+void flatInitBin(flatMap_t* map, int initialSize, hashFunction_t hashFunc, eqFunction_t eqFunc);
+void flatInitArena(flatMap_t* map, int initialSize, hashFunction_t hashFunc, eqFunction_t eqFunc, arena_t* arena);
+bool flatReserve(flatMap_t* map, int count);
+void flatDeinit(flatMap_t* map);
+
+bool flatPut(flatMap_t* map, const char* key, void* value);
+void* flatGet(flatMap_t* map, const char* key);
+void* flatRemove(flatMap_t* map, const char* key);
+
+bool flatPutBin(flatMap_t* map, const void* key, void* value);
+void* flatGetBin(flatMap_t* map, const void* key);
+void* flatRemoveBin(flatMap_t* map, const void* key);
+
+bool flatIterate(const flatMap_t* map, flatIterator_t* iter);
+bool flatIterRemove(flatMap_t* map, flatIterator_t* iter);
+void flatIterReset(flatIterator_t* iter);
+
+#endif
@@ -185,39 +185,33 @@ static hashNode_t* hashFindNode(hashMap_t* map, const void* key, uint32_t* hashO
     int index            = hash % map->size;
     hashBucket_t* bucket = &map->values[index];
     eqFunction_t eqFn    = map->eqFunc ? map->eqFunc : strEq;
-    // We can always dereference the first pointer because if the list is emptied, hasMulti should be false
-    // (It could still have only 1 entry but that's fine)
-    hashNode_t* node    = NULL;
-    node_t* listNodeOut = NULL;
+    hashNode_t* node     = NULL;
+    node_t* listNodeOut  = NULL;
 
+    int tries = 0;
     if (bucket->hasMulti)
     {
-        node = bucket->multi.first->val;
+        // The list node is needed to remove the entry, even if it's the first one
+        for (node_t* listNode = bucket->multi.first; listNode != NULL; listNode = listNode->next)
+        {
+            tries++;
+            hashNode_t* newNode = listNode->val;
+            if (newNode->hash == hash && eqFn(newNode->key, key))
+            {
+                node        = newNode;
+                listNodeOut = listNode;
+                break;
+            }
+        }
     }
     else
     {
+        tries++;
         node = &bucket->single;
-    }
-
-    int tries = 1;
-    if (node->key != NULL && (node->hash != hash || !eqFn(node->key, key)))
-    {
-        // Node doesn't match!
-        node = NULL;
-
-        if (bucket->hasMulti)
+        if (node->key != NULL && (node->hash != hash || !eqFn(node->key, key)))
         {
-            for (node_t* listNode = bucket->multi.first; listNode != NULL; listNode = listNode->next)
-            {
-                tries++;
-                hashNode_t* newNode = listNode->val;
-                if (newNode->hash == hash && eqFn(newNode->key, key))
-                {
-                    node        = newNode;
-                    listNodeOut = listNode;
-                    break;
-                }
-            }
+            // Node doesn't match!
+            node = NULL;
         }
     }
 
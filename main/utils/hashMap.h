@@ -32,7 +32,8 @@
  * through an array, up to a surprisingly large number of items. With that said, this is unlikely to be a real concern
  * in almost all situations. So unless a massive number of hash map operations is actually causing performance issues,
  * it's best to avoid premature optimization and instead just use whatever is the most convenient and results in the
- * simplest code.
+ * simplest code. If a map does turn out to be a bottleneck, flatMap.h has the same operations and keeps its entries in
+ * flat arrays instead of allocating them one at a time.
  *
  * \section hashMap_usage Usage
  *
@@ -4,6 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include <esp_log.h>
@@ -25,6 +26,9 @@
 // Function Prototypes
 //==============================================================================
 
+static node_t* allocNode(list_t* list);
+static void freeNode(list_t* list, node_t* node);
+
 #ifdef TEST_LIST
 static void validateList(const char* func, int line, bool nl, list_t* list, node_t* target);
 #endif
@@ -33,6 +37,100 @@ static void validateList(const char* func, int line, bool nl, list_t* list, node
 // Functions
 //==============================================================================
 
+/**
+ * @brief Allocate a pool of nodes which lists can share
+ *
+ * @param pool The pool to initialize
+ * @param numNodes The number of nodes in the pool
+ * @return true if the pool was allocated, false if there wasn't enough memory
+ */
+bool initListPool(listPool_t* pool, int numNodes)
+{
+    memset(pool, 0, sizeof(listPool_t));
+
+    pool->nodes = calloc(numNodes, sizeof(node_t));
+    if (NULL == pool->nodes)
+    {
+        return false;
+    }
+    pool->size = numNodes;
+
+    // Link every node into the free list, so the first node is handed out first
+    for (int i = numNodes - 1; i >= 0; i--)
+    {
+        pool->nodes[i].next = pool->freeList;
+        pool->freeList      = &pool->nodes[i];
+    }
+    return true;
+}
+
+/**
+ * @brief Free a pool of nodes. Every list using the pool must be cleared first
+ *
+ * @param pool The pool to free
+ */
+void deinitListPool(listPool_t* pool)
+{
+    if (0 != pool->used)
+    {
+        ESP_LOGW("LL", "Freeing a list pool with %d nodes in use", pool->used);
+    }
+    free(pool->nodes);
+    memset(pool, 0, sizeof(listPool_t));
+}
+
+/**
+ * @brief Get a node for a list, from its pool if it has one with nodes left, or from the heap otherwise
+ *
+ * @param list The list the node is for
+ * @return The node
+ */
+static node_t* allocNode(list_t* list)
+{
+    listPool_t* pool = list->pool;
+    if (NULL == pool)
+    {
+        return malloc(sizeof(node_t));
+    }
+
+    node_t* node = pool->freeList;
+    if (NULL == node)
+    {
+        pool->overflows++;
+        return malloc(sizeof(node_t));
+    }
+
+    pool->freeList = node->next;
+    pool->used++;
+    if (pool->used > pool->peak)
+    {
+        pool->peak = pool->used;
+    }
+    return node;
+}
+
+/**
+ * @brief Give a node back to the list's pool if it came from there, or free it otherwise
+ *
+ * @param list The list the node was in
+ * @param node The node to free
+ */
+static void freeNode(list_t* list, node_t* node)
+{
+    listPool_t* pool = list->pool;
+    uintptr_t addr   = (uintptr_t)node;
+    if (NULL != pool && addr >= (uintptr_t)pool->nodes && addr < (uintptr_t)&pool->nodes[pool->size])
+    {
+        node->next     = pool->freeList;
+        pool->freeList = node;
+        pool->used--;
+    }
+    else
+    {
+        free(node);
+    }
+}
+
 /**
  * @brief Add to the end of the list
  *
@@ -42,7 +140,7 @@ static void validateList(const char* func, int line, bool nl, list_t* list, node
 void push(list_t* list, void* val)
 {
     VALIDATE_LIST(__func__, __LINE__, true, list, val);
-    node_t* newLast = malloc(sizeof(node_t));
+    node_t* newLast = allocNode(list);
     newLast->val    = val;
     newLast->next   = NULL;
     newLast->prev   = list->last;
@@ -93,7 +191,7 @@ void* pop(list_t* list)
 
         // Get the last node val, then free it and update length
         retval = target->val;
-        free(target);
+        freeNode(list, target);
         list->length--;
     }
 
@@ -110,7 +208,7 @@ void* pop(list_t* list)
 void unshift(list_t* list, void* val)
 {
     VALIDATE_LIST(__func__, __LINE__, true, list, val);
-    node_t* newFirst = malloc(sizeof(node_t));
+    node_t* newFirst = allocNode(list);
     newFirst->val    = val;
     newFirst->next   = list->first;
     newFirst->prev   = NULL;
@@ -161,7 +259,7 @@ void* shift(list_t* list)
 
         // Get the first node val, then free it and update length
         retval = target->val;
-        free(target);
+        freeNode(list, target);
         list->length--;
     }
 
@@ -193,16 +291,12 @@ bool addIdx(list_t* list, void* val, uint16_t index)
     // Else if the index we're trying to add to is before the end of the list
     else if (index < list->length - 1)
     {
-        node_t* newNode = malloc(sizeof(node_t));
+        node_t* newNode = allocNode(list);
         newNode->val    = val;
         newNode->next   = NULL;
         newNode->prev   = NULL;
 
-        node_t* current = list->first;
-        for (uint16_t i = 0; i < index - 1; i++)
-        {
-            current = current->next;
-        }
+        node_t* current = getIdxNode(list, NULL, index - 1);
 
         // We need to adjust the newNode, and the nodes before and after it
         // current is set to the node before it
@@ -248,7 +342,7 @@ void addBefore(list_t* list, void* val, node_t* entry)
     else
     {
         node_t* prev    = entry->prev;
-        node_t* newNode = malloc(sizeof(node_t));
+        node_t* newNode = allocNode(list);
         newNode->val    = val;
         newNode->prev   = prev;
         newNode->next   = entry;
@@ -287,7 +381,7 @@ void addAfter(list_t* list, void* val, node_t* entry)
     else
     {
         node_t* next    = entry->next;
-        node_t* newNode = malloc(sizeof(node_t));
+        node_t* newNode = allocNode(list);
         newNode->val    = val;
         newNode->prev   = entry;
         newNode->next   = next;
@@ -334,11 +428,7 @@ void* removeIdx(list_t* list, uint16_t index)
     {
         void* retval = NULL;
 
-        node_t* current = list->first;
-        for (uint16_t i = 0; i < index - 1; i++)
-        {
-            current = current->next;
-        }
+        node_t* current = getIdxNode(list, NULL, index - 1);
 
         // We need to free the removed node, and adjust the nodes before and after it
         // current is set to the node before it
@@ -349,7 +439,7 @@ void* removeIdx(list_t* list, uint16_t index)
         current->next       = target->next;
         current->next->prev = current;
 
-        free(target);
+        freeNode(list, target);
         target = NULL;
 
         list->length--;
@@ -415,7 +505,7 @@ void* removeEntry(list_t* list, node_t* entry)
     VALIDATE_LIST(__func__, __LINE__, false, list, entry);
 
     // free the memory
-    free(entry);
+    freeNode(list, entry);
 
     // Return the value
     return retVal;
@@ -436,6 +526,246 @@ void clear(list_t* list)
     VALIDATE_LIST(__func__, __LINE__, false, list, NULL);
 }
 
+/**
+ * @brief Get the node at an index in the list. This walks from the first node, the last node, or the cursor, whichever
+ * is closest to the index
+ *
+ * @param list The list to get a node from
+ * @param cursor A cursor to start from and move to the index, or NULL to not use one. It must be zeroed before its
+ * first use and after the list is changed
+ * @param index The index of the node to get
+ * @return The node at the index, or NULL if the index was invalid
+ */
+node_t* getIdxNode(list_t* list, listCursor_t* cursor, int index)
+{
+    if (index < 0 || index >= list->length)
+    {
+        return NULL;
+    }
+
+    // Start from whichever end of the list is closer
+    node_t* node;
+    int idx;
+    if (index < list->length - 1 - index)
+    {
+        node = list->first;
+        idx  = 0;
+    }
+    else
+    {
+        node = list->last;
+        idx  = list->length - 1;
+    }
+
+    // Start from the cursor instead if it's even closer
+    if (NULL != cursor && NULL != cursor->node && cursor->idx < list->length
+        && abs(cursor->idx - index) < abs(idx - index))
+    {
+        node = cursor->node;
+        idx  = cursor->idx;
+    }
+
+    while (idx < index)
+    {
+        node = node->next;
+        idx++;
+    }
+    while (idx > index)
+    {
+        node = node->prev;
+        idx--;
+    }
+
+    if (NULL != cursor)
+    {
+        cursor->node = node;
+        cursor->idx  = index;
+    }
+    return node;
+}
+
+/**
+ * @brief Get the value at an index in the list, without removing it
+ *
+ * @param list The list to get a value from
+ * @param cursor A cursor to start from and move to the index, or NULL to not use one. It must be zeroed before its
+ * first use and after the list is changed
+ * @param index The index of the value to get
+ * @return The value at the index, or NULL if the index was invalid
+ */
+void* getIdx(list_t* list, listCursor_t* cursor, int index)
+{
+    node_t* node = getIdxNode(list, cursor, index);
+    return (NULL == node) ? NULL : node->val;
+}
+
+/**
+ * @brief Add a node to the end of an intrusive list
+ *
+ * @param list The list to add to
+ * @param node The node to add, which must not already be in a list
+ */
+void ilistPush(ilist_t* list, ilistNode_t* node)
+{
+    node->next = NULL;
+    node->prev = list->last;
+
+    if (NULL == list->last)
+    {
+        list->first = node;
+    }
+    else
+    {
+        list->last->next = node;
+    }
+    list->last = node;
+    list->length++;
+}
+
+/**
+ * @brief Remove the node at the end of an intrusive list
+ *
+ * @param list The list to remove from
+ * @return The removed node, or NULL if the list was empty
+ */
+ilistNode_t* ilistPop(ilist_t* list)
+{
+    ilistNode_t* node = list->last;
+    if (NULL != node)
+    {
+        ilistRemove(list, node);
+    }
+    return node;
+}
+
+/**
+ * @brief Add a node to the front of an intrusive list
+ *
+ * @param list The list to add to
+ * @param node The node to add, which must not already be in a list
+ */
+void ilistUnshift(ilist_t* list, ilistNode_t* node)
+{
+    node->next = list->first;
+    node->prev = NULL;
+
+    if (NULL == list->first)
+    {
+        list->last = node;
+    }
+    else
+    {
+        list->first->prev = node;
+    }
+    list->first = node;
+    list->length++;
+}
+
+/**
+ * @brief Remove the node at the front of an intrusive list
+ *
+ * @param list The list to remove from
+ * @return The removed node, or NULL if the list was empty
+ */
+ilistNode_t* ilistShift(ilist_t* list)
+{
+    ilistNode_t* node = list->first;
+    if (NULL != node)
+    {
+        ilistRemove(list, node);
+    }
+    return node;
+}
+
+/**
+ * @brief Insert a node into an intrusive list immediately before the given node.
+ *
+ * If the given node is NULL, inserts at the end of the list
+ *
+ * @param list The list to add to
+ * @param node The node to add, which must not already be in a list
+ * @param entry The existing node, before which to insert the new one
+ */
+void ilistAddBefore(ilist_t* list, ilistNode_t* node, ilistNode_t* entry)
+{
+    if (NULL == entry)
+    {
+        ilistPush(list, node);
+    }
+    else if (entry == list->first)
+    {
+        ilistUnshift(list, node);
+    }
+    else
+    {
+        node->prev        = entry->prev;
+        node->next        = entry;
+        entry->prev->next = node;
+        entry->prev       = node;
+        list->length++;
+    }
+}
+
+/**
+ * @brief Insert a node into an intrusive list immediately after the given node.
+ *
+ * If the given node is NULL, inserts at the beginning of the list
+ *
+ * @param list The list to add to
+ * @param node The node to add, which must not already be in a list
+ * @param entry The existing node, after which to insert the new one
+ */
+void ilistAddAfter(ilist_t* list, ilistNode_t* node, ilistNode_t* entry)
+{
+    if (NULL == entry)
+    {
+        ilistUnshift(list, node);
+    }
+    else if (entry == list->last)
+    {
+        ilistPush(list, node);
+    }
+    else
+    {
+        node->prev        = entry;
+        node->next        = entry->next;
+        entry->next->prev = node;
+        entry->next       = node;
+        list->length++;
+    }
+}
+
+/**
+ * @brief Remove a node from an intrusive list. Like removeEntry(), this doesn't check that the node is in the list
+ *
+ * @param list The list to remove from
+ * @param node The node to remove
+ */
+void ilistRemove(ilist_t* list, ilistNode_t* node)
+{
+    if (NULL == node->prev)
+    {
+        list->first = node->next;
+    }
+    else
+    {
+        node->prev->next = node->next;
+    }
+
+    if (NULL == node->next)
+    {
+        list->last = node->prev;
+    }
+    else
+    {
+        node->next->prev = node->prev;
+    }
+
+    node->next = NULL;
+    node->prev = NULL;
+    list->length--;
+}
+
 #ifdef TEST_LIST
 
 /**
@@ -495,7 +825,11 @@ static void validateList(const char* func, int line, bool nl, list_t* list, node
  */
 void listTester(void)
 {
-    list_t testList = {.first = NULL, .last = NULL, .length = 0};
+    // Use a pool smaller than the list usually is, so both pooled and allocated nodes are used
+    listPool_t pool;
+    initListPool(&pool, 16);
+
+    list_t testList = {.first = NULL, .last = NULL, .length = 0, .pool = &pool};
     list_t* l       = &testList;
 
     // Seed the list
@@ -562,12 +896,7 @@ void listTester(void)
                 {
                     idx = esp_random() % l->length;
                 }
-                node_t* node = l->first;
-                while (idx--)
-                {
-                    node = node->next;
-                }
-                removeEntry(l, node);
+                removeEntry(l, getIdxNode(l, NULL, idx));
                 break;
             }
             case 7:
@@ -577,6 +906,8 @@ void listTester(void)
             }
         }
     }
+    clear(l);
+    deinitListPool(&pool);
     ESP_LOGD("LV", "List validated");
 }
 
@@ -9,18 +9,41 @@
  *
  * Data can be added or removed from the head or tail in O(1) time, making this suitable as a queue or stack.
  *
+ * Each entry is a ::node_t which is allocated when a value is added and freed when it is removed. Lists which gain and
+ * lose entries very often, like a list of enemies, may instead take their nodes from a ::listPool_t. A pool allocates a
+ * fixed number of nodes up front and keeps the unused ones on a free list, so adding and removing never touch the heap.
+ * If a pool runs out, nodes are allocated from the heap as usual, and ::listPool_t.overflows counts how often that
+ * happened so the pool can be sized better. One pool may be shared by any number of lists.
+ *
+ * For data which is only ever in one list at a time, an intrusive list avoids nodes entirely. An ::ilistNode_t is
+ * embedded in the user's own struct, and the list links those together. Nothing is allocated or freed, and an entry
+ * can be removed in O(1) time from just a pointer to it.
+ *
  * \section linked_list_usage Usage
  *
  * push() and pop() add and remove from the tail of the list.
  *
  * unshift() and shift() add and remove from the head of the list.
  *
- * addIdx() and removeIdx() add and remove from the middle of the list, by index. These run in O(N), not O(1).
+ * addIdx() and removeIdx() add and remove from the middle of the list, by index. These run in O(N), not O(1), but walk
+ * from whichever end of the list is closer.
+ *
+ * getIdx() and getIdxNode() get a value or node by index. They take an optional ::listCursor_t which remembers the last
+ * index found, so stepping through nearby indices only walks a few nodes each time. A cursor must be zeroed before the
+ * first use, and zeroed again whenever the list is changed by anything other than reading it.
  *
  * removeEntry() can remove a specific entry.
  *
  * Links are allocated, so when done with a list, be sure to call clear() when done.
  *
+ * initListPool() allocates a pool of nodes and deinitListPool() frees it. A list uses a pool when its ::list_t.pool is
+ * set, which must only be changed while the list is empty. Every list using a pool must be cleared before the pool is
+ * deinitialized.
+ *
+ * ilistPush(), ilistPop(), ilistUnshift(), ilistShift(), ilistAddBefore(), ilistAddAfter(), and ilistRemove() work
+ * like their ::list_t counterparts on an ::ilist_t, but take and return ::ilistNode_t pointers. ILIST_ENTRY() gets the
+ * struct which contains a node.
+ *
  * \section linked_list_example Example
  *
  * Creating an empty list:
@@ -61,14 +84,73 @@
  * // Remove from tail
  * uint32_t* poppedVal = pop(myList);
  * \endcode
+ *
+ * Using a pool of nodes for a list which changes often:
+ * \code{.c}
+ * listPool_t pool;
+ * initListPool(&pool, 64);
+ *
+ * list_t enemies = {0};
+ * enemies.pool   = &pool;
+ *
+ * // These don't allocate until the pool's 64 nodes are used
+ * push(&enemies, enemy);
+ * removeEntry(&enemies, enemies.first);
+ *
+ * clear(&enemies);
+ * deinitListPool(&pool);
+ * \endcode
+ *
+ * Stepping through a list by index with a cursor:
+ * \code{.c}
+ * listCursor_t cursor = {0};
+ * for (int i = 0; i < myList->length; i += 2)
+ * {
+ *     // Each call walks two nodes from the last one, rather than from the start of the list
+ *     printf("%d, ", *((uint32_t*)getIdx(myList, &cursor, i)));
+ * }
+ * \endcode
+ *
+ * An intrusive list:
+ * \code{.c}
+ * typedef struct
+ * {
+ *     int x;
+ *     int y;
+ *     ilistNode_t link;
+ * } bullet_t;
+ *
+ * ilist_t bullets = {0};
+ * bullet_t b      = {.x = 1, .y = 2};
+ * ilistPush(&bullets, &b.link);
+ *
+ * for (ilistNode_t* n = bullets.first; n != NULL; n = n->next)
+ * {
+ *     bullet_t* bullet = ILIST_ENTRY(n, bullet_t, link);
+ *     printf("%d, %d\n", bullet->x, bullet->y);
+ * }
+ *
+ * // Nothing to free, the node is part of the bullet
+ * ilistRemove(&bullets, &b.link);
+ * \endcode
  */
 
 #ifndef _LINKED_LIST_H
 #define _LINKED_LIST_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+/**
+ * @brief Get a pointer to the struct containing an ::ilistNode_t
+ *
+ * @param node A pointer to the ::ilistNode_t, which must not be NULL
+ * @param type The type of the struct containing the node
+ * @param member The name of the node within the struct
+ */
+#define ILIST_ENTRY(node, type, member) ((type*)((uint8_t*)(node) - offsetof(type, member)))
+
 /**
  * @brief A node in a doubly linked list with pointers to the previous and next values (which may be NULL), and a \c
  * void* to arbritray data
@@ -80,16 +162,61 @@ typedef struct node
     struct node* prev; ///< The previous node in the list
 } node_t;
 
+/**
+ * @brief A fixed number of nodes which lists can use instead of allocating each node
+ */
+typedef struct
+{
+    node_t* nodes;    ///< All of the nodes in the pool
+    node_t* freeList; ///< The first unused node, linked to the rest through next
+    int size;         ///< The number of nodes in the pool
+    int used;         ///< The number of nodes currently in use
+    int peak;         ///< The most nodes that were in use at once
+    int overflows;    ///< The number of nodes allocated from the heap because the pool was empty
+} listPool_t;
+
 /**
  * @brief A doubly linked list with pointers to the first and last nodes
  */
 typedef struct
 {
-    node_t* first; ///< The first node in the list
-    node_t* last;  ///< The last node in the list
-    int length;    ///< The number of nodes in the list
+    node_t* first;    ///< The first node in the list
+    node_t* last;     ///< The last node in the list
+    int length;       ///< The number of nodes in the list
+    listPool_t* pool; ///< The pool to take nodes from, or NULL to allocate each node
 } list_t;
 
+/**
+ * @brief A remembered position in a list, used to speed up getting nearby indices. Zero it before using it
+ */
+typedef struct
+{
+    node_t* node; ///< The node at idx, or NULL if the cursor isn't set
+    int idx;      ///< The index of node
+} listCursor_t;
+
+/**
+ * @brief A node in an intrusive doubly linked list, which is embedded in the struct it links
+ */
+typedef struct ilistNode
+{
+    struct ilistNode* next; ///< The next node in the list
+    struct ilistNode* prev; ///< The previous node in the list
+} ilistNode_t;
+
+/**
+ * @brief An intrusive doubly linked list with pointers to the first and last nodes
+ */
+typedef struct
+{
+    ilistNode_t* first; ///< The first node in the list
+    ilistNode_t* last;  ///< The last node in the list
+    int length;         ///< The number of nodes in the list
+} ilist_t;
+
+bool initListPool(listPool_t* pool, int numNodes);
+void deinitListPool(listPool_t* pool);
+
 void push(list_t* list, void* val);
 void* pop(list_t* list);
 void unshift(list_t* list, void* val);
@@ -100,6 +227,16 @@ void addAfter(list_t* list, void* val, node_t* entry);
 void* removeIdx(list_t* list, uint16_t index);
 void* removeEntry(list_t* list, node_t* entry);
 void clear(list_t* list);
+node_t* getIdxNode(list_t* list, listCursor_t* cursor, int index);
+void* getIdx(list_t* list, listCursor_t* cursor, int index);
+
+void ilistPush(ilist_t* list, ilistNode_t* node);
+ilistNode_t* ilistPop(ilist_t* list);
+void ilistUnshift(ilist_t* list, ilistNode_t* node);
+ilistNode_t* ilistShift(ilist_t* list);
+void ilistAddBefore(ilist_t* list, ilistNode_t* node, ilistNode_t* entry);
+void ilistAddAfter(ilist_t* list, ilistNode_t* node, ilistNode_t* entry);
+void ilistRemove(ilist_t* list, ilistNode_t* node);
 
 #ifdef TEST_LIST
 // Exercise the linked list functions
@@ -0,0 +1,876 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_now.h>
+
+#include "p2pBulk.h"
+#include "macros.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+// How long to wait for the receiver to answer an offer, or to say it's done after the last fragment was ACKed. This is
+// longer than p2pConnection retries a message, so an answer which needed every retry still arrives in time
+#define REPLY_TIMEOUT_US 4000000
+
+// The length of a fragment's header, before its data
+#define DATA_HDR_LEN offsetof(p2pBulkDataMsg_t, data)
+
+// The length of a status message's header, before its bitmap
+#define STATUS_HDR_LEN offsetof(p2pBulkStatusMsg_t, bits)
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void p2pBulkTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len);
+static void p2pBulkReplyTimeout(void* arg);
+static void p2pBulkOffer(p2pBulk_t* bulk);
+static void p2pBulkFill(p2pBulk_t* bulk);
+static void p2pBulkSetDone(p2pBulk_t* bulk, uint16_t frag);
+static void p2pBulkCheckFinishing(p2pBulk_t* bulk);
+static void p2pBulkInterrupt(p2pBulk_t* bulk, bool reoffer);
+static void p2pBulkTxFinish(p2pBulk_t* bulk, p2pBulkEvt_t evt);
+static void p2pBulkCountRetransmits(p2pBulk_t* bulk);
+static void p2pBulkRecvOffer(p2pBulk_t* bulk, const p2pBulkOfferMsg_t* msg);
+static void p2pBulkRecvData(p2pBulk_t* bulk, const p2pBulkDataMsg_t* msg, uint8_t dataLen);
+static void p2pBulkRecvStatus(p2pBulk_t* bulk, const p2pBulkStatusMsg_t* msg, uint8_t bitsLen);
+static void p2pBulkSendStatus(p2pBulk_t* bulk);
+static void p2pBulkSendHdr(p2pBulk_t* bulk, p2pBulkMsgType_t type, uint8_t id);
+static void p2pBulkUpdateRate(p2pBulkStats_t* stats);
+static uint32_t p2pBulkFragLen(uint32_t len, uint16_t frag);
+static uint32_t p2pBulkCrc32(const uint8_t* data, uint32_t len);
+static bool bitGet(const uint8_t* bits, uint16_t idx);
+static void bitSet(uint8_t* bits, uint16_t idx);
+static void bitClear(uint8_t* bits, uint16_t idx);
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Initialize bulk transfers over a p2p connection. This must be called after p2pInitialize(), and sets a
+ * sliding window of ::P2P_MAX_WINDOW messages if the connection doesn't have one
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param p2p The p2p connection to transfer buffers over
+ * @param rxBuf Where received buffers are written. May be NULL if this Swadge only sends
+ * @param rxBufLen The length of rxBuf, which is the longest buffer that may be received
+ * @param cbFn A function pointer which will be called when transfers finish or are interrupted
+ */
+void p2pBulkInit(p2pBulk_t* bulk, p2pInfo* p2p, uint8_t* rxBuf, uint32_t rxBufLen, p2pBulkCbFn cbFn)
+{
+    memset(bulk, 0, sizeof(p2pBulk_t));
+    bulk->p2p       = p2p;
+    bulk->cbFn      = cbFn;
+    bulk->rx.buf    = rxBuf;
+    bulk->rx.bufLen = (NULL == rxBuf) ? 0 : rxBufLen;
+
+    // Start from a random ID so a restarted Swadge doesn't look like it's continuing an old transfer
+    bulk->tx.id = esp_random();
+
+    p2p->bulk = bulk;
+    if (NULL == p2p->win)
+    {
+        p2pSetWindow(p2p, P2P_MAX_WINDOW);
+    }
+
+    // Set up a timer for when the receiver doesn't answer
+    esp_timer_create_args_t p2pBulkReplyTimeoutArgs = {
+        .callback              = p2pBulkReplyTimeout,
+        .arg                   = bulk,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "p2pb_rt",
+        .skip_unhandled_events = false,
+    };
+    esp_timer_create(&p2pBulkReplyTimeoutArgs, &bulk->replyTmr);
+}
+
+/**
+ * @brief Stop any transfers and free everything allocated for them. This should be called before p2pDeinit()
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+void p2pBulkDeinit(p2pBulk_t* bulk)
+{
+    if (NULL != bulk->replyTmr)
+    {
+        esp_timer_stop(bulk->replyTmr);
+        esp_timer_delete(bulk->replyTmr);
+        bulk->replyTmr = NULL;
+    }
+
+    // The three transmit bitmaps are allocated together
+    free(bulk->tx.doneBits);
+    bulk->tx.doneBits = NULL;
+    bulk->tx.state    = P2P_BULK_TX_IDLE;
+
+    free(bulk->rx.bits);
+    bulk->rx.bits  = NULL;
+    bulk->rx.state = P2P_BULK_RX_IDLE;
+
+    if (bulk == bulk->p2p->bulk)
+    {
+        bulk->p2p->bulk = NULL;
+    }
+}
+
+/**
+ * @brief Start sending a buffer to the other Swadge. If not connected yet, the buffer is offered once the connection
+ * is established
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param tag A value for the Swadge mode to tell what kind of buffer this is, delivered to the receiver
+ * @param data The buffer to send, which must stay valid until the #p2pBulkCbFn is called with ::P2P_BULK_SENT or
+ * ::P2P_BULK_FAILED
+ * @param len The length of the buffer
+ * @return true if the transfer started, false if another buffer is being sent or this one is empty or too long
+ */
+bool p2pBulkSend(p2pBulk_t* bulk, uint8_t tag, const uint8_t* data, uint32_t len)
+{
+    if (P2P_BULK_TX_IDLE != bulk->tx.state || 0 == len || len > (uint32_t)UINT16_MAX * P2P_BULK_FRAG_LEN)
+    {
+        return false;
+    }
+
+    // Allocate the done, in-flight, and sent bitmaps together
+    uint16_t numFrags  = (len + P2P_BULK_FRAG_LEN - 1) / P2P_BULK_FRAG_LEN;
+    uint16_t bitmapLen = (numFrags + 7) / 8;
+    uint8_t* bitmaps   = calloc(3, bitmapLen);
+    if (NULL == bitmaps)
+    {
+        ESP_LOGE("P2P", "Couldn't allocate bitmaps for %" PRIu16 " fragments", numFrags);
+        return false;
+    }
+
+    bulk->tx.data         = data;
+    bulk->tx.len          = len;
+    bulk->tx.crc          = p2pBulkCrc32(data, len);
+    bulk->tx.tag          = tag;
+    bulk->tx.numFrags     = numFrags;
+    bulk->tx.numDone      = 0;
+    bulk->tx.nextFrag     = 0;
+    bulk->tx.resumes      = 0;
+    bulk->tx.doneBits     = bitmaps;
+    bulk->tx.inFlightBits = &bitmaps[bitmapLen];
+    bulk->tx.sentBits     = &bitmaps[2 * bitmapLen];
+    bulk->tx.id++;
+
+    memset(&bulk->tx.stats, 0, sizeof(p2pBulkStats_t));
+    bulk->tx.stats.totalBytes = len;
+    bulk->tx.stats.fragments  = numFrags;
+    bulk->tx.stats.startUs    = esp_timer_get_time();
+    bulk->tx.winRetransmits   = (NULL != bulk->p2p->win) ? bulk->p2p->win->retransmits : 0;
+
+    if (bulk->p2p->cnc.isConnected)
+    {
+        p2pBulkOffer(bulk);
+    }
+    else
+    {
+        bulk->tx.state = P2P_BULK_TX_WAITING;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop sending the current buffer and tell the receiver to drop it. The #p2pBulkCbFn isn't called
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+void p2pBulkCancel(p2pBulk_t* bulk)
+{
+    if (P2P_BULK_TX_IDLE == bulk->tx.state)
+    {
+        return;
+    }
+
+    if (bulk->p2p->cnc.isConnected)
+    {
+        p2pBulkSendHdr(bulk, P2P_BULK_MSG_CANCEL, bulk->tx.id);
+    }
+
+    esp_timer_stop(bulk->replyTmr);
+    free(bulk->tx.doneBits);
+    bulk->tx.doneBits = NULL;
+    bulk->tx.state    = P2P_BULK_TX_IDLE;
+}
+
+/**
+ * @brief Handle a message received by p2p. This must be called from the #p2pMsgRxCbFn with every received message
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param payload The received message
+ * @param len The length of the received message
+ * @return true if the message was part of a bulk transfer, false if the Swadge mode should handle it
+ */
+bool p2pBulkRecv(p2pBulk_t* bulk, const uint8_t* payload, uint8_t len)
+{
+    if (len < sizeof(p2pBulkHdr_t) || P2P_BULK_MARKER != payload[0])
+    {
+        return false;
+    }
+
+    const p2pBulkHdr_t* hdr = (const p2pBulkHdr_t*)payload;
+    switch (hdr->type)
+    {
+        case P2P_BULK_MSG_OFFER:
+        {
+            if (len >= sizeof(p2pBulkOfferMsg_t))
+            {
+                p2pBulkRecvOffer(bulk, (const p2pBulkOfferMsg_t*)payload);
+            }
+            break;
+        }
+        case P2P_BULK_MSG_DATA:
+        {
+            if (len > DATA_HDR_LEN)
+            {
+                p2pBulkRecvData(bulk, (const p2pBulkDataMsg_t*)payload, len - DATA_HDR_LEN);
+            }
+            break;
+        }
+        case P2P_BULK_MSG_STATUS:
+        {
+            if (len >= STATUS_HDR_LEN)
+            {
+                p2pBulkRecvStatus(bulk, (const p2pBulkStatusMsg_t*)payload, len - STATUS_HDR_LEN);
+            }
+            break;
+        }
+        case P2P_BULK_MSG_DONE:
+        {
+            if (hdr->id == bulk->tx.id && P2P_BULK_TX_IDLE != bulk->tx.state)
+            {
+                p2pBulkTxFinish(bulk, P2P_BULK_SENT);
+            }
+            break;
+        }
+        case P2P_BULK_MSG_REJECT:
+        {
+            if (hdr->id == bulk->tx.id && P2P_BULK_TX_IDLE != bulk->tx.state)
+            {
+                p2pBulkTxFinish(bulk, P2P_BULK_FAILED);
+            }
+            break;
+        }
+        case P2P_BULK_MSG_CANCEL:
+        {
+            if (hdr->id == bulk->rx.id)
+            {
+                bulk->rx.state = P2P_BULK_RX_IDLE;
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Handle a connection event. This must be called from the #p2pConCbFn with every connection event
+ *
+ * When the connection is lost, the buffer being sent is interrupted. When it's established again, the buffer is
+ * offered again and only the fragments the receiver is missing are sent
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param evt The connection event
+ */
+void p2pBulkConEvt(p2pBulk_t* bulk, connectionEvt_t evt)
+{
+    if (CON_LOST == evt)
+    {
+        if (P2P_BULK_TX_IDLE != bulk->tx.state && P2P_BULK_TX_WAITING != bulk->tx.state)
+        {
+            // The window is about to be cleared without calling the fragments' callbacks, so none are in flight
+            memset(bulk->tx.inFlightBits, 0, (bulk->tx.numFrags + 7) / 8);
+            p2pBulkCountRetransmits(bulk);
+            p2pBulkInterrupt(bulk, false);
+        }
+    }
+    else if (CON_ESTABLISHED == evt)
+    {
+        // The window starts counting over with a new connection
+        bulk->tx.winRetransmits = (NULL != bulk->p2p->win) ? bulk->p2p->win->retransmits : 0;
+        if (P2P_BULK_TX_WAITING == bulk->tx.state)
+        {
+            p2pBulkOffer(bulk);
+        }
+    }
+}
+
+/**
+ * @brief Get statistics for the current or last transfer in each direction
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param txStats Written with the statistics for the buffer being sent. May be NULL
+ * @param rxStats Written with the statistics for the buffer being received. May be NULL
+ */
+void p2pBulkGetStats(p2pBulk_t* bulk, p2pBulkStats_t* txStats, p2pBulkStats_t* rxStats)
+{
+    if (P2P_BULK_TX_IDLE != bulk->tx.state)
+    {
+        p2pBulkCountRetransmits(bulk);
+        bulk->tx.stats.elapsedUs = esp_timer_get_time() - bulk->tx.stats.startUs;
+        p2pBulkUpdateRate(&bulk->tx.stats);
+    }
+
+    if (NULL != txStats)
+    {
+        *txStats = bulk->tx.stats;
+    }
+    if (NULL != rxStats)
+    {
+        *rxStats = bulk->rx.stats;
+    }
+}
+
+/**
+ * @brief Handle the result of sending a bulk message. Fragments which were ACKed are done, and each one makes room in
+ * the window for another
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param status Whether the message was ACKed or failed
+ * @param data The message that was sent
+ * @param len The length of the message
+ */
+static void p2pBulkTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len)
+{
+    p2pBulk_t* bulk = p2p->bulk;
+    if (NULL == bulk || NULL == data || len < sizeof(p2pBulkHdr_t) || P2P_BULK_TX_IDLE == bulk->tx.state)
+    {
+        return;
+    }
+
+    // Only the sender's messages matter here, the receiver's are answered again if they're lost
+    const p2pBulkHdr_t* hdr = (const p2pBulkHdr_t*)data;
+    if (hdr->id != bulk->tx.id)
+    {
+        return;
+    }
+
+    if (P2P_BULK_MSG_DATA == hdr->type && len > DATA_HDR_LEN)
+    {
+        const p2pBulkDataMsg_t* msg = (const p2pBulkDataMsg_t*)data;
+        uint16_t frag               = msg->frag[0] | (msg->frag[1] << 8);
+        if (frag >= bulk->tx.numFrags)
+        {
+            return;
+        }
+
+        bitClear(bulk->tx.inFlightBits, frag);
+        if (MSG_ACKED == status)
+        {
+            // p2p only ACKs a message once it was delivered, so the receiver has this fragment
+            p2pBulkSetDone(bulk, frag);
+            p2pBulkCheckFinishing(bulk);
+            p2pBulkFill(bulk);
+        }
+        else if (P2P_BULK_TX_SENDING == bulk->tx.state)
+        {
+            // The fragment wasn't ACKed after every retry, so ask the receiver what it's missing
+            p2pBulkInterrupt(bulk, bulk->p2p->cnc.isConnected);
+        }
+    }
+    else if (P2P_BULK_MSG_OFFER == hdr->type && MSG_FAILED == status && P2P_BULK_TX_OFFERING == bulk->tx.state)
+    {
+        p2pBulkInterrupt(bulk, bulk->p2p->cnc.isConnected);
+    }
+}
+
+/**
+ * @brief Resume a transfer if the receiver didn't answer an offer, or didn't say it was done after the last fragment
+ *
+ * @param arg The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkReplyTimeout(void* arg)
+{
+    p2pBulk_t* bulk = (p2pBulk_t*)arg;
+    if (P2P_BULK_TX_OFFERING == bulk->tx.state || P2P_BULK_TX_FINISHING == bulk->tx.state)
+    {
+        p2pBulkInterrupt(bulk, bulk->p2p->cnc.isConnected);
+    }
+}
+
+/**
+ * @brief Offer the buffer being sent to the receiver, which answers with the fragments it already has
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkOffer(p2pBulk_t* bulk)
+{
+    bulk->tx.state = P2P_BULK_TX_OFFERING;
+    esp_timer_stop(bulk->replyTmr);
+    esp_timer_start_once(bulk->replyTmr, REPLY_TIMEOUT_US);
+
+    // If the Swadge mode filled the window, the reply timer offers again later
+    if (0 == p2pGetWindowSpace(bulk->p2p))
+    {
+        return;
+    }
+
+    p2pBulkOfferMsg_t msg = {
+        .hdr = {
+            .marker = P2P_BULK_MARKER,
+            .type   = P2P_BULK_MSG_OFFER,
+            .id     = bulk->tx.id,
+        },
+        .tag = bulk->tx.tag,
+        .len = {bulk->tx.len, bulk->tx.len >> 8, bulk->tx.len >> 16, bulk->tx.len >> 24},
+        .crc = {bulk->tx.crc, bulk->tx.crc >> 8, bulk->tx.crc >> 16, bulk->tx.crc >> 24},
+    };
+    p2pSendMsg(bulk->p2p, (const uint8_t*)&msg, sizeof(msg), p2pBulkTxCb);
+}
+
+/**
+ * @brief Send fragments the receiver doesn't have until the window is full
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkFill(p2pBulk_t* bulk)
+{
+    while (P2P_BULK_TX_SENDING == bulk->tx.state && 0 < p2pGetWindowSpace(bulk->p2p))
+    {
+        // Find the next fragment which is neither done nor in flight
+        while (bulk->tx.nextFrag < bulk->tx.numFrags
+               && (bitGet(bulk->tx.doneBits, bulk->tx.nextFrag) || bitGet(bulk->tx.inFlightBits, bulk->tx.nextFrag)))
+        {
+            bulk->tx.nextFrag++;
+        }
+        if (bulk->tx.nextFrag >= bulk->tx.numFrags)
+        {
+            return;
+        }
+
+        uint16_t frag = bulk->tx.nextFrag++;
+        uint32_t len  = p2pBulkFragLen(bulk->tx.len, frag);
+
+        bulk->tx.stats.fragmentsSent++;
+        if (bitGet(bulk->tx.sentBits, frag))
+        {
+            bulk->tx.stats.fragmentsResent++;
+        }
+        bitSet(bulk->tx.sentBits, frag);
+        bitSet(bulk->tx.inFlightBits, frag);
+
+        p2pBulkDataMsg_t msg;
+        msg.hdr.marker = P2P_BULK_MARKER;
+        msg.hdr.type   = P2P_BULK_MSG_DATA;
+        msg.hdr.id     = bulk->tx.id;
+        msg.frag[0]    = frag;
+        msg.frag[1]    = frag >> 8;
+        memcpy(msg.data, &bulk->tx.data[(uint32_t)frag * P2P_BULK_FRAG_LEN], len);
+        p2pSendMsg(bulk->p2p, (const uint8_t*)&msg, DATA_HDR_LEN + len, p2pBulkTxCb);
+    }
+}
+
+/**
+ * @brief Mark a fragment as received by the receiver
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param frag The fragment
+ */
+static void p2pBulkSetDone(p2pBulk_t* bulk, uint16_t frag)
+{
+    if (!bitGet(bulk->tx.doneBits, frag))
+    {
+        bitSet(bulk->tx.doneBits, frag);
+        bulk->tx.numDone++;
+        bulk->tx.stats.bytesDone += p2pBulkFragLen(bulk->tx.len, frag);
+
+        // Any progress means the interruptions so far were recovered from
+        bulk->tx.resumes = 0;
+    }
+}
+
+/**
+ * @brief Once the receiver has every fragment, wait for it to check the CRC and say it's done
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkCheckFinishing(p2pBulk_t* bulk)
+{
+    if (P2P_BULK_TX_SENDING == bulk->tx.state && bulk->tx.numDone == bulk->tx.numFrags)
+    {
+        bulk->tx.state = P2P_BULK_TX_FINISHING;
+        esp_timer_stop(bulk->replyTmr);
+        esp_timer_start_once(bulk->replyTmr, REPLY_TIMEOUT_US);
+    }
+}
+
+/**
+ * @brief Interrupt the buffer being sent, and maybe offer it again right away. Fail it if it was interrupted too many
+ * times in a row without any progress
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param reoffer true to offer the buffer again right away, false to wait for the connection to be established
+ */
+static void p2pBulkInterrupt(p2pBulk_t* bulk, bool reoffer)
+{
+    esp_timer_stop(bulk->replyTmr);
+    bulk->tx.stats.interruptions++;
+
+    if (++bulk->tx.resumes > P2P_BULK_MAX_RESUMES)
+    {
+        if (reoffer)
+        {
+            p2pBulkSendHdr(bulk, P2P_BULK_MSG_CANCEL, bulk->tx.id);
+        }
+        p2pBulkTxFinish(bulk, P2P_BULK_FAILED);
+        return;
+    }
+
+    bulk->tx.state = P2P_BULK_TX_WAITING;
+    if (NULL != bulk->cbFn)
+    {
+        bulk->cbFn(bulk, P2P_BULK_INTERRUPTED, bulk->tx.tag, bulk->tx.data, bulk->tx.len);
+    }
+
+    // The callback may have cancelled the transfer
+    if (P2P_BULK_TX_WAITING == bulk->tx.state && reoffer)
+    {
+        p2pBulkOffer(bulk);
+    }
+}
+
+/**
+ * @brief Finish sending the current buffer, free its bitmaps, and tell the Swadge mode
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param evt ::P2P_BULK_SENT or ::P2P_BULK_FAILED
+ */
+static void p2pBulkTxFinish(p2pBulk_t* bulk, p2pBulkEvt_t evt)
+{
+    esp_timer_stop(bulk->replyTmr);
+
+    p2pBulkCountRetransmits(bulk);
+    bulk->tx.stats.elapsedUs = esp_timer_get_time() - bulk->tx.stats.startUs;
+    p2pBulkUpdateRate(&bulk->tx.stats);
+
+    free(bulk->tx.doneBits);
+    bulk->tx.doneBits = NULL;
+    bulk->tx.state    = P2P_BULK_TX_IDLE;
+
+    // Called last, so the callback can send another buffer
+    if (NULL != bulk->cbFn)
+    {
+        bulk->cbFn(bulk, evt, bulk->tx.tag, bulk->tx.data, bulk->tx.len);
+    }
+}
+
+/**
+ * @brief Add the window's retransmissions since the last call to the statistics for the buffer being sent
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkCountRetransmits(p2pBulk_t* bulk)
+{
+    if (NULL != bulk->p2p->win)
+    {
+        bulk->tx.stats.retransmits += bulk->p2p->win->retransmits - bulk->tx.winRetransmits;
+        bulk->tx.winRetransmits = bulk->p2p->win->retransmits;
+    }
+}
+
+/**
+ * @brief Handle an offer. Answer with the fragments already received if it's the buffer being received, start
+ * receiving it if it's a new buffer, or reject it if it doesn't fit
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param msg The offer
+ */
+static void p2pBulkRecvOffer(p2pBulk_t* bulk, const p2pBulkOfferMsg_t* msg)
+{
+    uint32_t len = msg->len[0] | (msg->len[1] << 8) | (msg->len[2] << 16) | ((uint32_t)msg->len[3] << 24);
+    uint32_t crc = msg->crc[0] | (msg->crc[1] << 8) | (msg->crc[2] << 16) | ((uint32_t)msg->crc[3] << 24);
+
+    // An offer for the same buffer resumes it, even if the sender restarted and picked a new ID
+    if (P2P_BULK_RX_IDLE != bulk->rx.state && len == bulk->rx.len && crc == bulk->rx.crc && msg->tag == bulk->rx.tag)
+    {
+        bulk->rx.id = msg->hdr.id;
+        if (P2P_BULK_RX_COMPLETE == bulk->rx.state)
+        {
+            p2pBulkSendHdr(bulk, P2P_BULK_MSG_DONE, bulk->rx.id);
+        }
+        else
+        {
+            bulk->rx.stats.interruptions++;
+            p2pBulkSendStatus(bulk);
+        }
+        return;
+    }
+
+    if (0 == len || len > bulk->rx.bufLen || len > (uint32_t)UINT16_MAX * P2P_BULK_FRAG_LEN)
+    {
+        p2pBulkSendHdr(bulk, P2P_BULK_MSG_REJECT, msg->hdr.id);
+        return;
+    }
+
+    uint16_t numFrags = (len + P2P_BULK_FRAG_LEN - 1) / P2P_BULK_FRAG_LEN;
+    free(bulk->rx.bits);
+    bulk->rx.bits = calloc((numFrags + 7) / 8, 1);
+    if (NULL == bulk->rx.bits)
+    {
+        ESP_LOGE("P2P", "Couldn't allocate a bitmap for %" PRIu16 " fragments", numFrags);
+        bulk->rx.state = P2P_BULK_RX_IDLE;
+        p2pBulkSendHdr(bulk, P2P_BULK_MSG_REJECT, msg->hdr.id);
+        return;
+    }
+
+    bulk->rx.state        = P2P_BULK_RX_RECEIVING;
+    bulk->rx.len          = len;
+    bulk->rx.crc          = crc;
+    bulk->rx.id           = msg->hdr.id;
+    bulk->rx.tag          = msg->tag;
+    bulk->rx.numFrags     = numFrags;
+    bulk->rx.numRcvd      = 0;
+    bulk->rx.firstMissing = 0;
+
+    memset(&bulk->rx.stats, 0, sizeof(p2pBulkStats_t));
+    bulk->rx.stats.totalBytes = len;
+    bulk->rx.stats.fragments  = numFrags;
+    bulk->rx.stats.startUs    = esp_timer_get_time();
+
+    p2pBulkSendStatus(bulk);
+}
+
+/**
+ * @brief Handle a fragment. Once every fragment is received, check the CRC and tell the sender it's done
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param msg The fragment
+ * @param dataLen The number of bytes of the buffer in the fragment
+ */
+static void p2pBulkRecvData(p2pBulk_t* bulk, const p2pBulkDataMsg_t* msg, uint8_t dataLen)
+{
+    uint16_t frag = msg->frag[0] | (msg->frag[1] << 8);
+    if (P2P_BULK_RX_RECEIVING != bulk->rx.state || msg->hdr.id != bulk->rx.id || frag >= bulk->rx.numFrags
+        || dataLen != p2pBulkFragLen(bulk->rx.len, frag))
+    {
+        return;
+    }
+
+    bulk->rx.stats.fragmentsSent++;
+    if (bitGet(bulk->rx.bits, frag))
+    {
+        bulk->rx.stats.fragmentsResent++;
+        return;
+    }
+
+    memcpy(&bulk->rx.buf[(uint32_t)frag * P2P_BULK_FRAG_LEN], msg->data, dataLen);
+    bitSet(bulk->rx.bits, frag);
+    bulk->rx.numRcvd++;
+    bulk->rx.stats.bytesDone += dataLen;
+    bulk->rx.stats.elapsedUs = esp_timer_get_time() - bulk->rx.stats.startUs;
+    p2pBulkUpdateRate(&bulk->rx.stats);
+
+    while (bulk->rx.firstMissing < bulk->rx.numFrags && bitGet(bulk->rx.bits, bulk->rx.firstMissing))
+    {
+        bulk->rx.firstMissing++;
+    }
+
+    if (bulk->rx.numRcvd == bulk->rx.numFrags)
+    {
+        if (p2pBulkCrc32(bulk->rx.buf, bulk->rx.len) == bulk->rx.crc)
+        {
+            bulk->rx.state = P2P_BULK_RX_COMPLETE;
+            p2pBulkSendHdr(bulk, P2P_BULK_MSG_DONE, bulk->rx.id);
+            if (NULL != bulk->cbFn)
+            {
+                bulk->cbFn(bulk, P2P_BULK_RECEIVED, bulk->rx.tag, bulk->rx.buf, bulk->rx.len);
+            }
+        }
+        else
+        {
+            ESP_LOGW("P2P", "Bulk transfer CRC mismatch");
+            bulk->rx.state = P2P_BULK_RX_IDLE;
+            p2pBulkSendHdr(bulk, P2P_BULK_MSG_REJECT, bulk->rx.id);
+        }
+    }
+}
+
+/**
+ * @brief Handle the receiver's answer to an offer, then send the fragments it doesn't have
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param msg The status message
+ * @param bitsLen The number of bytes in the status message's bitmap
+ */
+static void p2pBulkRecvStatus(p2pBulk_t* bulk, const p2pBulkStatusMsg_t* msg, uint8_t bitsLen)
+{
+    if (msg->hdr.id != bulk->tx.id
+        || (P2P_BULK_TX_OFFERING != bulk->tx.state && P2P_BULK_TX_SENDING != bulk->tx.state))
+    {
+        return;
+    }
+    esp_timer_stop(bulk->replyTmr);
+
+    // A status only ever adds fragments the receiver has, so a late one can't undo any progress
+    uint16_t firstMissing = MIN(msg->firstMissing[0] | (msg->firstMissing[1] << 8), bulk->tx.numFrags);
+    for (uint16_t frag = 0; frag < firstMissing; frag++)
+    {
+        p2pBulkSetDone(bulk, frag);
+    }
+    for (uint32_t bit = 0; bit < bitsLen * 8; bit++)
+    {
+        uint32_t frag = firstMissing + 1 + bit;
+        if (frag >= bulk->tx.numFrags)
+        {
+            break;
+        }
+        if (msg->bits[bit / 8] & (1 << (bit % 8)))
+        {
+            p2pBulkSetDone(bulk, frag);
+        }
+    }
+
+    bulk->tx.state    = P2P_BULK_TX_SENDING;
+    bulk->tx.nextFrag = firstMissing;
+    p2pBulkCheckFinishing(bulk);
+    p2pBulkFill(bulk);
+}
+
+/**
+ * @brief Tell the sender which fragments were received: the first missing one, then a bitmap of the ones after it
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ */
+static void p2pBulkSendStatus(p2pBulk_t* bulk)
+{
+    p2pBulkStatusMsg_t msg = {0};
+    msg.hdr.marker         = P2P_BULK_MARKER;
+    msg.hdr.type           = P2P_BULK_MSG_STATUS;
+    msg.hdr.id             = bulk->rx.id;
+    msg.firstMissing[0]    = bulk->rx.firstMissing;
+    msg.firstMissing[1]    = bulk->rx.firstMissing >> 8;
+
+    // Fragments past what fits in the bitmap are treated as missing, and the receiver ignores any duplicates
+    uint32_t numBits = 0;
+    if (bulk->rx.firstMissing + 1 < bulk->rx.numFrags)
+    {
+        numBits = MIN(bulk->rx.numFrags - bulk->rx.firstMissing - 1, 8 * sizeof(msg.bits));
+    }
+    for (uint32_t bit = 0; bit < numBits; bit++)
+    {
+        if (bitGet(bulk->rx.bits, bulk->rx.firstMissing + 1 + bit))
+        {
+            msg.bits[bit / 8] |= (1 << (bit % 8));
+        }
+    }
+
+    p2pSendMsg(bulk->p2p, (const uint8_t*)&msg, STATUS_HDR_LEN + (numBits + 7) / 8, p2pBulkTxCb);
+}
+
+/**
+ * @brief Send a bulk message which is just the header
+ *
+ * @param bulk The p2pBulk_t struct with all the state information
+ * @param type The message type
+ * @param id The ID of the transfer the message is for
+ */
+static void p2pBulkSendHdr(p2pBulk_t* bulk, p2pBulkMsgType_t type, uint8_t id)
+{
+    p2pBulkHdr_t msg = {
+        .marker = P2P_BULK_MARKER,
+        .type   = type,
+        .id     = id,
+    };
+    p2pSendMsg(bulk->p2p, (const uint8_t*)&msg, sizeof(msg), p2pBulkTxCb);
+}
+
+/**
+ * @brief Calculate the throughput from the bytes done and the elapsed time
+ *
+ * @param stats The statistics to update
+ */
+static void p2pBulkUpdateRate(p2pBulkStats_t* stats)
+{
+    if (0 < stats->elapsedUs)
+    {
+        stats->bytesPerSec = (uint64_t)stats->bytesDone * 1000000 / stats->elapsedUs;
+    }
+}
+
+/**
+ * @brief Get the number of bytes in a fragment, which is ::P2P_BULK_FRAG_LEN except for the last one
+ *
+ * @param len The length of the buffer
+ * @param frag The fragment
+ * @return The number of bytes of the buffer in the fragment
+ */
+static uint32_t p2pBulkFragLen(uint32_t len, uint16_t frag)
+{
+    return MIN(P2P_BULK_FRAG_LEN, len - (uint32_t)frag * P2P_BULK_FRAG_LEN);
+}
+
+/**
+ * @brief Calculate the CRC-32 of a buffer, the same one used by zlib and PNG. This uses a table of 16 entries, one per
+ * nibble, which is much smaller than the usual table of 256
+ *
+ * @param data The buffer
+ * @param len The length of the buffer
+ * @return The CRC-32
+ */
+static uint32_t p2pBulkCrc32(const uint8_t* data, uint32_t len)
+{
+    static const uint32_t nibbleTable[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+        crc = (crc >> 4) ^ nibbleTable[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Get a bit from a bitmap
+ *
+ * @param bits The bitmap
+ * @param idx The index of the bit
+ * @return true if the bit is set
+ */
+static bool bitGet(const uint8_t* bits, uint16_t idx)
+{
+    return 0 != (bits[idx / 8] & (1 << (idx % 8)));
+}
+
+/**
+ * @brief Set a bit in a bitmap
+ *
+ * @param bits The bitmap
+ * @param idx The index of the bit
+ */
+static void bitSet(uint8_t* bits, uint16_t idx)
+{
+    bits[idx / 8] |= (1 << (idx % 8));
+}
+
+/**
+ * @brief Clear a bit in a bitmap
+ *
+ * @param bits The bitmap
+ * @param idx The index of the bit
+ */
+static void bitClear(uint8_t* bits, uint16_t idx)
+{
+    bits[idx / 8] &= ~(1 << (idx % 8));
+}
@@ -0,0 +1,288 @@
+/*! \file p2pBulk.h
+ *
+ * \section p2pBulk_design Design Philosophy
+ *
+ * p2pBulk sends buffers which are too big for a single p2pConnection message, like a drawing, a WSG saved with
+ * saveWsgNvs(), or a level file. It sits on top of a p2pConnection with a sliding window (see p2pSetWindow()), splits
+ * the buffer into fragments of ::P2P_BULK_FRAG_LEN bytes, and keeps the window full of fragments until the whole buffer
+ * is acknowledged.
+ *
+ * A transfer starts with an offer, which has the buffer's length, its CRC-32, and a tag chosen by the Swadge mode. The
+ * receiver answers with a status message, which has the first fragment it's missing and a bitmap of the fragments it
+ * already has after that one. The sender skips the fragments the receiver already has, then sends the rest. The
+ * receiver marks each fragment in its own bitmap as it arrives. Once it has every fragment and the CRC matches, it
+ * tells the sender the transfer is done. The receiver rejects offers which don't fit in its buffer, and transfers whose
+ * CRC doesn't match, which happens if the buffer changed while it was being sent.
+ *
+ * When a fragment fails, the connection is lost, or the receiver doesn't answer, the transfer is interrupted. The
+ * sender offers the same transfer again, right away if still connected or once the connection is established again.
+ * The receiver recognizes the offer by its length and CRC and answers with the fragments it already has, so only the
+ * missing ones are sent again. A transfer fails after ::P2P_BULK_MAX_RESUMES interruptions in a row without any new
+ * fragments getting through.
+ *
+ * \section p2pBulk_usage Usage
+ *
+ * p2pBulkInit() should be called after p2pInitialize() on both Swadges. It sets a sliding window if there isn't one
+ * already. p2pBulkDeinit() should be called before p2pDeinit().
+ *
+ * p2pBulkRecv() must be called from the #p2pMsgRxCbFn with every received message. It returns true if the message was
+ * part of a bulk transfer, and false if the Swadge mode should handle it. Bulk messages start with
+ * ::P2P_BULK_MARKER, so the Swadge mode's own messages must not start with that byte.
+ *
+ * p2pBulkConEvt() must be called from the #p2pConCbFn with every connection event so transfers can be interrupted and
+ * resumed.
+ *
+ * p2pBulkSend() starts sending a buffer. The buffer must stay valid until the #p2pBulkCbFn is called with
+ * ::P2P_BULK_SENT or ::P2P_BULK_FAILED. Only one buffer may be sent at a time in each direction, but both Swadges may
+ * send at once. Bulk fragments fill the window, so the Swadge mode's own messages may find it full while sending.
+ *
+ * p2pBulkCancel() stops sending and tells the receiver to drop the transfer.
+ *
+ * p2pBulkGetStats() gets the progress, throughput, and retransmissions of the current or last transfer in each
+ * direction.
+ *
+ * \section p2pBulk_example Example
+ *
+ * \code{.c}
+ * static p2pInfo p2p;
+ * static p2pBulk_t bulk;
+ * static uint8_t rxBuf[32768];
+ *
+ * static void demoBulkCb(p2pBulk_t* bulk, p2pBulkEvt_t evt, uint8_t tag, const uint8_t* data, uint32_t len);
+ *
+ * ...
+ *
+ * p2pInitialize(&p2p, 'd', demoConCb, demoMsgRxCb, -70);
+ * p2pBulkInit(&bulk, &p2p, rxBuf, sizeof(rxBuf), demoBulkCb);
+ * p2pStartConnection(&p2p);
+ *
+ * ...
+ *
+ * // Send a drawing once connected
+ * p2pBulkSend(&bulk, DRAWING_TAG, drawing, drawingLen);
+ *
+ * ...
+ *
+ * static void demoConCb(p2pInfo* p2p, connectionEvt_t evt)
+ * {
+ *     p2pBulkConEvt(&bulk, evt);
+ * }
+ *
+ * static void demoMsgRxCb(p2pInfo* p2p, const uint8_t* payload, uint8_t len)
+ * {
+ *     if (p2pBulkRecv(&bulk, payload, len))
+ *     {
+ *         return;
+ *     }
+ *     // Handle the mode's own messages
+ * }
+ *
+ * static void demoBulkCb(p2pBulk_t* bulk, p2pBulkEvt_t evt, uint8_t tag, const uint8_t* data, uint32_t len)
+ * {
+ *     if (P2P_BULK_RECEIVED == evt && DRAWING_TAG == tag)
+ *     {
+ *         // data points to rxBuf, which now holds the whole drawing
+ *     }
+ * }
+ * \endcode
+ */
+
+#ifndef _P2P_BULK_H_
+#define _P2P_BULK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <esp_timer.h>
+
+#include "p2pConnection.h"
+
+/// The first byte of every bulk message, which the Swadge mode's own messages must not start with
+#define P2P_BULK_MARKER 0xFB
+
+/// The number of bytes of the buffer in each fragment, after the five byte fragment header
+#define P2P_BULK_FRAG_LEN (P2P_MAX_WINDOW_DATA_LEN - 5)
+
+/// The number of interruptions in a row without any new fragments getting through before a transfer fails
+#define P2P_BULK_MAX_RESUMES 5
+
+/**
+ * @brief The types of bulk messages
+ */
+typedef enum __attribute__((packed))
+{
+    P2P_BULK_MSG_OFFER,  ///< The sender offers a buffer
+    P2P_BULK_MSG_DATA,   ///< A fragment of the buffer
+    P2P_BULK_MSG_STATUS, ///< The receiver's first missing fragment and a bitmap of the ones it has after that
+    P2P_BULK_MSG_DONE,   ///< The receiver has the whole buffer and its CRC matches
+    P2P_BULK_MSG_REJECT, ///< The receiver dropped the transfer
+    P2P_BULK_MSG_CANCEL, ///< The sender dropped the transfer
+} p2pBulkMsgType_t;
+
+/**
+ * @brief The byte format for the header of every bulk message
+ */
+typedef struct
+{
+    uint8_t marker;        ///< Must be ::P2P_BULK_MARKER
+    p2pBulkMsgType_t type; ///< The message type
+    uint8_t id;            ///< The ID of the transfer
+} p2pBulkHdr_t;
+
+/**
+ * @brief The byte format for an offer. Multi-byte fields are little-endian
+ */
+typedef struct
+{
+    p2pBulkHdr_t hdr; ///< The bulk header
+    uint8_t tag;      ///< A tag chosen by the Swadge mode
+    uint8_t len[4];   ///< The length of the buffer
+    uint8_t crc[4];   ///< The CRC-32 of the buffer
+} p2pBulkOfferMsg_t;
+
+/**
+ * @brief The byte format for a fragment. Multi-byte fields are little-endian
+ */
+typedef struct
+{
+    p2pBulkHdr_t hdr;                ///< The bulk header
+    uint8_t frag[2];                 ///< The index of this fragment
+    uint8_t data[P2P_BULK_FRAG_LEN]; ///< The bytes of the buffer in this fragment
+} p2pBulkDataMsg_t;
+
+/**
+ * @brief The byte format for a status message. Multi-byte fields are little-endian
+ */
+typedef struct
+{
+    p2pBulkHdr_t hdr;                ///< The bulk header
+    uint8_t firstMissing[2];         ///< Every fragment before this one was received
+    uint8_t bits[P2P_BULK_FRAG_LEN]; ///< Bit N is set if firstMissing + 1 + N was received, as far as the message goes
+} p2pBulkStatusMsg_t;
+
+/**
+ * @brief Events delivered to the Swadge mode through the #p2pBulkCbFn
+ */
+typedef enum
+{
+    P2P_BULK_SENT,        ///< The receiver has the whole buffer which was sent
+    P2P_BULK_RECEIVED,    ///< A whole buffer was received
+    P2P_BULK_INTERRUPTED, ///< A transfer being sent was interrupted and will be resumed
+    P2P_BULK_FAILED,      ///< A transfer being sent failed, or was rejected by the other Swadge
+} p2pBulkEvt_t;
+
+/**
+ * @brief The state of the buffer being sent
+ */
+typedef enum
+{
+    P2P_BULK_TX_IDLE,      ///< Nothing is being sent
+    P2P_BULK_TX_WAITING,   ///< Waiting for a connection to offer the transfer
+    P2P_BULK_TX_OFFERING,  ///< Waiting for the receiver to answer an offer
+    P2P_BULK_TX_SENDING,   ///< Sending fragments
+    P2P_BULK_TX_FINISHING, ///< Every fragment was ACKed, waiting for the receiver to check the CRC
+} p2pBulkTxState_t;
+
+/**
+ * @brief The state of the buffer being received
+ */
+typedef enum
+{
+    P2P_BULK_RX_IDLE,      ///< Nothing is being received
+    P2P_BULK_RX_RECEIVING, ///< Receiving fragments
+    P2P_BULK_RX_COMPLETE,  ///< The whole buffer was received
+} p2pBulkRxState_t;
+
+/**
+ * @brief Statistics for one direction of a bulk transfer
+ */
+typedef struct
+{
+    uint32_t totalBytes;      ///< The length of the buffer
+    uint32_t bytesDone;       ///< The number of bytes acknowledged if sending, or received if receiving
+    uint16_t fragments;       ///< The number of fragments in the buffer
+    uint32_t fragmentsSent;   ///< The number of fragments sent or received, including duplicates
+    uint32_t fragmentsResent; ///< The number of fragments sent again, or received more than once
+    uint32_t retransmits;     ///< When sending, the number of messages the window retransmitted during the transfer
+    uint32_t interruptions;   ///< The number of times the transfer was interrupted and resumed
+    int64_t startUs;          ///< When the transfer started
+    int64_t elapsedUs;        ///< How long the transfer took, or has taken so far
+    uint32_t bytesPerSec;     ///< The throughput, bytesDone over elapsedUs
+} p2pBulkStats_t;
+
+typedef struct _p2pBulk p2pBulk_t;
+
+/**
+ * @brief This typedef is for the function callback which delivers bulk transfer events to the Swadge mode
+ *
+ * @param bulk The p2pBulk_t
+ * @param evt The event
+ * @param tag The tag given to p2pBulkSend()
+ * @param data For ::P2P_BULK_RECEIVED, the received buffer. Otherwise the buffer given to p2pBulkSend()
+ * @param len The length of the buffer
+ */
+typedef void (*p2pBulkCbFn)(p2pBulk_t* bulk, p2pBulkEvt_t evt, uint8_t tag, const uint8_t* data, uint32_t len);
+
+/**
+ * @brief All the state variables for bulk transfers over one p2p connection
+ */
+typedef struct _p2pBulk
+{
+    p2pInfo* p2p;                ///< The connection the transfers use
+    p2pBulkCbFn cbFn;            ///< A callback function called when a transfer finishes or is interrupted
+    esp_timer_handle_t replyTmr; ///< A timer used to resume a transfer if the receiver doesn't answer
+
+    /**
+     * @brief The buffer being sent
+     */
+    struct
+    {
+        p2pBulkTxState_t state;  ///< What the sender is doing
+        const uint8_t* data;     ///< The buffer
+        uint32_t len;            ///< The length of the buffer
+        uint32_t crc;            ///< The CRC-32 of the buffer
+        uint8_t id;              ///< An ID for this transfer, so fragments of an older one are ignored
+        uint8_t tag;             ///< A tag chosen by the Swadge mode
+        uint16_t numFrags;       ///< The number of fragments
+        uint16_t numDone;        ///< The number of fragments the receiver has
+        uint16_t nextFrag;       ///< Every fragment before this one is done or in flight
+        uint8_t resumes;         ///< Interruptions in a row without new fragments getting through
+        uint8_t* doneBits;       ///< A bitmap of fragments the receiver has
+        uint8_t* inFlightBits;   ///< A bitmap of fragments in the window
+        uint8_t* sentBits;       ///< A bitmap of fragments sent at least once
+        uint32_t winRetransmits; ///< The window's retransmission count when the transfer started
+        p2pBulkStats_t stats;    ///< Statistics for this transfer
+    } tx;
+
+    /**
+     * @brief The buffer being received
+     */
+    struct
+    {
+        p2pBulkRxState_t state; ///< What the receiver is doing
+        uint8_t* buf;           ///< Where received buffers are written
+        uint32_t bufLen;        ///< The longest buffer which may be received
+        uint32_t len;           ///< The length of the buffer being received
+        uint32_t crc;           ///< The CRC-32 the buffer should have
+        uint8_t id;             ///< The ID of the transfer being received
+        uint8_t tag;            ///< The tag of the transfer being received
+        uint16_t numFrags;      ///< The number of fragments
+        uint16_t numRcvd;       ///< The number of fragments received
+        uint16_t firstMissing;  ///< Every fragment before this one was received
+        uint8_t* bits;          ///< A bitmap of received fragments
+        p2pBulkStats_t stats;   ///< Statistics for this transfer
+    } rx;
+} p2pBulk_t;
+
+void p2pBulkInit(p2pBulk_t* bulk, p2pInfo* p2p, uint8_t* rxBuf, uint32_t rxBufLen, p2pBulkCbFn cbFn);
+void p2pBulkDeinit(p2pBulk_t* bulk);
+
+bool p2pBulkSend(p2pBulk_t* bulk, uint8_t tag, const uint8_t* data, uint32_t len);
+void p2pBulkCancel(p2pBulk_t* bulk);
+
+bool p2pBulkRecv(p2pBulk_t* bulk, const uint8_t* payload, uint8_t len);
+void p2pBulkConEvt(p2pBulk_t* bulk, connectionEvt_t evt);
+
+void p2pBulkGetStats(p2pBulk_t* bulk, p2pBulkStats_t* txStats, p2pBulkStats_t* rxStats);
+
+#endif
@@ -2,6 +2,7 @@
 // Includes
 //==============================================================================
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -13,6 +14,7 @@
 
 #include "hdw-esp-now.h"
 #include "p2pConnection.h"
+#include "macros.h"
 
 //==============================================================================
 // Defines
@@ -26,6 +28,47 @@
 // (240 steps of rotation + (252/4) steps of decay) * 12ms
 #define FAILURE_RESTART_US 8000000
 
+// The length of a windowed message's header, before its data
+#define WIN_HDR_LEN (sizeof(p2pWindowMsg_t) - P2P_MAX_WINDOW_DATA_LEN)
+
+// Bounds for the retransmission timeout of windowed messages, which is calculated from the round trip time like TCP's.
+// The minimum matches the fixed retry time used without a window
+#define WIN_INITIAL_RTO_US 20000
+#define WIN_MIN_RTO_US     5000
+#define WIN_MAX_RTO_US     250000
+
+// The least the retransmission timeout may exceed the smoothed round trip time by, so that a very steady round trip
+// time doesn't cause retransmissions whenever a packet waits a little longer for the channel
+#define WIN_RTO_MARGIN_US 4000
+
+// How long received windowed messages wait for outgoing data to carry their ACK before an ACK is sent on its own
+#define WIN_ACK_DELAY_US 2000
+
+// The number of times start messages are retried. This gives up much sooner than RETRY_TIME_US because the other
+// Swadge was just heard, so if it doesn't answer it's most likely connecting to a different Swadge. Retries are counted
+// rather than timed so that a busy channel doesn't use them up
+#define START_RETRIES 8
+
+// Start messages are retried after a randomized exponential backoff, one slot plus up to 2^MAX_START_BACKOFF slots,
+// since many Swadges may be connecting at once
+#define START_RETRY_SLOT_US 5000
+#define MAX_START_BACKOFF   5
+
+// After a start message isn't answered, broadcasts start again after a randomized exponential backoff of this many
+// slots, up to 2^MAX_BACKOFF
+#define BACKOFF_SLOT_US 100000
+#define MAX_BACKOFF     5
+
+// How long to listen for more candidates after hearing the first one, before picking the strongest
+#define CANDIDATE_WAIT_US 100000
+
+// Candidates which haven't broadcast for this long are forgotten, since they're probably connecting to another Swadge
+#define CANDIDATE_STALE_US 2000000
+
+// The length of a connection message on the default channel, without the channel bytes. This is the only kind of
+// connection message which firmware from before channels sends, so it's what the default channel sends too
+#define CON_MSG_LEGACY_LEN offsetof(p2pConMsg_t, channel)
+
 // #define P2P_DEBUG
 #ifdef P2P_DEBUG
 static const char* P2P_TAG = "P2P";
@@ -39,18 +82,41 @@ static const char* P2P_TAG = "P2P";
 //==============================================================================
 
 static void p2pConnectionTimeout(void* arg);
+static void p2pCandidateTimeout(void* arg);
+static void p2pAddCandidate(p2pInfo* p2p, const uint8_t* mac_addr, int8_t rssi);
+static void p2pWaitForCandidates(p2pInfo* p2p);
+static void p2pSendStart(p2pInfo* p2p, const uint8_t* mac_addr);
+static void p2pStartFailure(p2pInfo* p2p);
+static bool p2pOtherRestarted(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8_t len);
+static uint32_t p2pBackoffUs(uint32_t slotUs, uint8_t exponent);
 static void p2pTxAllRetriesTimeout(void* arg);
 static void p2pTxRetryTimeout(void* arg);
+static void p2pInitState(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbFn msgRxCbFn,
+                         int8_t connectionRssi);
+static void p2pCreateTimers(p2pInfo* p2p);
+static void p2pStopTimers(p2pInfo* p2p);
 static void p2pRestart(p2pInfo* p2p);
 static void p2pRestartTmrCb(void* arg);
 static void p2pStartRestartTimer(void* arg);
 static void p2pProcConnectionEvt(p2pInfo* p2p, connectionEvt_t event);
 static void p2pGameStartAckRecv(p2pInfo* p2p, const uint8_t* data, uint8_t dataLen);
-static void p2pSendAckToMac(p2pInfo* p2p, const uint8_t* mac_addr);
+static void p2pSendAckToMac(p2pInfo* p2p, const uint8_t* mac_addr, uint8_t seqNum);
 static void p2pSendMsgEx(p2pInfo* p2p, uint8_t* msg, uint16_t len, bool shouldAck, p2pAckSuccessFn success,
                          p2pAckFailureFn failure);
 static void p2pModeMsgSuccess(p2pInfo* p2p, const uint8_t* data, uint8_t dataLen);
 static void p2pModeMsgFailure(p2pInfo* p2p);
+static void p2pWinRetryTimeout(void* arg);
+static void p2pWinAckTimeout(void* arg);
+static void p2pWindowSend(p2pInfo* p2p, const uint8_t* payload, uint16_t len, p2pMsgTxCbFn msgTxCbFn);
+static void p2pWindowTransmit(p2pInfo* p2p, p2pWindowMsg_t* msg, uint8_t len);
+static void p2pWindowRetransmit(p2pInfo* p2p, p2pWindowTxSlot_t* slot, int64_t nowUs);
+static void p2pWindowSendAck(p2pInfo* p2p);
+static void p2pWindowRecv(p2pInfo* p2p, const p2pWindowMsg_t* msg, uint8_t len);
+static void p2pWindowProcAck(p2pInfo* p2p, const p2pWindowMsg_t* msg);
+static void p2pWindowRttSample(p2pWindow_t* win, int32_t rttUs);
+static void p2pWindowDeliver(p2pInfo* p2p);
+static void p2pWindowRelease(p2pInfo* p2p);
+static void p2pWindowArmRetry(p2pInfo* p2p);
 
 //==============================================================================
 // Functions
@@ -72,6 +138,22 @@ static void p2pModeMsgFailure(p2pInfo* p2p);
 void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbFn msgRxCbFn, int8_t connectionRssi)
 {
     P2P_LOG("%s", __func__);
+    p2pInitState(p2p, modeId, conCbFn, msgRxCbFn, connectionRssi);
+    p2pCreateTimers(p2p);
+}
+
+/**
+ * @brief Set every field to its initial value, without creating the timers. The timer handles are zeroed too
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param modeId 8 bit mode ID. Must be unique per-swadge mode.
+ * @param conCbFn A function pointer which will be called when connection events occur
+ * @param msgRxCbFn A function pointer which will be called when a packet is received for the swadge mode
+ * @param connectionRssi The strength needed to start a connection with another swadge
+ */
+static void p2pInitState(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbFn msgRxCbFn,
+                         int8_t connectionRssi)
+{
     //  Make sure everything is zero!
     memset(p2p, 0, sizeof(p2pInfo));
 
@@ -85,6 +167,9 @@ void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbF
     // Set the initial sequence number at 255 so that a 0 received is valid.
     p2p->cnc.lastSeqNum = 255;
 
+    // Start sending at a random sequence number, which also picks the play order. Not 255, which would be a duplicate
+    p2p->cnc.mySeqNum = esp_random() % 255;
+
     // Set the connection Rssi, the higher the value, the closer the swadges
     // need to be.
     p2p->connectionRssi = connectionRssi;
@@ -93,6 +178,10 @@ void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbF
     p2p->modeId         = modeId;
     p2p->incomingModeId = modeId;
 
+    // Nothing has been timed yet
+    p2p->stats.startUs   = -1;
+    p2p->stats.connectUs = -1;
+
     // Get and save the string form of our MAC address
     esp_wifi_get_mac(WIFI_IF_STA, p2p->cnc.myMac);
 
@@ -114,7 +203,15 @@ void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbF
     p2p->startMsg.messageType = P2P_MSG_START;
     p2p->startMsg.seqNum      = 0;
     memset(p2p->startMsg.macAddr, 0xFF, sizeof(p2p->startMsg.macAddr));
+}
 
+/**
+ * @brief Create all the timers. They're deleted by p2pDeinit()
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pCreateTimers(p2pInfo* p2p)
+{
     // Set up a timer for acknowledging messages
     esp_timer_create_args_t p2pTxRetryTimeoutArgs = {
         .callback              = p2pTxRetryTimeout,
@@ -154,6 +251,36 @@ void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbF
         .skip_unhandled_events = false,
     };
     esp_timer_create(&p2pConnectionTimeoutArgs, &p2p->tmr.Connection);
+
+    // Set up a timer to retransmit windowed messages
+    esp_timer_create_args_t p2pWinRetryTimeoutArgs = {
+        .callback              = p2pWinRetryTimeout,
+        .arg                   = p2p,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "p2pt_wrt",
+        .skip_unhandled_events = false,
+    };
+    esp_timer_create(&p2pWinRetryTimeoutArgs, &p2p->tmr.WinRetry);
+
+    // Set up a timer to send delayed ACKs for windowed messages
+    esp_timer_create_args_t p2pWinAckTimeoutArgs = {
+        .callback              = p2pWinAckTimeout,
+        .arg                   = p2p,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "p2pt_wa",
+        .skip_unhandled_events = false,
+    };
+    esp_timer_create(&p2pWinAckTimeoutArgs, &p2p->tmr.WinAck);
+
+    // Set up a timer to pick a candidate to connect to
+    esp_timer_create_args_t p2pCandidateTimeoutArgs = {
+        .callback              = p2pCandidateTimeout,
+        .arg                   = p2p,
+        .dispatch_method       = ESP_TIMER_TASK,
+        .name                  = "p2pt_cd",
+        .skip_unhandled_events = false,
+    };
+    esp_timer_create(&p2pCandidateTimeoutArgs, &p2p->tmr.Candidate);
 }
 
 /**
@@ -167,6 +294,97 @@ void p2pSetAsymmetric(p2pInfo* p2p, uint8_t incomingModeId)
     p2p->incomingModeId = incomingModeId;
 }
 
+/**
+ * @brief Only connect to Swadges on the same channel, for modes with more than one kind of game or group of players.
+ * Connection broadcasts from other channels are dropped as soon as they're received. See \ref p2p_discovery. This
+ * should be called after p2pInitialize() and before p2pStartConnection(), and both Swadges must use the same channel.
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param channel The name of the channel, which is hashed to 16 bits. NULL is the default channel
+ */
+void p2pSetChannel(p2pInfo* p2p, const char* channel)
+{
+    uint16_t hash = 0;
+    if (NULL != channel)
+    {
+        // Fold a 32 bit FNV-1a hash to 16 bits
+        uint32_t fnv = 2166136261u;
+        for (const char* c = channel; '\0' != *c; c++)
+        {
+            fnv ^= (uint8_t)*c;
+            fnv *= 16777619u;
+        }
+        hash = (fnv >> 16) ^ (fnv & 0xFFFF);
+
+        // 0 is the default channel, so a named channel must not hash to it
+        if (0 == hash)
+        {
+            hash = 1;
+        }
+    }
+
+    p2p->conMsg.channel[0] = hash >> 8;
+    p2p->conMsg.channel[1] = hash & 0xFF;
+}
+
+/**
+ * @brief Let more than one message wait for an ACK at once, for modes which send messages often. See \ref p2p_window.
+ * Both Swadges must set a window. This should be called after p2pInitialize() and before p2pStartConnection(), and
+ * messages which are in flight when it's called are dropped without calling their callbacks.
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param windowSize The number of messages which may wait for an ACK at once, up to ::P2P_MAX_WINDOW. 0 sends one
+ * message at a time without a window, which is the default
+ */
+void p2pSetWindow(p2pInfo* p2p, uint8_t windowSize)
+{
+    P2P_LOG("%s %" PRIu8, __func__, windowSize);
+
+    // Get rid of any old window
+    if (NULL != p2p->tmr.WinRetry)
+    {
+        esp_timer_stop(p2p->tmr.WinRetry);
+        esp_timer_stop(p2p->tmr.WinAck);
+    }
+    if (NULL != p2p->win)
+    {
+        free(p2p->win->tx);
+        free(p2p->win);
+        p2p->win = NULL;
+    }
+
+    if (0 == windowSize)
+    {
+        return;
+    }
+
+    // Round the number of slots up to a power of two so that sequence numbers, which wrap around at 256, can be masked
+    // to index them
+    uint8_t numSlots = 1;
+    while (numSlots < MIN(windowSize, P2P_MAX_WINDOW))
+    {
+        numSlots <<= 1;
+    }
+
+    // Allocate the sent and received message slots together
+    p2pWindow_t* win = calloc(1, sizeof(p2pWindow_t));
+    void* slots      = calloc(numSlots, sizeof(p2pWindowTxSlot_t) + sizeof(p2pWindowRxSlot_t));
+    if (NULL == win || NULL == slots)
+    {
+        ESP_LOGE("P2P", "Couldn't allocate a window of %" PRIu8, windowSize);
+        free(win);
+        free(slots);
+        return;
+    }
+
+    win->size  = MIN(windowSize, P2P_MAX_WINDOW);
+    win->mask  = numSlots - 1;
+    win->rtoUs = WIN_INITIAL_RTO_US;
+    win->tx    = slots;
+    win->rx    = (p2pWindowRxSlot_t*)&win->tx[numSlots];
+    p2p->win   = win;
+}
+
 /**
  * @brief Start the connection process by sending broadcasts and notify the mode
  *
@@ -179,7 +397,14 @@ void p2pStartConnection(p2pInfo* p2p)
     p2p->cnc.isActive  = true;
     p2p->cnc.playOrder = NOT_SET;
 
-    esp_timer_start_once(p2p->tmr.Connection, 1000);
+    if (p2p->stats.startUs < 0)
+    {
+        p2p->stats.startUs = esp_timer_get_time();
+    }
+
+    // After a failed handshake, wait a random time so that Swadges which failed together don't broadcast together
+    uint32_t firstUs = (0 != p2p->dsc.backoff) ? p2pBackoffUs(BACKOFF_SLOT_US, p2p->dsc.backoff) : 1000;
+    esp_timer_start_once(p2p->tmr.Connection, firstUs);
 
     if (NULL != p2p->conCbFn)
     {
@@ -188,7 +413,8 @@ void p2pStartConnection(p2pInfo* p2p)
 }
 
 /**
- * @brief Stop up all timers
+ * @brief Stop and delete all timers, and free the window. p2pInitialize() must be called before the p2pInfo is used
+ * again
  *
  * @param p2p The p2pInfo struct with all the state information
  */
@@ -196,15 +422,43 @@ void p2pDeinit(p2pInfo* p2p)
 {
     P2P_LOG("%s", __func__);
 
+    // Drop any packets received after this
+    p2p->cnc.isActive = false;
+
+    // Free the window, if there is one
+    p2pSetWindow(p2p, 0);
+
     if (NULL != p2p->tmr.Connection)
     {
-        esp_timer_stop(p2p->tmr.Connection);
-        esp_timer_stop(p2p->tmr.TxRetry);
-        esp_timer_stop(p2p->tmr.Reinit);
-        esp_timer_stop(p2p->tmr.TxAllRetries);
+        p2pStopTimers(p2p);
+
+        esp_timer_delete(p2p->tmr.Connection);
+        esp_timer_delete(p2p->tmr.TxRetry);
+        esp_timer_delete(p2p->tmr.Reinit);
+        esp_timer_delete(p2p->tmr.TxAllRetries);
+        esp_timer_delete(p2p->tmr.WinRetry);
+        esp_timer_delete(p2p->tmr.WinAck);
+        esp_timer_delete(p2p->tmr.Candidate);
+        memset(&p2p->tmr, 0, sizeof(p2p->tmr));
     }
 }
 
+/**
+ * @brief Stop all timers, without deleting them
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pStopTimers(p2pInfo* p2p)
+{
+    esp_timer_stop(p2p->tmr.Connection);
+    esp_timer_stop(p2p->tmr.TxRetry);
+    esp_timer_stop(p2p->tmr.Reinit);
+    esp_timer_stop(p2p->tmr.TxAllRetries);
+    esp_timer_stop(p2p->tmr.WinRetry);
+    esp_timer_stop(p2p->tmr.WinAck);
+    esp_timer_stop(p2p->tmr.Candidate);
+}
+
 /**
  * @brief Send a broadcast connection message
  *
@@ -219,8 +473,15 @@ static void p2pConnectionTimeout(void* arg)
     P2P_LOG("%s", __func__);
 
     p2pInfo* p2p = (p2pInfo*)arg;
-    // Send a connection broadcast
-    p2pSendMsgEx(p2p, (uint8_t*)&p2p->conMsg, sizeof(p2p->conMsg), false, NULL, NULL);
+    // Send a connection broadcast. The channel is only sent when it isn't the default, so older firmware can connect
+    uint8_t conMsgLen = (0 == p2p->conMsg.channel[0] && 0 == p2p->conMsg.channel[1]) ? CON_MSG_LEGACY_LEN
+                                                                                      : sizeof(p2p->conMsg);
+    p2pSendMsgEx(p2p, (uint8_t*)&p2p->conMsg, conMsgLen, false, NULL, NULL);
+    p2p->stats.broadcasts++;
+
+    // If this was the end of a backoff, pick from the candidates which were heard during it
+    p2p->dsc.backingOff = false;
+    p2pWaitForCandidates(p2p);
 
     // esp_random returns a 32 bit number, so this is [500ms,1500ms]
     uint32_t timeoutUs = 1000 * (100 * (5 + (esp_random() % 11)));
@@ -230,6 +491,223 @@ static void p2pConnectionTimeout(void* arg)
     esp_timer_start_once(p2p->tmr.Connection, timeoutUs);
 }
 
+/**
+ * @brief Remember a Swadge which broadcast strongly enough to connect to. See \ref p2p_discovery
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param mac_addr The MAC of the Swadge which broadcast
+ * @param rssi The RSSI of the broadcast
+ */
+static void p2pAddCandidate(p2pInfo* p2p, const uint8_t* mac_addr, int8_t rssi)
+{
+    p2p->stats.candidates++;
+    int64_t nowUs = esp_timer_get_time();
+
+    // Look for this Swadge, and for the stalest or weakest candidate in case it needs to be replaced
+    p2pCandidate_t* cand   = NULL;
+    p2pCandidate_t* victim = NULL;
+    int16_t victimScore    = INT16_MAX;
+    for (uint8_t i = 0; i < p2p->dsc.numCandidates; i++)
+    {
+        p2pCandidate_t* other = &p2p->dsc.candidates[i];
+        if (0 == memcmp(other->mac, mac_addr, sizeof(other->mac)))
+        {
+            cand = other;
+            break;
+        }
+
+        // A stale candidate is replaced before any fresh one
+        int16_t score = (nowUs - other->heardUs >= CANDIDATE_STALE_US) ? INT16_MIN : other->rssi;
+        if (score < victimScore)
+        {
+            victim      = other;
+            victimScore = score;
+        }
+    }
+
+    if (NULL != cand)
+    {
+        // Smooth the RSSI, since single packets fade
+        cand->rssi = (cand->rssi + rssi) / 2;
+    }
+    else
+    {
+        if (p2p->dsc.numCandidates < P2P_MAX_CANDIDATES)
+        {
+            cand = &p2p->dsc.candidates[p2p->dsc.numCandidates++];
+        }
+        else if (victimScore < rssi)
+        {
+            cand = victim;
+        }
+        else
+        {
+            // Every candidate is fresh and stronger than this one
+            return;
+        }
+        memcpy(cand->mac, mac_addr, sizeof(cand->mac));
+        cand->rssi = rssi;
+    }
+    cand->heardUs = nowUs;
+
+    p2pWaitForCandidates(p2p);
+}
+
+/**
+ * @brief If there are candidates and this Swadge isn't backing off, wait a little for more before picking one
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pWaitForCandidates(p2pInfo* p2p)
+{
+    if (!p2p->dsc.waiting && !p2p->dsc.backingOff && !p2p->cnc.otherMacReceived && 0 != p2p->dsc.numCandidates)
+    {
+        p2p->dsc.waiting = true;
+        esp_timer_start_once(p2p->tmr.Candidate, CANDIDATE_WAIT_US);
+    }
+}
+
+/**
+ * @brief Pick the strongest candidate which was heard recently and send it a start message
+ *
+ * Called from the tmr.Candidate timer, which is set when a candidate is heard
+ *
+ * @param arg The p2pInfo struct with all the state information
+ */
+static void p2pCandidateTimeout(void* arg)
+{
+    P2P_LOG("%s", __func__);
+
+    p2pInfo* p2p     = (p2pInfo*)arg;
+    p2p->dsc.waiting = false;
+    if (p2p->cnc.otherMacReceived)
+    {
+        return;
+    }
+
+    // Forget stale candidates and find the strongest of the rest
+    int64_t nowUs  = esp_timer_get_time();
+    int8_t bestIdx = -1;
+    uint8_t i      = 0;
+    while (i < p2p->dsc.numCandidates)
+    {
+        p2pCandidate_t* cand = &p2p->dsc.candidates[i];
+        if (nowUs - cand->heardUs >= CANDIDATE_STALE_US)
+        {
+            *cand = p2p->dsc.candidates[--p2p->dsc.numCandidates];
+        }
+        else
+        {
+            if (bestIdx < 0 || cand->rssi > p2p->dsc.candidates[bestIdx].rssi)
+            {
+                bestIdx = i;
+            }
+            i++;
+        }
+    }
+
+    if (bestIdx >= 0)
+    {
+        // Remove the candidate, so it's only tried again if it broadcasts again
+        uint8_t mac[sizeof(p2p->cnc.otherMac)];
+        memcpy(mac, p2p->dsc.candidates[bestIdx].mac, sizeof(mac));
+        p2p->dsc.candidates[bestIdx] = p2p->dsc.candidates[--p2p->dsc.numCandidates];
+
+        p2pSendStart(p2p, mac);
+    }
+}
+
+/**
+ * @brief Connect to a Swadge by sending it a start message. This Swadge stops broadcasting and only listens to that
+ * Swadge from now on
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param mac_addr The MAC of the Swadge to connect to
+ */
+static void p2pSendStart(p2pInfo* p2p, const uint8_t* mac_addr)
+{
+    P2P_LOG("%s", __func__);
+
+    // Stop looking for other Swadges
+    esp_timer_stop(p2p->tmr.Connection);
+    esp_timer_stop(p2p->tmr.Candidate);
+    p2p->dsc.waiting    = false;
+    p2p->dsc.backingOff = false;
+
+    // We picked a Swadge, don't pick another
+    p2p->cnc.broadcastReceived = true;
+
+    // Save the other ESP's MAC
+    memcpy(p2p->cnc.otherMac, mac_addr, sizeof(p2p->cnc.otherMac));
+    p2p->cnc.otherMacReceived = true;
+
+    // If the last start message went to this Swadge too, it may have been received even though it wasn't ACKed. Send it
+    // again with the same sequence number, so that both Swadges pick the play order with the same one
+    bool resend      = (0 == memcmp(p2p->startMsg.macAddr, mac_addr, sizeof(p2p->startMsg.macAddr)));
+    uint8_t mySeqNum = p2p->cnc.mySeqNum;
+    if (resend)
+    {
+        p2p->cnc.mySeqNum = p2p->startMsg.seqNum;
+    }
+
+    // Send a message to that ESP to start the game.
+    p2p->startMsg.startByte   = P2P_START_BYTE;
+    p2p->startMsg.modeId      = p2p->modeId;
+    p2p->startMsg.messageType = P2P_MSG_START;
+    p2p->startMsg.seqNum      = 0;
+    memcpy(p2p->startMsg.macAddr, mac_addr, sizeof(p2p->startMsg.macAddr));
+    p2p->stats.startsSent++;
+
+    // If it's acked, call p2pGameStartAckRecv(), if not call p2pStartFailure()
+    p2pSendMsgEx(p2p, (uint8_t*)&p2p->startMsg, sizeof(p2p->startMsg), true, p2pGameStartAckRecv, p2pStartFailure);
+
+    // Carry on counting from where this Swadge was
+    if (resend)
+    {
+        p2p->cnc.mySeqNum = mySeqNum;
+    }
+}
+
+/**
+ * @brief Called when a start message isn't ACKed. If the other Swadge never sent a start message either, it's most
+ * likely connecting to a different Swadge, so back off and look for another. Otherwise the handshake failed partway
+ * through, so restart
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pStartFailure(p2pInfo* p2p)
+{
+    P2P_LOG("%s", __func__);
+
+    if (p2p->cnc.rxGameStartMsg)
+    {
+        p2pRestart(p2p);
+        return;
+    }
+
+    p2p->stats.abandoned++;
+    p2p->cnc.broadcastReceived = false;
+    p2p->cnc.otherMacReceived  = false;
+
+    // Broadcast again after a random time which doubles with each unanswered start message, so that Swadges which
+    // keep picking the same candidates spread out
+    p2p->dsc.backoff    = MIN(p2p->dsc.backoff + 1, MAX_BACKOFF);
+    p2p->dsc.backingOff = true;
+    esp_timer_start_once(p2p->tmr.Connection, p2pBackoffUs(BACKOFF_SLOT_US, p2p->dsc.backoff));
+}
+
+/**
+ * @brief Get a randomized exponential backoff, one slot plus a random number of slots below 2^exponent
+ *
+ * @param slotUs The length of a slot
+ * @param exponent The exponent, which doubles the range of the random part each time it's incremented
+ * @return The time to wait
+ */
+static uint32_t p2pBackoffUs(uint32_t slotUs, uint8_t exponent)
+{
+    return slotUs + (esp_random() % (slotUs << exponent));
+}
+
 /**
  * @brief Retries sending a message to be acked
  *
@@ -246,7 +724,19 @@ static void p2pTxRetryTimeout(void* arg)
 
     if (p2p->ack.msgToAckLen > 0)
     {
+        if (P2P_MSG_START == p2p->ack.msgToAck.hdr.messageType)
+        {
+            if (p2p->ack.retries >= START_RETRIES)
+            {
+                // Give up on this Swadge sooner than other messages
+                p2pTxAllRetriesTimeout(p2p);
+                return;
+            }
+            p2p->stats.startRetries++;
+        }
+
         P2P_LOG("Retrying message");
+        p2p->ack.retries++;
         p2pSendMsgEx(p2p, (uint8_t*)&p2p->ack.msgToAck, p2p->ack.msgToAckLen, true, p2p->ack.SuccessFn,
                      p2p->ack.FailureFn);
     }
@@ -287,6 +777,9 @@ static void p2pTxAllRetriesTimeout(void* arg)
  * the CON_ESTABLISHED event occurs. Message addressing, ACKing, and retries
  * all happen automatically
  *
+ * Without a window, a message which is waiting for an ACK is replaced by this one. With a window set by
+ * p2pSetWindow(), this message is sent alongside any others in flight, or fails right away if the window is full
+ *
  * @param p2p       The p2pInfo struct with all the state information
  * @param payload   A byte array to be copied to the payload for this message
  * @param len       The length of the byte array
@@ -296,6 +789,12 @@ void p2pSendMsg(p2pInfo* p2p, const uint8_t* payload, uint16_t len, p2pMsgTxCbFn
 {
     P2P_LOG("%s", __func__);
 
+    if (NULL != p2p->win)
+    {
+        p2pWindowSend(p2p, payload, len, msgTxCbFn);
+        return;
+    }
+
     p2pDataMsg_t builtMsg = {0};
     uint8_t builtMsgLen   = sizeof(p2pCommonHeader_t);
 
@@ -451,7 +950,7 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
 #endif
 
     // Check if this message matches our message ID
-    if (len < sizeof(p2pConMsg_t) || ((const p2pConMsg_t*)data)->startByte != P2P_START_BYTE
+    if (len < CON_MSG_LEGACY_LEN || ((const p2pConMsg_t*)data)->startByte != P2P_START_BYTE
         || ((const p2pConMsg_t*)data)->modeId != p2p->incomingModeId)
     {
         // This message is too short, or does not match our message ID
@@ -459,6 +958,40 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
         return;
     }
 
+    // If the other Swadge started over after this one connected, so must this one
+    if (p2pOtherRestarted(p2p, mac_addr, data, len))
+    {
+        return;
+    }
+
+    // There may be many connection broadcasts in a crowd, so drop the ones which aren't needed right away
+    if (P2P_MSG_CONNECT == ((const p2pConMsg_t*)data)->messageType)
+    {
+        // A broadcast without a channel is on the default channel
+        uint8_t channel[2] = {0};
+        if (sizeof(p2pConMsg_t) == len)
+        {
+            memcpy(channel, ((const p2pConMsg_t*)data)->channel, sizeof(channel));
+        }
+        else if (CON_MSG_LEGACY_LEN != len)
+        {
+            P2P_LOG("DISCARD: Broadcast with a bad length");
+            return;
+        }
+
+        if (0 != memcmp(channel, p2p->conMsg.channel, sizeof(p2p->conMsg.channel)))
+        {
+            P2P_LOG("DISCARD: Broadcast from another channel");
+            p2p->stats.filtered++;
+            return;
+        }
+        else if (p2p->cnc.otherMacReceived)
+        {
+            // This Swadge already picked a Swadge to connect to
+            return;
+        }
+    }
+
     // Make a pointer for convenience
     const p2pCommonHeader_t* p2pHdr = (const p2pCommonHeader_t*)data;
 
@@ -486,12 +1019,52 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
         return;
     }
 
+    // Data from the other Swadge means it's connected, so it received this Swadge's start message even if the ACK
+    // was lost. Connect before handling the data
+    if (!p2p->cnc.isConnected && p2p->cnc.rxGameStartMsg && p2p->ack.isWaitingForAck
+        && P2P_MSG_START == p2p->ack.msgToAck.hdr.messageType && len >= sizeof(p2pCommonHeader_t)
+        && (P2P_MSG_DATA == p2pHdr->messageType || P2P_MSG_WIN_DATA == p2pHdr->messageType))
+    {
+        P2P_LOG("Data received when waiting for a start ACK");
+        esp_timer_stop(p2p->tmr.TxRetry);
+        esp_timer_stop(p2p->tmr.TxAllRetries);
+        memset(&p2p->ack, 0, sizeof(p2p->ack));
+        p2pProcConnectionEvt(p2p, RX_GAME_START_ACK);
+    }
+
+    // Windowed messages have their own sequence numbers and ACKs, and are only used after connecting
+    if (len >= WIN_HDR_LEN && (P2P_MSG_WIN_DATA == p2pHdr->messageType || P2P_MSG_WIN_ACK == p2pHdr->messageType))
+    {
+        if (p2p->cnc.isConnected && NULL != p2p->win)
+        {
+            p2pWindowRecv(p2p, (const p2pWindowMsg_t*)data, len);
+        }
+        return;
+    }
+
+    // Don't answer a start message from a Swadge which is too far away to connect to, so that it gives up quickly
+    if (!p2p->cnc.otherMacReceived && len >= sizeof(p2pCommonHeader_t) && P2P_MSG_START == p2pHdr->messageType
+        && rssi <= p2p->connectionRssi)
+    {
+        P2P_LOG("DISCARD: Start message too weak");
+        return;
+    }
+
     // By here, we know the received message matches our message ID, either a
     // broadcast or for us. If this isn't an ack message, ack it
     if (len >= sizeof(p2pCommonHeader_t) && p2pHdr->messageType != P2P_MSG_ACK
         && p2pHdr->messageType != P2P_MSG_DATA_ACK)
     {
-        p2pSendAckToMac(p2p, mac_addr);
+        p2pSendAckToMac(p2p, mac_addr, p2pHdr->seqNum);
+    }
+
+    // Only older firmware sends an ACK without data that doesn't say which message it's for. Remember which Swadge sent
+    // it, including ACKs discarded below. The ACK of this Swadge's start message may be lost, so one which came before
+    // the other Swadge's start message counts too, but after picking a Swadge only its ACKs do
+    if (P2P_MSG_ACK == p2pHdr->messageType && sizeof(p2pCommonHeader_t) == len
+        && (!p2p->cnc.otherMacReceived || 0 == memcmp(mac_addr, p2p->cnc.otherMac, sizeof(p2p->cnc.otherMac))))
+    {
+        memcpy(p2p->cnc.legacyMac, mac_addr, sizeof(p2p->cnc.legacyMac));
     }
 
     // After ACKing the message, check the sequence number to see if we should
@@ -514,8 +1087,17 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
     // Check if this is an ACK
     bool isAck = (P2P_MSG_ACK == p2pHdr->messageType) || (P2P_MSG_DATA_ACK == p2pHdr->messageType);
 
-    // ACKs can be received in any state
-    if (p2p->ack.isWaitingForAck && isAck)
+    // An ACK without data says which message it's for, unless it's from firmware which came before that. An ACK for
+    // an older message, like a start message from before a restart, isn't for the message being waited on
+    if (p2p->ack.isWaitingForAck && P2P_MSG_ACK == p2pHdr->messageType && len > sizeof(p2pCommonHeader_t)
+        && ((const p2pDataMsg_t*)data)->data[0] != p2p->ack.msgToAck.hdr.seqNum)
+    {
+        P2P_LOG("DISCARD: ACK for another message");
+        return;
+    }
+
+    // ACKs can be received in any state
+    if (p2p->ack.isWaitingForAck && isAck)
     {
         P2P_LOG("ACK Received when waiting for one");
 
@@ -547,36 +1129,22 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
         // Ack handled
         return;
     }
-    else if (p2p->ack.isWaitingForAck || isAck)
+    else if (isAck || (p2p->ack.isWaitingForAck && (p2p->cnc.isConnected || P2P_MSG_START != p2pHdr->messageType)))
     {
-        // Don't process anything else when waiting for or receiving an ack
+        // Don't process anything else when waiting for or receiving an ack. The other Swadge's start message is
+        // processed while waiting for an ACK to this one's, since both may be sent at once
         return;
     }
 
     if (false == p2p->cnc.isConnected)
     {
-        // Received another broadcast, Check if this RSSI is strong enough
-        if (!p2p->cnc.broadcastReceived && rssi > p2p->connectionRssi && sizeof(p2pConMsg_t) == len
-            && ((const p2pConMsg_t*)data)->messageType == p2p->conMsg.messageType
-            && ((const p2pConMsg_t*)data)->modeId == p2p->incomingModeId
-            && ((const p2pConMsg_t*)data)->startByte == p2p->conMsg.startByte)
+        // Received another broadcast, remember it if this RSSI is strong enough
+        if (P2P_MSG_CONNECT == p2pHdr->messageType)
         {
-            // We received a broadcast, don't allow another
-            p2p->cnc.broadcastReceived = true;
-
-            // Save the other ESP's MAC
-            memcpy(p2p->cnc.otherMac, mac_addr, sizeof(p2p->cnc.otherMac));
-            p2p->cnc.otherMacReceived = true;
-
-            // Send a message to that ESP to start the game.
-            p2p->startMsg.startByte   = P2P_START_BYTE;
-            p2p->startMsg.modeId      = p2p->modeId;
-            p2p->startMsg.messageType = P2P_MSG_START;
-            p2p->startMsg.seqNum      = 0;
-            memcpy(p2p->startMsg.macAddr, mac_addr, sizeof(p2p->startMsg.macAddr));
-
-            // If it's acked, call p2pGameStartAckRecv(), if not reinit with p2pRestart()
-            p2pSendMsgEx(p2p, (uint8_t*)&p2p->startMsg, sizeof(p2p->startMsg), true, p2pGameStartAckRecv, p2pRestart);
+            if (rssi > p2p->connectionRssi)
+            {
+                p2pAddCandidate(p2p, mac_addr, rssi);
+            }
         }
         // Received a response to our broadcast
         else if (!p2p->cnc.rxGameStartMsg && sizeof(p2p->startMsg) == len && p2pHdr->messageType == P2P_MSG_START)
@@ -586,14 +1154,30 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
             // This is another swadge trying to start a game, which means
             // they received our p2p->conMsg. First disable our p2p->conMsg
             esp_timer_stop(p2p->tmr.Connection);
+            p2p->cnc.otherStartSeq = p2pHdr->seqNum;
+
+            // Older firmware goes first if this Swadge's start message reaches it before the ACK which was just sent,
+            // and second otherwise. Messages from one Swadge arrive in the order they were sent, so that depends on
+            // whether this Swadge already sent its start message. Before connecting, older firmware only ACKs start
+            // messages, so an ACK from it means an earlier one which was given up on got there too
+            bool startArrived    = (0 == memcmp(mac_addr, p2p->cnc.legacyMac, sizeof(p2p->cnc.legacyMac)));
+            p2p->cnc.legacyOrder = (p2p->cnc.otherMacReceived || startArrived) ? GOING_SECOND : GOING_FIRST;
+
+            // If this Swadge hasn't picked one to connect to yet, connect to that one instead of waiting for its
+            // broadcast, which it stopped sending when it picked this Swadge
+            if (!p2p->cnc.otherMacReceived)
+            {
+                p2pSendStart(p2p, mac_addr);
+            }
 
             // And process this connection event
             p2pProcConnectionEvt(p2p, RX_GAME_START_MSG);
         }
         return;
     }
-    else if (len >= sizeof(p2pCommonHeader_t))
+    else if (len >= sizeof(p2pCommonHeader_t) && P2P_MSG_START != p2pHdr->messageType)
     {
+        // A start message resent after connecting was already ACKed, and isn't for the mode
         P2P_LOG("cnc.isconnected is true");
         //  Let the mode handle it
         if (NULL != p2p->msgRxCbFn)
@@ -606,6 +1190,59 @@ void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8
     }
 }
 
+/**
+ * @brief Check if the other Swadge started over after this one connected to it. That happens when the last ACK of the
+ * handshake never reached it, so it gave up even though this Swadge connected. Messages from one Swadge arrive in the
+ * order they were sent, so after its start message, a broadcast or a different start message means it isn't connecting
+ * to this one anymore. Restart too, so that both Swadges agree
+ *
+ * @param p2p      The p2pInfo struct with all the state information
+ * @param mac_addr The MAC of the swadge that sent the data
+ * @param data     The data
+ * @param len      The length of the data
+ * @return true if the other Swadge started over and this one restarted, false otherwise
+ */
+static bool p2pOtherRestarted(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8_t len)
+{
+    if (!p2p->cnc.rxGameStartMsg || 0 != memcmp(mac_addr, p2p->cnc.otherMac, sizeof(p2p->cnc.otherMac)))
+    {
+        return false;
+    }
+
+    const p2pCommonHeader_t* p2pHdr = (const p2pCommonHeader_t*)data;
+    bool isStart  = (len >= sizeof(p2pCommonHeader_t) && P2P_MSG_START == p2pHdr->messageType);
+    bool forOther = isStart && 0 != memcmp(p2pHdr->macAddr, p2p->cnc.myMac, sizeof(p2p->cnc.myMac));
+    bool newStart = isStart && !forOther && p2pHdr->seqNum != p2p->cnc.otherStartSeq;
+
+    if (!p2p->cnc.isConnected)
+    {
+        // The other Swadge gave up on its start message and sent this one a new one. Both Swadges pick the play order
+        // with the newest one, so use it. Otherwise the handshake's own timeouts take care of a Swadge which gave up
+        if (newStart)
+        {
+            P2P_LOG("Other Swadge sent a new start message");
+            p2p->cnc.otherStartSeq = p2pHdr->seqNum;
+        }
+        return false;
+    }
+
+    if (P2P_MSG_CONNECT == p2pHdr->messageType)
+    {
+        P2P_LOG("Other Swadge is broadcasting again");
+    }
+    else if (forOther || newStart)
+    {
+        P2P_LOG("Other Swadge sent a new start message after connecting");
+    }
+    else
+    {
+        return false;
+    }
+
+    p2pRestart(p2p);
+    return true;
+}
+
 /**
  * @brief Set data to be automatically used as the payload all future ACKs, until the
  * data is cleared.
@@ -651,16 +1288,27 @@ void p2pClearDataInAck(p2pInfo* p2p)
  *
  * @param p2p      The p2pInfo struct with all the state information
  * @param mac_addr The MAC to address this ACK to
+ * @param seqNum   The sequence number of the message being ACKed
  */
-static void p2pSendAckToMac(p2pInfo* p2p, const uint8_t* mac_addr)
+static void p2pSendAckToMac(p2pInfo* p2p, const uint8_t* mac_addr, uint8_t seqNum)
 {
     P2P_LOG("%s", __func__);
 
     // Write the destination MAC address
     // Everything else should already be written
     memcpy(p2p->ackMsg.hdr.macAddr, mac_addr, sizeof(p2p->ackMsg.hdr.macAddr));
+
+    // An ACK without data carries the sequence number of the message it's for. Firmware which came before this ignores
+    // it, since ACKs without data are never passed to the mode
+    uint8_t ackLen = sizeof(p2pCommonHeader_t) + p2p->dataInAckLen;
+    if (P2P_MSG_ACK == p2p->ackMsg.hdr.messageType)
+    {
+        p2p->ackMsg.data[0] = seqNum;
+        ackLen++;
+    }
+
     // Send the ACK
-    p2pSendMsgEx(p2p, (uint8_t*)&p2p->ackMsg, sizeof(p2pCommonHeader_t) + p2p->dataInAckLen, false, NULL, NULL);
+    p2pSendMsgEx(p2p, (uint8_t*)&p2p->ackMsg, ackLen, false, NULL, NULL);
 }
 
 /**
@@ -683,7 +1331,8 @@ static void p2pGameStartAckRecv(p2pInfo* p2p, const uint8_t* data, uint8_t dataL
  * Two steps are necessary to establish a connection in no particular order.
  * 1. This swadge has to receive a start message from another swadge
  * 2. This swadge has to receive an ack to a start message sent to another swadge
- * The order of events determines who is the 'client' and who is the 'server'
+ * The start messages' sequence numbers determine who is the 'client' and who is the 'server', unless the other Swadge
+ * has older firmware, which goes by the order it finished these steps in
  *
  * @param p2p   The p2pInfo struct with all the state information
  * @param event The event that occurred
@@ -697,22 +1346,12 @@ static void p2pProcConnectionEvt(p2pInfo* p2p, connectionEvt_t event)
     {
         case RX_GAME_START_MSG:
         {
-            // Already received the ack, become the client
-            if (!p2p->cnc.rxGameStartMsg && p2p->cnc.rxGameStartAck)
-            {
-                p2p->cnc.playOrder = GOING_SECOND;
-            }
             // Mark this event
             p2p->cnc.rxGameStartMsg = true;
             break;
         }
         case RX_GAME_START_ACK:
         {
-            // Already received the msg, become the server
-            if (!p2p->cnc.rxGameStartAck && p2p->cnc.rxGameStartMsg)
-            {
-                p2p->cnc.playOrder = GOING_FIRST;
-            }
             // Mark this event
             p2p->cnc.rxGameStartAck = true;
             break;
@@ -738,6 +1377,29 @@ static void p2pProcConnectionEvt(p2pInfo* p2p, connectionEvt_t event)
         esp_timer_stop(p2p->tmr.Reinit);
 
         p2p->cnc.isConnected = true;
+        p2p->dsc.backoff     = 0;
+
+        // The Swadge whose start message had the higher sequence number goes first. Sequence numbers start out random,
+        // so this is random too, and both Swadges agree even if their start messages crossed. A tie goes to the
+        // higher MAC. Older firmware starts counting at 0 and picks the play order by which handshake message came
+        // first instead, so pick the opposite of what it picks
+        if (0 == memcmp(p2p->cnc.legacyMac, p2p->cnc.otherMac, sizeof(p2p->cnc.otherMac)))
+        {
+            p2p->cnc.playOrder = p2p->cnc.legacyOrder;
+        }
+        else
+        {
+            int16_t order = (int16_t)p2p->startMsg.seqNum - p2p->cnc.otherStartSeq;
+            if (0 == order)
+            {
+                order = memcmp(p2p->cnc.myMac, p2p->cnc.otherMac, sizeof(p2p->cnc.myMac));
+            }
+            p2p->cnc.playOrder = (order > 0) ? GOING_FIRST : GOING_SECOND;
+        }
+        if (p2p->stats.connectUs < 0)
+        {
+            p2p->stats.connectUs = esp_timer_get_time() - p2p->stats.startUs;
+        }
 
         // tell the mode it's connected
         if (NULL != p2p->conCbFn)
@@ -782,7 +1444,9 @@ static void p2pRestartTmrCb(void* arg)
 }
 
 /**
- * @brief Restart by deinitializing then initializing. Persist the msgId and p2p->conCbFn fields
+ * @brief Restart by resetting all the state. Persist the msgId and p2p->conCbFn fields, and the p2pBulk and p2pReplica
+ * which are attached, see \ref p2p_usage. The timers are stopped and reused rather than deleted, since this may be
+ * called from one of their callbacks
  *
  * @param p2p The p2pInfo struct with all the state information
  */
@@ -795,15 +1459,38 @@ static void p2pRestart(p2pInfo* p2p)
         p2p->conCbFn(p2p, CON_LOST);
     }
 
-    uint8_t modeId         = p2p->modeId;
-    uint8_t incomingModeId = p2p->incomingModeId;
-    p2pDeinit(p2p);
-    p2pInitialize(p2p, modeId, p2p->conCbFn, p2p->msgRxCbFn, p2p->connectionRssi);
+    uint8_t modeId              = p2p->modeId;
+    uint8_t incomingModeId      = p2p->incomingModeId;
+    uint8_t windowSize          = (NULL != p2p->win) ? p2p->win->size : 0;
+    struct _p2pBulk* bulk       = p2p->bulk;
+    struct _p2pReplica* replica = p2p->replica;
+    p2pConMsg_t conMsg          = p2p->conMsg;
+    p2pConStats_t stats         = p2p->stats;
+    uint8_t backoff             = p2p->dsc.backoff;
+    typeof(p2p->tmr) tmr        = p2p->tmr;
+    p2pStopTimers(p2p);
+    p2pSetWindow(p2p, 0);
+    p2pInitState(p2p, modeId, p2p->conCbFn, p2p->msgRxCbFn, p2p->connectionRssi);
+    p2p->tmr     = tmr;
+    p2p->bulk    = bulk;
+    p2p->replica = replica;
+
+    // Keep the channel and statistics, and back off further before connecting again
+    p2p->conMsg      = conMsg;
+    p2p->stats       = stats;
+    p2p->dsc.backoff = MIN(backoff + 1, MAX_BACKOFF);
+    p2p->stats.restarts++;
 
     if (incomingModeId != modeId)
     {
         p2pSetAsymmetric(p2p, incomingModeId);
     }
+
+    // Start the next connection with an empty window of the same size
+    if (0 != windowSize)
+    {
+        p2pSetWindow(p2p, windowSize);
+    }
 }
 
 /**
@@ -822,6 +1509,12 @@ void p2pSendCb(p2pInfo* p2p, const uint8_t* mac_addr __attribute__((unused)), es
 {
     P2P_LOG("%s - %s", __func__, status == ESP_NOW_SEND_SUCCESS ? "ESP_NOW_SEND_SUCCESS" : "ESP_NOW_SEND_FAIL");
 
+    // Nothing to retry if p2p was deinitialized while this message was being sent
+    if (NULL == p2p->tmr.TxRetry)
+    {
+        return;
+    }
+
     switch (status)
     {
         case ESP_NOW_SEND_SUCCESS:
@@ -839,8 +1532,12 @@ void p2pSendCb(p2pInfo* p2p, const uint8_t* mac_addr __attribute__((unused)), es
                 //     transmissionTimeUs = 1000;
                 // }
 
-                // Use a fixed retry of 5ms
+                // Use a fixed retry of 5ms. Start messages back off instead, since many Swadges may be connecting
                 uint32_t waitTimeUs = 5000;
+                if (P2P_MSG_START == p2p->ack.msgToAck.hdr.messageType)
+                {
+                    waitTimeUs = p2pBackoffUs(START_RETRY_SLOT_US, MIN(p2p->ack.retries, MAX_START_BACKOFF));
+                }
 
                 // Round it to the nearest Ms, add 69ms (the measured worst case)
                 // then add some randomness [0ms to 15ms random]
@@ -896,3 +1593,501 @@ void p2pSetPlayOrder(p2pInfo* p2p, playOrder_t order)
 {
     p2p->cnc.playOrder = order;
 }
+
+/**
+ * @brief Get the number of messages which can be sent right now without waiting for an ACK
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @return The free space in the window set by p2pSetWindow(). Without a window, 1 if no message is waiting for an ACK,
+ * otherwise 0
+ */
+uint8_t p2pGetWindowSpace(p2pInfo* p2p)
+{
+    if (NULL == p2p->win)
+    {
+        return p2p->ack.isWaitingForAck ? 0 : 1;
+    }
+    return p2p->win->size - (uint8_t)(p2p->win->txNext - p2p->win->txBase);
+}
+
+/**
+ * @brief Get statistics about connecting, such as how long it took. See \ref p2p_discovery
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param stats Written with the statistics
+ */
+void p2pGetConStats(p2pInfo* p2p, p2pConStats_t* stats)
+{
+    *stats = p2p->stats;
+}
+
+/**
+ * @brief Send a message with the sliding window, or fail it right away if the window is full
+ *
+ * @param p2p       The p2pInfo struct with all the state information
+ * @param payload   A byte array to be copied to the payload for this message
+ * @param len       The length of the byte array
+ * @param msgTxCbFn A callback function when this message is ACKed or fails
+ */
+static void p2pWindowSend(p2pInfo* p2p, const uint8_t* payload, uint16_t len, p2pMsgTxCbFn msgTxCbFn)
+{
+    p2pWindow_t* win = p2p->win;
+
+    if (NULL == payload)
+    {
+        len = 0;
+    }
+
+    if (0 == p2pGetWindowSpace(p2p) || len > P2P_MAX_WINDOW_DATA_LEN)
+    {
+        P2P_LOG("Window full or message too long");
+        if (NULL != msgTxCbFn)
+        {
+            msgTxCbFn(p2p, MSG_FAILED, payload, len);
+        }
+        return;
+    }
+
+    // Build the message in the next slot, where it's kept until it's ACKed
+    p2pWindowTxSlot_t* slot   = &win->tx[win->txNext & win->mask];
+    slot->msg.hdr.startByte   = P2P_START_BYTE;
+    slot->msg.hdr.modeId      = p2p->modeId;
+    slot->msg.hdr.messageType = P2P_MSG_WIN_DATA;
+    slot->msg.hdr.seqNum      = win->txNext;
+    memcpy(slot->msg.hdr.macAddr, p2p->cnc.otherMac, sizeof(slot->msg.hdr.macAddr));
+    if (0 != len)
+    {
+        memcpy(slot->msg.data, payload, len);
+    }
+    slot->msg.retry   = 0;
+    slot->len         = WIN_HDR_LEN + len;
+    slot->done        = false;
+    slot->retries     = 0;
+    slot->txCbFn      = msgTxCbFn;
+    slot->firstSentUs = esp_timer_get_time();
+    slot->lastSentUs  = slot->firstSentUs;
+    win->txNext++;
+
+    p2pWindowTransmit(p2p, &slot->msg, slot->len);
+    p2pWindowArmRetry(p2p);
+}
+
+/**
+ * @brief Transmit a windowed message with an up-to-date ACK for the messages received so far
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param msg The message to transmit. Its ACK fields are written here
+ * @param len The length of the message, including the header
+ */
+static void p2pWindowTransmit(p2pInfo* p2p, p2pWindowMsg_t* msg, uint8_t len)
+{
+    p2pWindow_t* win = p2p->win;
+
+    // Note which later messages were already received, so the other Swadge doesn't retransmit them
+    uint16_t ackBits = 0;
+    for (uint8_t i = 0; i < win->mask; i++)
+    {
+        if (win->rx[(uint8_t)(win->rxNext + 1 + i) & win->mask].received)
+        {
+            ackBits |= (1 << i);
+        }
+    }
+
+    // The oldest message which may still be retransmitted. The receiver skips anything older which it hasn't received
+    uint8_t baseSeq = win->txBase;
+    while (baseSeq != win->txNext && win->tx[baseSeq & win->mask].done)
+    {
+        baseSeq++;
+    }
+
+    msg->ackSeq     = win->rxNext;
+    msg->baseSeq    = baseSeq;
+    msg->ackBits[0] = ackBits & 0xFF;
+    msg->ackBits[1] = ackBits >> 8;
+    msg->echoSeq    = win->echoSeq;
+    msg->echoRetry  = win->echoRetry;
+
+    // This ACKs everything received so far
+    if (win->ackPending)
+    {
+        win->ackPending = false;
+        esp_timer_stop(p2p->tmr.WinAck);
+    }
+    win->rxUnacked = 0;
+
+    espNowSend((const char*)msg, len);
+}
+
+/**
+ * @brief Transmit a windowed message again
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param slot The message to retransmit
+ * @param nowUs The current time
+ */
+static void p2pWindowRetransmit(p2pInfo* p2p, p2pWindowTxSlot_t* slot, int64_t nowUs)
+{
+    P2P_LOG("Retransmitting windowed message %" PRIu8, slot->msg.hdr.seqNum);
+
+
+    if (slot->retries < UINT8_MAX)
+    {
+        slot->retries++;
+    }
+    slot->msg.retry  = slot->retries;
+    slot->lastSentUs = nowUs;
+    p2p->win->retransmits++;
+    p2pWindowTransmit(p2p, &slot->msg, slot->len);
+}
+
+/**
+ * @brief Send an ACK for windowed messages without any data
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pWindowSendAck(p2pInfo* p2p)
+{
+    p2pWindowMsg_t ack;
+    ack.hdr.startByte   = P2P_START_BYTE;
+    ack.hdr.modeId      = p2p->modeId;
+    ack.hdr.messageType = P2P_MSG_WIN_ACK;
+    ack.hdr.seqNum      = 0;
+    ack.retry           = 0;
+    memcpy(ack.hdr.macAddr, p2p->cnc.otherMac, sizeof(ack.hdr.macAddr));
+    p2pWindowTransmit(p2p, &ack, WIN_HDR_LEN);
+}
+
+/**
+ * @brief Sends a delayed ACK if no outgoing data carried it first
+ *
+ * Called from the tmr.WinAck timer. The timer is set when a windowed message is received and stopped when any windowed
+ * message is transmitted
+ *
+ * @param arg The p2pInfo struct with all the state information
+ */
+static void p2pWinAckTimeout(void* arg)
+{
+    p2pInfo* p2p = (p2pInfo*)arg;
+
+    if (NULL != p2p->win && p2p->win->ackPending)
+    {
+        p2pWindowSendAck(p2p);
+    }
+}
+
+/**
+ * @brief Retransmits windowed messages which weren't ACKed in time, and fails messages after all retries are exhausted
+ *
+ * Called from the tmr.WinRetry timer, which is set for the earliest deadline of any message in flight
+ *
+ * @param arg The p2pInfo struct with all the state information
+ */
+static void p2pWinRetryTimeout(void* arg)
+{
+    p2pInfo* p2p     = (p2pInfo*)arg;
+    p2pWindow_t* win = p2p->win;
+
+    if (NULL == win)
+    {
+        return;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    bool timedOut = false;
+    for (uint8_t seq = win->txBase; seq != win->txNext; seq++)
+    {
+        p2pWindowTxSlot_t* slot = &win->tx[seq & win->mask];
+        if (slot->done)
+        {
+            continue;
+        }
+
+        if (nowUs - slot->firstSentUs >= RETRY_TIME_US)
+        {
+            // Give up, the other Swadge will skip this message
+            P2P_LOG("Windowed message %" PRIu8 " totally failed", seq);
+            slot->done   = true;
+            slot->status = MSG_FAILED;
+        }
+        else if (nowUs - slot->lastSentUs >= win->rtoUs)
+        {
+            p2pWindowRetransmit(p2p, slot, nowUs);
+            timedOut = true;
+        }
+    }
+
+    // Back off until the round trip is measured again, in case the timeout is too short
+    if (timedOut)
+    {
+        win->rtoUs = MIN(WIN_MAX_RTO_US, 2 * win->rtoUs);
+    }
+
+    p2pWindowRelease(p2p);
+    p2pWindowArmRetry(p2p);
+}
+
+/**
+ * @brief Process a windowed message. The ACK is processed first, then any data is delivered in order
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param msg The received message
+ * @param len The length of the received message, at least the header length
+ */
+static void p2pWindowRecv(p2pInfo* p2p, const p2pWindowMsg_t* msg, uint8_t len)
+{
+    p2pWindowProcAck(p2p, msg);
+
+    // ACK right away when something unexpected happens, so the other Swadge can retransmit sooner
+    bool ackNow = false;
+
+    // Skip messages the other Swadge gave up on, but deliver any after them which were received
+    while (NULL != p2p->win && (int8_t)(p2p->win->rxNext - msg->baseSeq) < 0)
+    {
+        p2pWindow_t* win = p2p->win;
+        if (win->rx[win->rxNext & win->mask].received)
+        {
+            p2pWindowDeliver(p2p);
+        }
+        else
+        {
+            P2P_LOG("Skipping windowed message %" PRIu8, win->rxNext);
+            win->rxNext++;
+            win->rxSkipped++;
+            ackNow = true;
+        }
+    }
+
+    if (NULL != p2p->win && P2P_MSG_WIN_DATA == msg->hdr.messageType)
+    {
+        p2pWindow_t* win = p2p->win;
+        uint8_t ahead    = msg->hdr.seqNum - win->rxNext;
+
+        // Echo this message in the next ACK so the other Swadge can measure the round trip
+        win->echoSeq   = msg->hdr.seqNum;
+        win->echoRetry = msg->retry;
+        if (ahead > win->mask)
+        {
+            // Already delivered, so the ACK was lost, or too far ahead to hold on to
+            P2P_LOG("DISCARD: Windowed message %" PRIu8 " is outside the window", msg->hdr.seqNum);
+            ackNow = true;
+        }
+        else
+        {
+            p2pWindowRxSlot_t* slot = &win->rx[msg->hdr.seqNum & win->mask];
+            if (slot->received)
+            {
+                // A duplicate of a message waiting for an earlier one
+                ackNow = true;
+            }
+            else
+            {
+                slot->received = true;
+                slot->len      = len - WIN_HDR_LEN;
+                memcpy(slot->data, msg->data, slot->len);
+            }
+
+            // Out of order, an earlier message was probably lost
+            if (0 != ahead)
+            {
+                ackNow = true;
+            }
+
+            // ACK every other message right away, and otherwise wait a little for outgoing data to carry the ACK
+            win->rxUnacked++;
+            if (!win->ackPending)
+            {
+                win->ackPending = true;
+                esp_timer_start_once(p2p->tmr.WinAck, WIN_ACK_DELAY_US);
+            }
+        }
+
+        p2pWindowDeliver(p2p);
+    }
+
+    if (NULL != p2p->win && (ackNow || p2p->win->rxUnacked >= 2))
+    {
+        p2pWindowSendAck(p2p);
+    }
+
+    p2pWindowRelease(p2p);
+    p2pWindowArmRetry(p2p);
+}
+
+/**
+ * @brief Process the ACK fields of a received windowed message. Messages which were ACKed are marked done, and any
+ * message which was sent before a message that was received is assumed lost and retransmitted right away
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param msg The received message with the ACK fields
+ */
+static void p2pWindowProcAck(p2pInfo* p2p, const p2pWindowMsg_t* msg)
+{
+    p2pWindow_t* win = p2p->win;
+    int64_t nowUs    = esp_timer_get_time();
+    uint8_t ackSeq   = msg->ackSeq;
+    uint16_t ackBits = msg->ackBits[0] | (msg->ackBits[1] << 8);
+
+    // Ignore ACKs for messages which were never sent, they're stale or not for this connection
+    if ((uint8_t)(ackSeq - win->txBase) > (uint8_t)(win->txNext - win->txBase))
+    {
+        return;
+    }
+
+    // Mark ACKed messages
+    bool anySacked       = false;
+    uint8_t lastSackSeq  = 0;
+    int64_t lastSackedUs = 0;
+    for (uint8_t seq = win->txBase; seq != win->txNext; seq++)
+    {
+        p2pWindowTxSlot_t* slot = &win->tx[seq & win->mask];
+        uint8_t ahead           = seq - ackSeq;
+        bool sacked             = (ahead >= 1 && ahead <= 16 && (ackBits & (1 << (ahead - 1))));
+        if ((int8_t)ahead < 0 || sacked)
+        {
+            if (!slot->done)
+            {
+                // Measure the round trip if this ACK was sent in response to the latest transmission of this message
+                if (seq == msg->echoSeq && slot->retries == msg->echoRetry)
+                {
+                    p2pWindowRttSample(win, nowUs - slot->lastSentUs);
+                }
+                slot->done   = true;
+                slot->status = MSG_ACKED;
+            }
+
+            if (sacked)
+            {
+                anySacked    = true;
+                lastSackSeq  = seq;
+                lastSackedUs = MAX(lastSackedUs, slot->lastSentUs);
+            }
+        }
+    }
+
+    // Messages missing before one which was received were most likely lost, so don't wait for their timeouts
+    if (anySacked)
+    {
+        for (uint8_t seq = ackSeq; seq != lastSackSeq; seq++)
+        {
+            p2pWindowTxSlot_t* slot = &win->tx[seq & win->mask];
+            if (!slot->done && slot->lastSentUs <= lastSackedUs)
+            {
+                p2pWindowRetransmit(p2p, slot, nowUs);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Update the round trip time estimate and retransmission timeout with a new measurement, like TCP does
+ *
+ * @param win The window state
+ * @param rttUs The time between transmitting a message and receiving its ACK
+ */
+static void p2pWindowRttSample(p2pWindow_t* win, int32_t rttUs)
+{
+    rttUs = MAX(1, rttUs);
+    if (0 == win->srttUs)
+    {
+        win->srttUs   = rttUs;
+        win->rttVarUs = rttUs / 2;
+    }
+    else
+    {
+        int32_t errUs = rttUs - win->srttUs;
+        win->rttVarUs += (ABS(errUs) - win->rttVarUs) / 4;
+        win->srttUs += errUs / 8;
+    }
+    win->rtoUs = CLAMP(win->srttUs + MAX(WIN_RTO_MARGIN_US, 4 * win->rttVarUs), WIN_MIN_RTO_US, WIN_MAX_RTO_US);
+}
+
+/**
+ * @brief Deliver received windowed messages to the Swadge mode, in order, until one is missing
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pWindowDeliver(p2pInfo* p2p)
+{
+    // The callback may remove the window, so check it every time
+    while (NULL != p2p->win)
+    {
+        p2pWindow_t* win        = p2p->win;
+        p2pWindowRxSlot_t* slot = &win->rx[win->rxNext & win->mask];
+        if (!slot->received)
+        {
+            return;
+        }
+
+        slot->received = false;
+        win->rxNext++;
+        if (NULL != p2p->msgRxCbFn)
+        {
+            p2p->msgRxCbFn(p2p, slot->data, slot->len);
+        }
+    }
+}
+
+/**
+ * @brief Release windowed messages which were ACKed or failed from the start of the window, and call their transmit
+ * callbacks in the order they were sent
+ *
+ * Each message is released before its callback is called, so the callback can always send another message
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pWindowRelease(p2pInfo* p2p)
+{
+    // The callback may remove the window, so check it every time
+    while (NULL != p2p->win)
+    {
+        p2pWindow_t* win        = p2p->win;
+        p2pWindowTxSlot_t* slot = &win->tx[win->txBase & win->mask];
+        if (win->txBase == win->txNext || !slot->done)
+        {
+            return;
+        }
+        win->txBase++;
+
+        // Copy the data because the slot may be reused by a message sent from the callback
+        uint8_t data[P2P_MAX_WINDOW_DATA_LEN];
+        uint8_t dataLen = slot->len - WIN_HDR_LEN;
+        memcpy(data, slot->msg.data, dataLen);
+        if (NULL != slot->txCbFn)
+        {
+            slot->txCbFn(p2p, slot->status, data, dataLen);
+        }
+    }
+}
+
+/**
+ * @brief Set the retry timer for the earliest retransmission or failure of any windowed message in flight, or stop it
+ * if nothing is in flight
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ */
+static void p2pWindowArmRetry(p2pInfo* p2p)
+{
+    esp_timer_stop(p2p->tmr.WinRetry);
+
+    p2pWindow_t* win = p2p->win;
+    if (NULL == win)
+    {
+        return;
+    }
+
+    int64_t nextUs = INT64_MAX;
+    for (uint8_t seq = win->txBase; seq != win->txNext; seq++)
+    {
+        const p2pWindowTxSlot_t* slot = &win->tx[seq & win->mask];
+        if (!slot->done)
+        {
+            nextUs = MIN(nextUs, slot->lastSentUs + win->rtoUs);
+            nextUs = MIN(nextUs, slot->firstSentUs + RETRY_TIME_US);
+        }
+    }
+
+    if (INT64_MAX != nextUs)
+    {
+        esp_timer_start_once(p2p->tmr.WinRetry, MAX(1, nextUs - esp_timer_get_time()));
+    }
+}
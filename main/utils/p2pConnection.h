@@ -8,8 +8,10 @@
  * acknowledged, and are retried if not acknowledged.
  *
  * Connections are made when two Swadges broadcast connection messages to each other, then send start messages to each
- * other, and acknowledge each other's start message. The play order is determined by who acknowledges the start message
- * first, which is suitably random. A connection sequence looks like this:
+ * other, and acknowledge each other's start message. Each Swadge starts counting sequence numbers at a random number,
+ * and the Swadge whose start message had the larger sequence number goes first, so both Swadges agree on the play order
+ * even if some messages were lost. How a Swadge picks which broadcast to answer, and how it connects to older firmware,
+ * is described in \ref p2p_discovery. A connection sequence looks like this:
  */
 
 // clang-format off
@@ -19,19 +21,20 @@
  * == Connection ==
  *
  * group Part 1
- * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x00 {P2P_MSG_CONNECT}]"
- * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x01 {P2P_MSG_START}, 0x00 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB)]"
+ * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x00 {P2P_MSG_CONNECT}, 0x3A, 0x7C {channel, unless default}]"
+ * note right: Remember as a candidate, pick the strongest candidate after 100ms
+ * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x01 {P2P_MSG_START}, 0x5E {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB)]"
  * note left: Stop Broadcasting, set p2p->cnc.rxGameStartMsg
- * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x00 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12)]
+ * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x90 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12), 0x5E {ACKed seqNum}]
  * note right: set p2p->cnc.rxGameStartAck
  * end
  *
  * group Part 2
- * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x00 {P2P_MSG_CONNECT}]"
- * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x01 {P2P_MSG_START}, 0x01 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12)]"
- * note right: Stop Broadcasting, set p2p->cnc.rxGameStartMsg, become CLIENT
- * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x01 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB)]
- * note left: set p2p->cnc.rxGameStartAck, become SERVER
+ * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x01 {P2P_MSG_START}, 0x91 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12)]"
+ * note left: Sent right away, without waiting to hear a broadcast
+ * note right: set p2p->cnc.rxGameStartMsg, 0x5E < 0x91 so go second
+ * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x5F {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB), 0x91 {ACKed seqNum}]
+ * note left: set p2p->cnc.rxGameStartAck, 0x91 > 0x5E so go first
  * end
  * @enduml
  */
@@ -54,12 +57,12 @@
  * note right: msg not received
  * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x04 {P2P_MSG_DATA}, 0x04 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12), 'd', 'a', 't', 'a']
  * note left: first retry, up to five retries
- * "Swadge_12:12:12:12:12:12" ->x "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x04 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB)]
+ * "Swadge_12:12:12:12:12:12" ->x "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x04 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB), 0x04 {ACKed seqNum}]
  * note left: ack not received
  * "Swadge_AB:AB:AB:AB:AB:AB" ->  "Swadge_12:12:12:12:12:12" : "['p', {mode ID}, 0x04 {P2P_MSG_DATA}, 0x04 {seqNum}, (0x12, 0x12, 0x12, 0x12, 0x12, 0x12), 'd', 'a', 't', 'a']
  * note left: second retry
  * note right: duplicate seq num, ignore message
- * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x05 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB)]
+ * "Swadge_12:12:12:12:12:12" ->  "Swadge_AB:AB:AB:AB:AB:AB" : "['p', {mode ID}, 0x02 {P2P_MSG_ACK}, 0x05 {seqNum}, (0xAB, 0xAB, 0xAB, 0xAB, 0xAB, 0xAB), 0x04 {ACKed seqNum}]
  * end
  * @enduml
  */
@@ -72,7 +75,15 @@
  * p2pSendCb() and p2pRecvCb() must be called from the ESP-NOW callbacks to pass data to and from p2p.
  *
  * p2pInitialize() should be called to initialize p2p.
- * p2pDeinit() should be called when the Swadge mode is done to clean up.
+ * p2pDeinit() should be called when the Swadge mode is done to clean up. It deletes the timers, so p2pInitialize() must
+ * be called again before starting another connection with the same ::p2pInfo.
+ *
+ * p2pBulk.h and p2pReplica.h are the only code outside p2pConnection which writes to a ::p2pInfo. A #p2pMsgTxCbFn only
+ * gets the ::p2pInfo, so p2pBulkInit() and p2pReplicaInit() store themselves in ::p2pInfo.bulk and ::p2pInfo.replica
+ * for their transmit callbacks to find. p2pBulkDeinit() and p2pReplicaDeinit() set them back to NULL. p2pInitialize()
+ * does too, so they must be initialized after it. When a connection is lost and restarts with #CON_LOST, both fields
+ * are kept, since the bulk transfers and replicated state carry on with the next connection. Nothing else is hooked
+ * in. Received messages and connection events still reach them only through the Swadge mode's callbacks.
  *
  * The connection won't actually start until p2pStartConnection() is called.
  * Connection statues will be delivered to the Swadge mode through the
@@ -106,12 +117,11 @@
  * own timers, so if the Swadge Mode blocks p2p operation, timers may expire without getting the chance to retry
  * messages. As a good rule of thumb, if you notice visual stutters then something is taking too long.
  *
- * -# You must wait for both sides of the p2p connection to be established before transmitting any data packets. Roles
- * can be checked by calling p2pGetPlayOrder(). The Swadge with the #GOING_SECOND role finishes its handshake first, and
- * if a data packet is sent immediately after the #CON_ESTABLISHED event occurs, then that packet will mess up the
- * connection handshake for the other Swadge. The Swadge with the #GOING_FIRST role finishes its handshake second, and
- * once that #CON_ESTABLISHED event occurs, that Swadge may send a data packet to the other. That's why the role is
- * called #GOING_FIRST!
+ * -# You must wait for the #CON_ESTABLISHED event before transmitting any data packets. Roles can be checked by calling
+ * p2pGetPlayOrder(). The two Swadges don't finish their handshakes at the same time. If a data packet arrives at a
+ * Swadge which is still waiting for the ACK of its start message, it's taken as that ACK, since the other Swadge
+ * couldn't have connected without receiving the start message. Still, it's best to have the Swadge with the
+ * #GOING_FIRST role send the first data packet. That's why the role is called #GOING_FIRST!
  *
  * -# Try to not to have multiple Swadges transmit at the same time. Instead, have one send a message and have the other
  * respond. ESP32-S2s only have one antenna, so they cannot transmit and receive at the same time. If they do it's
@@ -123,7 +133,73 @@
  * -# p2pSendMsg() does not queue messages, so if you try to send multiple messages without first receiving the transmit
  * callback (#p2pMsgTxCbFn), then only the last sent message will be sent successfully. Instead, you should either
  * combine data into a single packet (which is preferred, fewer larger packets tend to be faster) or wait for a
- * transmission to completely finish before starting the next.
+ * transmission to completely finish before starting the next. If you need to send more often than that, use a sliding
+ * window, described below.
+ *
+ * \section p2p_window Sliding Window
+ *
+ * By default only one message may be waiting for an ACK at a time, so every message costs a full round trip. For modes
+ * which stream state every frame, p2pSetWindow() lets up to ::P2P_MAX_WINDOW messages be in flight at once. Both
+ * Swadges must set a window, which is best done right after p2pInitialize(). The connection handshake is the same with
+ * or without a window.
+ *
+ * Windowed messages are sent as #P2P_MSG_WIN_DATA and have their own sequence numbers. Every windowed packet carries a
+ * cumulative ACK, the next sequence number the sender expects, and a bitmask of later messages it has already received
+ * out of order. It also echoes the last data message received and which retransmission of it that was, so the round
+ * trip time can be measured even for retransmitted messages. ACKs ride along with data going the other way when there
+ * is any, and are otherwise sent as #P2P_MSG_WIN_ACK after a short delay, or right away when a message arrives out of
+ * order. Messages are retransmitted when they aren't ACKed within a timeout calculated from the measured round trip
+ * time, or as soon as a later message is ACKed. Received messages are delivered to #p2pMsgRxCbFn in order, exactly
+ * once.
+ *
+ * When the window is full, p2pSendMsg() calls #p2pMsgTxCbFn with ::MSG_FAILED right away, so check
+ * p2pGetWindowSpace() first. Each message's #p2pMsgTxCbFn is called with the data that was sent, in the order messages
+ * were sent, and there is always room to send another message from it. p2pSetDataInAck() doesn't apply to windowed
+ * messages. A message which isn't ACKed after three seconds fails, and the receiver skips it
+ * and delivers the messages after it.
+ *
+ * \section p2p_discovery Connecting in Crowds
+ *
+ * When a Swadge hears a connection broadcast stronger than the RSSI given to p2pInitialize(), it doesn't answer right
+ * away. The broadcasting Swadge is remembered as a candidate, and after listening 100ms for more broadcasts, a start
+ * message is sent to the strongest candidate heard in the last two seconds. Up to ::P2P_MAX_CANDIDATES are remembered,
+ * and the stalest or weakest is replaced when there isn't room. Each candidate's RSSI is averaged over its broadcasts,
+ * since single packets fade.
+ *
+ * A Swadge which receives a start message before picking a candidate connects to that Swadge, and answers with its own
+ * start message right away. Once a Swadge has picked another, broadcasts are dropped, and start messages from other
+ * Swadges are ignored. Start messages weaker than the RSSI given to p2pInitialize() aren't ACKed either.
+ *
+ * In a crowd, the picked Swadge may already be connecting to someone else. Start messages are retried eight times with
+ * a randomized exponential backoff, rather than for three seconds like other messages. If none are ACKed, the Swadge
+ * goes back to broadcasting after a random backoff which doubles each time this happens, up to about three seconds, so
+ * that Swadges which keep picking the same candidates spread out. The backoff resets once a connection is made.
+ *
+ * An ACK without data ends with the sequence number of the message it's for, so a late ACK for an older start message,
+ * like one sent before a restart, doesn't complete the handshake. ACKs from firmware which came before this don't have
+ * it and are still accepted. A start message which is sent again to the same Swadge keeps its sequence number, since
+ * the first one may have been received even though it wasn't ACKed, and both Swadges must pick the play order with the
+ * same one.
+ *
+ * Firmware which came before this starts counting sequence numbers at 0 and picks the play order differently. A Swadge
+ * whose start message is ACKed before the other Swadge's start message arrives goes second, and otherwise goes first.
+ * An ACK without the sequence number shows the other Swadge has that firmware. Messages from one Swadge arrive in the
+ * order they were sent, so if this Swadge's start message got to the other Swadge before this Swadge ACKed the other
+ * Swadge's, the other Swadge goes first and this one goes second, and otherwise the other way around. This also works
+ * when the start messages cross, which two Swadges with older firmware can't agree on. Only lost handshake messages can
+ * still make both Swadges pick the same play order.
+ *
+ * The last ACK of a handshake can still be lost, leaving one Swadge connected while the other gives up. The Swadge
+ * which gave up broadcasts or sends a new start message, and when the connected Swadge hears that, it restarts with
+ * #CON_LOST too. Modes should expect #CON_LOST after #CON_ESTABLISHED.
+ *
+ * p2pSetChannel() keeps groups of Swadges running the same mode apart, like two games being played at the same table. A
+ * hash of the channel name is sent in every connection broadcast, and broadcasts from other channels are dropped before
+ * anything else is done with them. Broadcasts on the default channel leave the hash out, so they're the same as
+ * broadcasts from firmware which came before channels, and the two can still connect.
+ *
+ * p2pGetConStats() reports how connecting went, including how long it took and how many broadcasts, candidates, and
+ * start messages there were. tools/p2p_sim simulates many Swadges connecting at once, and prints these statistics.
  *
  * \section p2p_example Example
  *
@@ -197,6 +273,15 @@
 /// The maximum payload of a p2p packet is 245 bytes
 #define P2P_MAX_DATA_LEN 245
 
+/// The maximum number of messages which may be in flight at once with p2pSetWindow()
+#define P2P_MAX_WINDOW 16
+
+/// The maximum payload of a windowed p2p packet. ESP-NOW packets are at most 250 bytes, minus the 17 byte header
+#define P2P_MAX_WINDOW_DATA_LEN 233
+
+/// The maximum number of Swadges remembered as candidates to connect to. See \ref p2p_discovery
+#define P2P_MAX_CANDIDATES 8
+
 /// After connecting, one Swadge will be ::GOING_FIRST and one will be ::GOING_SECOND
 typedef enum
 {
@@ -224,6 +309,9 @@ typedef enum
 
 typedef struct _p2pInfo p2pInfo;
 
+struct _p2pBulk;
+struct _p2pReplica;
+
 /**
  * @brief This typedef is for the function callback which delivers connection statuses to the Swadge mode
  *
@@ -273,7 +361,7 @@ typedef void (*p2pAckFailureFn)(p2pInfo* p2p);
 #define P2P_START_BYTE 'p'
 
 /**
- * @brief The five different types of p2p messages
+ * @brief The seven different types of p2p messages
  */
 typedef enum __attribute__((packed))
 {
@@ -281,7 +369,9 @@ typedef enum __attribute__((packed))
     P2P_MSG_START,    ///< The start message, used during connection
     P2P_MSG_ACK,      ///< An acknowledge message
     P2P_MSG_DATA_ACK, ///< An acknowledge message with extra data
-    P2P_MSG_DATA      ///< A data message
+    P2P_MSG_DATA,     ///< A data message
+    P2P_MSG_WIN_DATA, ///< A data message sent with a sliding window, see p2pSetWindow()
+    P2P_MSG_WIN_ACK,  ///< An acknowledge message for a sliding window without any data
 } p2pMsgType_t;
 
 /**
@@ -292,6 +382,7 @@ typedef struct
     uint8_t startByte;        ///< Start byte, must be ::P2P_START_BYTE
     uint8_t modeId;           ///< Mode byte, must be unique per-mode
     p2pMsgType_t messageType; ///< Message type byte
+    uint8_t channel[2];       ///< Channel name hash, MSB first. Not sent on the default channel, see p2pSetChannel()
 } p2pConMsg_t;
 
 /**
@@ -315,6 +406,97 @@ typedef struct
     uint8_t data[P2P_MAX_DATA_LEN]; ///< The data bytes sent or received
 } p2pDataMsg_t;
 
+/**
+ * @brief The byte format for a P2P packet sent with a sliding window. The ACK fields are for messages going the other
+ * way, so every packet acknowledges what its sender has received
+ */
+typedef struct
+{
+    p2pCommonHeader_t hdr;                 ///< The common header. seqNum is the window sequence number, unused for ACKs
+    uint8_t ackSeq;                        ///< The next sequence number this packet's sender expects to receive
+    uint8_t baseSeq;                       ///< The oldest sequence number this packet's sender is still retrying
+    uint8_t ackBits[2];                    ///< Bit N is set if ackSeq + 1 + N was received out of order, little-endian
+    uint8_t retry;                         ///< For data, the number of times this message was retransmitted
+    uint8_t echoSeq;                       ///< The seqNum of the last data message this packet's sender received
+    uint8_t echoRetry;                     ///< The retry of the last data message this packet's sender received
+    uint8_t data[P2P_MAX_WINDOW_DATA_LEN]; ///< The data bytes sent or received
+} p2pWindowMsg_t;
+
+/**
+ * @brief A message sent with a sliding window which may need to be retransmitted
+ */
+typedef struct
+{
+    p2pWindowMsg_t msg;     ///< The message, with the ACK fields filled in each time it's transmitted
+    uint8_t len;            ///< The length of the message, including the header
+    bool done;              ///< true if the message was ACKed or failed
+    messageStatus_t status; ///< Whether the message was ACKed or failed, once it's done
+    uint8_t retries;        ///< The number of times the message was retransmitted
+    int64_t firstSentUs;    ///< When the message was first transmitted
+    int64_t lastSentUs;     ///< When the message was last transmitted
+    p2pMsgTxCbFn txCbFn;    ///< A callback function called when this message is ACKed or fails
+} p2pWindowTxSlot_t;
+
+/**
+ * @brief A message received with a sliding window, waiting to be delivered in order
+ */
+typedef struct
+{
+    bool received;                         ///< true if this message was received and not delivered yet
+    uint8_t len;                           ///< The length of the data
+    uint8_t data[P2P_MAX_WINDOW_DATA_LEN]; ///< The data bytes received
+} p2pWindowRxSlot_t;
+
+/**
+ * @brief The state of a sliding window, allocated by p2pSetWindow()
+ */
+typedef struct
+{
+    uint8_t size;          ///< The number of messages which may be in flight at once
+    uint8_t mask;          ///< Sequence numbers are masked with this to index the slots, a power of two minus one
+    uint8_t txBase;        ///< The oldest sequence number whose callback hasn't been called
+    uint8_t txNext;        ///< The sequence number for the next message sent
+    uint8_t rxNext;        ///< The next sequence number to deliver
+    bool ackPending;       ///< true if received messages haven't been ACKed yet
+    uint8_t rxUnacked;     ///< The number of messages received since the last ACK was sent
+    uint8_t echoSeq;       ///< The seqNum of the last data message received
+    uint8_t echoRetry;     ///< The retry of the last data message received
+    int32_t srttUs;        ///< The smoothed round trip time, or 0 before it's measured
+    int32_t rttVarUs;      ///< The round trip time variation
+    int32_t rtoUs;         ///< The retransmission timeout
+    uint32_t retransmits;  ///< The number of messages retransmitted
+    uint32_t rxSkipped;    ///< The number of received messages skipped because the sender gave up on them
+    p2pWindowTxSlot_t* tx; ///< Sent messages, indexed by sequence number
+    p2pWindowRxSlot_t* rx; ///< Received messages, indexed by sequence number
+} p2pWindow_t;
+
+/**
+ * @brief A Swadge which was heard broadcasting while connecting, and may be connected to
+ */
+typedef struct
+{
+    uint8_t mac[6];  ///< The candidate's MAC address
+    int8_t rssi;     ///< The smoothed RSSI of the candidate's broadcasts
+    int64_t heardUs; ///< When the candidate's last broadcast was received
+} p2pCandidate_t;
+
+/**
+ * @brief Statistics about connecting. These are kept when a handshake fails and restarts, so they cover every attempt
+ * since p2pInitialize()
+ */
+typedef struct
+{
+    int64_t startUs;       ///< When p2pStartConnection() was first called, or -1 if it hasn't been
+    int64_t connectUs;     ///< The time from startUs until the connection was established, or -1 if it hasn't been
+    uint32_t broadcasts;   ///< The number of connection broadcasts sent
+    uint32_t candidates;   ///< The number of broadcasts received from Swadges which could be connected to
+    uint32_t filtered;     ///< The number of broadcasts dropped because they were on another channel
+    uint32_t startsSent;   ///< The number of start messages sent, not counting retries
+    uint32_t startRetries; ///< The number of times start messages were retried
+    uint32_t abandoned;    ///< The number of start messages which were never answered, so another Swadge was tried
+    uint32_t restarts;     ///< The number of handshakes or connections which failed and restarted with ::CON_LOST
+} p2pConStats_t;
+
 /**
  * @brief All the state variables required for a P2P session with another Swadge
  */
@@ -336,6 +518,12 @@ typedef struct _p2pInfo
 
     int8_t connectionRssi; ///< The minimum RSSI required to begin a connection
 
+    p2pWindow_t* win; ///< The sliding window, or NULL if only one message may be in flight. See p2pSetWindow()
+
+    struct _p2pBulk* bulk; ///< Set by p2pBulkInit() until p2pBulkDeinit(), or NULL. Kept across restarts
+
+    struct _p2pReplica* replica; ///< Set by p2pReplicaInit() until p2pReplicaDeinit(), or NULL. Kept across restarts
+
     /**
      * @brief Variables used for acknowledging and retrying messages
      */
@@ -345,6 +533,7 @@ typedef struct _p2pInfo
         p2pDataMsg_t msgToAck;     ///< A transmitted message which is waiting for an ACK
         uint16_t msgToAckLen;      ///< The length of the message which is waiting for an ACK
         uint32_t timeSentUs;       ///< The time the message is waiting for an ACK was transmitted
+        uint8_t retries;           ///< The number of times the message waiting for an ACK was retried
         p2pAckSuccessFn SuccessFn; ///< A callback function to be called if the message is ACKed
         p2pAckFailureFn FailureFn; ///< A callback function to be called if the message is not ACKed
     } ack;
@@ -354,19 +543,36 @@ typedef struct _p2pInfo
      */
     struct
     {
-        playOrder_t playOrder;  ///< Either ::GOING_FIRST or ::GOING_SECOND depending on how the handshake went
-        uint8_t myMac[6];       ///< This Swadge's MAC address
-        uint8_t otherMac[6];    ///< The other Swadge's MAC address
-        bool isActive;          ///< true if the connection process has started
-        bool isConnected;       ///< true if connected to another Swadge
-        bool broadcastReceived; ///< true if a broadcast was received to start the connection handshake
-        bool rxGameStartMsg;    ///< true if the other Swadge's game start message was received
-        bool rxGameStartAck;    ///< True if this Swadge's game start message was acknowledged
-        bool otherMacReceived;  ///< true if the other Swadge's MAC address has been received
-        uint8_t mySeqNum;       ///< The current sequence number used for transmissions
-        uint8_t lastSeqNum;     ///< The last sequence number used for transmissions
+        playOrder_t playOrder;   ///< Either ::GOING_FIRST or ::GOING_SECOND depending on how the handshake went
+        uint8_t myMac[6];        ///< This Swadge's MAC address
+        uint8_t otherMac[6];     ///< The other Swadge's MAC address
+        bool isActive;           ///< true if the connection process has started
+        bool isConnected;        ///< true if connected to another Swadge
+        bool broadcastReceived;  ///< true if a broadcast was received to start the connection handshake
+        bool rxGameStartMsg;     ///< true if the other Swadge's game start message was received
+        bool rxGameStartAck;     ///< True if this Swadge's game start message was acknowledged
+        bool otherMacReceived;   ///< true if the other Swadge's MAC address has been received
+        uint8_t mySeqNum;        ///< The current sequence number used for transmissions
+        uint8_t lastSeqNum;      ///< The last sequence number used for transmissions
+        uint8_t otherStartSeq;   ///< The sequence number of the other Swadge's start message, to pick the play order
+        uint8_t legacyMac[6];    ///< The last Swadge which sent an ACK that doesn't say which message it's for
+        playOrder_t legacyOrder; ///< The play order to use if the other Swadge has older firmware
     } cnc;
 
+    /**
+     * @brief Variables used to pick another Swadge to connect to, see \ref p2p_discovery
+     */
+    struct
+    {
+        p2pCandidate_t candidates[P2P_MAX_CANDIDATES]; ///< Swadges which could be connected to
+        uint8_t numCandidates;                         ///< The number of candidates
+        bool waiting;                                  ///< true while waiting for more candidates before picking one
+        bool backingOff;                               ///< true while backing off after a start message wasn't answered
+        uint8_t backoff;                               ///< The number of start messages not answered in a row
+    } dsc;
+
+    p2pConStats_t stats; ///< Statistics about connecting, see p2pGetConStats()
+
     /**
      * @brief The timers used for connection and ACKing
      */
@@ -376,6 +582,9 @@ typedef struct _p2pInfo
         esp_timer_handle_t TxAllRetries; ///< A timer used to cancel a transmission if all attempts failed
         esp_timer_handle_t Connection;   ///< A timer used to cancel a connection if the handshake fails
         esp_timer_handle_t Reinit;       ///< A timer used to restart P2P after any complete failures
+        esp_timer_handle_t WinRetry;     ///< A timer used to retransmit or fail windowed messages which weren't ACKed
+        esp_timer_handle_t WinAck;       ///< A timer used to send a delayed ACK for windowed messages
+        esp_timer_handle_t Candidate;    ///< A timer used to pick a candidate after hearing the first one
     } tmr;
 } p2pInfo;
 
@@ -392,6 +601,8 @@ typedef struct
 
 void p2pInitialize(p2pInfo* p2p, uint8_t modeId, p2pConCbFn conCbFn, p2pMsgRxCbFn msgRxCbFn, int8_t connectionRssi);
 void p2pSetAsymmetric(p2pInfo* p2p, uint8_t incomingModeId);
+void p2pSetWindow(p2pInfo* p2p, uint8_t windowSize);
+void p2pSetChannel(p2pInfo* p2p, const char* channel);
 void p2pDeinit(p2pInfo* p2p);
 
 void p2pStartConnection(p2pInfo* p2p);
@@ -401,6 +612,8 @@ void p2pSendCb(p2pInfo* p2p, const uint8_t* mac_addr, esp_now_send_status_t stat
 void p2pRecvCb(p2pInfo* p2p, const uint8_t* mac_addr, const uint8_t* data, uint8_t len, int8_t rssi);
 void p2pSetDataInAck(p2pInfo* p2p, const uint8_t* ackData, uint8_t ackDataLen);
 void p2pClearDataInAck(p2pInfo* p2p);
+uint8_t p2pGetWindowSpace(p2pInfo* p2p);
+void p2pGetConStats(p2pInfo* p2p, p2pConStats_t* stats);
 
 playOrder_t p2pGetPlayOrder(p2pInfo* p2p);
 void p2pSetPlayOrder(p2pInfo* p2p, playOrder_t order);
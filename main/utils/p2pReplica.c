@@ -0,0 +1,835 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_now.h>
+
+#include "p2pReplica.h"
+#include "macros.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+// The length of p2pConnection's header on every windowed message, counted in the bytes per second
+#define WIN_HDR_LEN offsetof(p2pWindowMsg_t, data)
+
+// A zero run control byte skips this many zero bytes plus one. A literal control byte has this bit set, and is followed
+// by its low seven bits plus one literal bytes
+#define RLE_LITERAL 0x80
+
+// The longest run of zero or literal bytes one control byte describes
+#define RLE_MAX_RUN 128
+
+// The default number of snapshots per second
+#define DEFAULT_UPDATES_PER_SEC 20
+
+// The default longest time between keyframes
+#define DEFAULT_KEYFRAME_MS 1000
+
+// How long bytes per second are measured over
+#define METER_PERIOD_US 1000000
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void p2pReplicaTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len);
+static void p2pReplicaSend(p2pReplica_t* rep, int64_t nowUs);
+static void p2pReplicaRender(p2pReplica_t* rep, int64_t nowUs);
+static void p2pReplicaPushInterp(p2pReplica_t* rep, const uint8_t* snap, int32_t timeMs);
+static void p2pReplicaReset(p2pReplica_t* rep);
+static void p2pReplicaUpdateMeter(p2pReplica_t* rep, int64_t nowUs);
+static uint8_t* p2pReplicaSlot(uint8_t* history, uint16_t stateLen, uint8_t seq);
+static uint16_t p2pReplicaEncodeDelta(const uint8_t* cur, const uint8_t* base, uint16_t stateLen, uint8_t* out);
+static bool p2pReplicaDecodeDelta(uint8_t* snap, uint16_t stateLen, const uint8_t* delta, uint16_t deltaLen);
+static void p2pReplicaLerpField(const p2pReplicaField_t* field, const uint8_t* a, const uint8_t* b, int32_t num,
+                                int32_t den, uint8_t* out);
+static uint8_t p2pReplicaElemSize(p2pReplicaKind_t kind);
+static int64_t p2pReplicaGetInt(const uint8_t* src, p2pReplicaKind_t kind);
+static void p2pReplicaPutInt(uint8_t* dst, p2pReplicaKind_t kind, int64_t val);
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Initialize replication over a p2p connection. This must be called after p2pInitialize(), with the same fields
+ * on both Swadges, and sets a sliding window of ::P2P_MAX_WINDOW messages if the connection doesn't have one
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param p2p The p2p connection to send snapshots over
+ * @param fields The replicated fields, which must stay valid until p2pReplicaDeinit()
+ * @param numFields The number of replicated fields
+ * @param local The state to send to the other Swadge, or NULL if this Swadge only receives
+ * @param remote The state to write with the other Swadge's state, or NULL if this Swadge only sends
+ * @return true if replication was initialized, false if the fields don't fit in a message or memory couldn't be
+ * allocated
+ */
+bool p2pReplicaInit(p2pReplica_t* rep, p2pInfo* p2p, const p2pReplicaField_t* fields, uint8_t numFields,
+                    const void* local, void* remote)
+{
+    memset(rep, 0, sizeof(p2pReplica_t));
+
+    uint32_t stateLen = 0;
+    for (uint8_t i = 0; i < numFields; i++)
+    {
+        if (0 != fields[i].size % p2pReplicaElemSize(fields[i].kind))
+        {
+            ESP_LOGE("P2P", "Replicated field %" PRIu8 " isn't a whole number of elements", i);
+            return false;
+        }
+        stateLen += fields[i].size;
+    }
+    if (0 == stateLen || stateLen > P2P_REPLICA_MAX_STATE)
+    {
+        ESP_LOGE("P2P", "Replicated fields are %" PRIu32 " bytes, must be 1 to %d", stateLen,
+                 (int)P2P_REPLICA_MAX_STATE);
+        return false;
+    }
+
+    // Allocate the snapshot being sent, both histories, and the interpolated snapshots together
+    rep->mem = calloc(1 + 2 * P2P_REPLICA_HISTORY + P2P_REPLICA_INTERP, stateLen);
+    if (NULL == rep->mem)
+    {
+        ESP_LOGE("P2P", "Couldn't allocate replication buffers");
+        return false;
+    }
+
+    rep->p2p        = p2p;
+    rep->fields     = fields;
+    rep->numFields  = numFields;
+    rep->stateLen   = stateLen;
+    rep->local      = local;
+    rep->remote     = remote;
+    rep->tx.cur     = rep->mem;
+    rep->tx.history = &rep->mem[stateLen];
+    rep->rx.history = &rep->mem[(1 + P2P_REPLICA_HISTORY) * stateLen];
+    for (uint8_t i = 0; i < P2P_REPLICA_INTERP; i++)
+    {
+        rep->rx.interp[i].data = &rep->mem[(1 + 2 * P2P_REPLICA_HISTORY + i) * stateLen];
+    }
+    rep->meter.stats.stateLen = stateLen;
+    rep->meter.periodUs       = esp_timer_get_time();
+
+    p2pReplicaSetRate(rep, DEFAULT_UPDATES_PER_SEC, DEFAULT_KEYFRAME_MS, 0);
+
+    p2p->replica = rep;
+    if (NULL == p2p->win)
+    {
+        p2pSetWindow(p2p, P2P_MAX_WINDOW);
+    }
+    return true;
+}
+
+/**
+ * @brief Stop replicating and free everything allocated for it. This should be called before p2pDeinit()
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ */
+void p2pReplicaDeinit(p2pReplica_t* rep)
+{
+    free(rep->mem);
+    rep->mem = NULL;
+
+    if (NULL != rep->p2p && rep == rep->p2p->replica)
+    {
+        rep->p2p->replica = NULL;
+    }
+}
+
+/**
+ * @brief Set how often snapshots are sent, which trades smoothness for airtime. The defaults are 20 updates per
+ * second, a keyframe every second, and no byte limit
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param updatesPerSec How many snapshots of the local state to take per second. Unchanged snapshots aren't sent
+ * @param keyframeMs The longest time between keyframes, in milliseconds. Keyframes are also sent when a delta isn't
+ * possible
+ * @param maxBytesPerSec The most bytes to send per second, including p2pConnection's header, or 0 for no limit. Updates
+ * which would go over the limit are skipped
+ */
+void p2pReplicaSetRate(p2pReplica_t* rep, uint8_t updatesPerSec, uint16_t keyframeMs, uint32_t maxBytesPerSec)
+{
+    rep->tx.intervalUs     = 1000000 / MAX(1, updatesPerSec);
+    rep->tx.keyframeUs     = (int64_t)keyframeMs * 1000;
+    rep->tx.maxBytesPerSec = maxBytesPerSec;
+    rep->tx.budget         = 0;
+    rep->tx.budgetUs       = esp_timer_get_time();
+}
+
+/**
+ * @brief Send a snapshot of the local state if one is due, and write the interpolated remote state. This should be
+ * called from the Swadge mode's main loop every frame
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @return true if the remote state was written, false if no snapshot was received yet
+ */
+bool p2pReplicaUpdate(p2pReplica_t* rep)
+{
+    if (NULL == rep->mem)
+    {
+        return false;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    if (NULL != rep->local && rep->p2p->cnc.isConnected && nowUs >= rep->tx.nextUs)
+    {
+        // Keep a steady cadence, but don't try to catch up on updates which were missed entirely
+        rep->tx.nextUs += rep->tx.intervalUs;
+        if (rep->tx.nextUs <= nowUs)
+        {
+            rep->tx.nextUs = nowUs + rep->tx.intervalUs;
+        }
+        p2pReplicaSend(rep, nowUs);
+    }
+
+    p2pReplicaUpdateMeter(rep, nowUs);
+
+    if (NULL == rep->remote || 0 == rep->rx.numInterp)
+    {
+        return false;
+    }
+    p2pReplicaRender(rep, nowUs);
+    return true;
+}
+
+/**
+ * @brief Handle a message received by p2p. This must be called from the #p2pMsgRxCbFn with every received message
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param payload The received message
+ * @param len The length of the received message
+ * @return true if the message was a snapshot, false if the Swadge mode should handle it
+ */
+bool p2pReplicaRecv(p2pReplica_t* rep, const uint8_t* payload, uint8_t len)
+{
+    if (len < sizeof(p2pReplicaHdr_t) || P2P_REPLICA_MARKER != payload[0])
+    {
+        return false;
+    }
+
+    rep->meter.stats.rxBytes += WIN_HDR_LEN + len;
+    rep->meter.rxPeriodBytes += WIN_HDR_LEN + len;
+    if (NULL == rep->mem || NULL == rep->remote)
+    {
+        return true;
+    }
+
+    const p2pReplicaHdr_t* hdr = (const p2pReplicaHdr_t*)payload;
+    const uint8_t* data        = &payload[sizeof(p2pReplicaHdr_t)];
+    uint16_t dataLen           = len - sizeof(p2pReplicaHdr_t);
+
+    // p2p delivers messages in order, but snapshots from before a reconnection may still be in the window
+    if (rep->rx.hasSnap && (int8_t)(hdr->seq - rep->rx.seq) <= 0)
+    {
+        rep->meter.stats.rxDropped++;
+        return true;
+    }
+
+    uint8_t* snap = p2pReplicaSlot(rep->rx.history, rep->stateLen, hdr->seq);
+    if (P2P_REPLICA_MSG_KEYFRAME == hdr->type && dataLen == rep->stateLen)
+    {
+        memcpy(snap, data, rep->stateLen);
+        rep->meter.stats.rxKeyframes++;
+    }
+    else if (P2P_REPLICA_MSG_DELTA == hdr->type && rep->rx.hasSnap && hdr->seq != hdr->baseSeq
+             && (uint8_t)(hdr->seq - hdr->baseSeq) < P2P_REPLICA_HISTORY
+             && rep->rx.valid[hdr->baseSeq % P2P_REPLICA_HISTORY])
+    {
+        // The sender only makes deltas against snapshots which were ACKed, so the base is still in the history
+        memcpy(snap, p2pReplicaSlot(rep->rx.history, rep->stateLen, hdr->baseSeq), rep->stateLen);
+        if (!p2pReplicaDecodeDelta(snap, rep->stateLen, data, dataLen))
+        {
+            rep->meter.stats.rxDropped++;
+            return true;
+        }
+        rep->meter.stats.rxDeltas++;
+    }
+    else
+    {
+        rep->meter.stats.rxDropped++;
+        return true;
+    }
+
+    // Unwrap the sender's 16 bit time around the last snapshot's time
+    uint16_t timeMs = hdr->timeMs[0] | (hdr->timeMs[1] << 8);
+    if (rep->rx.hasSnap)
+    {
+        rep->rx.lastTimeMs += (int16_t)(timeMs - (uint16_t)rep->rx.lastTimeMs);
+    }
+    else
+    {
+        // Snapshots from before reconnecting can't be interpolated with the ones after
+        rep->rx.lastTimeMs = timeMs;
+        rep->rx.numInterp  = 0;
+    }
+
+    // Track the smallest difference between the clocks, which is the snapshot with the least delay. It creeps up
+    // slowly so it follows the clocks drifting apart
+    int32_t offsetMs = (int32_t)(esp_timer_get_time() / 1000) - rep->rx.lastTimeMs;
+    if (!rep->rx.hasSnap || offsetMs < rep->rx.offsetMs)
+    {
+        rep->rx.offsetMs = offsetMs;
+    }
+    else if (offsetMs > rep->rx.offsetMs)
+    {
+        rep->rx.offsetMs++;
+    }
+
+    // Render far enough in the past that the next snapshot usually arrived already, even if one is lost
+    rep->rx.delayMs = 2 * MAX(1, hdr->intervalMs);
+
+    rep->rx.valid[hdr->seq % P2P_REPLICA_HISTORY] = true;
+    rep->rx.seq                                   = hdr->seq;
+    rep->rx.hasSnap                               = true;
+    p2pReplicaPushInterp(rep, snap, rep->rx.lastTimeMs);
+    return true;
+}
+
+/**
+ * @brief Handle a connection event. This must be called from the #p2pConCbFn with every connection event
+ *
+ * When the connection is established or lost, both directions start over with a keyframe
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param evt The connection event
+ */
+void p2pReplicaConEvt(p2pReplica_t* rep, connectionEvt_t evt)
+{
+    if (CON_ESTABLISHED == evt || CON_LOST == evt)
+    {
+        p2pReplicaReset(rep);
+    }
+}
+
+/**
+ * @brief Get statistics for replication in both directions
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param stats Written with the statistics
+ */
+void p2pReplicaGetStats(p2pReplica_t* rep, p2pReplicaStats_t* stats)
+{
+    *stats = rep->meter.stats;
+}
+
+/**
+ * @brief Handle the result of sending a snapshot. An ACKed snapshot can be used as the base for deltas
+ *
+ * @param p2p The p2pInfo struct with all the state information
+ * @param status Whether the snapshot was ACKed or failed
+ * @param data The message that was sent
+ * @param len The length of the message
+ */
+static void p2pReplicaTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len)
+{
+    p2pReplica_t* rep = p2p->replica;
+    if (NULL == rep || NULL == data || len < sizeof(p2pReplicaHdr_t) || P2P_REPLICA_MARKER != data[0])
+    {
+        return;
+    }
+
+    const p2pReplicaHdr_t* hdr = (const p2pReplicaHdr_t*)data;
+    if (MSG_ACKED != status)
+    {
+        // The receiver may not have the latest change, so send the next snapshot even if nothing changed
+        rep->tx.resend = true;
+    }
+    else if (rep->tx.hasSent && (uint8_t)(rep->tx.seq - hdr->seq) < P2P_REPLICA_HISTORY
+             && (!rep->tx.hasAcked || (int8_t)(hdr->seq - rep->tx.ackedSeq) > 0))
+    {
+        rep->tx.ackedSeq = hdr->seq;
+        rep->tx.hasAcked = true;
+    }
+}
+
+/**
+ * @brief Take a snapshot of the local state and send it as a delta or keyframe, unless nothing changed, the window is
+ * full, or it would go over the byte limit
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param nowUs The current time
+ */
+static void p2pReplicaSend(p2pReplica_t* rep, int64_t nowUs)
+{
+    // Refill the byte budget, holding at most a quarter second's worth or one message
+    if (rep->tx.maxBytesPerSec)
+    {
+        int32_t maxBudget = MAX(rep->tx.maxBytesPerSec / 4, WIN_HDR_LEN + sizeof(p2pReplicaHdr_t) + rep->stateLen);
+        int64_t earned    = (nowUs - rep->tx.budgetUs) * rep->tx.maxBytesPerSec / 1000000;
+
+        // Only count the time which earned whole bytes, so frequent updates don't round the rate down
+        rep->tx.budget += earned;
+        rep->tx.budgetUs += earned * 1000000 / rep->tx.maxBytesPerSec;
+        if (rep->tx.budget >= maxBudget)
+        {
+            rep->tx.budget   = maxBudget;
+            rep->tx.budgetUs = nowUs;
+        }
+    }
+
+    // Pack the replicated fields
+    const uint8_t* local = (const uint8_t*)rep->local;
+    uint16_t packedLen   = 0;
+    for (uint8_t i = 0; i < rep->numFields; i++)
+    {
+        memcpy(&rep->tx.cur[packedLen], &local[rep->fields[i].offset], rep->fields[i].size);
+        packedLen += rep->fields[i].size;
+    }
+
+    bool keyDue = (nowUs - rep->tx.lastKeyUs >= rep->tx.keyframeUs);
+    if (!keyDue && !rep->tx.resend && rep->tx.hasSent
+        && 0 == memcmp(rep->tx.cur, p2pReplicaSlot(rep->tx.history, rep->stateLen, rep->tx.seq), rep->stateLen))
+    {
+        rep->meter.stats.txUnchanged++;
+        return;
+    }
+
+    if (0 == p2pGetWindowSpace(rep->p2p))
+    {
+        rep->meter.stats.txSkipped++;
+        return;
+    }
+
+    uint8_t msg[P2P_MAX_WINDOW_DATA_LEN];
+    p2pReplicaHdr_t* hdr = (p2pReplicaHdr_t*)msg;
+    uint8_t* data        = &msg[sizeof(p2pReplicaHdr_t)];
+    uint8_t seq          = rep->tx.seq + 1;
+    uint16_t dataLen     = 0;
+
+    // Make a delta against the newest snapshot the receiver has, if it's still in the history
+    bool isDelta = !keyDue && rep->tx.hasAcked && (uint8_t)(seq - rep->tx.ackedSeq) < P2P_REPLICA_HISTORY;
+    if (isDelta)
+    {
+        dataLen = p2pReplicaEncodeDelta(rep->tx.cur, p2pReplicaSlot(rep->tx.history, rep->stateLen, rep->tx.ackedSeq),
+                                        rep->stateLen, data);
+        hdr->type    = P2P_REPLICA_MSG_DELTA;
+        hdr->baseSeq = rep->tx.ackedSeq;
+        isDelta      = (dataLen < rep->stateLen);
+    }
+    if (!isDelta)
+    {
+        memcpy(data, rep->tx.cur, rep->stateLen);
+        dataLen      = rep->stateLen;
+        hdr->type    = P2P_REPLICA_MSG_KEYFRAME;
+        hdr->baseSeq = seq;
+    }
+
+    uint16_t msgLen = sizeof(p2pReplicaHdr_t) + dataLen;
+    if (rep->tx.maxBytesPerSec)
+    {
+        if (rep->tx.budget < (int32_t)(WIN_HDR_LEN + msgLen))
+        {
+            rep->meter.stats.txSkipped++;
+            return;
+        }
+        rep->tx.budget -= WIN_HDR_LEN + msgLen;
+    }
+
+    uint16_t timeMs   = nowUs / 1000;
+    hdr->marker       = P2P_REPLICA_MARKER;
+    hdr->seq          = seq;
+    hdr->timeMs[0]    = timeMs & 0xFF;
+    hdr->timeMs[1]    = timeMs >> 8;
+    hdr->intervalMs   = MIN(255, rep->tx.intervalUs / 1000);
+    rep->tx.seq       = seq;
+    rep->tx.hasSent   = true;
+    rep->tx.resend    = false;
+    memcpy(p2pReplicaSlot(rep->tx.history, rep->stateLen, seq), rep->tx.cur, rep->stateLen);
+
+    if (P2P_REPLICA_MSG_KEYFRAME == hdr->type)
+    {
+        rep->tx.lastKeyUs = nowUs;
+        rep->meter.stats.txKeyframes++;
+    }
+    else
+    {
+        rep->meter.stats.txDeltas++;
+    }
+    rep->meter.stats.txBytes += WIN_HDR_LEN + msgLen;
+    rep->meter.txPeriodBytes += WIN_HDR_LEN + msgLen;
+
+    p2pSendMsg(rep->p2p, msg, msgLen, p2pReplicaTxCb);
+}
+
+/**
+ * @brief Write the remote state as it was a little in the past, interpolated between the snapshots around that time
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param nowUs The current time
+ */
+static void p2pReplicaRender(p2pReplica_t* rep, int64_t nowUs)
+{
+    // The sender's time to render
+    int32_t renderMs = (int32_t)(nowUs / 1000) - rep->rx.offsetMs - rep->rx.delayMs;
+
+    // Find the newest snapshot at or before the render time, or the oldest one if they're all after it
+    uint8_t a = 0;
+    while (a + 1 < rep->rx.numInterp && rep->rx.interp[a + 1].timeMs <= renderMs)
+    {
+        a++;
+    }
+    const p2pReplicaInterpSnap_t* snapA = &rep->rx.interp[a];
+    const p2pReplicaInterpSnap_t* snapB = snapA;
+    int32_t num                         = 0;
+    int32_t den                         = 1;
+    if (a + 1 < rep->rx.numInterp && renderMs > snapA->timeMs)
+    {
+        snapB = &rep->rx.interp[a + 1];
+        num   = renderMs - snapA->timeMs;
+        den   = MAX(1, snapB->timeMs - snapA->timeMs);
+    }
+
+    uint8_t* remote = (uint8_t*)rep->remote;
+    uint16_t packed = 0;
+    for (uint8_t i = 0; i < rep->numFields; i++)
+    {
+        const p2pReplicaField_t* field = &rep->fields[i];
+        p2pReplicaLerpField(field, &snapA->data[packed], &snapB->data[packed], num, den, &remote[field->offset]);
+        packed += field->size;
+    }
+}
+
+/**
+ * @brief Add a received snapshot to the ones kept to interpolate between, dropping the oldest if there's no room
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param snap The packed snapshot
+ * @param timeMs When the sender took the snapshot, unwrapped
+ */
+static void p2pReplicaPushInterp(p2pReplica_t* rep, const uint8_t* snap, int32_t timeMs)
+{
+    if (P2P_REPLICA_INTERP == rep->rx.numInterp)
+    {
+        // Reuse the oldest snapshot's buffer for the newest
+        uint8_t* oldest = rep->rx.interp[0].data;
+        memmove(&rep->rx.interp[0], &rep->rx.interp[1], (P2P_REPLICA_INTERP - 1) * sizeof(p2pReplicaInterpSnap_t));
+        rep->rx.interp[P2P_REPLICA_INTERP - 1].data = oldest;
+        rep->rx.numInterp--;
+    }
+
+    p2pReplicaInterpSnap_t* dst = &rep->rx.interp[rep->rx.numInterp++];
+    dst->timeMs                 = timeMs;
+    memcpy(dst->data, snap, rep->stateLen);
+}
+
+/**
+ * @brief Forget every snapshot in both directions, so the next one sent is a keyframe and the next one received must
+ * be a keyframe. The remote state is rendered from the old snapshots until a new one arrives
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ */
+static void p2pReplicaReset(p2pReplica_t* rep)
+{
+    rep->tx.hasAcked = false;
+    rep->tx.hasSent  = false;
+    rep->tx.resend   = false;
+    rep->tx.nextUs   = 0;
+    rep->rx.hasSnap  = false;
+    memset(rep->rx.valid, 0, sizeof(rep->rx.valid));
+}
+
+/**
+ * @brief Calculate the bytes per second sent and received once every measurement period
+ *
+ * @param rep The p2pReplica_t struct with all the state information
+ * @param nowUs The current time
+ */
+static void p2pReplicaUpdateMeter(p2pReplica_t* rep, int64_t nowUs)
+{
+    int64_t elapsedUs = nowUs - rep->meter.periodUs;
+    if (elapsedUs >= METER_PERIOD_US)
+    {
+        rep->meter.stats.txBytesPerSec = (uint64_t)rep->meter.txPeriodBytes * 1000000 / elapsedUs;
+        rep->meter.stats.rxBytesPerSec = (uint64_t)rep->meter.rxPeriodBytes * 1000000 / elapsedUs;
+        rep->meter.txPeriodBytes       = 0;
+        rep->meter.rxPeriodBytes       = 0;
+        rep->meter.periodUs            = nowUs;
+    }
+}
+
+/**
+ * @brief Get the packed snapshot with a given number from a history
+ *
+ * @param history The history
+ * @param stateLen The length of a packed snapshot
+ * @param seq The number of the snapshot
+ * @return The packed snapshot
+ */
+static uint8_t* p2pReplicaSlot(uint8_t* history, uint16_t stateLen, uint8_t seq)
+{
+    return &history[(seq % P2P_REPLICA_HISTORY) * stateLen];
+}
+
+/**
+ * @brief Encode a snapshot as a delta against an older one. The snapshots are XORed, then runs of zeros and of other
+ * bytes are each described by a control byte. Zeros at the end aren't encoded at all
+ *
+ * @param cur The snapshot to encode
+ * @param base The snapshot to encode it against
+ * @param stateLen The length of a packed snapshot
+ * @param out Written with the delta. Must be at least stateLen bytes
+ * @return The length of the delta, or stateLen if the delta wouldn't be shorter than the snapshot
+ */
+static uint16_t p2pReplicaEncodeDelta(const uint8_t* cur, const uint8_t* base, uint16_t stateLen, uint8_t* out)
+{
+    uint16_t outLen = 0;
+    uint16_t i      = 0;
+    while (i < stateLen)
+    {
+        if (cur[i] == base[i])
+        {
+            // Count the run of unchanged bytes
+            uint16_t start = i;
+            while (i < stateLen && cur[i] == base[i])
+            {
+                i++;
+            }
+            if (i == stateLen)
+            {
+                break;
+            }
+
+            for (uint16_t run = i - start; run > 0; run -= MIN(run, RLE_MAX_RUN))
+            {
+                if (outLen >= stateLen)
+                {
+                    return stateLen;
+                }
+                out[outLen++] = MIN(run, RLE_MAX_RUN) - 1;
+            }
+        }
+        else
+        {
+            // Count the run of changed bytes. A single unchanged byte costs less as a literal than as its own run
+            uint16_t start = i;
+            while (i < stateLen && i - start < RLE_MAX_RUN
+                   && (cur[i] != base[i] || (i + 1 < stateLen && cur[i + 1] != base[i + 1])))
+            {
+                i++;
+            }
+
+            uint16_t run = i - start;
+            if (outLen + 1 + run >= stateLen)
+            {
+                return stateLen;
+            }
+            out[outLen++] = RLE_LITERAL | (run - 1);
+            for (uint16_t j = start; j < i; j++)
+            {
+                out[outLen++] = cur[j] ^ base[j];
+            }
+        }
+    }
+    return outLen;
+}
+
+/**
+ * @brief Apply a delta to a copy of the snapshot it was made against
+ *
+ * @param snap The snapshot the delta was made against, which is changed into the new snapshot
+ * @param stateLen The length of a packed snapshot
+ * @param delta The delta
+ * @param deltaLen The length of the delta
+ * @return true if the delta was applied, false if it was malformed
+ */
+static bool p2pReplicaDecodeDelta(uint8_t* snap, uint16_t stateLen, const uint8_t* delta, uint16_t deltaLen)
+{
+    uint16_t pos = 0;
+    uint16_t i   = 0;
+    while (i < deltaLen)
+    {
+        uint8_t ctrl = delta[i++];
+        uint16_t run = (ctrl & ~RLE_LITERAL) + 1;
+        if (pos + run > stateLen)
+        {
+            return false;
+        }
+
+        if (ctrl & RLE_LITERAL)
+        {
+            if (i + run > deltaLen)
+            {
+                return false;
+            }
+            for (uint16_t j = 0; j < run; j++)
+            {
+                snap[pos++] ^= delta[i++];
+            }
+        }
+        else
+        {
+            pos += run;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Interpolate one field between two packed snapshots and write it to the Swadge mode's state
+ *
+ * @param field The field
+ * @param a The field in the older snapshot
+ * @param b The field in the newer snapshot
+ * @param num The numerator of how far between the snapshots to interpolate
+ * @param den The denominator of how far between the snapshots to interpolate
+ * @param out Where the field is written in the Swadge mode's state
+ */
+static void p2pReplicaLerpField(const p2pReplicaField_t* field, const uint8_t* a, const uint8_t* b, int32_t num,
+                                int32_t den, uint8_t* out)
+{
+    if (P2P_REPLICA_SNAP == field->kind || 0 == num)
+    {
+        memcpy(out, a, field->size);
+        return;
+    }
+
+    // The packed snapshot isn't aligned, so copy each element in and out
+    uint8_t elemSize = p2pReplicaElemSize(field->kind);
+    for (uint16_t i = 0; i < field->size; i += elemSize)
+    {
+        if (P2P_REPLICA_FLOAT == field->kind)
+        {
+            float fa, fb;
+            memcpy(&fa, &a[i], sizeof(float));
+            memcpy(&fb, &b[i], sizeof(float));
+            float val = fa + (fb - fa) * num / den;
+            memcpy(&out[i], &val, sizeof(float));
+        }
+        else
+        {
+            int64_t ia = p2pReplicaGetInt(&a[i], field->kind);
+            int64_t ib = p2pReplicaGetInt(&b[i], field->kind);
+            p2pReplicaPutInt(&out[i], field->kind, ia + (ib - ia) * num / den);
+        }
+    }
+}
+
+/**
+ * @brief Get the size of each element of a field
+ *
+ * @param kind How the field is interpolated
+ * @return The size of each element in bytes
+ */
+static uint8_t p2pReplicaElemSize(p2pReplicaKind_t kind)
+{
+    switch (kind)
+    {
+        case P2P_REPLICA_S16:
+        case P2P_REPLICA_U16:
+        {
+            return sizeof(int16_t);
+        }
+        case P2P_REPLICA_S32:
+        case P2P_REPLICA_U32:
+        {
+            return sizeof(int32_t);
+        }
+        case P2P_REPLICA_FLOAT:
+        {
+            return sizeof(float);
+        }
+        case P2P_REPLICA_SNAP:
+        case P2P_REPLICA_S8:
+        case P2P_REPLICA_U8:
+        default:
+        {
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Read an integer element from a packed snapshot
+ *
+ * @param src The element
+ * @param kind The kind of integer
+ * @return The integer
+ */
+static int64_t p2pReplicaGetInt(const uint8_t* src, p2pReplicaKind_t kind)
+{
+    switch (kind)
+    {
+        case P2P_REPLICA_S8:
+        {
+            return (int8_t)src[0];
+        }
+        case P2P_REPLICA_S16:
+        {
+            int16_t val;
+            memcpy(&val, src, sizeof(val));
+            return val;
+        }
+        case P2P_REPLICA_U16:
+        {
+            uint16_t val;
+            memcpy(&val, src, sizeof(val));
+            return val;
+        }
+        case P2P_REPLICA_S32:
+        {
+            int32_t val;
+            memcpy(&val, src, sizeof(val));
+            return val;
+        }
+        case P2P_REPLICA_U32:
+        {
+            uint32_t val;
+            memcpy(&val, src, sizeof(val));
+            return val;
+        }
+        case P2P_REPLICA_U8:
+        case P2P_REPLICA_SNAP:
+        case P2P_REPLICA_FLOAT:
+        default:
+        {
+            return src[0];
+        }
+    }
+}
+
+/**
+ * @brief Write an integer element to the Swadge mode's state
+ *
+ * @param dst Where the element is written
+ * @param kind The kind of integer
+ * @param val The integer, which is between the two values it was interpolated from so it fits
+ */
+static void p2pReplicaPutInt(uint8_t* dst, p2pReplicaKind_t kind, int64_t val)
+{
+    switch (kind)
+    {
+        case P2P_REPLICA_S16:
+        case P2P_REPLICA_U16:
+        {
+            uint16_t v = val;
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case P2P_REPLICA_S32:
+        case P2P_REPLICA_U32:
+        {
+            uint32_t v = val;
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case P2P_REPLICA_S8:
+        case P2P_REPLICA_U8:
+        case P2P_REPLICA_SNAP:
+        case P2P_REPLICA_FLOAT:
+        default:
+        {
+            dst[0] = val;
+            break;
+        }
+    }
+}
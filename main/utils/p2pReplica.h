@@ -0,0 +1,287 @@
+/*! \file p2pReplica.h
+ *
+ * \section p2pReplica_design Design Philosophy
+ *
+ * p2pReplica copies a Swadge mode's game state struct to the other Swadge many times a second, so real-time
+ * multiplayer modes don't each need their own message formats. The mode describes which fields of its struct are
+ * replicated with an array of ::p2pReplicaField_t, and p2pReplica takes care of the rest. Each Swadge may send its own
+ * state, receive the other Swadge's state, or both.
+ *
+ * Every update, the replicated fields are packed into a snapshot. Snapshots are numbered, and the sender keeps the last
+ * ::P2P_REPLICA_HISTORY of them. p2pConnection tells the sender which snapshots were ACKed, so it knows which ones the
+ * receiver has. Each new snapshot is XORed with the newest ACKed one, so only the bytes which changed are non-zero, and
+ * the result is run-length encoded into a delta. Fields which didn't change cost nothing, and an update where nothing
+ * changed isn't sent at all. A keyframe with the whole snapshot is sent instead when nothing was ACKed yet, when the
+ * ACKed snapshot is too old, when the delta wouldn't be smaller, and periodically so a receiver can always catch up.
+ * Because deltas are only made against ACKed snapshots, a lost delta never breaks the ones after it.
+ *
+ * The receiver keeps its own history of snapshots to apply deltas to, and the last few snapshots with the time the
+ * sender took them. Every update, it renders the state as it was a little in the past, interpolating between the two
+ * snapshots around that time. This hides jitter and missing snapshots. Fields which can't be interpolated, like a score
+ * or a flag, change when the snapshot with the new value is reached.
+ *
+ * Snapshots are sent as windowed p2pConnection messages, so the packed fields must fit in one message, which is
+ * ::P2P_REPLICA_MAX_STATE bytes. Use p2pBulk.h for anything larger, like a level. The update rate trades smoothness for
+ * airtime. p2pReplicaSetRate() sets how many snapshots are taken per second, how often keyframes are sent, and an
+ * optional limit on bytes per second. Updates which would go over the limit, or find the window full, are skipped
+ * rather than queued, since a newer snapshot is always better than an old one.
+ *
+ * \section p2pReplica_usage Usage
+ *
+ * p2pReplicaInit() should be called after p2pInitialize() on both Swadges, with the same fields. It sets a sliding
+ * window if there isn't one already. p2pReplicaDeinit() should be called before p2pDeinit().
+ *
+ * p2pReplicaRecv() must be called from the #p2pMsgRxCbFn with every received message. It returns true if the message
+ * was a snapshot, and false if the Swadge mode should handle it. Snapshot messages start with ::P2P_REPLICA_MARKER, so
+ * the Swadge mode's own messages must not start with that byte.
+ *
+ * p2pReplicaConEvt() must be called from the #p2pConCbFn with every connection event, so snapshots start over with a
+ * keyframe after reconnecting.
+ *
+ * p2pReplicaUpdate() should be called from the Swadge mode's main loop every frame, after the local state was updated.
+ * It sends a snapshot of the local state when one is due, and writes the interpolated remote state. The remote state's
+ * fields are only written by p2pReplicaUpdate(), so it's safe to read in the main loop.
+ *
+ * p2pReplicaGetStats() gets the bytes per second sent and received, and counts of keyframes, deltas, and skipped
+ * updates.
+ *
+ * \section p2pReplica_example Example
+ *
+ * \code{.c}
+ * typedef struct
+ * {
+ *     int32_t x;
+ *     int32_t y;
+ *     uint8_t score;
+ *     bool local; // Not replicated
+ * } player_t;
+ *
+ * static const p2pReplicaField_t playerFields[] = {
+ *     P2P_REPLICA_FIELD(player_t, x, P2P_REPLICA_S32),
+ *     P2P_REPLICA_FIELD(player_t, y, P2P_REPLICA_S32),
+ *     P2P_REPLICA_FIELD(player_t, score, P2P_REPLICA_SNAP),
+ * };
+ *
+ * static p2pInfo p2p;
+ * static p2pReplica_t replica;
+ * static player_t me;
+ * static player_t them;
+ *
+ * ...
+ *
+ * p2pInitialize(&p2p, 'd', demoConCb, demoMsgRxCb, -70);
+ * p2pReplicaInit(&replica, &p2p, playerFields, ARRAY_SIZE(playerFields), &me, &them);
+ * p2pReplicaSetRate(&replica, 20, 1000, 0);
+ * p2pStartConnection(&p2p);
+ *
+ * ...
+ *
+ * static void demoMainLoop(int64_t elapsedUs)
+ * {
+ *     // Move this player, then send it and get the other player
+ *     me.x += dx;
+ *     if (p2pReplicaUpdate(&replica))
+ *     {
+ *         drawPlayer(&them);
+ *     }
+ *     drawPlayer(&me);
+ * }
+ *
+ * static void demoConCb(p2pInfo* p2p, connectionEvt_t evt)
+ * {
+ *     p2pReplicaConEvt(&replica, evt);
+ * }
+ *
+ * static void demoMsgRxCb(p2pInfo* p2p, const uint8_t* payload, uint8_t len)
+ * {
+ *     if (p2pReplicaRecv(&replica, payload, len))
+ *     {
+ *         return;
+ *     }
+ *     // Handle the mode's own messages
+ * }
+ * \endcode
+ */
+
+#ifndef _P2P_REPLICA_H_
+#define _P2P_REPLICA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "p2pConnection.h"
+
+/// The first byte of every snapshot message, which the Swadge mode's own messages must not start with
+#define P2P_REPLICA_MARKER 0xFA
+
+/// The number of snapshots each Swadge keeps to make deltas against. This must be more than ::P2P_MAX_WINDOW
+#define P2P_REPLICA_HISTORY 32
+
+/// The number of received snapshots kept to interpolate between
+#define P2P_REPLICA_INTERP 4
+
+/// The most bytes of packed fields, which is what fits in one windowed message after the snapshot header
+#define P2P_REPLICA_MAX_STATE (P2P_MAX_WINDOW_DATA_LEN - sizeof(p2pReplicaHdr_t))
+
+/**
+ * @brief Describe a replicated field of a struct
+ *
+ * @param type The struct type
+ * @param member The field, which may be an array
+ * @param fieldKind The ::p2pReplicaKind_t of each element of the field
+ */
+#define P2P_REPLICA_FIELD(type, member, fieldKind) \
+    {.offset = offsetof(type, member), .size = sizeof(((type*)NULL)->member), .kind = (fieldKind)}
+
+/**
+ * @brief How a field is interpolated
+ */
+typedef enum
+{
+    P2P_REPLICA_SNAP,  ///< Not interpolated, any size. The value changes when its snapshot is reached
+    P2P_REPLICA_S8,    ///< Interpolated int8_t, or an array of them
+    P2P_REPLICA_U8,    ///< Interpolated uint8_t, or an array of them
+    P2P_REPLICA_S16,   ///< Interpolated int16_t, or an array of them
+    P2P_REPLICA_U16,   ///< Interpolated uint16_t, or an array of them
+    P2P_REPLICA_S32,   ///< Interpolated int32_t, or an array of them, including fixed point like q24_8
+    P2P_REPLICA_U32,   ///< Interpolated uint32_t, or an array of them
+    P2P_REPLICA_FLOAT, ///< Interpolated float, or an array of them
+} p2pReplicaKind_t;
+
+/**
+ * @brief A replicated field of the Swadge mode's state struct. See P2P_REPLICA_FIELD()
+ */
+typedef struct
+{
+    uint16_t offset;       ///< The offset of the field in the struct
+    uint16_t size;         ///< The size of the field in bytes
+    p2pReplicaKind_t kind; ///< How the field is interpolated
+} p2pReplicaField_t;
+
+/**
+ * @brief The types of snapshot messages
+ */
+typedef enum __attribute__((packed))
+{
+    P2P_REPLICA_MSG_KEYFRAME, ///< The whole packed snapshot
+    P2P_REPLICA_MSG_DELTA,    ///< The snapshot XORed with an older one, then run-length encoded
+} p2pReplicaMsgType_t;
+
+/**
+ * @brief The byte format for the header of every snapshot message. Multi-byte fields are little-endian
+ */
+typedef struct
+{
+    uint8_t marker;           ///< Must be ::P2P_REPLICA_MARKER
+    p2pReplicaMsgType_t type; ///< The message type
+    uint8_t seq;              ///< The number of this snapshot
+    uint8_t baseSeq;          ///< For a delta, the number of the snapshot it was made against
+    uint8_t timeMs[2];        ///< When the sender took this snapshot, in milliseconds, wrapping around
+    uint8_t intervalMs;       ///< How long the sender waits between snapshots, in milliseconds, at most 255
+} p2pReplicaHdr_t;
+
+/**
+ * @brief Statistics for replication in both directions
+ */
+typedef struct
+{
+    uint16_t stateLen;      ///< The number of bytes in a packed snapshot
+    uint32_t txKeyframes;   ///< The number of keyframes sent
+    uint32_t txDeltas;      ///< The number of deltas sent
+    uint32_t txUnchanged;   ///< The number of updates not sent because nothing changed
+    uint32_t txSkipped;     ///< The number of updates not sent because the window was full or over the byte limit
+    uint64_t txBytes;       ///< The number of bytes sent, including p2pConnection's header
+    uint32_t txBytesPerSec; ///< The bytes sent per second, measured over the last second
+    uint32_t rxKeyframes;   ///< The number of keyframes received
+    uint32_t rxDeltas;      ///< The number of deltas received
+    uint32_t rxDropped;     ///< The number of snapshots dropped because they were old or their base was unknown
+    uint64_t rxBytes;       ///< The number of bytes received, including p2pConnection's header
+    uint32_t rxBytesPerSec; ///< The bytes received per second, measured over the last second
+} p2pReplicaStats_t;
+
+/**
+ * @brief A received snapshot, kept to interpolate between
+ */
+typedef struct
+{
+    int32_t timeMs; ///< When the sender took this snapshot, unwrapped
+    uint8_t* data;  ///< The packed fields
+} p2pReplicaInterpSnap_t;
+
+/**
+ * @brief All the state variables for replicating state over one p2p connection
+ */
+typedef struct _p2pReplica
+{
+    p2pInfo* p2p;                    ///< The connection snapshots are sent over
+    const p2pReplicaField_t* fields; ///< The replicated fields
+    uint8_t numFields;               ///< The number of replicated fields
+    uint16_t stateLen;               ///< The number of bytes in a packed snapshot
+    const void* local;               ///< The state sent to the other Swadge, or NULL
+    void* remote;                    ///< The state written with the other Swadge's state, or NULL
+    uint8_t* mem;                    ///< Everything allocated by p2pReplicaInit(), which the buffers below point into
+
+    /**
+     * @brief Sending snapshots of the local state
+     */
+    struct
+    {
+        int64_t intervalUs;      ///< The time between snapshots
+        int64_t keyframeUs;      ///< The longest time between keyframes
+        uint32_t maxBytesPerSec; ///< The most bytes to send per second, or 0 for no limit
+        int64_t nextUs;          ///< When the next snapshot is due
+        int64_t lastKeyUs;       ///< When the last keyframe was sent
+        int32_t budget;          ///< Bytes which may be sent now without going over maxBytesPerSec
+        int64_t budgetUs;        ///< When the budget was last refilled
+        uint8_t seq;             ///< The number of the last snapshot taken
+        uint8_t ackedSeq;        ///< The newest snapshot the receiver has
+        bool hasAcked;           ///< true if ackedSeq is valid
+        uint8_t* cur;            ///< The packed fields of the snapshot being sent
+        uint8_t* history;        ///< Packed snapshots which were sent, indexed by number
+        bool hasSent;            ///< true if a snapshot was sent since connecting, so seq is in history
+        bool resend;             ///< true if a snapshot failed, so the next one is sent even if nothing changed
+    } tx;
+
+    /**
+     * @brief Receiving snapshots of the remote state
+     */
+    struct
+    {
+        uint8_t seq;                     ///< The number of the newest snapshot received
+        bool hasSnap;                    ///< true if a snapshot was received since connecting
+        uint8_t* history;                ///< Packed snapshots which were received, indexed by number
+        bool valid[P2P_REPLICA_HISTORY]; ///< Whether each snapshot in history was received
+        int32_t lastTimeMs;              ///< The unwrapped time of the newest snapshot
+        int32_t offsetMs;                ///< The local time minus the sender's time, tracking the quickest snapshots
+        int32_t delayMs;                 ///< How far in the past the remote state is rendered
+        uint8_t numInterp;               ///< The number of snapshots in interp
+
+        p2pReplicaInterpSnap_t interp[P2P_REPLICA_INTERP]; ///< The newest snapshots, oldest first
+    } rx;
+
+    /**
+     * @brief Statistics and the byte counts used to measure bytes per second
+     */
+    struct
+    {
+        p2pReplicaStats_t stats; ///< The statistics reported by p2pReplicaGetStats()
+        int64_t periodUs;        ///< When the current measurement period started
+        uint32_t txPeriodBytes;  ///< Bytes sent in the current period
+        uint32_t rxPeriodBytes;  ///< Bytes received in the current period
+    } meter;
+} p2pReplica_t;
+
+bool p2pReplicaInit(p2pReplica_t* rep, p2pInfo* p2p, const p2pReplicaField_t* fields, uint8_t numFields,
+                    const void* local, void* remote);
+void p2pReplicaDeinit(p2pReplica_t* rep);
+
+void p2pReplicaSetRate(p2pReplica_t* rep, uint8_t updatesPerSec, uint16_t keyframeMs, uint32_t maxBytesPerSec);
+bool p2pReplicaUpdate(p2pReplica_t* rep);
+
+bool p2pReplicaRecv(p2pReplica_t* rep, const uint8_t* payload, uint8_t len);
+void p2pReplicaConEvt(p2pReplica_t* rep, connectionEvt_t evt);
+
+void p2pReplicaGetStats(p2pReplica_t* rep, p2pReplicaStats_t* stats);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "hdw-nvs.h"
 #include "midiPlayer.h"
+#include "sfxMixer.h"
 #include "hdw-tft.h"
 #include "hdw-mic.h"
 #include "hdw-led.h"
@@ -247,6 +248,7 @@ bool setSfxVolumeSetting(uint16_t vol)
     if (setSetting(&sfx_setting, vol))
     {
         globalMidiPlayerSetVolume(MIDI_SFX, getSfxVolumeSetting());
+        globalSfxMixerSetVolume(getSfxVolumeSetting());
         return true;
     }
     return false;
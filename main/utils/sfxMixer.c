@@ -0,0 +1,559 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <string.h>
+#include <esp_log.h>
+
+#include "hdw-dac.h"
+#include "cnfs.h"
+#include "macros.h"
+#include "settingsManager.h"
+#include "sfxMixer.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief Heatshrink parameters, these must match the ones used by the assets preprocessor
+#define SFX_HS_INPUT_BUF  32
+#define SFX_HS_WINDOW_SZ2 8
+#define SFX_HS_LOOKAHEAD  4
+
+/// @brief The maximum volume setting, matches MAX_VOLUME for the MIDI players
+#define SFX_MAX_VOLUME_SETTING 13
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static bool globalMixerInit = false;
+static sfxMixer_t globalMixer;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void sfxVoiceRewind(sfxVoice_t* voice);
+static bool sfxVoiceRead(sfxVoice_t* voice, int16_t* out);
+static void sfxVoiceFree(sfxMixer_t* mixer, uint8_t voiceIdx);
+static int8_t sfxMixerAllocVoice(const sfxMixer_t* mixer, uint8_t priority);
+
+//==============================================================================
+// Static Functions
+//==============================================================================
+
+/**
+ * @brief Move a voice back to the start of its sample
+ *
+ * @param voice The voice to rewind
+ */
+static void sfxVoiceRewind(sfxVoice_t* voice)
+{
+    voice->readIdx  = 0;
+    voice->sinkIdx  = 0;
+    voice->chunkLen = 0;
+    voice->chunkIdx = 0;
+
+    if (voice->hsd)
+    {
+        heatshrink_decoder_reset(voice->hsd);
+    }
+}
+
+/**
+ * @brief Read the next source sample for a voice, decompressing more data or looping as necessary
+ *
+ * @param voice The voice to read from
+ * @param[out] out The next signed source sample
+ * @return true if a sample was read, false if the sample is finished playing
+ */
+static bool sfxVoiceRead(sfxVoice_t* voice, int16_t* out)
+{
+    const sfxSample_t* sample = voice->sample;
+
+    if (voice->readIdx >= sample->length)
+    {
+        // Reached the end of the sample, check if it should repeat
+        if (1 == voice->loops)
+        {
+            return false;
+        }
+        else if (voice->loops)
+        {
+            voice->loops--;
+        }
+
+        sfxVoiceRewind(voice);
+
+        if (0 == sample->length)
+        {
+            return false;
+        }
+    }
+
+    if (!sample->compressed)
+    {
+        *out = (int16_t)sample->data[voice->readIdx++] - 128;
+        return true;
+    }
+
+    // Refill the chunk from the decoder when it runs out
+    while (voice->chunkIdx >= voice->chunkLen)
+    {
+        size_t copied = 0;
+        heatshrink_decoder_poll(voice->hsd, voice->chunk, sizeof(voice->chunk), &copied);
+
+        if (copied)
+        {
+            voice->chunkLen = copied;
+            voice->chunkIdx = 0;
+        }
+        else if (voice->sinkIdx < sample->dataLen)
+        {
+            // The decoder needs more input
+            size_t sunk = 0;
+            heatshrink_decoder_sink(voice->hsd, &sample->data[voice->sinkIdx], sample->dataLen - voice->sinkIdx,
+                                    &sunk);
+            voice->sinkIdx += sunk;
+        }
+        else
+        {
+            // All input was sunk, so flush whatever is left in the decoder
+            if (HSDR_FINISH_MORE == heatshrink_decoder_finish(voice->hsd))
+            {
+                heatshrink_decoder_poll(voice->hsd, voice->chunk, sizeof(voice->chunk), &copied);
+            }
+
+            if (copied)
+            {
+                voice->chunkLen = copied;
+                voice->chunkIdx = 0;
+            }
+            else
+            {
+                // Ran out of data before the expected length, treat it as the end
+                voice->readIdx = sample->length;
+                return sfxVoiceRead(voice, out);
+            }
+        }
+    }
+
+    voice->readIdx++;
+    *out = (int16_t)voice->chunk[voice->chunkIdx++] - 128;
+    return true;
+}
+
+/**
+ * @brief Stop a voice and free any memory it was using
+ *
+ * @param mixer The mixer which owns the voice
+ * @param voiceIdx The index of the voice to free
+ */
+static void sfxVoiceFree(sfxMixer_t* mixer, uint8_t voiceIdx)
+{
+    sfxVoice_t* voice = &mixer->voices[voiceIdx];
+
+    if (voice->hsd)
+    {
+        heatshrink_decoder_free(voice->hsd);
+        voice->hsd = NULL;
+    }
+
+    voice->sample = NULL;
+    mixer->activeVoices &= ~(1 << voiceIdx);
+}
+
+/**
+ * @brief Find a voice to play a new sample on. A free voice is used if there is one. Otherwise the oldest voice with
+ * the lowest priority is stolen, as long as it doesn't have a higher priority than the new sample
+ *
+ * @param mixer The mixer to allocate a voice from
+ * @param priority The priority of the new sample
+ * @return The index of the voice to use, or -1 if none can be used
+ */
+static int8_t sfxMixerAllocVoice(const sfxMixer_t* mixer, uint8_t priority)
+{
+    uint32_t freeVoices = ~mixer->activeVoices & ((1 << SFX_MIXER_VOICES) - 1);
+    if (freeVoices)
+    {
+        return __builtin_ctz(freeVoices);
+    }
+
+    int8_t stealIdx = -1;
+    for (int8_t voiceIdx = 0; voiceIdx < SFX_MIXER_VOICES; voiceIdx++)
+    {
+        const sfxVoice_t* voice = &mixer->voices[voiceIdx];
+        if (voice->priority > priority)
+        {
+            continue;
+        }
+
+        if (-1 == stealIdx || voice->priority < mixer->voices[stealIdx].priority
+            || (voice->priority == mixer->voices[stealIdx].priority
+                && (int32_t)(voice->startSeq - mixer->voices[stealIdx].startSeq) < 0))
+        {
+            stealIdx = voiceIdx;
+        }
+    }
+
+    return stealIdx;
+}
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Load a PCM sample from CNFS. The data is referenced directly from CNFS and does not need to be freed.
+ *
+ * Files ending in <tt>.raw</tt> are heatshrink compressed by the assets preprocessor and will be streamed when played.
+ * All other files are treated as uncompressed unsigned 8-bit PCM.
+ *
+ * @param name The name of the file to load
+ * @param rate The sample rate of the file, in Hz
+ * @param[out] sample The sample to load into
+ * @return true if the sample was loaded, false if it wasn't
+ */
+bool loadSfxSample(const char* name, uint32_t rate, sfxSample_t* sample)
+{
+    size_t size;
+    const uint8_t* data = cnfsGetFile(name, &size);
+
+    memset(sample, 0, sizeof(sfxSample_t));
+
+    if (NULL == data)
+    {
+        ESP_LOGE("SFX", "Failed to get data for sample '%s'!", name);
+        return false;
+    }
+
+    sample->rate = rate;
+
+    size_t nameLen = strlen(name);
+    if (nameLen > 4 && 0 == strcmp(&name[nameLen - 4], ".raw"))
+    {
+        if (size < 4)
+        {
+            ESP_LOGE("SFX", "Compressed sample '%s' is too short", name);
+            return false;
+        }
+
+        // The decompressed size is the first four bytes, big-endian
+        sample->length     = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | (data[3]);
+        sample->data       = &data[4];
+        sample->dataLen    = size - 4;
+        sample->compressed = true;
+    }
+    else
+    {
+        sample->data    = data;
+        sample->dataLen = size;
+        sample->length  = size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Initialize a mixer with all voices stopped and full volume
+ *
+ * @param mixer The mixer to initialize
+ */
+void sfxMixerInit(sfxMixer_t* mixer)
+{
+    memset(mixer, 0, sizeof(sfxMixer_t));
+    mixer->volume = 255;
+}
+
+/**
+ * @brief Stop all voices in a mixer and free any streaming decoders
+ *
+ * @param mixer The mixer to deinitialize
+ */
+void sfxMixerDeinit(sfxMixer_t* mixer)
+{
+    sfxMixerStopAll(mixer);
+}
+
+/**
+ * @brief Start playing a sample on a mixer. This may steal a voice from another sample if all voices are in use.
+ *
+ * @param mixer The mixer to play the sample on
+ * @param sample The sample to play. This must remain valid while it is playing
+ * @param volume The volume of the sample, from 0 to 255
+ * @param speed The playback speed, where ::SFX_SPEED_NORMAL plays the sample at its native pitch
+ * @param loops The number of times to play the sample, or 0 to loop forever
+ * @param priority The priority of this sample. Higher priority samples are less likely to have their voice stolen
+ * @return The index of the voice playing the sample, or -1 if no voice was available
+ */
+int8_t sfxMixerPlay(sfxMixer_t* mixer, const sfxSample_t* sample, uint8_t volume, uq16_16 speed, uint32_t loops,
+                    uint8_t priority)
+{
+    if (NULL == sample || NULL == sample->data || 0 == sample->dataLen || 0 == sample->length)
+    {
+        return -1;
+    }
+
+    int8_t voiceIdx = sfxMixerAllocVoice(mixer, priority);
+    if (voiceIdx < 0)
+    {
+        return -1;
+    }
+
+    sfxVoice_t* voice = &mixer->voices[voiceIdx];
+
+    // Keep the decoder if the stolen voice had one and it's still needed
+    heatshrink_decoder* hsd = voice->hsd;
+    if (hsd && !sample->compressed)
+    {
+        heatshrink_decoder_free(hsd);
+        hsd = NULL;
+    }
+    else if (!hsd && sample->compressed)
+    {
+        hsd = heatshrink_decoder_alloc(SFX_HS_INPUT_BUF, SFX_HS_WINDOW_SZ2, SFX_HS_LOOKAHEAD);
+        if (NULL == hsd)
+        {
+            sfxVoiceFree(mixer, voiceIdx);
+            return -1;
+        }
+    }
+
+    memset(voice, 0, sizeof(sfxVoice_t));
+    voice->hsd      = hsd;
+    voice->sample   = sample;
+    voice->volume   = volume;
+    voice->priority = priority;
+    voice->loops    = loops;
+    voice->startSeq = mixer->seq++;
+    sfxVoiceRewind(voice);
+    sfxMixerSetSpeed(mixer, voiceIdx, speed);
+
+    // Prime the interpolator with the first two samples
+    sfxVoiceRead(voice, &voice->cur);
+    if (!sfxVoiceRead(voice, &voice->next))
+    {
+        voice->next = voice->cur;
+    }
+
+    mixer->activeVoices |= (1 << voiceIdx);
+    return voiceIdx;
+}
+
+/**
+ * @brief Stop a voice which is playing a sample
+ *
+ * @param mixer The mixer which owns the voice
+ * @param voiceIdx The voice index returned by sfxMixerPlay()
+ */
+void sfxMixerStop(sfxMixer_t* mixer, int8_t voiceIdx)
+{
+    if (0 <= voiceIdx && voiceIdx < SFX_MIXER_VOICES)
+    {
+        sfxVoiceFree(mixer, voiceIdx);
+    }
+}
+
+/**
+ * @brief Stop all voices in a mixer
+ *
+ * @param mixer The mixer to stop
+ */
+void sfxMixerStopAll(sfxMixer_t* mixer)
+{
+    for (uint8_t voiceIdx = 0; voiceIdx < SFX_MIXER_VOICES; voiceIdx++)
+    {
+        sfxVoiceFree(mixer, voiceIdx);
+    }
+}
+
+/**
+ * @brief Change the playback speed (and pitch) of a voice. This recalculates the voice's phase increment, so it should
+ * not be called every sample.
+ *
+ * @param mixer The mixer which owns the voice
+ * @param voiceIdx The voice index returned by sfxMixerPlay()
+ * @param speed The playback speed, where ::SFX_SPEED_NORMAL plays the sample at its native pitch
+ */
+void sfxMixerSetSpeed(sfxMixer_t* mixer, int8_t voiceIdx, uq16_16 speed)
+{
+    if (0 <= voiceIdx && voiceIdx < SFX_MIXER_VOICES && mixer->voices[voiceIdx].sample)
+    {
+        sfxVoice_t* voice = &mixer->voices[voiceIdx];
+        voice->step       = ((uint64_t)voice->sample->rate * speed) / DAC_SAMPLE_RATE_HZ;
+    }
+}
+
+/**
+ * @brief Change the volume of a voice
+ *
+ * @param mixer The mixer which owns the voice
+ * @param voiceIdx The voice index returned by sfxMixerPlay()
+ * @param volume The new volume, from 0 to 255
+ */
+void sfxMixerSetVoiceVolume(sfxMixer_t* mixer, int8_t voiceIdx, uint8_t volume)
+{
+    if (0 <= voiceIdx && voiceIdx < SFX_MIXER_VOICES)
+    {
+        mixer->voices[voiceIdx].volume = volume;
+    }
+}
+
+/**
+ * @brief Step every playing voice forward by one DAC sample and return the sum of their output
+ *
+ * @param mixer The mixer to step
+ * @return The signed sum of all voices, scaled to the range of a signed 8-bit sample but without clipping applied
+ */
+int32_t sfxMixerStep(sfxMixer_t* mixer)
+{
+    int32_t sum = 0;
+
+    uint32_t playingVoices = mixer->activeVoices;
+    while (playingVoices != 0)
+    {
+        uint8_t voiceIdx = __builtin_ctz(playingVoices);
+        playingVoices &= ~(1 << voiceIdx);
+
+        sfxVoice_t* voice = &mixer->voices[voiceIdx];
+
+        // Linearly interpolate between the current and next source samples
+        int32_t sample = voice->cur + (((voice->next - voice->cur) * (int32_t)voice->frac) >> 16);
+        sum += sample * voice->volume;
+
+        // Advance through the source by however many whole samples the step covered
+        voice->frac += voice->step;
+        uint32_t advance = voice->frac >> 16;
+        voice->frac &= Q16_16_DECI_MASK;
+
+        while (advance--)
+        {
+            voice->cur = voice->next;
+            if (!sfxVoiceRead(voice, &voice->next))
+            {
+                sfxVoiceFree(mixer, voiceIdx);
+                break;
+            }
+        }
+    }
+
+    // Apply the voice volume and mixer volume together
+    return (sum * mixer->volume) >> 16;
+}
+
+/**
+ * @brief Mix the output of a mixer on top of a buffer of unsigned 8-bit DAC samples. This should be called from the
+ * callback passed into initDac(), after the buffer is filled by any other sources.
+ *
+ * @param mixer The mixer to sample from
+ * @param samples The array of unsigned 8-bit samples to mix into
+ * @param len The length of the array
+ */
+void sfxMixerMixBuffer(sfxMixer_t* mixer, uint8_t* samples, int16_t len)
+{
+    // Nothing to do when the mixer is idle
+    if (0 == mixer->activeVoices)
+    {
+        return;
+    }
+
+    for (int16_t n = 0; n < len; n++)
+    {
+        int32_t sample = (int32_t)samples[n] + sfxMixerStep(mixer);
+
+        if (sample < 0)
+        {
+            samples[n] = 0;
+            mixer->clipped++;
+        }
+        else if (sample > 255)
+        {
+            samples[n] = 255;
+            mixer->clipped++;
+        }
+        else
+        {
+            samples[n] = sample;
+        }
+    }
+}
+
+//==============================================================================
+// System-wide mixer functions
+//==============================================================================
+
+/**
+ * @brief Initialize the system-wide sound effect mixer
+ */
+void initGlobalSfxMixer(void)
+{
+    if (!globalMixerInit)
+    {
+        globalMixerInit = true;
+        sfxMixerInit(&globalMixer);
+        globalSfxMixerSetVolume(getSfxVolumeSetting());
+    }
+}
+
+/**
+ * @brief Stop and deinitialize the system-wide sound effect mixer
+ */
+void deinitGlobalSfxMixer(void)
+{
+    if (globalMixerInit)
+    {
+        sfxMixerDeinit(&globalMixer);
+        globalMixerInit = false;
+    }
+}
+
+/**
+ * @brief Return a pointer to the system-wide sound effect mixer
+ *
+ * @return The system-wide mixer
+ */
+sfxMixer_t* globalSfxMixerGet(void)
+{
+    initGlobalSfxMixer();
+    return &globalMixer;
+}
+
+/**
+ * @brief Play a sample once at its native pitch and normal priority on the system-wide sound effect mixer
+ *
+ * @param sample The sample to play
+ * @param volume The volume of the sample, from 0 to 255
+ * @return The index of the voice playing the sample, or -1 if no voice was available
+ */
+int8_t globalSfxPlay(const sfxSample_t* sample, uint8_t volume)
+{
+    return sfxMixerPlay(globalSfxMixerGet(), sample, volume, SFX_SPEED_NORMAL, 1, 0);
+}
+
+/**
+ * @brief Set the volume of the system-wide sound effect mixer using a value from 0 to 13, the same scale as the SFX
+ * volume setting
+ *
+ * @param volumeSetting The volume value
+ */
+void globalSfxMixerSetVolume(int32_t volumeSetting)
+{
+    volumeSetting = CLAMP(volumeSetting, 0, SFX_MAX_VOLUME_SETTING);
+    // Use the same exponential curve as the MIDI players
+    globalMixer.volume = 255 >> (SFX_MAX_VOLUME_SETTING - volumeSetting);
+}
+
+/**
+ * @brief Mix the system-wide sound effect mixer's output on top of a buffer of DAC samples
+ *
+ * @param samples The array of unsigned 8-bit samples to mix into
+ * @param len The length of the array
+ */
+void globalSfxMixerMixBuffer(uint8_t* samples, int16_t len)
+{
+    if (globalMixerInit)
+    {
+        sfxMixerMixBuffer(&globalMixer, samples, len);
+    }
+}
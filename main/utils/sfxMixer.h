@@ -0,0 +1,194 @@
+/*! \file sfxMixer.h
+ *
+ * \section sfxMixer_design Design Philosophy
+ *
+ * This utility code is provided to play short 8-bit PCM sound effects on the DAC speaker (hdw-dac.h) without running a
+ * full MIDI player (midiPlayer.h) for each one. A mixer has ::SFX_MIXER_VOICES voices, each of which plays one sample at
+ * a time. Any number of voices may play at the same time and they are all summed together.
+ *
+ * Samples are unsigned 8-bit PCM at any sample rate. Each voice resamples its source to ::DAC_SAMPLE_RATE_HZ using a
+ * ::uq16_16 phase increment which is calculated once when the sample starts, or when the playback speed changes.
+ * Output is linearly interpolated between source samples, so there is no per-sample division.
+ *
+ * Samples may be stored uncompressed (like the <tt>.bin</tt> files in <tt>assets/drum_samples</tt>), or heatshrink
+ * compressed (like <tt>.raw</tt> files, see <tt>tools/convert_sample.sh</tt>). Compressed samples are decompressed in
+ * small chunks while they are playing, so they never need to be fully loaded into RAM.
+ *
+ * When all voices are in use, a new sample will steal the voice with the lowest priority. If multiple voices share the
+ * lowest priority, the one that has been playing the longest is stolen. A sample will not steal a voice that is playing
+ * a higher priority sample.
+ *
+ * \section sfxMixer_usage Usage
+ *
+ * Load a sample with loadSfxSample(). Sample data is referenced directly from CNFS, so there is nothing to free.
+ *
+ * The system-wide mixer is initialized along with the DAC and its output is mixed on top of whatever the Swadge mode or
+ * the global MIDI players produce. Play samples on it with globalSfxPlay() or get a pointer to it with
+ * globalSfxMixerGet() for advanced usage.
+ *
+ * Additional mixers may be initialized with sfxMixerInit() and mixed into any DAC buffer with sfxMixerMixBuffer(). They
+ * must be deinitialized with sfxMixerDeinit() to free any streaming decoders.
+ *
+ * \section sfxMixer_example Example
+ *
+ * \code{.c}
+ * // Load a sample recorded at 8192Hz
+ * sfxSample_t wilhelm;
+ * loadSfxSample("wilhelm.bin", 8192, &wilhelm);
+ *
+ * // Play it once, at full volume
+ * globalSfxPlay(&wilhelm, 255);
+ *
+ * // Play it again at half volume, one octave higher, looping forever, with a high priority
+ * int8_t voice = sfxMixerPlay(globalSfxMixerGet(), &wilhelm, 128, 2 << 16, 0, 10);
+ *
+ * // Stop the looping voice
+ * sfxMixerStop(globalSfxMixerGet(), voice);
+ * \endcode
+ */
+
+#pragma once
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fp_math.h"
+#include "heatshrink_decoder.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The number of voices in each mixer
+#define SFX_MIXER_VOICES 12
+
+/// @brief The number of decompressed bytes buffered by each voice when streaming a compressed sample
+#define SFX_STREAM_CHUNK 64
+
+/// @brief The playback speed of a sample at its native pitch
+#define SFX_SPEED_NORMAL (1 << 16)
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A PCM sample which may be played by a mixer
+ */
+typedef struct
+{
+    /// @brief The sample data, either unsigned 8-bit PCM or heatshrink-compressed unsigned 8-bit PCM
+    const uint8_t* data;
+
+    /// @brief The number of bytes in \c data
+    uint32_t dataLen;
+
+    /// @brief The number of PCM samples, after any decompression
+    uint32_t length;
+
+    /// @brief The sample rate of the data, in Hz
+    uint32_t rate;
+
+    /// @brief true if \c data is heatshrink compressed and must be streamed
+    bool compressed;
+} sfxSample_t;
+
+/**
+ * @brief The state of a single voice playing a single sample
+ */
+typedef struct
+{
+    /// @brief The sample this voice is playing
+    const sfxSample_t* sample;
+
+    /// @brief The index of the next PCM sample to read from the source
+    uint32_t readIdx;
+
+    /// @brief The fractional position between \c cur and \c next
+    uq16_16 frac;
+
+    /// @brief The amount \c frac is advanced every DAC sample
+    uq16_16 step;
+
+    /// @brief The signed source sample at the current integer position
+    int16_t cur;
+
+    /// @brief The signed source sample after \c cur, used for interpolation
+    int16_t next;
+
+    /// @brief The volume of this voice, from 0 to 255
+    uint8_t volume;
+
+    /// @brief The priority of this voice, used when stealing voices
+    uint8_t priority;
+
+    /// @brief The number of times left to play the sample, or 0 to loop forever
+    uint32_t loops;
+
+    /// @brief A monotonic counter value set when this voice started, used to find the oldest voice
+    uint32_t startSeq;
+
+    /// @brief The streaming decoder for compressed samples, or NULL
+    heatshrink_decoder* hsd;
+
+    /// @brief The number of compressed bytes which have been sunk into \c hsd
+    uint32_t sinkIdx;
+
+    /// @brief Decompressed bytes waiting to be played
+    uint8_t chunk[SFX_STREAM_CHUNK];
+
+    /// @brief The number of valid bytes in \c chunk
+    uint8_t chunkLen;
+
+    /// @brief The index of the next byte to read from \c chunk
+    uint8_t chunkIdx;
+} sfxVoice_t;
+
+/**
+ * @brief A mixer which sums the output of several voices
+ */
+typedef struct
+{
+    /// @brief The voices which play samples
+    sfxVoice_t voices[SFX_MIXER_VOICES];
+
+    /// @brief A bitmap of voices which are currently playing
+    uint32_t activeVoices;
+
+    /// @brief The output volume of the whole mixer, from 0 to 255
+    uint8_t volume;
+
+    /// @brief Incremented every time a voice starts, used to find the oldest voice
+    uint32_t seq;
+
+    /// @brief The number of output samples which were clipped
+    uint32_t clipped;
+} sfxMixer_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+bool loadSfxSample(const char* name, uint32_t rate, sfxSample_t* sample);
+
+void sfxMixerInit(sfxMixer_t* mixer);
+void sfxMixerDeinit(sfxMixer_t* mixer);
+int8_t sfxMixerPlay(sfxMixer_t* mixer, const sfxSample_t* sample, uint8_t volume, uq16_16 speed, uint32_t loops,
+                    uint8_t priority);
+void sfxMixerStop(sfxMixer_t* mixer, int8_t voiceIdx);
+void sfxMixerStopAll(sfxMixer_t* mixer);
+void sfxMixerSetSpeed(sfxMixer_t* mixer, int8_t voiceIdx, uq16_16 speed);
+void sfxMixerSetVoiceVolume(sfxMixer_t* mixer, int8_t voiceIdx, uint8_t volume);
+int32_t sfxMixerStep(sfxMixer_t* mixer);
+void sfxMixerMixBuffer(sfxMixer_t* mixer, uint8_t* samples, int16_t len);
+
+void initGlobalSfxMixer(void);
+void deinitGlobalSfxMixer(void);
+sfxMixer_t* globalSfxMixerGet(void);
+int8_t globalSfxPlay(const sfxSample_t* sample, uint8_t volume);
+void globalSfxMixerSetVolume(int32_t volumeSetting);
+void globalSfxMixerMixBuffer(uint8_t* samples, int16_t len);
@@ -0,0 +1,1762 @@
+/**
+ * @file emu_fuzz.c
+ * @brief Coverage-guided fuzzing of Swadge modes, running many headless emulators in parallel
+ *
+ * Each test case is a CSV replay (see ext_replay.h) of button, touchpad, and accelerometer inputs for one mode. A test
+ * case is run by starting the emulator headless on a virtual clock with `--fast-forward`, locked in the mode, playing
+ * back the replay. The emulator must be built with `make ENABLE_FUZZ_COVERAGE=true`, and writes a map of the edges
+ * between basic blocks of Swadge code which ran with `--fuzz-coverage`.
+ *
+ * Like AFL, a test case is interesting if it reached an edge which no earlier test case reached, or reached an edge a
+ * number of times in a range which no earlier test case did. Interesting test cases are saved to the corpus, and new
+ * test cases are made by mutating and splicing test cases from the corpus. Several emulators run at once, one per job.
+ *
+ * A crash is any run which is killed by a signal or which prints an AddressSanitizer report or the emulator's crash
+ * backtrace. Crashes are grouped by a hash of the kind of crash and the top few functions on the stack, so each bug is
+ * only reported once. The first test case for each crash is minimized by shortening the run and removing inputs for as
+ * long as it still crashes the same way, and written to a replay file with a description of how to reproduce it.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The number of edge counters in the coverage map. This must match FUZZ_COVERAGE_MAP_SIZE in ext_fuzzer.h
+#define COVERAGE_MAP_SIZE (1 << 16)
+
+/// @brief The default path to the emulator, relative to this tool's folder
+#define DEFAULT_EMULATOR "../../swadge_emulator"
+
+/// @brief The default output folder
+#define DEFAULT_OUT_DIR "fuzz-out"
+
+/// @brief The default number of frames each test case runs for
+#define DEFAULT_FRAMES 600
+
+/// @brief The default time a run may take before it is counted as a hang, in seconds
+#define DEFAULT_TIMEOUT_S 60
+
+/// @brief The random seed given to every emulator, so runs are reproducible
+#define EMU_SEED 1
+
+/// @brief The frame length used to place inputs in time. Modes which run slower or faster still get every input
+#define NOMINAL_FRAME_US 16667
+
+/// @brief The most inputs a test case may have
+#define MAX_EVENTS 1024
+
+/// @brief The most mutations applied to a test case at once
+#define MAX_STACKED_MUTATIONS 8
+
+/// @brief The most emulators which may run at once
+#define MAX_JOBS 256
+
+/// @brief The most runs used to minimize one crash
+#define MAX_MINIMIZE_RUNS 300
+
+/// @brief The number of stack frames which identify a crash
+#define STACK_FRAMES_HASHED 3
+
+/// @brief The most hangs which are saved
+#define MAX_SAVED_HANGS 100
+
+/// @brief The longest path this tool builds
+#define MAX_PATH 1024
+
+#define MIN(a, b)     (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)     (((a) > (b)) ? (a) : (b))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/// @brief The inputs a test case can have, in the same order as replayLogTypeStrs in ext_replay.c
+typedef enum
+{
+    EV_BTN_DOWN,
+    EV_BTN_UP,
+    EV_TOUCH_PHI,
+    EV_TOUCH_R,
+    EV_TOUCH_I,
+    EV_ACCEL_X,
+    EV_ACCEL_Y,
+    EV_ACCEL_Z,
+    NUM_EVENT_TYPES,
+} eventType_t;
+
+/// @brief The result of running one test case
+typedef enum
+{
+    RUN_OK,    ///< The emulator ran all the frames and exited normally
+    RUN_CRASH, ///< The emulator crashed
+    RUN_HANG,  ///< The emulator didn't finish in time and was killed
+    RUN_ERROR, ///< The emulator exited with an error without crashing, e.g. from a bad argument
+} runResult_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/// @brief One input in a test case
+typedef struct
+{
+    uint32_t timeUs;  ///< The Swadge time to apply the input at
+    eventType_t type; ///< The kind of input
+    int32_t value;    ///< A button index for button inputs, otherwise the value
+} event_t;
+
+/// @brief A test case, which is a list of inputs for one mode, sorted by time
+typedef struct
+{
+    int mode;        ///< The index of the mode in ::fuzz's modes
+    int numEvents;   ///< The number of inputs
+    event_t* events; ///< The inputs
+} input_t;
+
+/// @brief A running emulator
+typedef struct
+{
+    pid_t pid;               ///< The process ID, or 0 if this job isn't running
+    input_t input;           ///< The test case being run
+    bool fromCorpus;         ///< Whether the test case was loaded from disk and is already saved
+    int64_t startMs;         ///< When the emulator started, in real milliseconds
+    char dir[MAX_PATH + 32]; ///< The folder the emulator runs in, with the replay, coverage, and log files
+} job_t;
+
+/// @brief The outcome of a finished run
+typedef struct
+{
+    runResult_t result; ///< How the run ended
+    uint64_t signature; ///< For crashes, the hash which identifies the bug
+    char summary[256];  ///< For crashes, a description of the crash and its top stack frames
+    int exitStatus;     ///< The exit status or signal number
+} runOutcome_t;
+
+/// @brief All of the fuzzer's state
+typedef struct
+{
+    // Options
+    char emulator[MAX_PATH]; ///< The absolute path to the emulator
+    char outDir[MAX_PATH];   ///< The absolute path to the output folder
+    int numJobs;             ///< The number of emulators to run at once
+    uint32_t frames;         ///< The number of frames each test case runs for
+    int timeoutS;            ///< How long a run may take before it's counted as a hang
+    uint64_t maxRuns;        ///< The number of runs to stop after, or 0 to run until interrupted
+    int64_t maxSeconds;      ///< The time to stop after, or 0 to run until interrupted
+    bool minimize;           ///< Whether to minimize crashes
+
+    // Modes
+    char** modes;    ///< The names of the modes being fuzzed
+    char** modeDirs; ///< Names of the modes which are safe to use as folder names
+    int numModes;    ///< The number of modes being fuzzed
+    int nextMode;    ///< The mode to make the next test case for, round robin
+
+    // Corpus
+    input_t* corpus;  ///< Interesting test cases
+    int corpusLen;    ///< The number of interesting test cases
+    uint32_t nextId;  ///< The ID of the next test case written to the corpus folder
+    input_t* pending; ///< Test cases to run before mutating, loaded from disk or empty seeds
+    int pendingLen;   ///< The number of pending test cases
+    int pendingRun;   ///< The number of pending test cases which were started
+    int pendingSaved; ///< The number of pending test cases from the corpus folder, which are already saved
+
+    // Coverage
+    uint8_t virgin[COVERAGE_MAP_SIZE];   ///< Hit count buckets which no test case reached yet, like AFL's virgin map
+    uint8_t coverage[COVERAGE_MAP_SIZE]; ///< The coverage of the last run
+    uint32_t edges;                      ///< The number of edges reached by any test case
+
+    // Crashes
+    uint64_t* signatures; ///< The crashes found so far
+    int numSignatures;    ///< The number of unique crashes
+
+    // Statistics
+    uint64_t runs;    ///< Finished runs
+    uint64_t crashes; ///< Runs which crashed, including repeats
+    uint64_t hangs;   ///< Runs which were killed for taking too long
+    uint64_t errors;  ///< Runs which exited with an error without crashing
+    int64_t startMs;  ///< When fuzzing started
+
+    uint64_t rng; ///< The state of the random number generator
+
+    job_t jobs[MAX_JOBS]; ///< The running emulators
+} fuzz_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static uint32_t rnd(uint32_t n);
+static int64_t nowMs(void);
+static void onSignal(int sig);
+static bool makeDirs(const char* path);
+static void freeInput(input_t* input);
+static input_t copyInput(const input_t* input);
+static void sortEvents(input_t* input);
+static bool writeInput(const input_t* input, const char* fname);
+static bool readInput(const char* fname, int mode, input_t* input);
+static void randomEvent(event_t* ev, uint32_t durationUs);
+static uint32_t randomTime(const input_t* input, uint32_t durationUs);
+static void mutate(input_t* input);
+static bool loadModes(const char** include, int numInclude, const char** exclude, int numExclude);
+static void loadDir(const char* dir, int mode, bool saved);
+static bool startJob(job_t* job, const input_t* input, bool fromCorpus, uint32_t frames);
+static runOutcome_t finishJob(job_t* job, int status, bool hung);
+static runOutcome_t runSync(const char* dir, const input_t* input, uint32_t frames);
+static uint64_t crashSignature(const char* logFile, char* summary, size_t summaryLen);
+static bool hasNewCoverage(const char* covFile);
+static void saveToCorpus(const input_t* input);
+static int pickFromCorpus(int mode);
+static bool knownCrash(uint64_t signature);
+static void handleCrash(const input_t* input, const runOutcome_t* outcome);
+static void handleHang(const input_t* input);
+static void printStatus(bool final);
+static void usage(const char* prog);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+/// @brief The names of the input types in CSV replays
+static const char* const eventTypeNames[] = {
+    "BtnDown", "BtnUp", "TouchPhi", "TouchR", "TouchI", "AccelX", "AccelY", "AccelZ",
+};
+
+/// @brief The names of the buttons in CSV replays
+static const char* const buttonNames[] = {
+    "Up", "Down", "Left", "Right", "A", "B", "Start", "Select",
+};
+
+/// @brief Functions which are in every crash's stack, so they don't identify it
+static const char* const ignoredFrames[] = {
+    "signalHandler_crash", "__restore_rt", "raise", "abort", "__assert_fail", "__pthread_kill", "pthread_kill",
+    "__libc_start", "_start", "__GI_", "__interceptor_", "__asan", "__sanitizer", "__ubsan", "??", "0x",
+};
+
+/// @brief Set by the signal handler to stop fuzzing
+static volatile sig_atomic_t stopRequested = 0;
+
+/// @brief The fuzzer's state. This is big, so it isn't on the stack
+static fuzz_t fuzz;
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Get a random number with xorshift64*
+ *
+ * @param n The number of possible values
+ * @return A random number from 0 to n - 1, or 0 if n is 0
+ */
+static uint32_t rnd(uint32_t n)
+{
+    fuzz.rng ^= fuzz.rng >> 12;
+    fuzz.rng ^= fuzz.rng << 25;
+    fuzz.rng ^= fuzz.rng >> 27;
+    return n ? ((fuzz.rng * 0x2545F4914F6CDD1DULL) >> 32) % n : 0;
+}
+
+/**
+ * @brief Get the monotonic time
+ *
+ * @return The time in milliseconds
+ */
+static int64_t nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Stop fuzzing after the running jobs are stopped
+ *
+ * @param sig The signal
+ */
+static void onSignal(int sig)
+{
+    stopRequested = 1;
+}
+
+/**
+ * @brief Create a folder and any missing parent folders
+ *
+ * @param path The folder to create
+ * @return true if the folder exists now, false if it couldn't be created
+ */
+static bool makeDirs(const char* path)
+{
+    char tmp[MAX_PATH];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char* p = tmp + 1; *p; p++)
+    {
+        if ('/' == *p)
+        {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+    return 0 == mkdir(tmp, 0755) || EEXIST == errno;
+}
+
+/**
+ * @brief Free a test case's inputs
+ *
+ * @param input The test case to free
+ */
+static void freeInput(input_t* input)
+{
+    free(input->events);
+    input->events    = NULL;
+    input->numEvents = 0;
+}
+
+/**
+ * @brief Copy a test case
+ *
+ * @param input The test case to copy
+ * @return A copy which must be freed with freeInput()
+ */
+static input_t copyInput(const input_t* input)
+{
+    input_t copy = *input;
+    copy.events  = malloc(sizeof(event_t) * (input->numEvents ? input->numEvents : 1));
+    memcpy(copy.events, input->events, sizeof(event_t) * input->numEvents);
+    return copy;
+}
+
+/**
+ * @brief Sort a test case's inputs by time. Inputs at the same time keep their order, so a button can be pressed and
+ * released in the same frame
+ *
+ * @param input The test case to sort
+ */
+static void sortEvents(input_t* input)
+{
+    // Insertion sort, since mutations leave the inputs nearly sorted
+    for (int i = 1; i < input->numEvents; i++)
+    {
+        event_t ev = input->events[i];
+        int j      = i - 1;
+        while (j >= 0 && input->events[j].timeUs > ev.timeUs)
+        {
+            input->events[j + 1] = input->events[j];
+            j--;
+        }
+        input->events[j + 1] = ev;
+    }
+}
+
+/**
+ * @brief Write a test case as a CSV replay
+ *
+ * @param input The test case to write
+ * @param fname The file to write
+ * @return true if the file was written
+ */
+static bool writeInput(const input_t* input, const char* fname)
+{
+    FILE* file = fopen(fname, "w");
+    if (NULL == file)
+    {
+        return false;
+    }
+
+    fprintf(file, "Time,Type,Value\n");
+    if (0 == input->numEvents)
+    {
+        // The replay extension expects at least one entry, so release the touchpad
+        fprintf(file, "0,TouchI,0\n");
+    }
+
+    for (int i = 0; i < input->numEvents; i++)
+    {
+        const event_t* ev = &input->events[i];
+        if (EV_BTN_DOWN == ev->type || EV_BTN_UP == ev->type)
+        {
+            fprintf(file, "%" PRIu32 ",%s,%s\n", ev->timeUs, eventTypeNames[ev->type], buttonNames[ev->value]);
+        }
+        else
+        {
+            fprintf(file, "%" PRIu32 ",%s,%" PRId32 "\n", ev->timeUs, eventTypeNames[ev->type], ev->value);
+        }
+    }
+    return 0 == fclose(file);
+}
+
+/**
+ * @brief Read a test case from a CSV replay. Entries which aren't inputs, like screenshots, are skipped
+ *
+ * @param fname The file to read
+ * @param mode The mode the test case is for
+ * @param[out] input The test case, which must be freed with freeInput()
+ * @return true if the file was read
+ */
+static bool readInput(const char* fname, int mode, input_t* input)
+{
+    FILE* file = fopen(fname, "r");
+    if (NULL == file)
+    {
+        return false;
+    }
+
+    input->mode      = mode;
+    input->numEvents = 0;
+    input->events    = malloc(sizeof(event_t) * MAX_EVENTS);
+
+    char line[256];
+    while (NULL != fgets(line, sizeof(line), file) && input->numEvents < MAX_EVENTS)
+    {
+        uint32_t timeUs;
+        char type[32], value[64];
+        if (3 != sscanf(line, "%" SCNu32 ",%31[^,],%63s", &timeUs, type, value))
+        {
+            // The header, or an entry without a value
+            continue;
+        }
+
+        event_t* ev = &input->events[input->numEvents];
+        ev->timeUs  = timeUs;
+        ev->type    = NUM_EVENT_TYPES;
+        for (int t = 0; t < NUM_EVENT_TYPES; t++)
+        {
+            if (0 == strcmp(type, eventTypeNames[t]))
+            {
+                ev->type = t;
+            }
+        }
+
+        if (EV_BTN_DOWN == ev->type || EV_BTN_UP == ev->type)
+        {
+            ev->value = -1;
+            for (int b = 0; b < (int)ARRAY_SIZE(buttonNames); b++)
+            {
+                if (0 == strcmp(value, buttonNames[b]))
+                {
+                    ev->value = b;
+                }
+            }
+            if (ev->value < 0)
+            {
+                continue;
+            }
+        }
+        else if (NUM_EVENT_TYPES != ev->type)
+        {
+            ev->value = strtol(value, NULL, 10);
+        }
+        else
+        {
+            continue;
+        }
+        input->numEvents++;
+    }
+    fclose(file);
+
+    sortEvents(input);
+    return true;
+}
+
+/**
+ * @brief Make a random input
+ *
+ * @param[out] ev The input to write
+ * @param durationUs The length of the test case, to pick a time within
+ */
+static void randomEvent(event_t* ev, uint32_t durationUs)
+{
+    ev->timeUs = rnd(durationUs);
+    ev->type   = rnd(NUM_EVENT_TYPES);
+    switch (ev->type)
+    {
+        case EV_BTN_DOWN:
+        case EV_BTN_UP:
+        {
+            ev->value = rnd(8);
+            break;
+        }
+        case EV_TOUCH_PHI:
+        {
+            ev->value = rnd(360);
+            break;
+        }
+        case EV_TOUCH_R:
+        {
+            ev->value = rnd(1025);
+            break;
+        }
+        case EV_TOUCH_I:
+        {
+            // Touching or not touching are what matter, so favor the ends
+            ev->value = rnd(2) ? 0 : rnd(1 << 18);
+            break;
+        }
+        case EV_ACCEL_X:
+        case EV_ACCEL_Y:
+        case EV_ACCEL_Z:
+        default:
+        {
+            ev->value = (int32_t)rnd(1025) - 512;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Pick a time for a new input. Half the time it's just after an existing input, which extends sequences of
+ * inputs the mode already reacted to, like menu navigation
+ *
+ * @param input The test case the input is added to
+ * @param durationUs The length of the test case
+ * @return The time for the new input, in microseconds
+ */
+static uint32_t randomTime(const input_t* input, uint32_t durationUs)
+{
+    if (input->numEvents && rnd(2))
+    {
+        return input->events[rnd(input->numEvents)].timeUs + 1 + rnd(10 * NOMINAL_FRAME_US);
+    }
+    return rnd(durationUs);
+}
+
+/**
+ * @brief Apply a random stack of mutations to a test case, keeping its inputs sorted by time
+ *
+ * @param input The test case to mutate. Its inputs must have room for ::MAX_EVENTS
+ */
+static void mutate(input_t* input)
+{
+    uint32_t durationUs = fuzz.frames * NOMINAL_FRAME_US;
+    int numMutations    = 1 + rnd(MAX_STACKED_MUTATIONS);
+
+    for (int m = 0; m < numMutations; m++)
+    {
+        event_t* evs = input->events;
+        int n        = input->numEvents;
+
+        switch (rnd(8))
+        {
+            case 0:
+            {
+                // Add a random input
+                if (n < MAX_EVENTS)
+                {
+                    randomEvent(&evs[n], durationUs);
+                    evs[n].timeUs = randomTime(input, durationUs);
+                    input->numEvents++;
+                }
+                break;
+            }
+            case 1:
+            {
+                // Tap a button, which is what most modes react to
+                if (n + 2 <= MAX_EVENTS)
+                {
+                    uint32_t t  = randomTime(input, durationUs);
+                    int32_t btn = rnd(8);
+                    evs[n]      = (event_t){.timeUs = t, .type = EV_BTN_DOWN, .value = btn};
+                    evs[n + 1]  = (event_t){.timeUs = t + 1 + rnd(500000), .type = EV_BTN_UP, .value = btn};
+                    input->numEvents += 2;
+                }
+                break;
+            }
+            case 2:
+            {
+                // Remove a range of inputs
+                if (n > 0)
+                {
+                    int start = rnd(n);
+                    int len   = 1 + rnd(rnd(2) ? 1 : (n - start));
+                    memmove(&evs[start], &evs[start + len], sizeof(event_t) * (n - start - len));
+                    input->numEvents -= len;
+                }
+                break;
+            }
+            case 3:
+            {
+                // Change an input's value
+                if (n > 0)
+                {
+                    event_t* ev = &evs[rnd(n)];
+                    if (EV_BTN_DOWN == ev->type || EV_BTN_UP == ev->type || rnd(2))
+                    {
+                        uint32_t t = ev->timeUs;
+                        eventType_t type = ev->type;
+                        do
+                        {
+                            randomEvent(ev, durationUs);
+                        } while (ev->type != type);
+                        ev->timeUs = t;
+                    }
+                    else
+                    {
+                        // Nudge analog values a little
+                        ev->value += (int32_t)rnd(33) - 16;
+                    }
+                }
+                break;
+            }
+            case 4:
+            {
+                // Move an input in time
+                if (n > 0)
+                {
+                    event_t* ev = &evs[rnd(n)];
+                    int32_t dt  = (int32_t)rnd(2 * NOMINAL_FRAME_US * 30) - NOMINAL_FRAME_US * 30;
+                    ev->timeUs  = ((int64_t)ev->timeUs + dt < 0) ? 0 : ev->timeUs + dt;
+                }
+                break;
+            }
+            case 5:
+            {
+                // Repeat a range of inputs later, like doing the same thing twice
+                if (n > 0)
+                {
+                    int start      = rnd(n);
+                    int len        = 1 + rnd(MIN(n - start, MAX_EVENTS - n));
+                    uint32_t shift = 1 + rnd(durationUs / 2);
+                    if (len > 0 && n + len <= MAX_EVENTS)
+                    {
+                        for (int i = 0; i < len; i++)
+                        {
+                            evs[n + i] = evs[start + i];
+                            evs[n + i].timeUs += shift;
+                        }
+                        input->numEvents += len;
+                    }
+                }
+                break;
+            }
+            case 6:
+            {
+                // Splice: keep the start of this test case and finish with another one of the same mode
+                int tries = 8;
+                while (tries-- && fuzz.corpusLen)
+                {
+                    const input_t* other = &fuzz.corpus[rnd(fuzz.corpusLen)];
+                    if (other->mode != input->mode || other->events == input->events)
+                    {
+                        continue;
+                    }
+
+                    uint32_t cut = rnd(durationUs);
+                    int keep     = 0;
+                    while (keep < n && evs[keep].timeUs < cut)
+                    {
+                        keep++;
+                    }
+                    input->numEvents = keep;
+                    for (int i = 0; i < other->numEvents && input->numEvents < MAX_EVENTS; i++)
+                    {
+                        if (other->events[i].timeUs >= cut)
+                        {
+                            evs[input->numEvents++] = other->events[i];
+                        }
+                    }
+                    break;
+                }
+                break;
+            }
+            case 7:
+            default:
+            {
+                // Hold the touchpad somewhere, then let go
+                if (n + 4 <= MAX_EVENTS)
+                {
+                    uint32_t t = randomTime(input, durationUs);
+                    evs[n]     = (event_t){.timeUs = t, .type = EV_TOUCH_PHI, .value = rnd(360)};
+                    evs[n + 1] = (event_t){.timeUs = t, .type = EV_TOUCH_R, .value = rnd(1025)};
+                    evs[n + 2] = (event_t){.timeUs = t, .type = EV_TOUCH_I, .value = 1 + rnd(1 << 18)};
+                    evs[n + 3] = (event_t){.timeUs = t + rnd(1000000), .type = EV_TOUCH_I, .value = 0};
+                    input->numEvents += 4;
+                }
+                break;
+            }
+        }
+        sortEvents(input);
+    }
+}
+
+/**
+ * @brief Get the list of modes from the emulator and pick which ones to fuzz
+ *
+ * @param include Modes to fuzz, which may be the start of a mode's name, or NULL to fuzz every mode
+ * @param numInclude The number of modes in \c include
+ * @param exclude Modes not to fuzz, which may be the start of a mode's name
+ * @param numExclude The number of modes in \c exclude
+ * @return true if at least one mode was found
+ */
+static bool loadModes(const char** include, int numInclude, const char** exclude, int numExclude)
+{
+    char cmd[MAX_PATH + 32];
+    snprintf(cmd, sizeof(cmd), "'%s' --modes-list", fuzz.emulator);
+    FILE* pipe = popen(cmd, "r");
+    if (NULL == pipe)
+    {
+        return false;
+    }
+
+    char line[256];
+    while (NULL != fgets(line, sizeof(line), pipe))
+    {
+        if (0 != strncmp(line, " - ", 3))
+        {
+            continue;
+        }
+        char* name             = line + 3;
+        name[strcspn(name, "\r\n")] = '\0';
+
+        bool wanted = (0 == numInclude);
+        for (int i = 0; i < numInclude; i++)
+        {
+            wanted |= (0 == strncasecmp(name, include[i], strlen(include[i])));
+        }
+        for (int i = 0; i < numExclude; i++)
+        {
+            wanted &= (0 != strncasecmp(name, exclude[i], strlen(exclude[i])));
+        }
+
+        if (wanted)
+        {
+            fuzz.modes    = realloc(fuzz.modes, sizeof(char*) * (fuzz.numModes + 1));
+            fuzz.modeDirs = realloc(fuzz.modeDirs, sizeof(char*) * (fuzz.numModes + 1));
+
+            fuzz.modes[fuzz.numModes]    = strdup(name);
+            fuzz.modeDirs[fuzz.numModes] = strdup(name);
+            for (char* c = fuzz.modeDirs[fuzz.numModes]; *c; c++)
+            {
+                if (!isalnum((unsigned char)*c))
+                {
+                    *c = '_';
+                }
+            }
+            fuzz.numModes++;
+        }
+    }
+    pclose(pipe);
+    return 0 < fuzz.numModes;
+}
+
+/**
+ * @brief Queue every CSV replay in a folder to be run before fuzzing starts
+ *
+ * @param dir The folder to read
+ * @param mode The mode the replays are for
+ * @param saved true if the replays are in the corpus folder already, false to save them if they're interesting
+ */
+static void loadDir(const char* dir, int mode, bool saved)
+{
+    DIR* d = opendir(dir);
+    if (NULL == d)
+    {
+        return;
+    }
+
+    struct dirent* ent;
+    while (NULL != (ent = readdir(d)))
+    {
+        const char* ext = strrchr(ent->d_name, '.');
+        if (NULL == ext || 0 != strcasecmp(ext, ".csv"))
+        {
+            continue;
+        }
+
+        char path[MAX_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+
+        input_t input;
+        if (readInput(path, mode, &input))
+        {
+            fuzz.pending                    = realloc(fuzz.pending, sizeof(input_t) * (fuzz.pendingLen + 1));
+            fuzz.pending[fuzz.pendingLen++] = input;
+            fuzz.pendingSaved += saved;
+
+            // Don't overwrite corpus files on the next run
+            unsigned id;
+            if (saved && 1 == sscanf(ent->d_name, "id-%u", &id) && id >= fuzz.nextId)
+            {
+                fuzz.nextId = id + 1;
+            }
+        }
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Start an emulator to run a test case
+ *
+ * @param job The job to run it in, which must not be running
+ * @param input The test case to run. It's copied
+ * @param fromCorpus true if the test case is saved in the corpus folder already
+ * @param frames The number of frames to run for
+ * @return true if the emulator started
+ */
+static bool startJob(job_t* job, const input_t* input, bool fromCorpus, uint32_t frames)
+{
+    char path[MAX_PATH * 2];
+    snprintf(path, sizeof(path), "%s/input.csv", job->dir);
+    if (!writeInput(input, path))
+    {
+        printf("ERR: Could not write %s\n", path);
+        return false;
+    }
+
+    // The old coverage map must not be mistaken for this run's
+    snprintf(path, sizeof(path), "%s/coverage.bin", job->dir);
+    unlink(path);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        printf("ERR: fork() failed: %s\n", strerror(errno));
+        return false;
+    }
+    else if (0 == pid)
+    {
+        // The emulator writes crash reports to the current folder, so give every job its own
+        if (0 != chdir(job->dir))
+        {
+            _exit(127);
+        }
+
+        int log = open("log.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0)
+        {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+
+        // Leaks aren't crashes, and most of them are in libraries
+        setenv("ASAN_OPTIONS", "detect_leaks=0:abort_on_error=0:allocator_may_return_null=1", 1);
+        setenv("UBSAN_OPTIONS", "print_stacktrace=1:halt_on_error=1", 1);
+
+        char framesArg[32], seedArg[16];
+        snprintf(framesArg, sizeof(framesArg), "--fast-forward=%" PRIu32, frames);
+        snprintf(seedArg, sizeof(seedArg), "%d", EMU_SEED);
+        char* args[] = {
+            fuzz.emulator, framesArg, "--mode",  fuzz.modes[input->mode], "--lock",  "--nvs-memory", "--seed",
+            seedArg,       "--playback", "input.csv", "--fuzz-coverage", "coverage.bin", NULL,
+        };
+        execv(fuzz.emulator, args);
+        _exit(127);
+    }
+
+    job->pid        = pid;
+    job->input      = copyInput(input);
+    job->fromCorpus = fromCorpus;
+    job->startMs    = nowMs();
+    return true;
+}
+
+/**
+ * @brief Find out how a job's run ended, after its emulator exited
+ *
+ * @param job The job which finished
+ * @param status The status from waitpid()
+ * @param hung true if the emulator was killed for taking too long
+ * @return How the run ended
+ */
+static runOutcome_t finishJob(job_t* job, int status, bool hung)
+{
+    runOutcome_t outcome = {0};
+    job->pid             = 0;
+
+    char logFile[MAX_PATH * 2];
+    snprintf(logFile, sizeof(logFile), "%s/log.txt", job->dir);
+
+    if (hung)
+    {
+        outcome.result = RUN_HANG;
+        return outcome;
+    }
+
+    outcome.signature = crashSignature(logFile, outcome.summary, sizeof(outcome.summary));
+    if (WIFSIGNALED(status))
+    {
+        outcome.result     = RUN_CRASH;
+        outcome.exitStatus = WTERMSIG(status);
+        if (0 == outcome.signature)
+        {
+            // There was no report, so the signal is all there is to go on
+            snprintf(outcome.summary, sizeof(outcome.summary), "signal %d", outcome.exitStatus);
+            outcome.signature = 0xCBF29CE484222325ULL ^ (uint64_t)outcome.exitStatus;
+        }
+    }
+    else
+    {
+        outcome.exitStatus = WEXITSTATUS(status);
+        if (0 != outcome.signature)
+        {
+            outcome.result = RUN_CRASH;
+        }
+        else
+        {
+            outcome.result = (0 == outcome.exitStatus) ? RUN_OK : RUN_ERROR;
+        }
+    }
+    return outcome;
+}
+
+/**
+ * @brief Run a test case and wait for it to finish. This is used to minimize crashes
+ *
+ * @param dir The folder to run the emulator in
+ * @param input The test case to run
+ * @param frames The number of frames to run for
+ * @return How the run ended
+ */
+static runOutcome_t runSync(const char* dir, const input_t* input, uint32_t frames)
+{
+    runOutcome_t outcome = {.result = RUN_ERROR};
+
+    job_t job = {0};
+    snprintf(job.dir, sizeof(job.dir), "%s", dir);
+    if (!startJob(&job, input, true, frames))
+    {
+        return outcome;
+    }
+    freeInput(&job.input);
+
+    while (true)
+    {
+        int status;
+        pid_t pid = waitpid(job.pid, &status, WNOHANG);
+        if (pid == job.pid)
+        {
+            return finishJob(&job, status, false);
+        }
+        else if (nowMs() - job.startMs > fuzz.timeoutS * 1000LL)
+        {
+            kill(job.pid, SIGKILL);
+            waitpid(job.pid, &status, 0);
+            return finishJob(&job, status, true);
+        }
+        usleep(2000);
+    }
+}
+
+/**
+ * @brief Find a crash report in an emulator's output and hash the kind of crash and the top stack frames
+ *
+ * Both AddressSanitizer reports and the emulator's own crash backtraces are understood. Frames in the crash handler,
+ * the C library, and the sanitizer runtime are skipped, since they're the same for every crash.
+ *
+ * @param logFile The emulator's output
+ * @param[out] summary A description of the crash, like "heap-buffer-overflow in foo < bar < baz"
+ * @param summaryLen The size of \c summary
+ * @return The hash which identifies the crash, or 0 if there is no crash report
+ */
+static uint64_t crashSignature(const char* logFile, char* summary, size_t summaryLen)
+{
+    FILE* file = fopen(logFile, "r");
+    if (NULL == file)
+    {
+        return 0;
+    }
+
+    char kind[64]                         = "";
+    char frames[STACK_FRAMES_HASHED][128] = {{0}};
+    int numFrames                         = 0;
+    bool inStack                          = false;
+    bool found                            = false;
+    bool sanitizerStack                   = false;
+
+    char line[1024];
+    while (NULL != fgets(line, sizeof(line), file))
+    {
+        char fn[128] = "";
+        const char* asan;
+        if (NULL != (asan = strstr(line, "ERROR: AddressSanitizer: ")) && !found)
+        {
+            sscanf(asan + strlen("ERROR: AddressSanitizer: "), "%63s", kind);
+            found          = true;
+            inStack        = true;
+            sanitizerStack = true;
+            continue;
+        }
+        else if (NULL != strstr(line, "CRASH BACKTRACE") && !found)
+        {
+            snprintf(kind, sizeof(kind), "crash");
+            found   = true;
+            inStack = true;
+            continue;
+        }
+        else if (NULL != strstr(line, "runtime error:") && !found)
+        {
+            // -fsanitize=bounds-strict reports out of bounds array indices this way
+            snprintf(kind, sizeof(kind), "runtime-error");
+            found          = true;
+            inStack        = true;
+            sanitizerStack = true;
+            continue;
+        }
+
+        if (!inStack || numFrames >= STACK_FRAMES_HASHED)
+        {
+            continue;
+        }
+
+        // AddressSanitizer frames look like "    #3 0x55d0c0 in func /path/file.c:12"
+        // addr2line frames look like "func at /path/file.c:12" or " (inlined by) func at /path/file.c:12"
+        const char* at = strstr(line, " at ");
+        if (sanitizerStack && 1 == sscanf(line, " #%*d %*s in %127s", fn))
+        {
+            // Read the function name already
+        }
+        else if (!sanitizerStack && NULL != at)
+        {
+            const char* start = strstr(line, "(inlined by) ");
+            start             = start ? start + strlen("(inlined by) ") : line;
+            sscanf(start, "%127s", fn);
+        }
+        else if (numFrames > 0 && '\n' == line[0])
+        {
+            // The end of the first stack
+            inStack = false;
+            continue;
+        }
+
+        if ('\0' == fn[0])
+        {
+            continue;
+        }
+
+        bool ignored = false;
+        for (int i = 0; i < (int)ARRAY_SIZE(ignoredFrames); i++)
+        {
+            ignored |= (0 == strncmp(fn, ignoredFrames[i], strlen(ignoredFrames[i])));
+        }
+        if (!ignored)
+        {
+            snprintf(frames[numFrames++], sizeof(frames[0]), "%s", fn);
+        }
+    }
+    fclose(file);
+
+    if (!found)
+    {
+        return 0;
+    }
+
+    // FNV-1a of the kind and frames
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    int len       = snprintf(summary, summaryLen, "%s in", kind);
+    for (const char* c = kind; *c; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001B3ULL;
+    }
+    for (int f = 0; f < numFrames; f++)
+    {
+        for (const char* c = frames[f]; *c; c++)
+        {
+            hash = (hash ^ (uint8_t)*c) * 0x100000001B3ULL;
+        }
+        hash = (hash ^ '\n') * 0x100000001B3ULL;
+
+        if (len < (int)summaryLen)
+        {
+            len += snprintf(summary + len, summaryLen - len, "%s%s", f ? " < " : " ", frames[f]);
+        }
+    }
+    if (0 == numFrames && len < (int)summaryLen)
+    {
+        snprintf(summary + len, summaryLen - len, " an unknown function");
+    }
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Check a run's coverage map for edges or hit counts which no earlier run reached, and mark them as reached
+ *
+ * @param covFile The coverage map written by the emulator
+ * @return true if the run reached something new
+ */
+static bool hasNewCoverage(const char* covFile)
+{
+    FILE* file = fopen(covFile, "rb");
+    if (NULL == file)
+    {
+        return false;
+    }
+    size_t len = fread(fuzz.coverage, 1, sizeof(fuzz.coverage), file);
+    fclose(file);
+    if (sizeof(fuzz.coverage) != len)
+    {
+        return false;
+    }
+
+    bool newBits = false;
+    for (int i = 0; i < COVERAGE_MAP_SIZE; i++)
+    {
+        uint8_t count = fuzz.coverage[i];
+        if (0 == count)
+        {
+            continue;
+        }
+
+        // Hit counts are put in AFL's buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, and 128+
+        uint8_t bucket;
+        if (count <= 3)
+        {
+            bucket = 1 << (count - 1);
+        }
+        else if (count <= 7)
+        {
+            bucket = 1 << 3;
+        }
+        else if (count <= 15)
+        {
+            bucket = 1 << 4;
+        }
+        else if (count <= 31)
+        {
+            bucket = 1 << 5;
+        }
+        else if (count <= 127)
+        {
+            bucket = 1 << 6;
+        }
+        else
+        {
+            bucket = 1 << 7;
+        }
+
+        if (fuzz.virgin[i] & bucket)
+        {
+            if (0xFF == fuzz.virgin[i])
+            {
+                fuzz.edges++;
+            }
+            fuzz.virgin[i] &= ~bucket;
+            newBits = true;
+        }
+    }
+    return newBits;
+}
+
+/**
+ * @brief Add a test case to the corpus and save it to the corpus folder
+ *
+ * @param input The test case to add. It's copied
+ */
+static void saveToCorpus(const input_t* input)
+{
+    char path[MAX_PATH * 2];
+    snprintf(path, sizeof(path), "%s/corpus/%s/id-%06" PRIu32 ".csv", fuzz.outDir, fuzz.modeDirs[input->mode],
+             fuzz.nextId++);
+    if (!writeInput(input, path))
+    {
+        printf("ERR: Could not write %s\n", path);
+    }
+}
+
+/**
+ * @brief Pick a test case from the corpus to mutate. Of two random test cases, the one with fewer inputs is picked.
+ * Longer test cases often only reach new hit counts by doing more of the same, so this keeps the corpus from growing
+ * without finding anything
+ *
+ * @param mode The mode to pick a test case for
+ * @return The index of the test case in the corpus, or -1 if the mode has none
+ */
+static int pickFromCorpus(int mode)
+{
+    int picks[2] = {-1, -1};
+    for (int p = 0; p < 2; p++)
+    {
+        // Reservoir sampling, since the corpus isn't grouped by mode
+        int candidates = 0;
+        for (int c = 0; c < fuzz.corpusLen; c++)
+        {
+            if (fuzz.corpus[c].mode == mode && 0 == rnd(++candidates))
+            {
+                picks[p] = c;
+            }
+        }
+    }
+
+    if (picks[0] < 0 || fuzz.corpus[picks[1]].numEvents < fuzz.corpus[picks[0]].numEvents)
+    {
+        return picks[1];
+    }
+    return picks[0];
+}
+
+/**
+ * @brief Check if a crash was found before, in this session or an earlier one
+ *
+ * @param signature The crash's hash
+ * @return true if the crash was found before
+ */
+static bool knownCrash(uint64_t signature)
+{
+    for (int i = 0; i < fuzz.numSignatures; i++)
+    {
+        if (fuzz.signatures[i] == signature)
+        {
+            return true;
+        }
+    }
+
+    char path[MAX_PATH * 2];
+    snprintf(path, sizeof(path), "%s/crashes/crash-%016" PRIx64 ".csv", fuzz.outDir, signature);
+    return 0 == access(path, F_OK);
+}
+
+/**
+ * @brief Record a crash. The first time a crash is found, the test case is minimized and written to the crashes folder
+ * with a description of the crash and a command to reproduce it
+ *
+ * @param input The test case which crashed
+ * @param outcome How the run crashed
+ */
+static void handleCrash(const input_t* input, const runOutcome_t* outcome)
+{
+    fuzz.crashes++;
+    if (knownCrash(outcome->signature))
+    {
+        return;
+    }
+
+    fuzz.signatures                       = realloc(fuzz.signatures, sizeof(uint64_t) * (fuzz.numSignatures + 1));
+    fuzz.signatures[fuzz.numSignatures++] = outcome->signature;
+
+    printf("\nNew crash %016" PRIx64 " in %s: %s\n", outcome->signature, fuzz.modes[input->mode], outcome->summary);
+
+    char base[MAX_PATH * 2];
+    snprintf(base, sizeof(base), "%s/crashes/crash-%016" PRIx64, fuzz.outDir, outcome->signature);
+
+    char path[MAX_PATH * 2 + 16];
+    snprintf(path, sizeof(path), "%s-orig.csv", base);
+    writeInput(input, path);
+
+    input_t min     = copyInput(input);
+    min.events      = realloc(min.events, sizeof(event_t) * MAX_EVENTS);
+    uint32_t frames = fuzz.frames;
+    int runs        = 0;
+
+    if (fuzz.minimize)
+    {
+        char dir[MAX_PATH + 32];
+        snprintf(dir, sizeof(dir), "%s/work/minimize", fuzz.outDir);
+
+        // Find the fewest frames which still crash. A crash at one frame count almost always happens at higher ones too
+        uint32_t lo = 1, hi = frames;
+        while (lo < hi && runs < MAX_MINIMIZE_RUNS && !stopRequested)
+        {
+            uint32_t mid     = lo + (hi - lo) / 2;
+            runOutcome_t out = runSync(dir, &min, mid);
+            runs++;
+            if (RUN_CRASH == out.result && out.signature == outcome->signature)
+            {
+                hi = mid;
+            }
+            else
+            {
+                lo = mid + 1;
+            }
+        }
+        frames = hi;
+
+        // Remove ranges of inputs while it still crashes the same way, halving the range size when nothing can go
+        int chunk = (min.numEvents + 1) / 2;
+        while (chunk >= 1 && runs < MAX_MINIMIZE_RUNS && !stopRequested)
+        {
+            bool removed = false;
+            for (int start = 0; start < min.numEvents && runs < MAX_MINIMIZE_RUNS && !stopRequested;)
+            {
+                input_t candidate = copyInput(&min);
+                int len           = MIN(chunk, min.numEvents - start);
+                memmove(&candidate.events[start], &candidate.events[start + len],
+                        sizeof(event_t) * (min.numEvents - start - len));
+                candidate.numEvents -= len;
+
+                runOutcome_t out = runSync(dir, &candidate, frames);
+                runs++;
+                if (RUN_CRASH == out.result && out.signature == outcome->signature)
+                {
+                    memcpy(min.events, candidate.events, sizeof(event_t) * candidate.numEvents);
+                    min.numEvents = candidate.numEvents;
+                    removed       = true;
+                }
+                else
+                {
+                    start += len;
+                }
+                freeInput(&candidate);
+            }
+
+            if (!removed)
+            {
+                chunk /= 2;
+            }
+        }
+        printf("Minimized from %d inputs and %" PRIu32 " frames to %d inputs and %" PRIu32 " frames in %d runs\n",
+               input->numEvents, fuzz.frames, min.numEvents, frames, runs);
+    }
+
+    snprintf(path, sizeof(path), "%s.csv", base);
+    writeInput(&min, path);
+
+    snprintf(path, sizeof(path), "%s.txt", base);
+    FILE* file = fopen(path, "w");
+    if (NULL != file)
+    {
+        fprintf(file, "Crash:     %s\n", outcome->summary);
+        fprintf(file, "Signature: %016" PRIx64 "\n", outcome->signature);
+        fprintf(file, "Mode:      %s\n", fuzz.modes[input->mode]);
+        fprintf(file, "Frames:    %" PRIu32 "\n", frames);
+        fprintf(file, "Inputs:    %d (%d before minimizing)\n\n", min.numEvents, input->numEvents);
+        fprintf(file, "Reproduce with:\n  %s --fast-forward=%" PRIu32 " --mode \"%s\" --lock --nvs-memory --seed %d "
+                      "--playback %s.csv\n",
+                fuzz.emulator, frames, fuzz.modes[input->mode], EMU_SEED, base);
+        fclose(file);
+    }
+    freeInput(&min);
+}
+
+/**
+ * @brief Record a test case which took too long to run
+ *
+ * @param input The test case which hung
+ */
+static void handleHang(const input_t* input)
+{
+    fuzz.hangs++;
+    if (fuzz.hangs <= MAX_SAVED_HANGS)
+    {
+        char path[MAX_PATH * 2];
+        snprintf(path, sizeof(path), "%s/hangs/hang-%s-%03" PRIu64 ".csv", fuzz.outDir, fuzz.modeDirs[input->mode],
+                 fuzz.hangs);
+        writeInput(input, path);
+    }
+}
+
+/**
+ * @brief Print the fuzzing statistics
+ *
+ * @param final true to end the line, false to overwrite it next time
+ */
+static void printStatus(bool final)
+{
+    double seconds = (nowMs() - fuzz.startMs) / 1000.0;
+    printf("\r%6.0fs  runs %-9" PRIu64 " %6.1f/s  corpus %-6d edges %-6" PRIu32 " crashes %-5" PRIu64
+           " unique %-3d hangs %-4" PRIu64 "%s",
+           seconds, fuzz.runs, seconds > 0 ? fuzz.runs / seconds : 0, fuzz.corpusLen, fuzz.edges, fuzz.crashes,
+           fuzz.numSignatures, fuzz.hangs, final ? "\n" : "");
+    fflush(stdout);
+}
+
+/**
+ * @brief Print how to use this program
+ *
+ * @param prog The name of this program
+ */
+static void usage(const char* prog)
+{
+    printf("Usage: %s [OPTION...]\n"
+           "Coverage-guided fuzzing of Swadge modes with many headless emulators in parallel\n"
+           "The emulator must be built with 'make ENABLE_FUZZ_COVERAGE=true'\n\n"
+           "  -e, --emulator=PATH  The emulator to run (default " DEFAULT_EMULATOR ")\n"
+           "  -j, --jobs=N         Run N emulators at once (default: the number of CPUs)\n"
+           "  -m, --mode=MODE      Fuzz modes whose names start with MODE. May be repeated (default: every mode)\n"
+           "  -x, --exclude=MODE   Don't fuzz modes whose names start with MODE. May be repeated\n"
+           "  -f, --frames=N       Run each test case for N frames (default %d)\n"
+           "  -i, --input=DIR      Seed the corpus with the CSV replays in DIR, for every mode being fuzzed\n"
+           "  -o, --output=DIR     Write the corpus, crashes, and hangs to DIR (default " DEFAULT_OUT_DIR ")\n"
+           "  -n, --runs=N         Stop after N runs\n"
+           "  -t, --time=SECONDS   Stop after SECONDS seconds\n"
+           "  -T, --timeout=SEC    Count runs which take longer than SEC seconds as hangs (default %d)\n"
+           "  -s, --seed=SEED      Seed the mutations (default: the time)\n"
+           "      --no-minimize    Save crashes without minimizing them\n"
+           "  -h, --help           Print this help\n",
+           prog, DEFAULT_FRAMES, DEFAULT_TIMEOUT_S);
+}
+
+/**
+ * @brief Fuzz the emulator
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 if no new crashes were found, 1 if any were, 2 if there was an error
+ */
+int main(int argc, char** argv)
+{
+    const char* emulator = DEFAULT_EMULATOR;
+    const char* outDir   = DEFAULT_OUT_DIR;
+    const char* inDir    = NULL;
+    const char* include[64];
+    const char* exclude[64];
+    int numInclude = 0, numExclude = 0;
+
+    fuzz.numJobs   = sysconf(_SC_NPROCESSORS_ONLN);
+    fuzz.frames    = DEFAULT_FRAMES;
+    fuzz.timeoutS  = DEFAULT_TIMEOUT_S;
+    fuzz.minimize  = true;
+    fuzz.rng       = time(NULL);
+
+    static const struct option longOpts[] = {
+        {"emulator", required_argument, NULL, 'e'}, {"jobs", required_argument, NULL, 'j'},
+        {"mode", required_argument, NULL, 'm'},     {"exclude", required_argument, NULL, 'x'},
+        {"frames", required_argument, NULL, 'f'},   {"input", required_argument, NULL, 'i'},
+        {"output", required_argument, NULL, 'o'},   {"runs", required_argument, NULL, 'n'},
+        {"time", required_argument, NULL, 't'},     {"timeout", required_argument, NULL, 'T'},
+        {"seed", required_argument, NULL, 's'},     {"no-minimize", no_argument, NULL, 'M'},
+        {"help", no_argument, NULL, 'h'},           {0},
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "e:j:m:x:f:i:o:n:t:T:s:h", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'e':
+            {
+                emulator = optarg;
+                break;
+            }
+            case 'j':
+            {
+                fuzz.numJobs = atoi(optarg);
+                break;
+            }
+            case 'm':
+            {
+                if (numInclude < 64)
+                {
+                    include[numInclude++] = optarg;
+                }
+                break;
+            }
+            case 'x':
+            {
+                if (numExclude < 64)
+                {
+                    exclude[numExclude++] = optarg;
+                }
+                break;
+            }
+            case 'f':
+            {
+                fuzz.frames = strtoul(optarg, NULL, 10);
+                break;
+            }
+            case 'i':
+            {
+                inDir = optarg;
+                break;
+            }
+            case 'o':
+            {
+                outDir = optarg;
+                break;
+            }
+            case 'n':
+            {
+                fuzz.maxRuns = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 't':
+            {
+                fuzz.maxSeconds = strtoll(optarg, NULL, 10);
+                break;
+            }
+            case 'T':
+            {
+                fuzz.timeoutS = atoi(optarg);
+                break;
+            }
+            case 's':
+            {
+                fuzz.rng = strtoull(optarg, NULL, 10);
+                break;
+            }
+            case 'M':
+            {
+                fuzz.minimize = false;
+                break;
+            }
+            case 'h':
+            default:
+            {
+                usage(argv[0]);
+                return ('h' == opt) ? 0 : 2;
+            }
+        }
+    }
+
+    fuzz.numJobs = MAX(1, MIN(fuzz.numJobs, MAX_JOBS));
+    fuzz.rng |= 1;
+    if (0 == fuzz.frames || 0 >= fuzz.timeoutS)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Children run in other folders, so every path they use must be absolute
+    if (NULL == realpath(emulator, fuzz.emulator))
+    {
+        printf("ERR: Could not find the emulator at %s. Build it with 'make ENABLE_FUZZ_COVERAGE=true'\n", emulator);
+        return 2;
+    }
+    if (!makeDirs(outDir) || NULL == realpath(outDir, fuzz.outDir))
+    {
+        printf("ERR: Could not create %s\n", outDir);
+        return 2;
+    }
+
+    if (!loadModes(include, numInclude, exclude, numExclude))
+    {
+        printf("ERR: No modes to fuzz\n");
+        return 2;
+    }
+
+    // Every mode starts with an empty test case, then anything saved from earlier runs or given with --input
+    char path[MAX_PATH * 2];
+    for (int m = 0; m < fuzz.numModes; m++)
+    {
+        snprintf(path, sizeof(path), "%s/corpus/%s", fuzz.outDir, fuzz.modeDirs[m]);
+        makeDirs(path);
+        loadDir(path, m, true);
+    }
+    for (int m = 0; m < fuzz.numModes; m++)
+    {
+        fuzz.pending                    = realloc(fuzz.pending, sizeof(input_t) * (fuzz.pendingLen + 1));
+        fuzz.pending[fuzz.pendingLen++] = (input_t){.mode = m, .events = malloc(sizeof(event_t) * MAX_EVENTS)};
+        if (NULL != inDir)
+        {
+            loadDir(inDir, m, false);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/crashes", fuzz.outDir);
+    makeDirs(path);
+    snprintf(path, sizeof(path), "%s/hangs", fuzz.outDir);
+    makeDirs(path);
+    snprintf(path, sizeof(path), "%s/work/minimize", fuzz.outDir);
+    makeDirs(path);
+    for (int j = 0; j < fuzz.numJobs; j++)
+    {
+        snprintf(fuzz.jobs[j].dir, sizeof(fuzz.jobs[j].dir), "%s/work/%d", fuzz.outDir, j);
+        makeDirs(fuzz.jobs[j].dir);
+    }
+
+    memset(fuzz.virgin, 0xFF, sizeof(fuzz.virgin));
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("Fuzzing %d mode%s with %d jobs, %" PRIu32 " frames per run, %d test cases to start\n", fuzz.numModes,
+           fuzz.numModes == 1 ? "" : "s", fuzz.numJobs, fuzz.frames, fuzz.pendingLen);
+
+    fuzz.startMs        = nowMs();
+    int64_t lastPrintMs = 0;
+    bool sawCoverage    = false;
+    int running         = 0;
+    input_t scratch     = {.events = malloc(sizeof(event_t) * MAX_EVENTS)};
+
+    while (true)
+    {
+        bool done = stopRequested || (fuzz.maxRuns && fuzz.runs + running >= fuzz.maxRuns)
+                    || (fuzz.maxSeconds && nowMs() - fuzz.startMs >= fuzz.maxSeconds * 1000);
+
+        // Start test cases in every free job
+        for (int j = 0; j < fuzz.numJobs && !done; j++)
+        {
+            job_t* job = &fuzz.jobs[j];
+            if (0 != job->pid)
+            {
+                continue;
+            }
+            else if (fuzz.maxRuns && fuzz.runs + running >= fuzz.maxRuns)
+            {
+                break;
+            }
+
+            if (fuzz.pendingRun < fuzz.pendingLen)
+            {
+                // Run what was loaded before mutating anything, so the coverage of the corpus is known
+                int p = fuzz.pendingRun++;
+                if (startJob(job, &fuzz.pending[p], p < fuzz.pendingSaved, fuzz.frames))
+                {
+                    running++;
+                }
+                freeInput(&fuzz.pending[p]);
+            }
+            else
+            {
+                // Mutate a test case from the corpus, picking modes round robin so each gets the same time
+                int mode      = fuzz.nextMode;
+                fuzz.nextMode = (fuzz.nextMode + 1) % fuzz.numModes;
+                int pick      = pickFromCorpus(mode);
+
+                scratch.mode      = mode;
+                scratch.numEvents = 0;
+                if (pick >= 0)
+                {
+                    scratch.numEvents = fuzz.corpus[pick].numEvents;
+                    memcpy(scratch.events, fuzz.corpus[pick].events, sizeof(event_t) * scratch.numEvents);
+                }
+                mutate(&scratch);
+
+                if (startJob(job, &scratch, false, fuzz.frames))
+                {
+                    running++;
+                }
+            }
+        }
+
+        if (done && 0 == running)
+        {
+            break;
+        }
+
+        // Collect finished emulators
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0)
+        {
+            // Kill emulators which took too long, or every emulator when stopping
+            for (int j = 0; j < fuzz.numJobs; j++)
+            {
+                job_t* job = &fuzz.jobs[j];
+                if (0 != job->pid && (stopRequested || nowMs() - job->startMs > fuzz.timeoutS * 1000LL))
+                {
+                    kill(job->pid, SIGKILL);
+                    waitpid(job->pid, &status, 0);
+                    running--;
+
+                    if (!stopRequested)
+                    {
+                        finishJob(job, status, true);
+                        handleHang(&job->input);
+                        fuzz.runs++;
+                    }
+                    job->pid = 0;
+                    freeInput(&job->input);
+                }
+            }
+
+            if (nowMs() - lastPrintMs >= 1000)
+            {
+                lastPrintMs = nowMs();
+                printStatus(false);
+            }
+            usleep(1000);
+            continue;
+        }
+
+        for (int j = 0; j < fuzz.numJobs; j++)
+        {
+            job_t* job = &fuzz.jobs[j];
+            if (job->pid != pid)
+            {
+                continue;
+            }
+
+            running--;
+            fuzz.runs++;
+            runOutcome_t outcome = finishJob(job, status, false);
+
+            snprintf(path, sizeof(path), "%s/coverage.bin", job->dir);
+            switch (outcome.result)
+            {
+                case RUN_OK:
+                {
+                    if (hasNewCoverage(path))
+                    {
+                        sawCoverage = true;
+
+                        // Keep every test case which reached something new
+                        fuzz.corpus = realloc(fuzz.corpus, sizeof(input_t) * (fuzz.corpusLen + 1));
+                        fuzz.corpus[fuzz.corpusLen++] = copyInput(&job->input);
+                        if (!job->fromCorpus)
+                        {
+                            saveToCorpus(&job->input);
+                        }
+                    }
+                    else if (!sawCoverage && fuzz.runs >= (uint64_t)fuzz.numModes)
+                    {
+                        printf("\nERR: The emulator didn't write any coverage. Build it with "
+                               "'make clean; make ENABLE_FUZZ_COVERAGE=true'\n");
+                        stopRequested = 1;
+                    }
+                    break;
+                }
+                case RUN_CRASH:
+                {
+                    printStatus(false);
+                    handleCrash(&job->input, &outcome);
+                    break;
+                }
+                case RUN_HANG:
+                {
+                    handleHang(&job->input);
+                    break;
+                }
+                case RUN_ERROR:
+                default:
+                {
+                    fuzz.errors++;
+                    if (fuzz.errors == fuzz.runs)
+                    {
+                        printf("\nERR: The emulator exited with status %d, see %s/log.txt\n", outcome.exitStatus,
+                               job->dir);
+                        stopRequested = 1;
+                    }
+                    break;
+                }
+            }
+            freeInput(&job->input);
+            break;
+        }
+    }
+
+    printStatus(true);
+    printf("%" PRIu64 " crashes, %d unique. Crashes are in %s/crashes\n", fuzz.crashes, fuzz.numSignatures,
+           fuzz.outDir);
+
+    freeInput(&scratch);
+    for (int c = 0; c < fuzz.corpusLen; c++)
+    {
+        freeInput(&fuzz.corpus[c]);
+    }
+    free(fuzz.corpus);
+    free(fuzz.pending);
+    free(fuzz.signatures);
+    for (int m = 0; m < fuzz.numModes; m++)
+    {
+        free(fuzz.modes[m]);
+        free(fuzz.modeDirs[m]);
+    }
+    free(fuzz.modes);
+    free(fuzz.modeDirs);
+
+    return fuzz.numSignatures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+# Shared settings for the C programs in tools/ which are built for the host from the firmware's and emulator's sources
+#
+# Each tool's makefile sets EXECUTABLE and SOURCES, and optionally EXTRA_DEFINES, EXTRA_INC_DIRS, EXTRA_LIBS, and
+# EXTRA_CLEAN, then includes this file. Targets which only that tool has go after the include
+
+################################################################################
+# Programs to use
+################################################################################
+
+CC = gcc
+FIND = find
+
+################################################################################
+# Source Files
+################################################################################
+
+# Every tool is in its own directory in tools/
+ROOT = ../..
+
+# The emulator's ESP-IDF logging and heap functions, for tools which don't provide their own
+IDF_SOURCES = \
+	$(ROOT)/emulator/src/idf/esp_heap_caps.c \
+	$(ROOT)/emulator/src/idf/esp_log.c
+
+################################################################################
+# Compiler Flags
+################################################################################
+
+# These are flags for the compiler, all files. Optimize like the emulator does
+CFLAGS = -g -O2 -std=gnu17
+
+# These are warning flags that the IDF uses
+CFLAGS_WARNINGS = \
+	-Wall \
+	-Werror=all \
+	-Wno-error=unused-function \
+	-Wno-error=unused-variable \
+	-Wno-error=deprecated-declarations \
+	-Wextra \
+	-Wno-unused-parameter \
+	-Wno-sign-compare \
+	-Wno-enum-conversion \
+	-Wno-error=unused-but-set-variable \
+	-Wno-old-style-declaration \
+	-Wno-missing-field-initializers
+
+################################################################################
+# Defines
+################################################################################
+
+DEFINES_LIST = \
+	CONFIG_IDF_TARGET_ESP32S2=y \
+	CONFIG_LOG_MAXIMUM_LEVEL=1 \
+	_GNU_SOURCE \
+	$(EXTRA_DEFINES)
+DEFINES = $(patsubst %, -D%, $(DEFINES_LIST))
+
+################################################################################
+# Includes
+################################################################################
+
+INC_DIRS = \
+	$(shell $(FIND) $(ROOT)/main -type d) \
+	$(ROOT)/emulator/src \
+	$(ROOT)/emulator/src-lib \
+	$(ROOT)/emulator/idf-inc \
+	$(shell $(FIND) $(ROOT)/components -type d -iname "include") \
+	$(EXTRA_INC_DIRS)
+INC = $(patsubst %, -I%, $(INC_DIRS))
+
+################################################################################
+# Linker options
+################################################################################
+
+LIBS = m $(EXTRA_LIBS)
+LIBRARY_FLAGS = $(patsubst %, -l%, $(LIBS))
+
+################################################################################
+# Targets for Building
+################################################################################
+
+# This list of targets do not build files which match their name
+.PHONY: all clean print-%
+
+all: $(EXECUTABLE)
+
+# Build everything at once, since each tool is only a handful of files
+$(EXECUTABLE): $(SOURCES)
+	$(CC) $(CFLAGS) $(CFLAGS_WARNINGS) $(DEFINES) $(INC) $(SOURCES) $(LIBRARY_FLAGS) -o $@
+
+clean:
+	-@rm -f $(EXECUTABLE) $(EXTRA_CLEAN)
+
+################################################################################
+# Makefile Debugging
+################################################################################
+
+# Print any value from this makefile
+print-%  : ; @echo $* = $($*)
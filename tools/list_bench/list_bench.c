@@ -0,0 +1,649 @@
+/**
+ * @file list_bench.c
+ * @brief Compare the speed of lists with allocated nodes, pooled nodes, and intrusive nodes on the computer
+ *
+ * Every list is built unmodified from the firmware's linked_list.c and used through its public functions. The lists
+ * hold entities like a game mode would, and every value read back is checked. Indexed access is compared separately,
+ * walking from the first node like addIdx() and removeIdx() used to, from the nearest end, and from a cursor.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <esp_random.h>
+
+#include "linked_list.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The default number of operations in each list test
+#define DEFAULT_OPS 1000000
+
+/// @brief The default number of lookups in each index test
+#define DEFAULT_INDEX_OPS 100000
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/**
+ * @brief The kinds of lists which are compared
+ */
+typedef enum
+{
+    IMPL_HEAP,      ///< list_t allocating each node from the heap
+    IMPL_POOL,      ///< list_t taking nodes from a listPool_t with room for every entity
+    IMPL_INTRUSIVE, ///< ilist_t linking nodes embedded in the entities
+    NUM_IMPLS,
+} listImpl_t;
+
+/**
+ * @brief The tests which are run on every kind of list
+ */
+typedef enum
+{
+    TEST_QUEUE,   ///< Push every entity, then shift every entity
+    TEST_CHURN,   ///< Remove a random entity and push it back
+    TEST_ITERATE, ///< Iterate over every entity
+    NUM_TESTS,
+} listTest_t;
+
+/**
+ * @brief The ways of finding a node by index which are compared
+ */
+typedef enum
+{
+    WALK_FIRST,   ///< Walk from the first node
+    WALK_NEAREST, ///< getIdx() without a cursor, walking from the nearest end
+    WALK_CURSOR,  ///< getIdx() with a cursor
+    NUM_WALKS,
+} indexWalk_t;
+
+/**
+ * @brief The index tests which are run with every way of walking
+ */
+typedef enum
+{
+    ITEST_SEQUENTIAL, ///< Get every index in order
+    ITEST_RANDOM,     ///< Get random indices
+    NUM_ITESTS,
+} indexTest_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Options given on the command line
+ */
+typedef struct
+{
+    uint32_t ops;      ///< The number of operations in each list test
+    uint32_t indexOps; ///< The number of lookups in each index test
+    int32_t sizes[8];  ///< The numbers of entities to test with
+    int32_t numSizes;  ///< The number of entries in sizes
+} benchArgs_t;
+
+/**
+ * @brief An entity which is kept in a list, like an enemy in a game
+ */
+typedef struct
+{
+    int32_t value;    ///< The entity's data, its index plus one
+    node_t* node;     ///< The entity's node in a list_t, for removing it directly
+    ilistNode_t link; ///< The entity's node in an ilist_t
+} entity_t;
+
+/**
+ * @brief One list of any kind, and the entities it's tested with
+ */
+typedef struct
+{
+    listImpl_t impl;     ///< Which kind of list this is
+    list_t list;         ///< The list, for IMPL_HEAP and IMPL_POOL
+    listPool_t pool;     ///< The pool, for IMPL_POOL
+    ilist_t ilist;       ///< The list, for IMPL_INTRUSIVE
+    entity_t* entities;  ///< The entities which are put in the list
+    int32_t* order;      ///< A random order of entity indices
+    int32_t numEntities; ///< The number of entities
+} benchList_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static int64_t nowNs(void);
+static void listAdd(benchList_t* l, entity_t* e);
+static entity_t* listTake(benchList_t* l);
+static void listRemove(benchList_t* l, entity_t* e);
+static int32_t listSum(benchList_t* l);
+static void listFill(benchList_t* l);
+static void listEmpty(benchList_t* l);
+static int64_t runTest(benchList_t* l, listTest_t test, int32_t rounds, bool* ok);
+static node_t* walkFromFirst(list_t* list, int index);
+static int64_t runIndexTest(list_t* list, indexWalk_t walk, indexTest_t test, const int32_t* indices,
+                            int32_t numIndices, int32_t rounds, bool* ok);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+/// @brief State for esp_random()
+static uint64_t randState = 0x9E3779B97F4A7C15ULL;
+
+/// @brief The name of each kind of list
+static const char* const implNames[NUM_IMPLS] = {"heap", "pool", "intrusive"};
+
+/// @brief The name of each test
+static const char* const testNames[NUM_TESTS] = {"queue", "churn", "iterate"};
+
+/// @brief The name of each way of walking
+static const char* const walkNames[NUM_WALKS] = {"from first", "nearest end", "cursor"};
+
+/// @brief The name of each index test
+static const char* const indexTestNames[NUM_ITESTS] = {"in order", "random"};
+
+static const struct option longOpts[] = {
+    {"ops", required_argument, NULL, 'n'},
+    {"index-ops", required_argument, NULL, 'x'},
+    {"sizes", required_argument, NULL, 'z'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Generate a random number for linked_list.c and entity orders. This is a xorshift64* generator, so runs are
+ * repeatable
+ *
+ * @return A random number
+ */
+uint32_t esp_random(void)
+{
+    randState ^= randState >> 12;
+    randState ^= randState << 25;
+    randState ^= randState >> 27;
+    return (uint32_t)((randState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief Get the real time
+ *
+ * @return The monotonic time, in nanoseconds
+ */
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**
+ * @brief Add an entity to the end of a list
+ *
+ * @param l The list
+ * @param e The entity
+ */
+static void listAdd(benchList_t* l, entity_t* e)
+{
+    if (IMPL_INTRUSIVE == l->impl)
+    {
+        ilistPush(&l->ilist, &e->link);
+    }
+    else
+    {
+        push(&l->list, e);
+        e->node = l->list.last;
+    }
+}
+
+/**
+ * @brief Take the entity from the front of a list
+ *
+ * @param l The list
+ * @return The entity, or NULL if the list was empty
+ */
+static entity_t* listTake(benchList_t* l)
+{
+    if (IMPL_INTRUSIVE == l->impl)
+    {
+        ilistNode_t* node = ilistShift(&l->ilist);
+        return (NULL == node) ? NULL : ILIST_ENTRY(node, entity_t, link);
+    }
+    return shift(&l->list);
+}
+
+/**
+ * @brief Remove an entity from anywhere in a list
+ *
+ * @param l The list
+ * @param e The entity, which must be in the list
+ */
+static void listRemove(benchList_t* l, entity_t* e)
+{
+    if (IMPL_INTRUSIVE == l->impl)
+    {
+        ilistRemove(&l->ilist, &e->link);
+    }
+    else
+    {
+        removeEntry(&l->list, e->node);
+        e->node = NULL;
+    }
+}
+
+/**
+ * @brief Iterate over every entity in a list
+ *
+ * @param l The list
+ * @return The sum of every entity's value, which checks that every entity was visited once
+ */
+static int32_t listSum(benchList_t* l)
+{
+    int32_t sum = 0;
+    if (IMPL_INTRUSIVE == l->impl)
+    {
+        for (ilistNode_t* node = l->ilist.first; NULL != node; node = node->next)
+        {
+            sum += ILIST_ENTRY(node, entity_t, link)->value;
+        }
+    }
+    else
+    {
+        for (node_t* node = l->list.first; NULL != node; node = node->next)
+        {
+            sum += ((entity_t*)node->val)->value;
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief Add every entity to a list, in order
+ *
+ * @param l The list
+ */
+static void listFill(benchList_t* l)
+{
+    for (int32_t i = 0; i < l->numEntities; i++)
+    {
+        listAdd(l, &l->entities[i]);
+    }
+}
+
+/**
+ * @brief Remove every entity from a list
+ *
+ * @param l The list
+ */
+static void listEmpty(benchList_t* l)
+{
+    if (IMPL_INTRUSIVE == l->impl)
+    {
+        while (NULL != ilistShift(&l->ilist))
+        {
+        }
+    }
+    else
+    {
+        clear(&l->list);
+    }
+}
+
+/**
+ * @brief Run one test on a list
+ *
+ * @param l The list
+ * @param test The test to run
+ * @param rounds The number of times to run the test
+ * @param[out] ok Set to false if the list returned a wrong value
+ * @return The time spent in the list's functions, in nanoseconds
+ */
+static int64_t runTest(benchList_t* l, listTest_t test, int32_t rounds, bool* ok)
+{
+    int64_t elapsedNs = 0;
+    int32_t n         = l->numEntities;
+    int32_t fullSum   = (int32_t)(((int64_t)n * (n + 1)) / 2);
+
+    if (TEST_QUEUE != test)
+    {
+        listFill(l);
+    }
+
+    for (int32_t r = 0; r < rounds; r++)
+    {
+        switch (test)
+        {
+            case TEST_QUEUE:
+            {
+                int64_t start = nowNs();
+                listFill(l);
+                for (int32_t i = 0; i < n; i++)
+                {
+                    *ok &= (listTake(l) == &l->entities[i]);
+                }
+                elapsedNs += nowNs() - start;
+                break;
+            }
+            case TEST_CHURN:
+            {
+                int64_t start = nowNs();
+                for (int32_t i = 0; i < n; i++)
+                {
+                    entity_t* e = &l->entities[l->order[i]];
+                    listRemove(l, e);
+                    listAdd(l, e);
+                }
+                elapsedNs += nowNs() - start;
+                break;
+            }
+            case TEST_ITERATE:
+            default:
+            {
+                int64_t start = nowNs();
+                int32_t sum   = listSum(l);
+                elapsedNs += nowNs() - start;
+                *ok &= (sum == fullSum);
+                break;
+            }
+        }
+    }
+
+    if (TEST_QUEUE != test)
+    {
+        // Churning reorders the entities, but every one must still be there once
+        *ok &= (listSum(l) == fullSum);
+        listEmpty(l);
+    }
+    *ok &= (0 == l->list.length && 0 == l->ilist.length);
+    return elapsedNs;
+}
+
+/**
+ * @brief Find a node by walking from the first node, the way addIdx() and removeIdx() used to
+ *
+ * @param list The list
+ * @param index The index of the node, which must be valid
+ * @return The node
+ */
+static node_t* walkFromFirst(list_t* list, int index)
+{
+    node_t* node = list->first;
+    while (index--)
+    {
+        node = node->next;
+    }
+    return node;
+}
+
+/**
+ * @brief Run one index test on a list
+ *
+ * @param list The list, whose values are their index plus one
+ * @param walk The way of finding nodes
+ * @param test The test to run
+ * @param indices Random indices, for ITEST_RANDOM
+ * @param numIndices The number of indices to get in each round
+ * @param rounds The number of times to run the test
+ * @param[out] ok Set to false if the list returned a wrong value
+ * @return The time spent finding nodes, in nanoseconds
+ */
+static int64_t runIndexTest(list_t* list, indexWalk_t walk, indexTest_t test, const int32_t* indices,
+                            int32_t numIndices, int32_t rounds, bool* ok)
+{
+    int64_t elapsedNs = 0;
+    for (int32_t r = 0; r < rounds; r++)
+    {
+        listCursor_t cursor = {0};
+        int64_t start       = nowNs();
+        for (int32_t i = 0; i < numIndices; i++)
+        {
+            int32_t idx = (ITEST_RANDOM == test) ? indices[i] : i;
+            void* val;
+            switch (walk)
+            {
+                case WALK_FIRST:
+                    val = walkFromFirst(list, idx)->val;
+                    break;
+                case WALK_NEAREST:
+                    val = getIdx(list, NULL, idx);
+                    break;
+                case WALK_CURSOR:
+                default:
+                    val = getIdx(list, &cursor, idx);
+                    break;
+            }
+            *ok &= ((intptr_t)val == idx + 1);
+        }
+        elapsedNs += nowNs() - start;
+    }
+    return elapsedNs;
+}
+
+/**
+ * @brief Print the command line options
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...]\n", progName);
+    printf("Compare the speed of lists with allocated, pooled, and intrusive nodes, and of indexed access\n\n");
+    printf("  -n, --ops=N               Operations in each list test (default %d)\n", DEFAULT_OPS);
+    printf("  -x, --index-ops=N         Lookups in each index test (default %d)\n", DEFAULT_INDEX_OPS);
+    printf("  -z, --sizes=N,N,...       Numbers of entities to test with, up to 8 (default 10,100,1000,10000)\n");
+    printf("  -h, --help                Give this help list\n");
+}
+
+/**
+ * @brief Parse arguments, run every test, and print the results
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 if a list returned a wrong value, 2 on bad arguments
+ */
+int main(int argc, char** argv)
+{
+    benchArgs_t args = {
+        .ops      = DEFAULT_OPS,
+        .indexOps = DEFAULT_INDEX_OPS,
+        .sizes    = {10, 100, 1000, 10000},
+        .numSizes = 4,
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:x:z:h", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'n':
+                args.ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                args.indexOps = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+            {
+                args.numSizes = 0;
+                for (char* tok = strtok(optarg, ","); NULL != tok && args.numSizes < 8; tok = strtok(NULL, ","))
+                {
+                    args.sizes[args.numSizes++] = atoi(tok);
+                }
+                break;
+            }
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (0 == args.ops || 0 == args.indexOps || 0 == args.numSizes)
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+    for (int32_t s = 0; s < args.numSizes; s++)
+    {
+        if (args.sizes[s] < 1)
+        {
+            fprintf(stderr, "ERROR: Sizes must be greater than 0\n");
+            return 2;
+        }
+    }
+
+    bool ok = true;
+
+    // Compare the kinds of list
+    printf("%6s %-8s", "n", "test");
+    for (int32_t impl = 0; impl < NUM_IMPLS; impl++)
+    {
+        printf(" %14s", implNames[impl]);
+    }
+    printf("   (ns/op, speedup vs heap)\n");
+
+    for (int32_t s = 0; s < args.numSizes; s++)
+    {
+        int32_t n      = args.sizes[s];
+        int32_t rounds = (args.ops + n - 1) / n;
+
+        // Make the entities once. Each list test leaves the list empty, so they're shared
+        entity_t* entities = calloc(n, sizeof(entity_t));
+        int32_t* order     = calloc(n, sizeof(int32_t));
+        for (int32_t i = 0; i < n; i++)
+        {
+            entities[i].value = i + 1;
+            order[i]          = i;
+        }
+        for (int32_t i = n - 1; i > 0; i--)
+        {
+            int32_t j = esp_random() % (i + 1);
+            int32_t t = order[i];
+            order[i]  = order[j];
+            order[j]  = t;
+        }
+
+        for (int32_t test = 0; test < NUM_TESTS; test++)
+        {
+            printf("%6" PRId32 " %-8s", n, testNames[test]);
+            double heapNsPerOp = 0;
+            for (int32_t impl = 0; impl < NUM_IMPLS; impl++)
+            {
+                benchList_t l = {
+                    .impl        = impl,
+                    .entities    = entities,
+                    .order       = order,
+                    .numEntities = n,
+                };
+                if (IMPL_POOL == impl)
+                {
+                    initListPool(&l.pool, n);
+                    l.list.pool = &l.pool;
+                }
+
+                bool testOk    = true;
+                int64_t ns     = runTest(&l, test, rounds, &testOk);
+                double nsPerOp = (double)ns / ((int64_t)rounds * n);
+                if (IMPL_HEAP == impl)
+                {
+                    heapNsPerOp = nsPerOp;
+                    printf(" %14.1f", nsPerOp);
+                }
+                else
+                {
+                    printf(" %7.1f (%4.1fx)", nsPerOp, (nsPerOp > 0) ? heapNsPerOp / nsPerOp : 0);
+                }
+
+                if (IMPL_POOL == impl)
+                {
+                    // The pool has room for every entity, so it should never fall back to the heap
+                    testOk &= (0 == l.pool.overflows && 0 == l.pool.used);
+                    deinitListPool(&l.pool);
+                }
+                if (!testOk)
+                {
+                    fprintf(stderr, "\nERROR: %s list returned a wrong value\n", implNames[impl]);
+                    ok = false;
+                }
+            }
+            printf("\n");
+        }
+
+        free(entities);
+        free(order);
+    }
+
+    // Compare the ways of finding a node by index
+    printf("\n%6s %-10s", "n", "index");
+    for (int32_t walk = 0; walk < NUM_WALKS; walk++)
+    {
+        printf(" %14s", walkNames[walk]);
+    }
+    printf("   (ns/op, speedup vs from first)\n");
+
+    for (int32_t s = 0; s < args.numSizes; s++)
+    {
+        int32_t n      = args.sizes[s];
+        int32_t rounds = (args.indexOps + n - 1) / n;
+
+        // The values are their index plus one, so every lookup can be checked
+        list_t list      = {0};
+        int32_t* indices = calloc(n, sizeof(int32_t));
+        for (int32_t i = 0; i < n; i++)
+        {
+            push(&list, (void*)(intptr_t)(i + 1));
+            indices[i] = esp_random() % n;
+        }
+
+        for (int32_t test = 0; test < NUM_ITESTS; test++)
+        {
+            printf("%6" PRId32 " %-10s", n, indexTestNames[test]);
+            double firstNsPerOp = 0;
+            for (int32_t walk = 0; walk < NUM_WALKS; walk++)
+            {
+                bool testOk    = true;
+                int64_t ns     = runIndexTest(&list, walk, test, indices, n, rounds, &testOk);
+                double nsPerOp = (double)ns / ((int64_t)rounds * n);
+                if (WALK_FIRST == walk)
+                {
+                    firstNsPerOp = nsPerOp;
+                    printf(" %14.1f", nsPerOp);
+                }
+                else
+                {
+                    printf(" %7.1f (%4.1fx)", nsPerOp, (nsPerOp > 0) ? firstNsPerOp / nsPerOp : 0);
+                }
+
+                if (!testOk)
+                {
+                    fprintf(stderr, "\nERROR: walking %s returned a wrong value\n", walkNames[walk]);
+                    ok = false;
+                }
+            }
+            printf("\n");
+        }
+
+        clear(&list);
+        free(indices);
+    }
+
+    return ok ? 0 : 1;
+}
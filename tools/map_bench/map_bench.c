@@ -0,0 +1,569 @@
+/**
+ * @file map_bench.c
+ * @brief Compare the speed of hashMap.c and flatMap.c on the computer
+ *
+ * Both maps are built unmodified from the firmware's sources and used through their public functions. Each test is
+ * run with string keys and with integer keys, for maps of different sizes, and every value read back is checked.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <esp_random.h>
+
+#include "arena.h"
+#include "flatMap.h"
+#include "hashMap.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The default number of operations in each test
+#define DEFAULT_OPS 1000000
+
+/// @brief The initial size given to maps which grow as they are filled
+#define INITIAL_SIZE 16
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/**
+ * @brief The map implementations which are compared
+ */
+typedef enum
+{
+    IMPL_HASH,  ///< hashMap.c, starting small and growing
+    IMPL_FLAT,  ///< flatMap.c, starting small and growing
+    IMPL_ARENA, ///< flatMap.c in an arena, with room reserved for every key up front
+    NUM_IMPLS,
+} mapImpl_t;
+
+/**
+ * @brief The tests which are run on every map
+ */
+typedef enum
+{
+    TEST_BUILD,   ///< Initialize a map, put every key, then deinitialize it
+    TEST_GET,     ///< Get every key, in a random order
+    TEST_MISS,    ///< Get keys which aren't in the map
+    TEST_ITERATE, ///< Iterate over every entry
+    TEST_REMOVE,  ///< Remove every key, in a random order
+    NUM_TESTS,
+} mapTest_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Options given on the command line
+ */
+typedef struct
+{
+    uint32_t ops;     ///< The number of operations in each test
+    bool intsOnly;    ///< true to only test integer keys
+    bool strsOnly;    ///< true to only test string keys
+    int32_t sizes[8]; ///< The numbers of keys to test with
+    int32_t numSizes; ///< The number of entries in sizes
+} benchArgs_t;
+
+/**
+ * @brief One map of any implementation, and the keys it's tested with
+ */
+typedef struct
+{
+    mapImpl_t impl;        ///< Which implementation this is
+    bool strKeys;          ///< true for string keys, false for integer keys
+    hashMap_t hash;        ///< The map, for IMPL_HASH
+    flatMap_t flat;        ///< The map, for IMPL_FLAT and IMPL_ARENA
+    arena_t arena;         ///< The arena, for IMPL_ARENA
+    uint8_t* arenaMem;     ///< The arena's memory
+    size_t arenaSize;      ///< The size of arenaMem
+    const void** keys;     ///< The keys which are put in the map
+    const void** missKeys; ///< Keys which are never in the map
+    int32_t* order;        ///< A random order of key indices
+    int32_t numKeys;       ///< The number of keys
+} benchMap_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static int64_t nowNs(void);
+static void mapInit(benchMap_t* m);
+static void mapPut(benchMap_t* m, const void* key, void* value);
+static void* mapGet(benchMap_t* m, const void* key);
+static void* mapRemove(benchMap_t* m, const void* key);
+static int32_t mapIterate(benchMap_t* m);
+static void mapDeinit(benchMap_t* m);
+static void mapFill(benchMap_t* m);
+static int64_t runTest(benchMap_t* m, mapTest_t test, int32_t rounds, bool* ok);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+/// @brief State for esp_random()
+static uint64_t randState = 0x9E3779B97F4A7C15ULL;
+
+/// @brief The name of each implementation
+static const char* const implNames[NUM_IMPLS] = {"hashMap", "flatMap", "flatMap+arena"};
+
+/// @brief The name of each test
+static const char* const testNames[NUM_TESTS] = {"build", "get", "miss", "iterate", "remove"};
+
+static const struct option longOpts[] = {
+    {"ops", required_argument, NULL, 'n'},
+    {"sizes", required_argument, NULL, 'z'},
+    {"ints", no_argument, NULL, 'i'},
+    {"strings", no_argument, NULL, 's'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Generate a random number for linked_list.c and key orders. This is a xorshift64* generator, so runs are
+ * repeatable
+ *
+ * @return A random number
+ */
+uint32_t esp_random(void)
+{
+    randState ^= randState >> 12;
+    randState ^= randState << 25;
+    randState ^= randState >> 27;
+    return (uint32_t)((randState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief Get the real time
+ *
+ * @return The monotonic time, in nanoseconds
+ */
+static int64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**
+ * @brief Initialize a map with the functions for its key type
+ *
+ * @param m The map to initialize
+ */
+static void mapInit(benchMap_t* m)
+{
+    hashFunction_t hashFn = m->strKeys ? NULL : hashInt;
+    eqFunction_t eqFn     = m->strKeys ? NULL : intsEq;
+    switch (m->impl)
+    {
+        case IMPL_HASH:
+            hashInitBin(&m->hash, INITIAL_SIZE, hashFn, eqFn);
+            break;
+        case IMPL_FLAT:
+            flatInitBin(&m->flat, INITIAL_SIZE, hashFn, eqFn);
+            break;
+        case IMPL_ARENA:
+        default:
+            arenaReset(&m->arena);
+            flatInitArena(&m->flat, m->numKeys, hashFn, eqFn, &m->arena);
+            break;
+    }
+}
+
+/**
+ * @brief Put a key in a map
+ *
+ * @param m The map
+ * @param key The key
+ * @param value The value
+ */
+static void mapPut(benchMap_t* m, const void* key, void* value)
+{
+    if (IMPL_HASH == m->impl)
+    {
+        hashPutBin(&m->hash, key, value);
+    }
+    else
+    {
+        flatPutBin(&m->flat, key, value);
+    }
+}
+
+/**
+ * @brief Get a key's value from a map
+ *
+ * @param m The map
+ * @param key The key
+ * @return The value, or NULL if the key isn't in the map
+ */
+static void* mapGet(benchMap_t* m, const void* key)
+{
+    return (IMPL_HASH == m->impl) ? hashGetBin(&m->hash, key) : flatGetBin(&m->flat, key);
+}
+
+/**
+ * @brief Remove a key from a map
+ *
+ * @param m The map
+ * @param key The key
+ * @return The removed value, or NULL if the key wasn't in the map
+ */
+static void* mapRemove(benchMap_t* m, const void* key)
+{
+    return (IMPL_HASH == m->impl) ? hashRemoveBin(&m->hash, key) : flatRemoveBin(&m->flat, key);
+}
+
+/**
+ * @brief Iterate over every entry in a map
+ *
+ * @param m The map
+ * @return The sum of every value, which checks that every entry was returned once
+ */
+static int32_t mapIterate(benchMap_t* m)
+{
+    int32_t sum = 0;
+    if (IMPL_HASH == m->impl)
+    {
+        hashIterator_t iter = {0};
+        while (hashIterate(&m->hash, &iter))
+        {
+            sum += (intptr_t)iter.value;
+        }
+    }
+    else
+    {
+        flatIterator_t iter = {0};
+        while (flatIterate(&m->flat, &iter))
+        {
+            sum += (intptr_t)iter.value;
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief Deinitialize a map
+ *
+ * @param m The map
+ */
+static void mapDeinit(benchMap_t* m)
+{
+    if (IMPL_HASH == m->impl)
+    {
+        hashDeinit(&m->hash);
+    }
+    else
+    {
+        flatDeinit(&m->flat);
+    }
+}
+
+/**
+ * @brief Initialize a map and put every key in it. The value of each key is its index plus one
+ *
+ * @param m The map
+ */
+static void mapFill(benchMap_t* m)
+{
+    mapInit(m);
+    for (int32_t i = 0; i < m->numKeys; i++)
+    {
+        mapPut(m, m->keys[i], (void*)(intptr_t)(i + 1));
+    }
+}
+
+/**
+ * @brief Run one test on a map
+ *
+ * @param m The map
+ * @param test The test to run
+ * @param rounds The number of times to run the test
+ * @param[out] ok Set to false if the map returned a wrong value
+ * @return The time spent in the map's functions, in nanoseconds
+ */
+static int64_t runTest(benchMap_t* m, mapTest_t test, int32_t rounds, bool* ok)
+{
+    int64_t elapsedNs = 0;
+    int32_t n         = m->numKeys;
+
+    if (TEST_BUILD != test && TEST_REMOVE != test)
+    {
+        mapFill(m);
+    }
+
+    for (int32_t r = 0; r < rounds; r++)
+    {
+        switch (test)
+        {
+            case TEST_BUILD:
+            {
+                int64_t start = nowNs();
+                mapFill(m);
+                mapDeinit(m);
+                elapsedNs += nowNs() - start;
+                break;
+            }
+            case TEST_GET:
+            {
+                int64_t start = nowNs();
+                for (int32_t i = 0; i < n; i++)
+                {
+                    int32_t k = m->order[i];
+                    *ok &= ((intptr_t)mapGet(m, m->keys[k]) == k + 1);
+                }
+                elapsedNs += nowNs() - start;
+                break;
+            }
+            case TEST_MISS:
+            {
+                int64_t start = nowNs();
+                for (int32_t i = 0; i < n; i++)
+                {
+                    *ok &= (NULL == mapGet(m, m->missKeys[i]));
+                }
+                elapsedNs += nowNs() - start;
+                break;
+            }
+            case TEST_ITERATE:
+            {
+                int64_t start = nowNs();
+                int32_t sum   = mapIterate(m);
+                elapsedNs += nowNs() - start;
+                *ok &= (sum == (int32_t)(((int64_t)n * (n + 1)) / 2));
+                break;
+            }
+            case TEST_REMOVE:
+            default:
+            {
+                // Only the removals are timed
+                mapFill(m);
+                int64_t start = nowNs();
+                for (int32_t i = 0; i < n; i++)
+                {
+                    int32_t k = m->order[i];
+                    *ok &= ((intptr_t)mapRemove(m, m->keys[k]) == k + 1);
+                }
+                elapsedNs += nowNs() - start;
+                *ok &= (0 == ((IMPL_HASH == m->impl) ? m->hash.count : m->flat.count));
+                mapDeinit(m);
+                break;
+            }
+        }
+    }
+
+    if (TEST_BUILD != test && TEST_REMOVE != test)
+    {
+        mapDeinit(m);
+    }
+    return elapsedNs;
+}
+
+/**
+ * @brief Print the command line options
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...]\n", progName);
+    printf("Compare the speed of hashMap and flatMap with string and integer keys\n\n");
+    printf("  -n, --ops=N               Operations in each test (default %d)\n", DEFAULT_OPS);
+    printf("  -z, --sizes=N,N,...       Numbers of keys to test with, up to 8 (default 10,100,1000,10000)\n");
+    printf("  -i, --ints                Only test integer keys\n");
+    printf("  -s, --strings             Only test string keys\n");
+    printf("  -h, --help                Give this help list\n");
+}
+
+/**
+ * @brief Parse arguments, run every test, and print the results
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 if a map returned a wrong value, 2 on bad arguments
+ */
+int main(int argc, char** argv)
+{
+    benchArgs_t args = {
+        .ops      = DEFAULT_OPS,
+        .sizes    = {10, 100, 1000, 10000},
+        .numSizes = 4,
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:z:ish", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'n':
+                args.ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+            {
+                args.numSizes = 0;
+                for (char* tok = strtok(optarg, ","); NULL != tok && args.numSizes < 8; tok = strtok(NULL, ","))
+                {
+                    args.sizes[args.numSizes++] = atoi(tok);
+                }
+                break;
+            }
+            case 'i':
+                args.intsOnly = true;
+                break;
+            case 's':
+                args.strsOnly = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (0 == args.ops || 0 == args.numSizes || (args.intsOnly && args.strsOnly))
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+    for (int32_t s = 0; s < args.numSizes; s++)
+    {
+        if (args.sizes[s] < 1)
+        {
+            fprintf(stderr, "ERROR: Sizes must be greater than 0\n");
+            return 2;
+        }
+    }
+
+    bool ok = true;
+    printf("%-8s %6s %-8s", "keys", "n", "test");
+    for (int32_t impl = 0; impl < NUM_IMPLS; impl++)
+    {
+        printf(" %14s", implNames[impl]);
+    }
+    printf("   (ns/op, speedup vs hashMap)\n");
+
+    for (int32_t keyType = 0; keyType < 2; keyType++)
+    {
+        bool strKeys = (0 == keyType);
+        if ((strKeys && args.intsOnly) || (!strKeys && args.strsOnly))
+        {
+            continue;
+        }
+
+        for (int32_t s = 0; s < args.numSizes; s++)
+        {
+            int32_t n      = args.sizes[s];
+            int32_t rounds = (args.ops + n - 1) / n;
+
+            // Make the keys once, so that making them isn't measured. Integer keys are spread out, and never 0, since
+            // hashMap treats a NULL key as an empty bucket
+            char (*strs)[16]      = calloc(2 * n, sizeof(*strs));
+            const void** keys     = calloc(n, sizeof(const void*));
+            const void** missKeys = calloc(n, sizeof(const void*));
+            int32_t* order        = calloc(n, sizeof(int32_t));
+            for (int32_t i = 0; i < n; i++)
+            {
+                if (strKeys)
+                {
+                    snprintf(strs[i], sizeof(*strs), "key%" PRId32, i);
+                    snprintf(strs[n + i], sizeof(*strs), "miss%" PRId32, i);
+                    keys[i]     = strs[i];
+                    missKeys[i] = strs[n + i];
+                }
+                else
+                {
+                    keys[i]     = (const void*)(intptr_t)((i + 1) * 7919);
+                    missKeys[i] = (const void*)(intptr_t)((i + 1) * 7919 + 1);
+                }
+                order[i] = i;
+            }
+            for (int32_t i = n - 1; i > 0; i--)
+            {
+                int32_t j = esp_random() % (i + 1);
+                int32_t t = order[i];
+                order[i]  = order[j];
+                order[j]  = t;
+            }
+
+            // Enough for the reserved arrays, plus alignment
+            size_t arenaSize = 0;
+            {
+                flatMap_t sizer = {0};
+                flatReserve(&sizer, n);
+                arenaSize = (size_t)sizer.size * (sizeof(uint32_t) + sizeof(flatEntry_t)) + ARENA_ALIGN;
+                flatDeinit(&sizer);
+            }
+
+            for (int32_t test = 0; test < NUM_TESTS; test++)
+            {
+                printf("%-8s %6" PRId32 " %-8s", strKeys ? "string" : "int", n, testNames[test]);
+                double hashNsPerOp = 0;
+                for (int32_t impl = 0; impl < NUM_IMPLS; impl++)
+                {
+                    benchMap_t m = {
+                        .impl      = impl,
+                        .strKeys   = strKeys,
+                        .arenaSize = arenaSize,
+                        .keys      = keys,
+                        .missKeys  = missKeys,
+                        .order     = order,
+                        .numKeys   = n,
+                    };
+                    if (IMPL_ARENA == impl)
+                    {
+                        m.arenaMem = malloc(arenaSize);
+                        arenaInit(&m.arena, m.arenaMem, arenaSize);
+                    }
+
+                    bool testOk    = true;
+                    int64_t ns     = runTest(&m, test, rounds, &testOk);
+                    double nsPerOp = (double)ns / ((int64_t)rounds * n);
+                    if (IMPL_HASH == impl)
+                    {
+                        hashNsPerOp = nsPerOp;
+                        printf(" %14.1f", nsPerOp);
+                    }
+                    else
+                    {
+                        printf(" %7.1f (%4.1fx)", nsPerOp, (nsPerOp > 0) ? hashNsPerOp / nsPerOp : 0);
+                    }
+
+                    if (!testOk)
+                    {
+                        fprintf(stderr, "\nERROR: %s returned a wrong value\n", implNames[impl]);
+                        ok = false;
+                    }
+                    free(m.arenaMem);
+                }
+                printf("\n");
+            }
+
+            free(strs);
+            free(keys);
+            free(missKeys);
+            free(order);
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,588 @@
+/**
+ * @file midi_render.c
+ * @brief Render a MIDI file from CNFS to a WAV file as fast as possible, using the same MIDI player as the firmware
+ *
+ * This is used to benchmark the synthesizer and to check that changes to it don't change its output. Songs are
+ * rendered with midiPlayerFillBuffer() into unsigned 8-bit mono samples at ::DAC_SAMPLE_RATE_HZ, exactly what would be
+ * sent to the DAC. A render can be written to a WAV file, and compared against a previously written "golden" WAV file
+ * with a numeric tolerance.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "hdw-dac.h"
+#include "hdw-nvs.h"
+#include "cnfs.h"
+#include "cnfs_image.h"
+#include "midiPlayer.h"
+#include "midiFileParser.h"
+#include "midiData.h"
+#include "drums.h"
+#include "macros.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The default maximum length of a render, in seconds
+#define DEFAULT_MAX_SECONDS 600
+
+/// @brief The size of a canonical PCM WAV header
+#define WAV_HEADER_SIZE 44
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Options parsed from the command line
+ */
+typedef struct
+{
+    const char* song;
+    const char* outFile;
+    const char* goldenFile;
+    uint32_t maxSeconds;
+    int32_t repeat;
+    int32_t tolerance;
+    double rmsTolerance;
+    bool drumTables;
+    bool quiet;
+} renderArgs_t;
+
+/**
+ * @brief The result of comparing a render against a golden render
+ */
+typedef struct
+{
+    uint32_t maxDiff;
+    uint32_t diffSamples;
+    double rms;
+} renderDiff_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static void songFinishedCb(void);
+static double nowSeconds(void);
+static uint8_t* renderSong(const midiFile_t* song, uint32_t maxSamples, uint32_t* outLen, double* outTime,
+                           uint32_t* outClipped);
+static void putLe16(uint8_t* out, uint16_t val);
+static void putLe32(uint8_t* out, uint32_t val);
+static uint32_t getLe32(const uint8_t* in);
+static uint16_t getLe16(const uint8_t* in);
+static bool writeWav(const char* fname, const uint8_t* samples, uint32_t len);
+static uint8_t* readWav(const char* fname, uint32_t* outLen);
+static void compareRenders(const uint8_t* a, const uint8_t* b, uint32_t len, renderDiff_t* diff);
+static void listSongs(void);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+/// @brief Set when the player reaches the end of the song
+static bool songFinished = false;
+
+static const struct option longOpts[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"golden", required_argument, NULL, 'g'},
+    {"tolerance", required_argument, NULL, 't'},
+    {"rms-tolerance", required_argument, NULL, 'r'},
+    {"seconds", required_argument, NULL, 's'},
+    {"repeat", required_argument, NULL, 'n'},
+    {"drum-tables", no_argument, NULL, 'd'},
+    {"list", no_argument, NULL, 'l'},
+    {"quiet", no_argument, NULL, 'q'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// Stubs
+//==============================================================================
+
+/**
+ * @brief There is no NVS in this tool, so nothing can be read from it
+ *
+ * @return false, always
+ */
+bool readNamespaceNvsBlob(const char* namespace, const char* key, void* out_value, size_t* length)
+{
+    return false;
+}
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Called by the MIDI player when the song is over
+ */
+static void songFinishedCb(void)
+{
+    songFinished = true;
+}
+
+/**
+ * @brief Get a monotonic timestamp
+ *
+ * @return The current time in seconds
+ */
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Render a song from start to end with a fresh MIDI player
+ *
+ * @param song The song to render
+ * @param maxSamples The maximum number of samples to render, if the song doesn't end first
+ * @param[out] outLen Written with the number of samples rendered
+ * @param[out] outTime Written with the number of seconds spent in midiPlayerFillBuffer()
+ * @param[out] outClipped Written with the number of samples clipped by the MIDI player
+ * @return The rendered samples, which must be freed, or NULL on error
+ */
+static uint8_t* renderSong(const midiFile_t* song, uint32_t maxSamples, uint32_t* outLen, double* outTime,
+                           uint32_t* outClipped)
+{
+    // Round the capacity up to a whole number of buffers
+    uint32_t cap     = ((maxSamples + DAC_BUF_SIZE - 1) / DAC_BUF_SIZE) * DAC_BUF_SIZE;
+    uint8_t* samples = malloc(cap);
+    // The player is too large for the stack
+    midiPlayer_t* player = malloc(sizeof(midiPlayer_t));
+    if (NULL == samples || NULL == player)
+    {
+        free(samples);
+        free(player);
+        return NULL;
+    }
+
+    midiPlayerInit(player);
+    midiSetFile(player, song);
+    player->songFinishedCallback = songFinishedCb;
+    player->loop                 = false;
+    midiPause(player, false);
+
+    songFinished  = false;
+    uint32_t len  = 0;
+    double tStart = nowSeconds();
+    while (!songFinished && len < maxSamples)
+    {
+        midiPlayerFillBuffer(player, &samples[len], DAC_BUF_SIZE);
+        len += DAC_BUF_SIZE;
+    }
+    *outTime    = nowSeconds() - tStart;
+    *outLen     = MIN(len, maxSamples);
+    *outClipped = player->clipped;
+
+    midiPlayerReset(player);
+    free(player);
+    return samples;
+}
+
+/**
+ * @brief Write a 16-bit little-endian value
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe16(uint8_t* out, uint16_t val)
+{
+    out[0] = val & 0xFF;
+    out[1] = (val >> 8) & 0xFF;
+}
+
+/**
+ * @brief Write a 32-bit little-endian value
+ *
+ * @param out The buffer to write to
+ * @param val The value to write
+ */
+static void putLe32(uint8_t* out, uint32_t val)
+{
+    putLe16(out, val & 0xFFFF);
+    putLe16(out + 2, (val >> 16) & 0xFFFF);
+}
+
+/**
+ * @brief Read a 16-bit little-endian value
+ *
+ * @param in The buffer to read from
+ * @return The value
+ */
+static uint16_t getLe16(const uint8_t* in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+/**
+ * @brief Read a 32-bit little-endian value
+ *
+ * @param in The buffer to read from
+ * @return The value
+ */
+static uint32_t getLe32(const uint8_t* in)
+{
+    return getLe16(in) | ((uint32_t)getLe16(in + 2) << 16);
+}
+
+/**
+ * @brief Write samples to an unsigned 8-bit mono PCM WAV file at ::DAC_SAMPLE_RATE_HZ
+ *
+ * @param fname The file to write
+ * @param samples The samples to write
+ * @param len The number of samples
+ * @return true if the file was written, false if it was not
+ */
+static bool writeWav(const char* fname, const uint8_t* samples, uint32_t len)
+{
+    FILE* fp = fopen(fname, "wb");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "ERR: Could not open %s for writing\n", fname);
+        return false;
+    }
+
+    uint8_t hdr[WAV_HEADER_SIZE];
+    memcpy(&hdr[0], "RIFF", 4);
+    putLe32(&hdr[4], WAV_HEADER_SIZE - 8 + len);
+    memcpy(&hdr[8], "WAVE", 4);
+    memcpy(&hdr[12], "fmt ", 4);
+    putLe32(&hdr[16], 16);                 // fmt chunk size
+    putLe16(&hdr[20], 1);                  // PCM
+    putLe16(&hdr[22], 1);                  // Mono
+    putLe32(&hdr[24], DAC_SAMPLE_RATE_HZ); // Sample rate
+    putLe32(&hdr[28], DAC_SAMPLE_RATE_HZ); // Byte rate
+    putLe16(&hdr[32], 1);                  // Block align
+    putLe16(&hdr[34], 8);                  // Bits per sample
+    memcpy(&hdr[36], "data", 4);
+    putLe32(&hdr[40], len);
+
+    bool ok = (1 == fwrite(hdr, sizeof(hdr), 1, fp)) && (len == fwrite(samples, 1, len, fp));
+    ok      = (0 == fclose(fp)) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "ERR: Could not write %s\n", fname);
+    }
+    return ok;
+}
+
+/**
+ * @brief Read samples from a WAV file written by writeWav()
+ *
+ * @param fname The file to read
+ * @param[out] outLen Written with the number of samples read
+ * @return The samples, which must be freed, or NULL if the file could not be read or is in the wrong format
+ */
+static uint8_t* readWav(const char* fname, uint32_t* outLen)
+{
+    FILE* fp = fopen(fname, "rb");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "ERR: Could not open %s\n", fname);
+        return NULL;
+    }
+
+    uint8_t riff[12];
+    if (1 != fread(riff, sizeof(riff), 1, fp) || memcmp(&riff[0], "RIFF", 4) || memcmp(&riff[8], "WAVE", 4))
+    {
+        fprintf(stderr, "ERR: %s is not a WAV file\n", fname);
+        fclose(fp);
+        return NULL;
+    }
+
+    // Walk the chunks until the data chunk is found
+    bool fmtOk = false;
+    uint8_t chunkHdr[8];
+    while (1 == fread(chunkHdr, sizeof(chunkHdr), 1, fp))
+    {
+        uint32_t chunkLen = getLe32(&chunkHdr[4]);
+        if (!memcmp(chunkHdr, "fmt ", 4) && chunkLen >= 16)
+        {
+            uint8_t fmt[16];
+            if (1 != fread(fmt, sizeof(fmt), 1, fp))
+            {
+                break;
+            }
+            fmtOk = (1 == getLe16(&fmt[0])) && (1 == getLe16(&fmt[2])) && (DAC_SAMPLE_RATE_HZ == getLe32(&fmt[4]))
+                    && (8 == getLe16(&fmt[14]));
+            fseek(fp, (chunkLen - 16) + (chunkLen & 1), SEEK_CUR);
+        }
+        else if (!memcmp(chunkHdr, "data", 4))
+        {
+            if (!fmtOk)
+            {
+                break;
+            }
+
+            uint8_t* samples = malloc(chunkLen ? chunkLen : 1);
+            if (NULL != samples && chunkLen == fread(samples, 1, chunkLen, fp))
+            {
+                fclose(fp);
+                *outLen = chunkLen;
+                return samples;
+            }
+            free(samples);
+            break;
+        }
+        else
+        {
+            // Chunks are padded to an even length
+            fseek(fp, chunkLen + (chunkLen & 1), SEEK_CUR);
+        }
+    }
+
+    fprintf(stderr, "ERR: %s must be an 8-bit mono PCM WAV file at %dHz\n", fname, DAC_SAMPLE_RATE_HZ);
+    fclose(fp);
+    return NULL;
+}
+
+/**
+ * @brief Compare two renders sample by sample
+ *
+ * @param a The first render
+ * @param b The second render
+ * @param len The number of samples to compare
+ * @param[out] diff Written with the comparison results
+ */
+static void compareRenders(const uint8_t* a, const uint8_t* b, uint32_t len, renderDiff_t* diff)
+{
+    memset(diff, 0, sizeof(renderDiff_t));
+
+    uint64_t sumSq = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint32_t d = abs((int32_t)a[i] - (int32_t)b[i]);
+        if (d)
+        {
+            diff->diffSamples++;
+            sumSq += d * d;
+            if (d > diff->maxDiff)
+            {
+                diff->maxDiff = d;
+            }
+        }
+    }
+
+    diff->rms = len ? sqrt((double)sumSq / len) : 0;
+}
+
+/**
+ * @brief Print the names of all MIDI files in CNFS
+ */
+static void listSongs(void)
+{
+    const cnfsFileEntry* files = getCnfsFiles();
+    int32_t numFiles           = getCnfsNumFiles();
+    for (int32_t i = 0; i < numFiles; i++)
+    {
+        size_t nameLen = strlen(files[i].name);
+        if (nameLen > 4 && !strcmp(&files[i].name[nameLen - 4], ".mid"))
+        {
+            printf("%s\n", files[i].name);
+        }
+    }
+}
+
+/**
+ * @brief Print the usage message
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...] SONG.mid\n", progName);
+    printf("Render a MIDI file from CNFS with the Swadge MIDI player, faster than real time\n\n");
+    printf("  -o, --output=FILE         Write the render to a WAV file\n");
+    printf("  -g, --golden=FILE         Compare the render against a golden WAV file\n");
+    printf("  -t, --tolerance=N         Maximum difference allowed for any single sample (default 0)\n");
+    printf("  -r, --rms-tolerance=X     Maximum RMS difference allowed over the whole render\n");
+    printf("  -s, --seconds=N           Stop rendering after N seconds of audio (default %d)\n", DEFAULT_MAX_SECONDS);
+    printf("  -n, --repeat=N            Render N times and report the fastest, for benchmarking (default 1)\n");
+    printf("  -d, --drum-tables         Pre-render the drumkits and play drums from tables\n");
+    printf("  -l, --list                List all MIDI files in CNFS\n");
+    printf("  -q, --quiet               Only print errors and comparison failures\n");
+    printf("  -h, --help                Give this help list\n\n");
+    printf("If only --rms-tolerance is given, individual samples are not checked.\n");
+    printf("Exits with 0 on success, 1 if the render did not match the golden file, or 2 on error.\n");
+}
+
+/**
+ * @brief Parse arguments, render a song, and optionally write or compare it
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 on a golden mismatch, 2 on error
+ */
+int main(int argc, char** argv)
+{
+    renderArgs_t args = {
+        .maxSeconds   = DEFAULT_MAX_SECONDS,
+        .repeat       = 1,
+        .tolerance    = -1,
+        .rmsTolerance = -1,
+    };
+
+    if (!initCnfs())
+    {
+        fprintf(stderr, "ERR: CNFS image is empty\n");
+        return 2;
+    }
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "o:g:t:r:s:n:dlqh", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'o':
+                args.outFile = optarg;
+                break;
+            case 'g':
+                args.goldenFile = optarg;
+                break;
+            case 't':
+                args.tolerance = atoi(optarg);
+                break;
+            case 'r':
+                args.rmsTolerance = atof(optarg);
+                break;
+            case 's':
+                args.maxSeconds = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                args.repeat = MAX(1, atoi(optarg));
+                break;
+            case 'd':
+                args.drumTables = true;
+                break;
+            case 'l':
+                listSongs();
+                return 0;
+            case 'q':
+                args.quiet = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+    args.song = argv[optind];
+
+    // With no tolerances given, the render must match exactly
+    if (args.tolerance < 0 && args.rmsTolerance < 0)
+    {
+        args.tolerance = 0;
+    }
+
+    midiFile_t song = {0};
+    if (!loadMidiFile(args.song, &song, false))
+    {
+        fprintf(stderr, "ERR: Could not load %s from CNFS\n", args.song);
+        return 2;
+    }
+
+    if (args.drumTables
+        && (!prerenderDrumkit(&defaultDrumkitTimbre, false) || !prerenderDrumkit(&donutDrumkitTimbre, false)))
+    {
+        fprintf(stderr, "ERR: Could not pre-render drumkits\n");
+        unloadMidiFile(&song);
+        return 2;
+    }
+
+    uint32_t maxSamples = args.maxSeconds * DAC_SAMPLE_RATE_HZ;
+    uint8_t* samples    = NULL;
+    uint32_t len        = 0;
+    uint32_t clipped    = 0;
+    double bestTime     = INFINITY;
+    for (int32_t i = 0; i < args.repeat; i++)
+    {
+        double renderTime;
+        free(samples);
+        samples = renderSong(&song, maxSamples, &len, &renderTime, &clipped);
+        if (NULL == samples)
+        {
+            fprintf(stderr, "ERR: Out of memory\n");
+            unloadMidiFile(&song);
+            return 2;
+        }
+        bestTime = MIN(bestTime, renderTime);
+    }
+
+    double audioTime = (double)len / DAC_SAMPLE_RATE_HZ;
+    if (!args.quiet)
+    {
+        printf("%s: rendered %.2fs of audio in %.3fs (%.1fx real time), %" PRIu32 " samples clipped\n", args.song,
+               audioTime, bestTime, (bestTime > 0) ? audioTime / bestTime : INFINITY, clipped);
+    }
+
+    int ret = 0;
+    if (NULL != args.outFile && !writeWav(args.outFile, samples, len))
+    {
+        ret = 2;
+    }
+
+    if (NULL != args.goldenFile && 0 == ret)
+    {
+        uint32_t goldenLen;
+        uint8_t* golden = readWav(args.goldenFile, &goldenLen);
+        if (NULL == golden)
+        {
+            ret = 2;
+        }
+        else
+        {
+            renderDiff_t diff;
+            compareRenders(samples, golden, MIN(len, goldenLen), &diff);
+
+            bool lenOk  = (len == goldenLen);
+            bool diffOk = (args.tolerance < 0) || (diff.maxDiff <= (uint32_t)args.tolerance);
+            bool rmsOk  = (args.rmsTolerance < 0) || (diff.rms <= args.rmsTolerance);
+
+            if (!lenOk || !diffOk || !rmsOk || !args.quiet)
+            {
+                printf("%s: %s golden %s, length %" PRIu32 "/%" PRIu32 ", %" PRIu32 " samples differ, max diff %" PRIu32
+                       ", RMS %.4f\n",
+                       args.song, (lenOk && diffOk && rmsOk) ? "matches" : "DOES NOT MATCH", args.goldenFile, len,
+                       goldenLen, diff.diffSamples, diff.maxDiff, diff.rms);
+            }
+
+            if (!lenOk || !diffOk || !rmsOk)
+            {
+                ret = 1;
+            }
+            free(golden);
+        }
+    }
+
+    free(samples);
+    freeDrumkitTables();
+    unloadMidiFile(&song);
+    deinitCnfs();
+    return ret;
+}
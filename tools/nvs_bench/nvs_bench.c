@@ -0,0 +1,336 @@
+/**
+ * @file nvs_bench.c
+ * @brief Measure how many NVS reads and writes per second the emulator can do
+ *
+ * The emulator's hdw-nvs.c is built unmodified and exercised through the same API the firmware uses. By default NVS is
+ * kept in a JSON file in a temporary directory, just like the emulator, and the cost of writing that file is measured
+ * separately from the in-memory reads and writes. With --memory, the file is never touched.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <esp_random.h>
+
+#include "hdw-nvs.h"
+#include "hdw-nvs_emu.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The default number of operations in each test
+#define DEFAULT_OPS 100000
+
+/// @brief The default number of distinct keys
+#define DEFAULT_KEYS 64
+
+/// @brief The default size of each blob, in bytes
+#define DEFAULT_BLOB_BYTES 256
+
+/// @brief The number of times NVS is written to the file in the flush test
+#define FLUSH_OPS 200
+
+/// @brief The namespaces which are benchmarked, so that the default namespace is left alone
+#define BENCH_NAMESPACE      "bench"
+#define BENCH_BLOB_NAMESPACE "benchBlob"
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Options given on the command line
+ */
+typedef struct
+{
+    uint32_t ops;       ///< The number of operations in each test
+    uint32_t keys;      ///< The number of distinct keys
+    uint32_t blobBytes; ///< The size of each blob, in bytes
+    bool memoryOnly;    ///< true to never touch the NVS file
+} benchArgs_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static int64_t nowUs(void);
+static void report(const char* name, uint32_t ops, int64_t elapsedUs);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+/// @brief Key names, generated once so that formatting them isn't measured
+static char (*keyNames)[16] = NULL;
+
+/// @brief State for esp_random()
+static uint64_t randState = 0x9E3779B97F4A7C15ULL;
+
+static const struct option longOpts[] = {
+    {"ops", required_argument, NULL, 'n'},
+    {"keys", required_argument, NULL, 'k'},
+    {"blob", required_argument, NULL, 'b'},
+    {"memory", no_argument, NULL, 'm'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Generate a random number for linked_list.c. This is a xorshift64* generator, so runs are repeatable
+ *
+ * @return A random number
+ */
+uint32_t esp_random(void)
+{
+    randState ^= randState >> 12;
+    randState ^= randState << 25;
+    randState ^= randState >> 27;
+    return (uint32_t)((randState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief Get the real time
+ *
+ * @return The monotonic time, in microseconds
+ */
+static int64_t nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief Print the result of one test
+ *
+ * @param name The name of the test
+ * @param ops The number of operations in the test
+ * @param elapsedUs The time the test took, in microseconds
+ */
+static void report(const char* name, uint32_t ops, int64_t elapsedUs)
+{
+    if (elapsedUs < 1)
+    {
+        elapsedUs = 1;
+    }
+    printf("%-28s %9" PRIu32 " ops %10.3f ms %12.0f ops/s %9.3f us/op\n", name, ops, elapsedUs / 1000.0,
+           ops * 1000000.0 / elapsedUs, (double)elapsedUs / ops);
+}
+
+/**
+ * @brief Print the command line options
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...]\n", progName);
+    printf("Measure the emulator's NVS reads and writes per second\n\n");
+    printf("  -n, --ops=N               Operations in each test (default %d)\n", DEFAULT_OPS);
+    printf("  -k, --keys=N              Distinct keys to read and write (default %d)\n", DEFAULT_KEYS);
+    printf("  -b, --blob=BYTES          Size of each blob (default %d)\n", DEFAULT_BLOB_BYTES);
+    printf("  -m, --memory              Keep NVS in memory only, like --nvs-memory\n");
+    printf("  -h, --help                Give this help list\n");
+}
+
+/**
+ * @brief Parse arguments, run every test, and print the results
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 if NVS failed, 2 on bad arguments
+ */
+int main(int argc, char** argv)
+{
+    benchArgs_t args = {
+        .ops        = DEFAULT_OPS,
+        .keys       = DEFAULT_KEYS,
+        .blobBytes  = DEFAULT_BLOB_BYTES,
+        .memoryOnly = false,
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:k:b:mh", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'n':
+                args.ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                args.keys = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                args.blobBytes = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                args.memoryOnly = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (0 == args.ops || 0 == args.keys || 0 == args.blobBytes)
+    {
+        fprintf(stderr, "ERROR: ops, keys, and blob size must be greater than 0\n");
+        return 2;
+    }
+
+    // Run in a temporary directory so the real NVS file isn't touched. NVS uses the first writable candidate file,
+    // which is nvs.json in the working directory
+    char tmpDir[] = "/tmp/nvs_bench.XXXXXX";
+    char oldDir[1024];
+    if (NULL == getcwd(oldDir, sizeof(oldDir)) || NULL == mkdtemp(tmpDir) || 0 != chdir(tmpDir))
+    {
+        fprintf(stderr, "ERROR: Couldn't make a temporary directory\n");
+        return 1;
+    }
+
+    emuNvsSetMemoryOnly(args.memoryOnly);
+    if (!initNvs(true))
+    {
+        fprintf(stderr, "ERROR: Couldn't initialize NVS\n");
+        return 1;
+    }
+
+    keyNames = calloc(args.keys, sizeof(*keyNames));
+    for (uint32_t k = 0; k < args.keys; k++)
+    {
+        snprintf(keyNames[k], sizeof(*keyNames), "key%" PRIu32, k);
+    }
+
+    uint8_t* blob    = malloc(args.blobBytes);
+    uint8_t* blobOut = malloc(args.blobBytes);
+    for (uint32_t i = 0; i < args.blobBytes; i++)
+    {
+        blob[i] = esp_random();
+    }
+
+    printf("%s NVS, %" PRIu32 " keys, %" PRIu32 " byte blobs\n", args.memoryOnly ? "In-memory" : "File backed",
+           args.keys, args.blobBytes);
+
+    bool ok        = true;
+    int32_t sink32 = 0;
+
+    // Every write changes the value
+    int64_t start = nowUs();
+    for (uint32_t i = 0; i < args.ops; i++)
+    {
+        ok &= writeNamespaceNvs32(BENCH_NAMESPACE, keyNames[i % args.keys], (int32_t)i);
+    }
+    report("write32", args.ops, nowUs() - start);
+
+    // Every write stores the value which is already there
+    start = nowUs();
+    for (uint32_t i = 0; i < args.ops; i++)
+    {
+        uint32_t k = i % args.keys;
+        ok &= writeNamespaceNvs32(BENCH_NAMESPACE, keyNames[k], (int32_t)(args.ops - args.keys + k));
+    }
+    report("write32 (unchanged)", args.ops, nowUs() - start);
+
+    start = nowUs();
+    for (uint32_t i = 0; i < args.ops; i++)
+    {
+        int32_t val;
+        ok &= readNamespaceNvs32(BENCH_NAMESPACE, keyNames[i % args.keys], &val);
+        sink32 += val;
+    }
+    report("read32", args.ops, nowUs() - start);
+
+    start = nowUs();
+    for (uint32_t i = 0; i < args.ops; i++)
+    {
+        blob[0] = i;
+        ok &= writeNamespaceNvsBlob(BENCH_BLOB_NAMESPACE, keyNames[i % args.keys], blob, args.blobBytes);
+    }
+    report("writeBlob", args.ops, nowUs() - start);
+
+    start = nowUs();
+    for (uint32_t i = 0; i < args.ops; i++)
+    {
+        size_t len = args.blobBytes;
+        ok &= readNamespaceNvsBlob(BENCH_BLOB_NAMESPACE, keyNames[i % args.keys], blobOut, &len);
+        sink32 += blobOut[0];
+    }
+    report("readBlob", args.ops, nowUs() - start);
+
+    uint32_t statOps = args.ops / 100 ? args.ops / 100 : 1;
+    start            = nowUs();
+    for (uint32_t i = 0; i < statOps; i++)
+    {
+        nvs_stats_t stats = {0};
+        ok &= readNvsStats(&stats);
+        sink32 += stats.used_entries;
+    }
+    report("readNvsStats", statOps, nowUs() - start);
+
+    if (!args.memoryOnly)
+    {
+        // Writing the file after every write is what NVS used to do
+        start = nowUs();
+        for (uint32_t i = 0; i < FLUSH_OPS; i++)
+        {
+            ok &= writeNamespaceNvs32(BENCH_NAMESPACE, keyNames[i % args.keys], -(int32_t)i - 1);
+            ok &= emuNvsFlush();
+        }
+        report("write32 + flush", FLUSH_OPS, nowUs() - start);
+
+        struct stat st;
+        if (0 == stat("nvs.json", &st))
+        {
+            printf("NVS file is %lld bytes\n", (long long)st.st_size);
+        }
+    }
+
+    if (!args.memoryOnly)
+    {
+        // Check that the last blob made it to the file and back
+        ok &= deinitNvs();
+        ok &= initNvs(true);
+        size_t len = args.blobBytes;
+        ok &= readNamespaceNvsBlob(BENCH_BLOB_NAMESPACE, keyNames[(args.ops - 1) % args.keys], blobOut, &len);
+        ok &= (blobOut[0] == (uint8_t)(args.ops - 1));
+    }
+    deinitNvs();
+
+    remove("nvs.json");
+    if (0 != chdir(oldDir) || 0 != rmdir(tmpDir))
+    {
+        fprintf(stderr, "WARNING: Couldn't remove %s\n", tmpDir);
+    }
+
+    free(blob);
+    free(blobOut);
+    free(keyNames);
+
+    if (!ok)
+    {
+        fprintf(stderr, "ERROR: An NVS operation failed (checksum %" PRId32 ")\n", sink32);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1644 @@
+/**
+ * @file p2p_sim.c
+ * @brief Simulate many Swadges connecting and exchanging messages with p2pConnection.c, all in one process
+ *
+ * Each simulated Swadge is a node with its own ::p2pInfo, MAC address, and position on a virtual floor. The firmware's
+ * p2pConnection.c, p2pBulk.c, and p2pReplica.c are built unmodified, and the ESP-IDF functions they call (esp_timer,
+ * esp_random(), esp_wifi_get_mac(), espNowSend(), and esp_log_write()) are implemented here on top of a discrete event
+ * simulation.
+ * Time only advances from one event to the next, so a simulation runs much faster than real time and is exactly
+ * reproducible from its seed.
+ *
+ * Every transmission occupies a single shared channel for its airtime, and is delivered to every other node after a
+ * configurable latency and jitter. Packets may be randomly lost, are all lost during an outage, and are lost if the
+ * link's RSSI is below the receiver sensitivity. The RSSI of each link is either fixed or derived from the distance
+ * between the nodes.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdarg.h>
+
+#include <esp_timer.h>
+#include <esp_random.h>
+#include <esp_wifi.h>
+#include <esp_now.h>
+#include <esp_log.h>
+
+#include "hdw-esp-now.h"
+#include "p2pConnection.h"
+#include "p2pBulk.h"
+#include "p2pReplica.h"
+#include "macros.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The default number of simulated Swadges
+#define DEFAULT_NODES 2
+
+/// @brief The default length of a simulation, in seconds
+#define DEFAULT_SECONDS 60
+
+/// @brief The mode ID used by every node
+#define SIM_MODE_ID 0x53
+
+/// @brief The RSSI needed to start a connection, the same as Ultimate TTT
+#define SIM_CONNECTION_RSSI -70
+
+/// @brief How long a node waits to start connecting again after a failed handshake
+#define RECONNECT_DELAY_US 100000
+
+/// @brief The longest ESP-NOW payload
+#define SIM_MAX_PACKET 250
+
+/// @brief The PHY preamble and header time of a 1Mbps 802.11b frame, in microseconds
+#define AIR_PREAMBLE_US 192
+
+/// @brief The bytes added to every ESP-NOW payload by the MAC header, the vendor action header, and the FCS
+#define AIR_OVERHEAD_BYTES 43
+
+/// @brief The time to send one byte at 1Mbps, in microseconds
+#define AIR_US_PER_BYTE 8
+
+/// @brief The DCF interframe space, in microseconds
+#define AIR_DIFS_US 50
+
+/// @brief The length of one backoff slot, in microseconds
+#define AIR_SLOT_US 20
+
+/// @brief The number of backoff slots a transmission picks from
+#define AIR_CW_SLOTS 16
+
+/// @brief The RSSI of a link one meter long, in dBm
+#define RSSI_AT_1M -40
+
+/// @brief The path loss exponent of a crowded indoor space
+#define PATH_LOSS_EXPONENT 3.0
+
+/// @brief Packets weaker than this are never received, in dBm
+#define RX_SENSITIVITY -95
+
+/// @brief Used for the --rssi option when the RSSI should be calculated from distance
+#define RSSI_FROM_DISTANCE INT32_MIN
+
+/// @brief The time between frames of a Swadge mode's main loop, with --replica
+#define FRAME_US 16667
+
+/// @brief The number of moving objects in the state replicated with --replica
+#define REPLICA_OBJECTS 8
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/**
+ * @brief The types of events in the simulation
+ */
+typedef enum
+{
+    EVT_START,   ///< A node calls p2pStartConnection()
+    EVT_TIMER,   ///< A node's esp_timer expires
+    EVT_RX,      ///< A packet arrives at a node
+    EVT_TX_DONE, ///< A node's transmission finishes
+    EVT_FRAME,   ///< A node runs a frame of its main loop, with --replica
+} simEvtType_t;
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Options parsed from the command line
+ */
+typedef struct
+{
+    int32_t numNodes;
+    uint32_t seconds;
+    uint64_t seed;
+    uint32_t latencyUs;
+    uint32_t jitterUs;
+    double lossPct;
+    int32_t fixedRssi;
+    int32_t rssiJitter;
+    double area;
+    uint32_t staggerUs;
+    int32_t payload;
+    int32_t window;
+    int32_t bulk;
+    int32_t replicaHz;
+    uint32_t replicaLimit;
+    int32_t channels;
+    int64_t outageStartUs;
+    int64_t outageEndUs;
+    bool contention;
+    bool verbose;
+} simArgs_t;
+
+typedef struct simNode simNode_t;
+
+/**
+ * @brief The game state each node replicates with --replica. Every field is a function of the sender's clock, so the
+ * receiver can check each snapshot
+ */
+typedef struct
+{
+    int32_t clockMs;                     ///< The sender's time in milliseconds, which measures how old a render is
+    int16_t pos[REPLICA_OBJECTS][2];     ///< Objects which each move for a second, then stop for two
+    uint16_t score;                      ///< A value which changes every few seconds, and isn't interpolated
+    uint8_t unused[REPLICA_OBJECTS * 2]; ///< Bytes which never change
+    bool localOnly;                      ///< A field which isn't replicated
+} simReplicaState_t;
+
+/**
+ * @brief A timer created by esp_timer_create(). Handles point at \c tmr, which must be the first member
+ */
+typedef struct
+{
+    struct esp_timer tmr; ///< The callback and argument of this timer
+    simNode_t* node;      ///< The node which created this timer
+    uint32_t generation;  ///< Incremented whenever the timer is started or stopped, to ignore stale events
+    bool armed;           ///< true if the timer is running
+    bool deleted;         ///< true if esp_timer_delete() was called on this timer
+} simTimer_t;
+
+/**
+ * @brief A transmitted packet, shared by all the receive events for it
+ */
+typedef struct
+{
+    uint8_t srcMac[6];            ///< The MAC address of the sender
+    uint8_t len;                  ///< The length of \c data
+    uint8_t data[SIM_MAX_PACKET]; ///< The transmitted bytes
+    int32_t refs;                 ///< The number of receive events which haven't run yet
+} simPacket_t;
+
+/**
+ * @brief A scheduled event
+ */
+typedef struct
+{
+    int64_t timeUs;    ///< When this event happens
+    uint64_t seq;      ///< The order this event was scheduled in, to break ties deterministically
+    simEvtType_t type; ///< The type of event
+    simNode_t* node;   ///< The node this event happens to
+    union
+    {
+        /// @brief For ::EVT_TIMER
+        struct
+        {
+            simTimer_t* timer;
+            uint32_t generation;
+        } tmr;
+
+        /// @brief For ::EVT_RX
+        struct
+        {
+            simPacket_t* pkt;
+            int8_t rssi;
+        } rx;
+    };
+} simEvent_t;
+
+/**
+ * @brief A single simulated Swadge
+ */
+struct simNode
+{
+    int32_t idx;              ///< This node's index
+    uint8_t mac[6];           ///< This node's MAC address
+    double x;                 ///< The X position on the floor, in meters
+    double y;                 ///< The Y position on the floor, in meters
+    p2pInfo p2p;              ///< This node's connection state
+    int64_t startUs;          ///< When this node first started connecting
+    int32_t peer;             ///< The index of the connected node, or -1
+    uint32_t restarts;        ///< The number of failed handshakes
+    uint32_t msgsSent;        ///< The number of data messages sent, which numbers each message
+    uint32_t msgsAcked;       ///< The number of data messages which were acknowledged
+    uint32_t msgsFailed;      ///< The number of data messages which ran out of retries
+    uint32_t msgsRx;          ///< The number of data messages received
+    uint32_t lastRxNum;       ///< The number of the last data message received
+    uint32_t rxMisorder;      ///< The number of data messages received out of order or more than once
+    uint64_t bytesAcked;      ///< The number of payload bytes which were acknowledged
+    p2pBulk_t bulk;           ///< This node's bulk transfers, with --bulk
+    uint8_t* bulkTxBuf;       ///< The buffer this node sends with --bulk
+    uint8_t* bulkRxBuf;       ///< The buffer this node receives into with --bulk
+    uint32_t bulkNum;         ///< The number of buffers started, which changes the contents of each one
+    uint32_t bulkSent;        ///< The number of buffers sent
+    uint32_t bulkFailed;      ///< The number of buffers which failed
+    uint32_t bulkRx;          ///< The number of buffers received
+    uint32_t bulkBad;         ///< The number of buffers received with the wrong contents
+    int64_t bulkTimeUs;       ///< The total time taken to send the buffers which were sent
+    uint64_t bulkFrags;       ///< Fragments sent for the buffers which were sent or failed
+    uint64_t bulkResent;      ///< Fragments sent again for the buffers which were sent or failed
+    uint64_t bulkRetx;        ///< Window retransmissions while sending the buffers which were sent or failed
+    uint64_t bulkIntr;        ///< Interruptions while sending the buffers which were sent or failed
+    p2pReplica_t replica;     ///< This node's state replication, with --replica
+    simReplicaState_t local;  ///< The state this node sends
+    simReplicaState_t remote; ///< The state received from the peer
+    uint32_t replicaFrames;   ///< Frames where the remote state was rendered
+    uint64_t replicaLagMs;    ///< The total age of the rendered remote state over those frames
+    uint32_t replicaChecked;  ///< Received snapshots which were checked
+    uint32_t replicaBad;      ///< Received snapshots which didn't match the sender's state
+    uint8_t replicaLastSeq;   ///< The newest snapshot which was checked
+};
+
+/**
+ * @brief Statistics for the shared channel
+ */
+typedef struct
+{
+    uint64_t sent;      ///< Packets transmitted
+    uint64_t delivered; ///< Packets delivered to a receiver
+    uint64_t lost;      ///< Packets randomly lost on the way to a receiver
+    uint64_t weak;      ///< Packets not received because the RSSI was too low
+    int64_t airtimeUs;  ///< The total time the channel was in use
+} simBusStats_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static uint32_t simRand(void);
+static double simRandUnit(void);
+static void* simAlloc(size_t size);
+static bool eventBefore(const simEvent_t* a, const simEvent_t* b);
+static void pushEvent(simEvent_t* evt);
+static bool popEvent(simEvent_t* out);
+static void runEvent(const simEvent_t* evt);
+static int8_t linkRssi(const simNode_t* src, const simNode_t* dst);
+static simNode_t* nodeFromP2p(p2pInfo* p2p);
+static simNode_t* nodeFromMac(const uint8_t* mac);
+static void sendNextMsg(simNode_t* node);
+static void simConCb(p2pInfo* p2p, connectionEvt_t evt);
+static void simMsgRxCb(p2pInfo* p2p, const uint8_t* payload, uint8_t len);
+static void simMsgTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len);
+static void sendNextBulk(simNode_t* node);
+static uint8_t bulkByte(uint8_t tag, uint32_t idx);
+static void simBulkCb(p2pBulk_t* bulk, p2pBulkEvt_t evt, uint8_t tag, const uint8_t* data, uint32_t len);
+static void replicaState(int32_t idx, int32_t clockMs, simReplicaState_t* state);
+static void runFrame(simNode_t* node);
+static int compareInt64(const void* a, const void* b);
+static int32_t printReport(double wallSeconds);
+static double nowSeconds(void);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static simArgs_t args;
+
+static simNode_t* nodes = NULL;
+
+/// @brief The node whose code is currently running, used by the ESP-IDF functions to know who called them
+static simNode_t* curNode = NULL;
+
+/// @brief The current simulated time
+static int64_t simTimeUs = 0;
+
+/// @brief The time the shared channel is free to transmit again
+static int64_t channelFreeUs = 0;
+
+/// @brief A binary min-heap of scheduled events
+static simEvent_t* eventHeap = NULL;
+static uint32_t eventHeapLen = 0;
+static uint32_t eventHeapCap = 0;
+static uint64_t eventSeq     = 0;
+
+/// @brief Every timer ever created, so they can be freed at the end and checked for leaks
+static simTimer_t** allTimers = NULL;
+static uint32_t numTimers     = 0;
+static uint32_t timersCap     = 0;
+
+static uint64_t rngState;
+
+static simBusStats_t busStats;
+
+/// @brief The fields of ::simReplicaState_t replicated with --replica
+static const p2pReplicaField_t replicaFields[] = {
+    P2P_REPLICA_FIELD(simReplicaState_t, clockMs, P2P_REPLICA_S32),
+    P2P_REPLICA_FIELD(simReplicaState_t, pos, P2P_REPLICA_S16),
+    P2P_REPLICA_FIELD(simReplicaState_t, score, P2P_REPLICA_SNAP),
+    P2P_REPLICA_FIELD(simReplicaState_t, unused, P2P_REPLICA_SNAP),
+};
+
+static const struct option longOpts[] = {
+    {"nodes", required_argument, NULL, 'n'},
+    {"time", required_argument, NULL, 't'},
+    {"seed", required_argument, NULL, 's'},
+    {"latency", required_argument, NULL, 'l'},
+    {"jitter", required_argument, NULL, 'j'},
+    {"loss", required_argument, NULL, 'p'},
+    {"rssi", required_argument, NULL, 'r'},
+    {"rssi-jitter", required_argument, NULL, 'R'},
+    {"area", required_argument, NULL, 'a'},
+    {"stagger", required_argument, NULL, 'g'},
+    {"payload", required_argument, NULL, 'b'},
+    {"window", required_argument, NULL, 'w'},
+    {"bulk", required_argument, NULL, 'k'},
+    {"replica", required_argument, NULL, 'y'},
+    {"replica-limit", required_argument, NULL, 'Y'},
+    {"channels", required_argument, NULL, 'm'},
+    {"outage", required_argument, NULL, 'o'},
+    {"no-contention", no_argument, NULL, 'c'},
+    {"verbose", no_argument, NULL, 'v'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// ESP-IDF Functions
+//==============================================================================
+
+/**
+ * @brief Create a timer which belongs to the current node
+ *
+ * @param create_args The callback and argument for the timer
+ * @param out_handle Written with the new timer
+ * @return ESP_OK
+ */
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    simTimer_t* timer   = simAlloc(sizeof(simTimer_t));
+    timer->tmr.callback = create_args->callback;
+    timer->tmr.arg      = create_args->arg;
+    timer->node         = curNode;
+
+    if (numTimers == timersCap)
+    {
+        timersCap = timersCap ? timersCap * 2 : 64;
+        allTimers = realloc(allTimers, timersCap * sizeof(simTimer_t*));
+        if (NULL == allTimers)
+        {
+            fprintf(stderr, "ERR: Out of memory\n");
+            exit(2);
+        }
+    }
+    allTimers[numTimers++] = timer;
+
+    *out_handle = &timer->tmr;
+    return ESP_OK;
+}
+
+/**
+ * @brief Start a one-shot timer. Like the hardware, and unlike the emulator, a running timer is not restarted
+ *
+ * @param handle The timer to start
+ * @param timeout_us The time until the timer expires
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if the timer is already running
+ */
+esp_err_t esp_timer_start_once(esp_timer_handle_t handle, uint64_t timeout_us)
+{
+    simTimer_t* timer = (simTimer_t*)handle;
+    if (timer->deleted)
+    {
+        fprintf(stderr, "ERR: Node %" PRId32 " started a deleted timer\n", timer->node->idx);
+        exit(2);
+    }
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = true;
+    timer->generation++;
+
+    simEvent_t evt = {
+        .timeUs = simTimeUs + timeout_us,
+        .type   = EVT_TIMER,
+        .node   = timer->node,
+        .tmr    = {
+            .timer      = timer,
+            .generation = timer->generation,
+        },
+    };
+    pushEvent(&evt);
+    return ESP_OK;
+}
+
+/**
+ * @brief Stop a timer. Its scheduled event is left in the queue and ignored when it runs
+ *
+ * @param handle The timer to stop
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if the timer is not running
+ */
+esp_err_t esp_timer_stop(esp_timer_handle_t handle)
+{
+    simTimer_t* timer = (simTimer_t*)handle;
+    if (!timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    timer->generation++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Delete a timer. It's stopped, and freed at the end of the simulation in case an event still refers to it
+ *
+ * @param handle The timer to delete
+ * @return ESP_OK
+ */
+esp_err_t esp_timer_delete(esp_timer_handle_t handle)
+{
+    esp_timer_stop(handle);
+    ((simTimer_t*)handle)->deleted = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the simulated time
+ *
+ * @return The simulated time, in microseconds
+ */
+int64_t esp_timer_get_time(void)
+{
+    return simTimeUs;
+}
+
+/**
+ * @brief Get a random number from the simulation's seeded generator
+ *
+ * @return A random 32 bit number
+ */
+uint32_t esp_random(void)
+{
+    return simRand();
+}
+
+/**
+ * @brief Get the current node's MAC address
+ *
+ * @param ifx unused
+ * @param mac Written with the MAC address
+ * @return ESP_OK, or ESP_FAIL if no node is running
+ */
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6])
+{
+    if (NULL == curNode)
+    {
+        return ESP_FAIL;
+    }
+    memcpy(mac, curNode->mac, 6);
+    return ESP_OK;
+}
+
+/**
+ * @brief Broadcast a packet from the current node on the shared channel
+ *
+ * The packet waits for the channel to be free, plus a random backoff, then occupies it for its airtime. When the
+ * transmission finishes, the sender gets a send callback and each other node receives a copy after the link latency.
+ *
+ * @param data The data to broadcast
+ * @param dataLen The length of the data to broadcast
+ */
+void espNowSend(const char* data, uint8_t dataLen)
+{
+    simNode_t* src = curNode;
+    if (NULL == src || dataLen > SIM_MAX_PACKET)
+    {
+        return;
+    }
+
+    int64_t airtimeUs = AIR_PREAMBLE_US + (AIR_OVERHEAD_BYTES + dataLen) * AIR_US_PER_BYTE;
+    int64_t startUs   = simTimeUs;
+    if (args.contention)
+    {
+        startUs       = MAX(simTimeUs, channelFreeUs) + AIR_DIFS_US + (simRand() % AIR_CW_SLOTS) * AIR_SLOT_US;
+        channelFreeUs = startUs + airtimeUs;
+    }
+    int64_t endUs = startUs + airtimeUs;
+
+    busStats.sent++;
+    busStats.airtimeUs += airtimeUs;
+
+    simEvent_t done = {
+        .timeUs = endUs,
+        .type   = EVT_TX_DONE,
+        .node   = src,
+    };
+    pushEvent(&done);
+
+    simPacket_t* pkt = simAlloc(sizeof(simPacket_t));
+    memcpy(pkt->srcMac, src->mac, sizeof(pkt->srcMac));
+    memcpy(pkt->data, data, dataLen);
+    pkt->len = dataLen;
+
+    for (int32_t i = 0; i < args.numNodes; i++)
+    {
+        simNode_t* dst = &nodes[i];
+        if (dst == src)
+        {
+            continue;
+        }
+
+        int8_t rssi = linkRssi(src, dst);
+        if (rssi < RX_SENSITIVITY)
+        {
+            busStats.weak++;
+            continue;
+        }
+        if ((args.lossPct > 0 && simRandUnit() * 100 < args.lossPct)
+            || (startUs >= args.outageStartUs && startUs < args.outageEndUs))
+        {
+            busStats.lost++;
+            continue;
+        }
+
+        int64_t jitterUs = args.jitterUs ? (simRand() % (args.jitterUs + 1)) : 0;
+
+        simEvent_t rx = {
+            .timeUs = endUs + args.latencyUs + jitterUs,
+            .type   = EVT_RX,
+            .node   = dst,
+            .rx     = {
+                .pkt  = pkt,
+                .rssi = rssi,
+            },
+        };
+        pushEvent(&rx);
+        pkt->refs++;
+    }
+
+    if (0 == pkt->refs)
+    {
+        free(pkt);
+    }
+}
+
+/**
+ * @brief Print a log message from p2pConnection.c, with the node which logged it
+ *
+ * @param level unused
+ * @param tag The log tag
+ * @param format The printf format string
+ * @param ... The format arguments
+ */
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    fprintf(stderr, "%10.3fms node %3" PRId32 " %s: ", simTimeUs / 1000.0, curNode ? curNode->idx : -1, tag);
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+//==============================================================================
+// Simulation Functions
+//==============================================================================
+
+/**
+ * @brief Get a random number from a xorshift64* generator, so results only depend on the seed
+ *
+ * @return A random 32 bit number
+ */
+static uint32_t simRand(void)
+{
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (rngState * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/**
+ * @brief Get a random number in [0, 1)
+ *
+ * @return A random number
+ */
+static double simRandUnit(void)
+{
+    return simRand() / 4294967296.0;
+}
+
+/**
+ * @brief Allocate zeroed memory, or exit if there is none
+ *
+ * @param size The number of bytes to allocate
+ * @return The allocated memory
+ */
+static void* simAlloc(size_t size)
+{
+    void* mem = calloc(1, size);
+    if (NULL == mem)
+    {
+        fprintf(stderr, "ERR: Out of memory\n");
+        exit(2);
+    }
+    return mem;
+}
+
+/**
+ * @brief Check if one event should run before another
+ *
+ * @param a An event
+ * @param b Another event
+ * @return true if \c a is earlier, or at the same time and was scheduled first
+ */
+static bool eventBefore(const simEvent_t* a, const simEvent_t* b)
+{
+    return (a->timeUs < b->timeUs) || (a->timeUs == b->timeUs && a->seq < b->seq);
+}
+
+/**
+ * @brief Schedule an event
+ *
+ * @param evt The event to schedule. Its sequence number is assigned here
+ */
+static void pushEvent(simEvent_t* evt)
+{
+    if (eventHeapLen == eventHeapCap)
+    {
+        eventHeapCap = eventHeapCap ? eventHeapCap * 2 : 256;
+        eventHeap    = realloc(eventHeap, eventHeapCap * sizeof(simEvent_t));
+        if (NULL == eventHeap)
+        {
+            fprintf(stderr, "ERR: Out of memory\n");
+            exit(2);
+        }
+    }
+
+    evt->seq = eventSeq++;
+
+    // Sift up
+    uint32_t i = eventHeapLen++;
+    while (i > 0)
+    {
+        uint32_t parent = (i - 1) / 2;
+        if (!eventBefore(evt, &eventHeap[parent]))
+        {
+            break;
+        }
+        eventHeap[i] = eventHeap[parent];
+        i            = parent;
+    }
+    eventHeap[i] = *evt;
+}
+
+/**
+ * @brief Remove the earliest event from the schedule
+ *
+ * @param[out] out Written with the earliest event
+ * @return true if there was an event, false if the schedule is empty
+ */
+static bool popEvent(simEvent_t* out)
+{
+    if (0 == eventHeapLen)
+    {
+        return false;
+    }
+
+    *out = eventHeap[0];
+    eventHeapLen--;
+    if (0 == eventHeapLen)
+    {
+        return true;
+    }
+
+    // Sift the last event down from the top
+    simEvent_t* last = &eventHeap[eventHeapLen];
+    uint32_t i       = 0;
+    while (true)
+    {
+        uint32_t child = 2 * i + 1;
+        if (child >= eventHeapLen)
+        {
+            break;
+        }
+        if (child + 1 < eventHeapLen && eventBefore(&eventHeap[child + 1], &eventHeap[child]))
+        {
+            child++;
+        }
+        if (!eventBefore(&eventHeap[child], last))
+        {
+            break;
+        }
+        eventHeap[i] = eventHeap[child];
+        i            = child;
+    }
+    eventHeap[i] = *last;
+    return true;
+}
+
+/**
+ * @brief Advance the simulated time to an event and run it as its node
+ *
+ * @param evt The event to run
+ */
+static void runEvent(const simEvent_t* evt)
+{
+    simTimeUs = evt->timeUs;
+    curNode   = evt->node;
+
+    switch (evt->type)
+    {
+        case EVT_START:
+        {
+            if (args.verbose)
+            {
+                printf("%10.3fms node %3" PRId32 " starts connecting\n", simTimeUs / 1000.0, curNode->idx);
+            }
+            p2pStartConnection(&curNode->p2p);
+            break;
+        }
+        case EVT_TIMER:
+        {
+            simTimer_t* timer = evt->tmr.timer;
+            if (timer->armed && timer->generation == evt->tmr.generation)
+            {
+                timer->armed = false;
+                timer->tmr.callback(timer->tmr.arg);
+            }
+            break;
+        }
+        case EVT_RX:
+        {
+            simPacket_t* pkt = evt->rx.pkt;
+            busStats.delivered++;
+            p2pRecvCb(&curNode->p2p, pkt->srcMac, pkt->data, pkt->len, evt->rx.rssi);
+            if (0 == --pkt->refs)
+            {
+                free(pkt);
+            }
+            break;
+        }
+        case EVT_TX_DONE:
+        {
+            const uint8_t bcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+            p2pSendCb(&curNode->p2p, bcastMac, ESP_NOW_SEND_SUCCESS);
+            break;
+        }
+        case EVT_FRAME:
+        {
+            runFrame(curNode);
+            break;
+        }
+    }
+
+    curNode = NULL;
+}
+
+/**
+ * @brief Get the RSSI of a single transmission from one node to another
+ *
+ * @param src The transmitting node
+ * @param dst The receiving node
+ * @return The RSSI, in dBm
+ */
+static int8_t linkRssi(const simNode_t* src, const simNode_t* dst)
+{
+    int32_t rssi;
+    if (RSSI_FROM_DISTANCE != args.fixedRssi)
+    {
+        rssi = args.fixedRssi;
+    }
+    else
+    {
+        // Log-distance path loss, with a 10cm minimum so that nodes on top of each other are very loud
+        double dist = MAX(0.1, hypot(src->x - dst->x, src->y - dst->y));
+        rssi        = lround(RSSI_AT_1M - 10 * PATH_LOSS_EXPONENT * log10(dist));
+    }
+
+    if (args.rssiJitter > 0)
+    {
+        rssi += (int32_t)(simRand() % (2 * args.rssiJitter + 1)) - args.rssiJitter;
+    }
+    return CLAMP(rssi, INT8_MIN, INT8_MAX);
+}
+
+/**
+ * @brief Get the node which owns a ::p2pInfo
+ *
+ * @param p2p The connection state passed to a p2p callback
+ * @return The node
+ */
+static simNode_t* nodeFromP2p(p2pInfo* p2p)
+{
+    return (simNode_t*)((uint8_t*)p2p - offsetof(simNode_t, p2p));
+}
+
+/**
+ * @brief Find a node by its MAC address
+ *
+ * @param mac The MAC address
+ * @return The node, or NULL if no node has that address
+ */
+static simNode_t* nodeFromMac(const uint8_t* mac)
+{
+    for (int32_t i = 0; i < args.numNodes; i++)
+    {
+        if (0 == memcmp(nodes[i].mac, mac, sizeof(nodes[i].mac)))
+        {
+            return &nodes[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Send the next data message from a connected node, to keep the link saturated. With a window, send until the
+ * window is full
+ *
+ * @param node The node to send from
+ */
+static void sendNextMsg(simNode_t* node)
+{
+    int32_t numMsgs = (args.window > 0) ? p2pGetWindowSpace(&node->p2p) : 1;
+    for (int32_t m = 0; m < numMsgs; m++)
+    {
+        // Number each message so the receiver can check the order they're delivered in
+        uint8_t payload[P2P_MAX_DATA_LEN];
+        for (int32_t i = 0; i < args.payload; i++)
+        {
+            payload[i] = node->msgsSent + i;
+        }
+        node->msgsSent++;
+        memcpy(payload, &node->msgsSent, MIN(args.payload, (int32_t)sizeof(node->msgsSent)));
+        p2pSendMsg(&node->p2p, payload, args.payload, simMsgTxCb);
+    }
+}
+
+/**
+ * @brief Record connection events. The node which goes first starts sending data as soon as it's connected
+ *
+ * @param p2p The node's connection state
+ * @param evt The connection event
+ */
+static void simConCb(p2pInfo* p2p, connectionEvt_t evt)
+{
+    simNode_t* node = nodeFromP2p(p2p);
+    if (args.bulk > 0)
+    {
+        p2pBulkConEvt(&node->bulk, evt);
+    }
+    if (args.replicaHz > 0)
+    {
+        p2pReplicaConEvt(&node->replica, evt);
+    }
+
+    switch (evt)
+    {
+        case CON_ESTABLISHED:
+        {
+            simNode_t* peer = nodeFromMac(p2p->cnc.otherMac);
+            node->peer      = peer ? peer->idx : -1;
+            if (args.verbose)
+            {
+                printf("%10.3fms node %3" PRId32 " connected to node %3" PRId32 ", going %s\n", simTimeUs / 1000.0,
+                       node->idx, node->peer, (GOING_FIRST == p2pGetPlayOrder(p2p)) ? "first" : "second");
+            }
+
+            if (args.replicaHz > 0)
+            {
+                // Both nodes replicate their state from their main loops
+            }
+            else if (GOING_FIRST == p2pGetPlayOrder(p2p))
+            {
+                if (args.bulk > 0)
+                {
+                    sendNextBulk(node);
+                }
+                else if (args.payload > 0)
+                {
+                    sendNextMsg(node);
+                }
+            }
+            break;
+        }
+        case CON_LOST:
+        {
+            node->restarts++;
+            node->peer = -1;
+            if (args.verbose)
+            {
+                printf("%10.3fms node %3" PRId32 " connection lost, restarting\n", simTimeUs / 1000.0, node->idx);
+            }
+
+            // p2pRestart() reinitializes after this callback returns, so start connecting again a little later
+            simEvent_t start = {
+                .timeUs = simTimeUs + RECONNECT_DELAY_US,
+                .type   = EVT_START,
+                .node   = node,
+            };
+            pushEvent(&start);
+            break;
+        }
+        case CON_STARTED:
+        case RX_GAME_START_ACK:
+        case RX_GAME_START_MSG:
+        default:
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Count received data messages, and those which were delivered out of order or more than once
+ *
+ * @param p2p The node's connection state
+ * @param payload The received data
+ * @param len The length of the received data
+ */
+static void simMsgRxCb(p2pInfo* p2p, const uint8_t* payload, uint8_t len)
+{
+    simNode_t* node = nodeFromP2p(p2p);
+    if (args.bulk > 0 && p2pBulkRecv(&node->bulk, payload, len))
+    {
+        return;
+    }
+    if (args.replicaHz > 0 && p2pReplicaRecv(&node->replica, payload, len))
+    {
+        return;
+    }
+    node->msgsRx++;
+
+    uint32_t num = 0;
+    if (len >= sizeof(num))
+    {
+        memcpy(&num, payload, sizeof(num));
+        if (num <= node->lastRxNum)
+        {
+            node->rxMisorder++;
+        }
+        node->lastRxNum = num;
+    }
+}
+
+/**
+ * @brief Count acknowledged and failed data messages, then send the next one
+ *
+ * @param p2p The node's connection state
+ * @param status Whether the message was acknowledged
+ * @param data Data included in the acknowledgement, unused
+ * @param len The length of the data in the acknowledgement, unused
+ */
+static void simMsgTxCb(p2pInfo* p2p, messageStatus_t status, const uint8_t* data, uint8_t len)
+{
+    simNode_t* node = nodeFromP2p(p2p);
+    if (MSG_ACKED == status)
+    {
+        node->msgsAcked++;
+        node->bytesAcked += args.payload;
+    }
+    else
+    {
+        node->msgsFailed++;
+    }
+    sendNextMsg(node);
+}
+
+/**
+ * @brief Start sending the next buffer from a connected node, unless one is being sent already. Each buffer has
+ * different contents so the receiver can't mistake it for the last one
+ *
+ * @param node The node to send from
+ */
+static void sendNextBulk(simNode_t* node)
+{
+    if (P2P_BULK_TX_IDLE != node->bulk.tx.state)
+    {
+        return;
+    }
+
+    uint8_t tag = ++node->bulkNum;
+    for (int32_t i = 0; i < args.bulk; i++)
+    {
+        node->bulkTxBuf[i] = bulkByte(tag, i);
+    }
+    p2pBulkSend(&node->bulk, tag, node->bulkTxBuf, args.bulk);
+}
+
+/**
+ * @brief Get a byte of a buffer sent with --bulk
+ *
+ * @param tag The buffer's tag
+ * @param idx The index of the byte
+ * @return The byte
+ */
+static uint8_t bulkByte(uint8_t tag, uint32_t idx)
+{
+    return (tag * 31) ^ (idx * 7) ^ (idx >> 8);
+}
+
+/**
+ * @brief Count bulk transfer events and check received buffers. A sender starts the next buffer when one finishes
+ *
+ * @param bulk The node's bulk transfers
+ * @param evt The event
+ * @param tag The buffer's tag
+ * @param data The buffer
+ * @param len The length of the buffer
+ */
+static void simBulkCb(p2pBulk_t* bulk, p2pBulkEvt_t evt, uint8_t tag, const uint8_t* data, uint32_t len)
+{
+    simNode_t* node = (simNode_t*)((uint8_t*)bulk - offsetof(simNode_t, bulk));
+
+    if (P2P_BULK_RECEIVED == evt)
+    {
+        node->bulkRx++;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            if (data[i] != bulkByte(tag, i))
+            {
+                node->bulkBad++;
+                break;
+            }
+        }
+        return;
+    }
+    else if (P2P_BULK_INTERRUPTED == evt)
+    {
+        if (args.verbose)
+        {
+            printf("%10.3fms node %3" PRId32 " bulk transfer interrupted\n", simTimeUs / 1000.0, node->idx);
+        }
+        return;
+    }
+
+    p2pBulkStats_t stats;
+    p2pBulkGetStats(bulk, &stats, NULL);
+    if (P2P_BULK_SENT == evt)
+    {
+        node->bulkSent++;
+        node->bulkTimeUs += stats.elapsedUs;
+    }
+    else
+    {
+        node->bulkFailed++;
+    }
+    node->bulkFrags += stats.fragmentsSent;
+    node->bulkResent += stats.fragmentsResent;
+    node->bulkRetx += stats.retransmits;
+    node->bulkIntr += stats.interruptions;
+
+    if (node->p2p.cnc.isConnected)
+    {
+        sendNextBulk(node);
+    }
+}
+
+/**
+ * @brief Get the state a node replicates at a given time. Objects move back and forth, each for one second out of
+ * three, so deltas have some fields which changed and some which didn't
+ *
+ * @param idx The node's index
+ * @param clockMs The node's time, in milliseconds
+ * @param state Written with the state. The field which isn't replicated is left alone
+ */
+static void replicaState(int32_t idx, int32_t clockMs, simReplicaState_t* state)
+{
+    state->clockMs = clockMs;
+    for (int32_t i = 0; i < REPLICA_OBJECTS; i++)
+    {
+        // Move for the first of every three seconds, offset per object, then stay where it stopped
+        int32_t phaseMs = clockMs + i * 375;
+        int32_t movedMs = (phaseMs / 3000) * 1000 + MIN(phaseMs % 3000, 1000);
+        for (int32_t axis = 0; axis < 2; axis++)
+        {
+            // Bounce between 0 and 4000 at a few units per millisecond
+            int32_t dist           = (movedMs * (1 + i + axis) + idx * 977) % 8000;
+            state->pos[i][axis] = (dist < 4000) ? dist : 8000 - dist;
+        }
+    }
+    state->score = idx * 100 + clockMs / 2500;
+    memset(state->unused, idx, sizeof(state->unused));
+}
+
+/**
+ * @brief Run a frame of a node's main loop with --replica. The node updates its own state, sends and renders with
+ * p2pReplica, then checks the newest snapshot it received and how old the rendered state is
+ *
+ * @param node The node
+ */
+static void runFrame(simNode_t* node)
+{
+    simEvent_t next = {
+        .timeUs = simTimeUs + FRAME_US,
+        .type   = EVT_FRAME,
+        .node   = node,
+    };
+    pushEvent(&next);
+
+    int32_t nowMs = simTimeUs / 1000;
+    replicaState(node->idx, nowMs, &node->local);
+    if (!p2pReplicaUpdate(&node->replica) || !node->p2p.cnc.isConnected || node->peer < 0)
+    {
+        return;
+    }
+
+    node->replicaFrames++;
+    node->replicaLagMs += nowMs - node->remote.clockMs;
+
+    // Check each new snapshot against the state the peer had when it took it
+    p2pReplica_t* rep = &node->replica;
+    if (rep->rx.hasSnap && rep->rx.seq != node->replicaLastSeq)
+    {
+        node->replicaLastSeq = rep->rx.seq;
+        simReplicaState_t rcvd, truth;
+        const uint8_t* snap = &rep->rx.history[(rep->rx.seq % P2P_REPLICA_HISTORY) * rep->stateLen];
+        memcpy(&rcvd.clockMs, snap, sizeof(rcvd.clockMs));
+        memcpy(&rcvd.pos, &snap[sizeof(rcvd.clockMs)], sizeof(rcvd.pos));
+        memcpy(&rcvd.score, &snap[sizeof(rcvd.clockMs) + sizeof(rcvd.pos)], sizeof(rcvd.score));
+        memcpy(&rcvd.unused, &snap[sizeof(rcvd.clockMs) + sizeof(rcvd.pos) + sizeof(rcvd.score)], sizeof(rcvd.unused));
+        replicaState(node->peer, rcvd.clockMs, &truth);
+
+        node->replicaChecked++;
+        if (0 != memcmp(rcvd.pos, truth.pos, sizeof(truth.pos)) || rcvd.score != truth.score
+            || 0 != memcmp(rcvd.unused, truth.unused, sizeof(truth.unused)))
+        {
+            node->replicaBad++;
+        }
+    }
+}
+
+/**
+ * @brief Compare two int64_t for qsort()
+ *
+ * @param a An int64_t
+ * @param b Another int64_t
+ * @return Negative, zero, or positive if \c a is less than, equal to, or greater than \c b
+ */
+static int compareInt64(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Print the results of the simulation
+ *
+ * @param wallSeconds The real time the simulation took
+ * @return The number of connected nodes whose peer isn't connected back to them or is on another channel
+ */
+static int32_t printReport(double wallSeconds)
+{
+    int64_t* setupUs    = simAlloc(args.numNodes * sizeof(int64_t));
+    int32_t numSetup    = 0;
+    int32_t connected   = 0;
+    int32_t mismatched  = 0;
+    uint32_t restarts   = 0;
+    p2pConStats_t cs    = {0};
+    uint64_t msgsAcked  = 0;
+    uint64_t msgsFailed = 0;
+    uint64_t msgsRx     = 0;
+    uint64_t rxMisorder = 0;
+    uint64_t bytesAcked = 0;
+    int32_t senders     = 0;
+    uint64_t retransmit = 0;
+    uint64_t rxSkipped  = 0;
+    int64_t srttSumUs   = 0;
+    int32_t numSrtt     = 0;
+    uint64_t bulkSent   = 0;
+    uint64_t bulkFailed = 0;
+    uint64_t bulkRx     = 0;
+    uint64_t bulkBad    = 0;
+    int64_t bulkTimeUs  = 0;
+    uint64_t bulkFrags  = 0;
+    uint64_t bulkResent = 0;
+    uint64_t bulkRetx   = 0;
+    uint64_t bulkIntr   = 0;
+    p2pReplicaStats_t rs = {0};
+    uint64_t repFrames  = 0;
+    uint64_t repLagMs   = 0;
+    uint64_t repChecked = 0;
+    uint64_t repBad     = 0;
+
+    for (int32_t i = 0; i < args.numNodes; i++)
+    {
+        simNode_t* node = &nodes[i];
+        p2pConStats_t ncs;
+        p2pGetConStats(&node->p2p, &ncs);
+        if (ncs.connectUs >= 0)
+        {
+            setupUs[numSetup++] = ncs.connectUs;
+        }
+        if (node->p2p.cnc.isConnected)
+        {
+            connected++;
+            // Both Swadges must be connected to each other. Connecting to a Swadge on another channel is a mismatch too
+            if (node->peer < 0 || !nodes[node->peer].p2p.cnc.isConnected || nodes[node->peer].peer != node->idx
+                || (node->peer % args.channels) != (node->idx % args.channels))
+            {
+                mismatched++;
+            }
+        }
+        cs.broadcasts += ncs.broadcasts;
+        cs.candidates += ncs.candidates;
+        cs.filtered += ncs.filtered;
+        cs.startsSent += ncs.startsSent;
+        cs.startRetries += ncs.startRetries;
+        cs.abandoned += ncs.abandoned;
+        restarts += node->restarts;
+        msgsAcked += node->msgsAcked;
+        msgsFailed += node->msgsFailed;
+        msgsRx += node->msgsRx;
+        rxMisorder += node->rxMisorder;
+        bytesAcked += node->bytesAcked;
+        if (NULL != node->p2p.win)
+        {
+            retransmit += node->p2p.win->retransmits;
+            rxSkipped += node->p2p.win->rxSkipped;
+            if (node->p2p.win->srttUs > 0)
+            {
+                srttSumUs += node->p2p.win->srttUs;
+                numSrtt++;
+            }
+        }
+        if (node->msgsAcked || node->msgsFailed || node->bulkSent || node->bulkFailed
+            || node->replica.meter.stats.txBytes)
+        {
+            senders++;
+        }
+        bulkSent += node->bulkSent;
+        bulkFailed += node->bulkFailed;
+        bulkRx += node->bulkRx;
+        bulkBad += node->bulkBad;
+        bulkTimeUs += node->bulkTimeUs;
+        bulkFrags += node->bulkFrags;
+        bulkResent += node->bulkResent;
+        bulkRetx += node->bulkRetx;
+        bulkIntr += node->bulkIntr;
+        if (args.replicaHz > 0)
+        {
+            p2pReplicaStats_t nodeStats;
+            p2pReplicaGetStats(&nodes[i].replica, &nodeStats);
+            rs.stateLen = nodeStats.stateLen;
+            rs.txKeyframes += nodeStats.txKeyframes;
+            rs.txDeltas += nodeStats.txDeltas;
+            rs.txUnchanged += nodeStats.txUnchanged;
+            rs.txSkipped += nodeStats.txSkipped;
+            rs.txBytes += nodeStats.txBytes;
+            rs.rxKeyframes += nodeStats.rxKeyframes;
+            rs.rxDeltas += nodeStats.rxDeltas;
+            rs.rxDropped += nodeStats.rxDropped;
+            repFrames += node->replicaFrames;
+            repLagMs += node->replicaLagMs;
+            repChecked += node->replicaChecked;
+            repBad += node->replicaBad;
+        }
+    }
+
+    double simSeconds = simTimeUs / 1000000.0;
+    printf("%" PRId32 " nodes, %.1fs simulated in %.3fs (%.0fx real time), seed %" PRIu64 "\n", args.numNodes,
+           simSeconds, wallSeconds, (wallSeconds > 0) ? simSeconds / wallSeconds : INFINITY, args.seed);
+    printf("Connections: %" PRId32 "/%" PRId32 " nodes connected, %" PRId32 " mismatched, %" PRIu32
+           " failed handshakes\n",
+           connected, args.numNodes, mismatched, restarts);
+    printf("Discovery: %.1f broadcasts, %.1f candidates heard, %.1f starts sent, %.1f start retries, %.1f abandoned "
+           "per node, %" PRIu32 " other channel broadcasts filtered\n",
+           (double)cs.broadcasts / args.numNodes, (double)cs.candidates / args.numNodes,
+           (double)cs.startsSent / args.numNodes, (double)cs.startRetries / args.numNodes,
+           (double)cs.abandoned / args.numNodes, cs.filtered);
+
+    if (numSetup > 0)
+    {
+        qsort(setupUs, numSetup, sizeof(int64_t), compareInt64);
+        printf("Setup time: min %.1fms, median %.1fms, p95 %.1fms, max %.1fms\n", setupUs[0] / 1000.0,
+               setupUs[numSetup / 2] / 1000.0, setupUs[(numSetup * 95) / 100] / 1000.0,
+               setupUs[numSetup - 1] / 1000.0);
+    }
+
+    if (args.replicaHz > 0)
+    {
+        uint64_t txSnaps = rs.txKeyframes + rs.txDeltas;
+        printf("Replica: %" PRIu64 " snapshots of %" PRIu16 " bytes sent, %" PRIu32 " keyframes, %" PRIu32
+               " deltas, %" PRIu32 " unchanged, %" PRIu32 " skipped, %.1f bytes each with headers\n",
+               txSnaps, rs.stateLen, rs.txKeyframes, rs.txDeltas, rs.txUnchanged, rs.txSkipped,
+               txSnaps ? (double)rs.txBytes / txSnaps : 0);
+        printf("Replica received: %" PRIu32 " keyframes, %" PRIu32 " deltas, %" PRIu32 " dropped, %" PRIu64
+               " checked, %" PRIu64 " wrong, %.1f B/s per sender, rendered %.1fms behind\n",
+               rs.rxKeyframes, rs.rxDeltas, rs.rxDropped, repChecked, repBad,
+               (simSeconds > 0 && senders) ? rs.txBytes / simSeconds / senders : 0,
+               repFrames ? (double)repLagMs / repFrames : 0);
+    }
+    else if (args.bulk > 0)
+    {
+        // Throughput while sending, not counting the time before connecting
+        double bulkBps = (bulkTimeUs > 0) ? (double)bulkSent * args.bulk * 1000000 / bulkTimeUs : 0;
+        printf("Bulk: %" PRIu64 " buffers of %" PRId32 " bytes sent, %" PRIu64 " failed, %" PRIu64 " received, %" PRIu64
+               " corrupt, %.1fms and %.1f KB/s each\n",
+               bulkSent, args.bulk, bulkFailed, bulkRx, bulkBad, bulkSent ? bulkTimeUs / 1000.0 / bulkSent : 0,
+               bulkBps / 1024);
+        printf("Bulk retries: %" PRIu64 " fragments sent, %" PRIu64 " sent again, %" PRIu64
+               " window retransmissions, %" PRIu64 " interruptions\n",
+               bulkFrags, bulkResent, bulkRetx, bulkIntr);
+    }
+    else if (args.payload > 0)
+    {
+        double totalBps = (simSeconds > 0) ? bytesAcked / simSeconds : 0;
+        printf("Traffic: %" PRIu64 " messages acked, %" PRIu64 " failed, %" PRIu64 " received, %" PRIu64
+               " out of order, %.1f KB/s total, %.1f KB/s per link\n",
+               msgsAcked, msgsFailed, msgsRx, rxMisorder, totalBps / 1024, senders ? totalBps / 1024 / senders : 0);
+        if (args.window > 0)
+        {
+            printf("Window: %" PRId32 " messages, %" PRIu64 " retransmissions, %" PRIu64 " skipped, mean RTT %.2fms\n",
+                   args.window, retransmit, rxSkipped, numSrtt ? srttSumUs / 1000.0 / numSrtt : 0);
+        }
+    }
+
+    printf("Channel: %" PRIu64 " packets sent, %" PRIu64 " delivered, %" PRIu64 " lost, %" PRIu64 " too weak, %.1f%% "
+           "busy\n",
+           busStats.sent, busStats.delivered, busStats.lost, busStats.weak,
+           (simTimeUs > 0) ? (100.0 * busStats.airtimeUs) / simTimeUs : 0);
+
+    free(setupUs);
+    return mismatched;
+}
+
+/**
+ * @brief Get a monotonic timestamp
+ *
+ * @return The current time in seconds
+ */
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Print the usage message
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...]\n", progName);
+    printf("Simulate Swadges connecting and exchanging messages with p2pConnection, faster than real time\n\n");
+    printf("  -n, --nodes=N             Number of Swadges (default %d)\n", DEFAULT_NODES);
+    printf("  -t, --time=SECONDS        Simulated time to run for (default %d)\n", DEFAULT_SECONDS);
+    printf("  -s, --seed=SEED           Seed for positions, timing, and loss (default 1)\n");
+    printf("  -l, --latency=US          Delay between a transmission ending and its reception (default 500)\n");
+    printf("  -j, --jitter=US           Random extra delay per reception, which can reorder packets (default 0)\n");
+    printf("  -p, --loss=PERCENT        Chance of losing each reception (default 0)\n");
+    printf("  -r, --rssi=DBM            Use a fixed RSSI for every link instead of the distance between Swadges\n");
+    printf("  -R, --rssi-jitter=DB      Random variation of each reception's RSSI (default 0)\n");
+    printf("  -a, --area=METERS         Swadges are placed randomly on a square floor this wide (default 5)\n");
+    printf("  -g, --stagger=MS          Swadges start connecting at random times up to this late (default 1000)\n");
+    printf("  -b, --payload=BYTES       Data message size once connected, or 0 to only connect (default 32)\n");
+    printf("  -w, --window=N            Send data with a sliding window of N messages (default 0, one at a time)\n");
+    printf("  -k, --bulk=BYTES          Send buffers this long with p2pBulk instead of data messages\n");
+    printf("  -y, --replica=HZ          Replicate a game state with p2pReplica at this many updates per second\n");
+    printf("  -Y, --replica-limit=BPS   Bytes per second to send at most with --replica (default 0, no limit)\n");
+    printf("  -m, --channels=N          Split Swadges evenly between N channels with p2pSetChannel() (default 1)\n");
+    printf("  -o, --outage=SEC:MS       Lose every packet for MS milliseconds, starting SEC seconds in\n");
+    printf("  -c, --no-contention       Don't share airtime, every transmission starts immediately\n");
+    printf("  -v, --verbose             Print connection events as they happen\n");
+    printf("  -h, --help                Give this help list\n");
+}
+
+/**
+ * @brief Parse arguments, run the simulation, and print the results
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 if the simulation found a problem, 2 on error
+ */
+int main(int argc, char** argv)
+{
+    args = (simArgs_t){
+        .numNodes   = DEFAULT_NODES,
+        .seconds    = DEFAULT_SECONDS,
+        .seed       = 1,
+        .latencyUs  = 500,
+        .fixedRssi  = RSSI_FROM_DISTANCE,
+        .area       = 5,
+        .staggerUs  = 1000000,
+        .payload    = 32,
+        .channels   = 1,
+        .contention = true,
+    };
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "n:t:s:l:j:p:r:R:a:g:b:w:k:y:Y:m:o:cvh", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'n':
+                args.numNodes = atoi(optarg);
+                break;
+            case 't':
+                args.seconds = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                args.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'l':
+                args.latencyUs = strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                args.jitterUs = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                args.lossPct = atof(optarg);
+                break;
+            case 'r':
+                args.fixedRssi = atoi(optarg);
+                break;
+            case 'R':
+                args.rssiJitter = MAX(0, atoi(optarg));
+                break;
+            case 'a':
+                args.area = atof(optarg);
+                break;
+            case 'g':
+                args.staggerUs = strtoul(optarg, NULL, 10) * 1000;
+                break;
+            case 'b':
+                args.payload = atoi(optarg);
+                break;
+            case 'w':
+                args.window = atoi(optarg);
+                break;
+            case 'k':
+                args.bulk = atoi(optarg);
+                break;
+            case 'y':
+                args.replicaHz = atoi(optarg);
+                break;
+            case 'Y':
+                args.replicaLimit = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                args.channels = atoi(optarg);
+                break;
+            case 'o':
+            {
+                double startSec = 0;
+                int32_t lenMs   = 0;
+                if (2 != sscanf(optarg, "%lf:%" SCNd32, &startSec, &lenMs) || startSec < 0 || lenMs < 0)
+                {
+                    printUsage(argv[0]);
+                    return 2;
+                }
+                args.outageStartUs = startSec * 1000000;
+                args.outageEndUs   = args.outageStartUs + (int64_t)lenMs * 1000;
+                break;
+            }
+            case 'c':
+                args.contention = false;
+                break;
+            case 'v':
+                args.verbose = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind != argc || args.numNodes < 2 || args.payload < 0 || args.payload >= P2P_MAX_DATA_LEN
+        || args.window < 0 || args.window > P2P_MAX_WINDOW
+        || (args.window > 0 && args.payload > P2P_MAX_WINDOW_DATA_LEN) || args.bulk < 0
+        || args.bulk > UINT16_MAX * P2P_BULK_FRAG_LEN || args.replicaHz < 0 || args.replicaHz > UINT8_MAX
+        || args.channels < 1)
+    {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    // xorshift must not be seeded with zero
+    rngState = args.seed ? args.seed : 0x9E3779B97F4A7C15ULL;
+
+    nodes = simAlloc(args.numNodes * sizeof(simNode_t));
+    for (int32_t i = 0; i < args.numNodes; i++)
+    {
+        simNode_t* node = &nodes[i];
+        node->idx       = i;
+
+        // Locally administered addresses which are easy to read in verbose output
+        node->mac[0]      = 0x02;
+        node->mac[1]      = 0x5A;
+        node->mac[3]      = (i >> 16) & 0xFF;
+        node->mac[4]      = (i >> 8) & 0xFF;
+        node->mac[5]      = i & 0xFF;
+        node->x           = simRandUnit() * args.area;
+        node->y           = simRandUnit() * args.area;
+        node->peer        = -1;
+
+        // Initialize as the node, so that esp_wifi_get_mac() and esp_timer_create() know who is calling
+        curNode = node;
+        p2pInitialize(&node->p2p, SIM_MODE_ID, simConCb, simMsgRxCb, SIM_CONNECTION_RSSI);
+        p2pSetWindow(&node->p2p, args.window);
+        if (args.channels > 1)
+        {
+            char channel[16];
+            snprintf(channel, sizeof(channel), "sim-%" PRId32, i % args.channels);
+            p2pSetChannel(&node->p2p, channel);
+        }
+        if (args.bulk > 0)
+        {
+            // Without --window, this sets the largest window
+            node->bulkTxBuf = simAlloc(args.bulk);
+            node->bulkRxBuf = simAlloc(args.bulk);
+            p2pBulkInit(&node->bulk, &node->p2p, node->bulkRxBuf, args.bulk, simBulkCb);
+        }
+        if (args.replicaHz > 0)
+        {
+            // Without --window, this sets the largest window
+            p2pReplicaInit(&node->replica, &node->p2p, replicaFields, ARRAY_SIZE(replicaFields), &node->local,
+                           &node->remote);
+            p2pReplicaSetRate(&node->replica, args.replicaHz, 1000, args.replicaLimit);
+        }
+        curNode = NULL;
+
+        node->startUs = args.staggerUs ? simRand() % args.staggerUs : 0;
+
+        simEvent_t evt = {
+            .timeUs = node->startUs,
+            .type   = EVT_START,
+            .node   = node,
+        };
+        pushEvent(&evt);
+
+        if (args.replicaHz > 0)
+        {
+            simEvent_t frame = {
+                .timeUs = node->startUs,
+                .type   = EVT_FRAME,
+                .node   = node,
+            };
+            pushEvent(&frame);
+        }
+    }
+
+    int64_t endUs = (int64_t)args.seconds * 1000000;
+    double tStart = nowSeconds();
+    simEvent_t evt;
+    while (eventHeapLen > 0 && eventHeap[0].timeUs <= endUs && popEvent(&evt))
+    {
+        runEvent(&evt);
+    }
+    simTimeUs          = endUs;
+    double wallSeconds = nowSeconds() - tStart;
+
+    int32_t mismatched = printReport(wallSeconds);
+    if (0 != mismatched)
+    {
+        fprintf(stderr, "ERR: %" PRId32 " nodes are connected to a node which isn't connected back to them\n",
+                mismatched);
+    }
+
+    // Free packets which are still in flight, then everything else
+    while (popEvent(&evt))
+    {
+        if (EVT_RX == evt.type && 0 == --evt.rx.pkt->refs)
+        {
+            free(evt.rx.pkt);
+        }
+    }
+    for (int32_t i = 0; i < args.numNodes; i++)
+    {
+        if (args.bulk > 0)
+        {
+            p2pBulkDeinit(&nodes[i].bulk);
+            free(nodes[i].bulkTxBuf);
+            free(nodes[i].bulkRxBuf);
+        }
+        if (args.replicaHz > 0)
+        {
+            p2pReplicaDeinit(&nodes[i].replica);
+        }
+        p2pDeinit(&nodes[i].p2p);
+    }
+
+    // Every timer should have been deleted by p2pDeinit(), no matter how many times a node restarted
+    uint32_t leakedTimers = 0;
+    for (uint32_t i = 0; i < numTimers; i++)
+    {
+        if (!allTimers[i]->deleted)
+        {
+            leakedTimers++;
+        }
+        free(allTimers[i]);
+    }
+    if (0 != leakedTimers)
+    {
+        fprintf(stderr, "ERR: %" PRIu32 " of %" PRIu32 " timers were never deleted\n", leakedTimers, numTimers);
+    }
+
+    free(allTimers);
+    free(eventHeap);
+    free(nodes);
+    return (0 != leakedTimers || 0 != mismatched) ? 1 : 0;
+}
@@ -0,0 +1,446 @@
+/**
+ * @file screen_dump.c
+ * @brief Convert raw screen dumps from the emulator to GIFs, and benchmark the emulator's screen recorder
+ *
+ * The emulator's emu_screen_recorder.c is built unmodified, so dumps are converted with exactly the same delta encoding
+ * and frame timing as a GIF recorded in the emulator. With --bench, the same frames are also encoded the way the
+ * emulator used to record GIFs: every frame in full, on the calling thread. That is the time the emulator's main loop
+ * used to spend per frame.
+ */
+
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "emu_screen_recorder.h"
+#include "gifenc.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// @brief The size of generated frames, the same as the Swadge's display
+#define SYNTH_WIDTH  280
+#define SYNTH_HEIGHT 240
+
+/// @brief The time between generated frames, in microseconds
+#define SYNTH_FRAME_US 16667
+
+/// @brief The size of the moving square in generated frames
+#define SYNTH_SPRITE 32
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A sequence of frames, either read from a dump or generated
+ */
+typedef struct
+{
+    uint16_t width;         ///< The width of each frame
+    uint16_t height;        ///< The height of each frame
+    uint32_t count;         ///< The number of frames
+    int64_t* times;         ///< The time of each frame since the start, in microseconds
+    paletteColor_t* pixels; ///< All frames' pixels, one after the other
+} frames_t;
+
+//==============================================================================
+// Function Prototypes
+//==============================================================================
+
+static int64_t nowUs(void);
+static bool readDump(const char* filename, frames_t* frames);
+static bool generateFrames(uint32_t count, frames_t* frames);
+static bool recordFrames(const frames_t* frames, const char* filename, bool roundCorners, int64_t* maxAddUs);
+static bool encodeFullFrames(const frames_t* frames, const char* filename);
+static long fileSize(const char* filename);
+static void printUsage(const char* progName);
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static const struct option longOpts[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"synthetic", required_argument, NULL, 's'},
+    {"square", no_argument, NULL, 'q'},
+    {"bench", no_argument, NULL, 'b'},
+    {"help", no_argument, NULL, 'h'},
+    {0},
+};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Get the real time
+ *
+ * @return The monotonic time, in microseconds
+ */
+static int64_t nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief Read every frame of a raw screen dump into memory
+ *
+ * @param filename The dump to read
+ * @param[out] frames The frames which were read
+ * @return true if the dump was read, false if it couldn't be opened or isn't a screen dump
+ */
+static bool readDump(const char* filename, frames_t* frames)
+{
+    FILE* file = fopen(filename, "rb");
+    if (NULL == file)
+    {
+        fprintf(stderr, "ERROR: Couldn't open %s\n", filename);
+        return false;
+    }
+
+    uint8_t header[SCREEN_DUMP_HEADER_SIZE];
+    if (sizeof(header) != fread(header, 1, sizeof(header), file) || memcmp(header, SCREEN_DUMP_MAGIC, 4)
+        || SCREEN_DUMP_VERSION != header[4])
+    {
+        fprintf(stderr, "ERROR: %s is not a screen dump\n", filename);
+        fclose(file);
+        return false;
+    }
+
+    frames->width  = header[6] | (header[7] << 8);
+    frames->height = header[8] | (header[9] << 8);
+    frames->count  = 0;
+    frames->times  = NULL;
+    frames->pixels = NULL;
+
+    size_t frameSize = (size_t)frames->width * frames->height;
+    uint32_t cap     = 0;
+    uint8_t timeBytes[8];
+    while (sizeof(timeBytes) == fread(timeBytes, 1, sizeof(timeBytes), file))
+    {
+        if (frames->count == cap)
+        {
+            cap            = cap ? cap * 2 : 64;
+            frames->times  = realloc(frames->times, cap * sizeof(int64_t));
+            frames->pixels = realloc(frames->pixels, cap * frameSize);
+            if (NULL == frames->times || NULL == frames->pixels)
+            {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                fclose(file);
+                return false;
+            }
+        }
+
+        uint64_t time = 0;
+        for (int8_t i = 7; i >= 0; i--)
+        {
+            time = (time << 8) | timeBytes[i];
+        }
+
+        if (frameSize != fread(&frames->pixels[frames->count * frameSize], 1, frameSize, file))
+        {
+            // The emulator stopped in the middle of writing this frame
+            break;
+        }
+        frames->times[frames->count++] = time;
+    }
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * @brief Generate frames which look like a game: a static background with a moving square and a changing score
+ *
+ * @param count The number of frames to generate
+ * @param[out] frames The generated frames
+ * @return true if the frames were generated, false if there wasn't enough memory
+ */
+static bool generateFrames(uint32_t count, frames_t* frames)
+{
+    size_t frameSize = (size_t)SYNTH_WIDTH * SYNTH_HEIGHT;
+
+    frames->width  = SYNTH_WIDTH;
+    frames->height = SYNTH_HEIGHT;
+    frames->count  = count;
+    frames->times  = malloc(count * sizeof(int64_t));
+    frames->pixels = malloc(count * frameSize);
+    if (NULL == frames->times || NULL == frames->pixels)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return false;
+    }
+
+    for (uint32_t f = 0; f < count; f++)
+    {
+        paletteColor_t* px = &frames->pixels[f * frameSize];
+        frames->times[f]   = (int64_t)f * SYNTH_FRAME_US;
+
+        // A static background of diagonal bands
+        for (int y = 0; y < SYNTH_HEIGHT; y++)
+        {
+            for (int x = 0; x < SYNTH_WIDTH; x++)
+            {
+                px[y * SYNTH_WIDTH + x] = (paletteColor_t)(((x + y) / 20) % 6);
+            }
+        }
+
+        // A square bouncing around the screen
+        int sx = (f * 3) % (2 * (SYNTH_WIDTH - SYNTH_SPRITE));
+        int sy = (f * 2) % (2 * (SYNTH_HEIGHT - SYNTH_SPRITE));
+        sx     = (sx < SYNTH_WIDTH - SYNTH_SPRITE) ? sx : 2 * (SYNTH_WIDTH - SYNTH_SPRITE) - sx;
+        sy     = (sy < SYNTH_HEIGHT - SYNTH_SPRITE) ? sy : 2 * (SYNTH_HEIGHT - SYNTH_SPRITE) - sy;
+        for (int y = sy; y < sy + SYNTH_SPRITE; y++)
+        {
+            memset(&px[y * SYNTH_WIDTH + sx], c500, SYNTH_SPRITE);
+        }
+
+        // A score in the corner which changes every few frames
+        for (int y = 8; y < 16; y++)
+        {
+            for (int x = 60; x < 100; x++)
+            {
+                px[y * SYNTH_WIDTH + x] = (((x / 4) ^ (f / 10)) & 1) ? c555 : c000;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Record frames to a GIF with the emulator's screen recorder. Frames are queued as fast as the worker thread
+ * takes them, so none are dropped.
+ *
+ * @param frames The frames to record
+ * @param filename The GIF to write
+ * @param roundCorners true to make the corners transparent, like the emulator
+ * @param[out] maxAddUs The longest time a single screenRecorderAddFrame() call took, or NULL
+ * @return true if the GIF was written
+ */
+static bool recordFrames(const frames_t* frames, const char* filename, bool roundCorners, int64_t* maxAddUs)
+{
+    if (!screenRecorderStart(filename, SCREEN_REC_GIF, frames->width, frames->height, roundCorners))
+    {
+        fprintf(stderr, "ERROR: Couldn't write %s\n", filename);
+        return false;
+    }
+
+    size_t frameSize = (size_t)frames->width * frames->height;
+    int64_t maxAdd   = 0;
+    for (uint32_t f = 0; f < frames->count; f++)
+    {
+        while (SCREEN_RECORDER_QUEUE_LEN == screenRecorderQueued())
+        {
+            usleep(100);
+        }
+
+        int64_t start = nowUs();
+        screenRecorderAddFrame(&frames->pixels[f * frameSize], f ? frames->times[f] - frames->times[f - 1] : 0);
+        int64_t addUs = nowUs() - start;
+        if (addUs > maxAdd)
+        {
+            maxAdd = addUs;
+        }
+    }
+
+    screenRecStats_t stats;
+    screenRecorderStop(&stats);
+    printf("Wrote %" PRIu32 " of %" PRIu32 " frames to %s (merged %" PRIu32 ", dropped %" PRIu32 ")\n",
+           stats.framesWritten, frames->count, filename, stats.framesMerged, stats.framesDropped);
+
+    if (maxAddUs)
+    {
+        *maxAddUs = maxAdd;
+    }
+    return true;
+}
+
+/**
+ * @brief Encode every frame in full on this thread, the way the emulator used to record GIFs
+ *
+ * @param frames The frames to encode
+ * @param filename The GIF to write
+ * @return true if the GIF was written
+ */
+static bool encodeFullFrames(const frames_t* frames, const char* filename)
+{
+    uint8_t palette[256 * 3] = {0};
+    ge_GIF* gif              = ge_new_gif(filename, frames->width, frames->height, palette, 8, cTransparent, 0);
+    if (NULL == gif)
+    {
+        fprintf(stderr, "ERROR: Couldn't write %s\n", filename);
+        return false;
+    }
+
+    size_t frameSize = (size_t)frames->width * frames->height;
+    for (uint32_t f = 0; f < frames->count; f++)
+    {
+        memcpy(gif->frame, &frames->pixels[f * frameSize], frameSize);
+        ge_add_frame(gif, 2);
+    }
+    ge_close_gif(gif);
+    return true;
+}
+
+/**
+ * @brief Get the size of a file
+ *
+ * @param filename The file
+ * @return The size of the file in bytes, or -1 if it doesn't exist
+ */
+static long fileSize(const char* filename)
+{
+    struct stat st;
+    if (stat(filename, &st))
+    {
+        return -1;
+    }
+    return st.st_size;
+}
+
+/**
+ * @brief Print the command line options
+ *
+ * @param progName The name of this program
+ */
+static void printUsage(const char* progName)
+{
+    printf("Usage: %s [OPTION...] [DUMP]\n", progName);
+    printf("Convert a raw screen dump from the emulator to a GIF\n\n");
+    printf("  -o, --output=FILE         GIF to write (default: DUMP with .gif, or synthetic.gif)\n");
+    printf("  -s, --synthetic=FRAMES    Use generated frames instead of a dump\n");
+    printf("  -q, --square              Don't make the corners transparent\n");
+    printf("  -b, --bench               Also encode every frame in full on one thread, and compare\n");
+    printf("  -h, --help                Give this help list\n");
+}
+
+/**
+ * @brief Parse arguments, convert the dump, and optionally compare against full-frame encoding
+ *
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return 0 on success, 1 if the conversion failed, 2 on bad arguments
+ */
+int main(int argc, char** argv)
+{
+    const char* output = NULL;
+    uint32_t synthetic = 0;
+    bool roundCorners  = true;
+    bool bench         = false;
+
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "o:s:qbh", longOpts, NULL)))
+    {
+        switch (opt)
+        {
+            case 'o':
+                output = optarg;
+                break;
+            case 's':
+                synthetic = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                roundCorners = false;
+                break;
+            case 'b':
+                bench = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                return 0;
+            default:
+                printUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    const char* input = (optind < argc) ? argv[optind] : NULL;
+    if ((NULL == input) == (0 == synthetic))
+    {
+        fprintf(stderr, "ERROR: Give either a dump or --synthetic\n");
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    frames_t frames = {0};
+    if (input ? !readDump(input, &frames) : !generateFrames(synthetic, &frames))
+    {
+        return 1;
+    }
+
+    if (0 == frames.count)
+    {
+        fprintf(stderr, "ERROR: No frames to convert\n");
+        return 1;
+    }
+
+    char outName[512];
+    if (NULL == output)
+    {
+        if (input)
+        {
+            snprintf(outName, sizeof(outName), "%s", input);
+            char* ext = strrchr(outName, '.');
+            if (ext && !strcmp(ext, ".raw"))
+            {
+                *ext = '\0';
+            }
+            strncat(outName, ".gif", sizeof(outName) - strlen(outName) - 1);
+        }
+        else
+        {
+            snprintf(outName, sizeof(outName), "synthetic.gif");
+        }
+        output = outName;
+    }
+
+    int64_t maxAddUs;
+    int64_t start = nowUs();
+    if (!recordFrames(&frames, output, roundCorners, &maxAddUs))
+    {
+        return 1;
+    }
+    int64_t deltaUs = nowUs() - start;
+
+    if (bench)
+    {
+        char fullName[sizeof(outName) + 8];
+        snprintf(fullName, sizeof(fullName), "%s.full", output);
+
+        start = nowUs();
+        if (!encodeFullFrames(&frames, fullName))
+        {
+            return 1;
+        }
+        int64_t fullUs = nowUs() - start;
+
+        printf("\n%-28s %12s %16s %12s\n", "Encoder", "Total (ms)", "Caller us/frame", "Bytes");
+        printf("%-28s %12.1f %16.1f %12ld\n", "full frames, caller thread", fullUs / 1000.0,
+               (double)fullUs / frames.count, fileSize(fullName));
+        printf("%-28s %12.1f %16.1f %12ld\n", "delta frames, worker thread", deltaUs / 1000.0,
+               (double)deltaUs / frames.count, fileSize(output));
+        printf("Longest screenRecorderAddFrame() call: %" PRId64 " us\n", maxAddUs);
+
+        unlink(fullName);
+    }
+
+    free(frames.times);
+    free(frames.pixels);
+    return 0;
+}